@@ -0,0 +1,81 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gen.h"
+
+static void print_usage(const char *prog) {
+    printf("Usage: %s [options] [-o out.as]\n", prog);
+    printf("  --lines <n>         instruction lines (default 10000)\n");
+    printf("  --macros <n>        macro definitions (default 20)\n");
+    printf("  --macro-size <n>    instructions per macro (default 3)\n");
+    printf("  --macro-calls <f>   fraction of lines calling a macro (default 0.1)\n");
+    printf("  --nesting <n>       maximum loop nesting depth (default 3)\n");
+    printf("  --labels <f>        fraction of lines with a label (default 0.1)\n");
+    printf("  --forward <f>       fraction of forward label references (default 0.3)\n");
+    printf("  --data <n>          .data lines (default 500)\n");
+    printf("  --strings <n>       .string lines (default 200)\n");
+    printf("  --seed <n>          random seed (default 1)\n");
+}
+
+int main(int argc, char *argv[]) {
+    GenConfig cfg;
+    const char *out_path = NULL;
+    FILE *out = stdout;
+    char *source;
+    size_t length;
+    int i;
+
+    gen_config_init(&cfg);
+
+    for (i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+        if (strcmp(arg, "--help") == 0) {
+            print_usage(argv[0]);
+            return 0;
+        }
+        if (!value) {
+            print_usage(argv[0]);
+            return 1;
+        }
+
+        if (strcmp(arg, "--lines") == 0) cfg.lines = atoi(value);
+        else if (strcmp(arg, "--macros") == 0) cfg.macros = atoi(value);
+        else if (strcmp(arg, "--macro-size") == 0) cfg.macro_size = atoi(value);
+        else if (strcmp(arg, "--macro-calls") == 0) cfg.macro_calls = atof(value);
+        else if (strcmp(arg, "--nesting") == 0) cfg.nesting = atoi(value);
+        else if (strcmp(arg, "--labels") == 0) cfg.label_density = atof(value);
+        else if (strcmp(arg, "--forward") == 0) cfg.forward_refs = atof(value);
+        else if (strcmp(arg, "--data") == 0) cfg.data_lines = atoi(value);
+        else if (strcmp(arg, "--strings") == 0) cfg.string_lines = atoi(value);
+        else if (strcmp(arg, "--seed") == 0) cfg.seed = strtoul(value, NULL, 10);
+        else if (strcmp(arg, "-o") == 0) out_path = value;
+        else {
+            fprintf(stderr, "Unknown option '%s'\n", arg);
+            print_usage(argv[0]);
+            return 1;
+        }
+        i++;
+    }
+
+    source = gen_source(&cfg, &length);
+    if (!source) {
+        fprintf(stderr, "Failed to generate source\n");
+        return 1;
+    }
+
+    if (out_path) {
+        out = fopen(out_path, "w");
+        if (!out) {
+            fprintf(stderr, "Error: Cannot write %s\n", out_path);
+            free(source);
+            return 1;
+        }
+    }
+
+    fwrite(source, 1, length, out);
+    if (out != stdout) fclose(out);
+    free(source);
+    return 0;
+}
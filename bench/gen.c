@@ -0,0 +1,206 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gen.h"
+
+typedef struct {
+    char *text;
+    size_t length;
+    size_t capacity;
+    unsigned long rng;
+} GenState;
+
+static const char *two_operand[] = {"mov", "cmp", "add", "sub"};
+static const char *one_operand[] = {"clr", "not", "inc", "dec", "red"};
+static const char *words[] = {"alpha", "beta", "gamma", "delta", "error", "value", "index", "done"};
+
+void gen_config_init(GenConfig *cfg) {
+    cfg->seed = 1;
+    cfg->lines = 10000;
+    cfg->macros = 20;
+    cfg->macro_size = 3;
+    cfg->macro_calls = 0.1;
+    cfg->nesting = 3;
+    cfg->label_density = 0.1;
+    cfg->forward_refs = 0.3;
+    cfg->data_lines = 500;
+    cfg->string_lines = 200;
+}
+
+/* xorshift64; deterministic across platforms with 64-bit long */
+static unsigned long next_random(GenState *st) {
+    st->rng ^= st->rng << 13;
+    st->rng ^= st->rng >> 7;
+    st->rng ^= st->rng << 17;
+    return st->rng;
+}
+
+static int random_below(GenState *st, int n) {
+    return (n <= 0) ? 0 : (int)(next_random(st) % (unsigned long)n);
+}
+
+static int chance(GenState *st, double p) {
+    return (double)(next_random(st) % 1000000UL) < p * 1000000.0;
+}
+
+static int emit(GenState *st, const char *line) {
+    size_t len = strlen(line);
+    if (st->length + len + 1 > st->capacity) {
+        size_t new_capacity = st->capacity ? st->capacity * 2 : 65536;
+        char *temp;
+        while (new_capacity < st->length + len + 1) new_capacity *= 2;
+        temp = (char *)realloc(st->text, new_capacity);
+        if (!temp) return 0;
+        st->text = temp;
+        st->capacity = new_capacity;
+    }
+    memcpy(st->text + st->length, line, len + 1);
+    st->length += len;
+    return 1;
+}
+
+/*
+ * label_operand:
+ * Picks a code label (L<n>) or data label (D<n>) name. Code labels are
+ * numbered in definition order, so "forward" means an index not yet defined.
+ */
+static void label_operand(GenState *st, const GenConfig *cfg, int defined, int total, char *out) {
+    if (cfg->data_lines > 0 && random_below(st, 4) == 0) {
+        sprintf(out, "D%d", random_below(st, cfg->data_lines));
+    } else if (total > defined && (defined == 0 || chance(st, cfg->forward_refs))) {
+        sprintf(out, "L%d", defined + random_below(st, total - defined));
+    } else if (defined > 0) {
+        sprintf(out, "L%d", random_below(st, defined));
+    } else {
+        strcpy(out, "r1");
+    }
+}
+
+static void source_operand(GenState *st, const GenConfig *cfg, int defined, int total, char *out) {
+    switch (random_below(st, 3)) {
+        case 0:
+            sprintf(out, "#%d", random_below(st, 2000) - 1000);
+            break;
+        case 1:
+            sprintf(out, "r%d", random_below(st, 8));
+            break;
+        default:
+            label_operand(st, cfg, defined, total, out);
+            break;
+    }
+}
+
+static void dest_operand(GenState *st, const GenConfig *cfg, int defined, int total, char *out) {
+    if (random_below(st, 2) == 0) {
+        sprintf(out, "r%d", random_below(st, 8));
+    } else {
+        label_operand(st, cfg, defined, total, out);
+    }
+}
+
+/* Writes a random instruction with operands (no label) into out */
+static void random_instruction(GenState *st, const GenConfig *cfg, int defined, int total, char *out) {
+    char src[40], dst[40];
+    int kind = random_below(st, 10);
+
+    if (kind < 5) {
+        source_operand(st, cfg, defined, total, src);
+        dest_operand(st, cfg, defined, total, dst);
+        sprintf(out, "%s %s, %s", two_operand[random_below(st, 4)], src, dst);
+    } else if (kind < 6) {
+        label_operand(st, cfg, defined, total, src);
+        dest_operand(st, cfg, defined, total, dst);
+        /* lea needs a label; fall back to mov when none exists yet */
+        sprintf(out, "%s %s, %s", src[0] == 'r' ? "mov" : "lea", src, dst);
+    } else if (kind < 9) {
+        dest_operand(st, cfg, defined, total, dst);
+        sprintf(out, "%s %s", one_operand[random_below(st, 5)], dst);
+    } else {
+        source_operand(st, cfg, defined, total, src);
+        sprintf(out, "prn %s", src);
+    }
+}
+
+char *gen_source(const GenConfig *cfg, size_t *out_len) {
+    GenState st;
+    char line[128], instr[96];
+    int *loop_stack;
+    int depth = 0;
+    int total_labels = (int)(cfg->lines * cfg->label_density);
+    int defined = 0;
+    int i, j;
+
+    memset(&st, 0, sizeof(st));
+    st.rng = cfg->seed ? cfg->seed * 2654435761UL : 88172645463325252UL;
+
+    loop_stack = (int *)malloc((size_t)(cfg->nesting + 1) * sizeof(int));
+    if (!loop_stack) return NULL;
+
+    emit(&st, "; generated benchmark source\n");
+
+    for (i = 0; i < cfg->macros; i++) {
+        sprintf(line, "macro M%d\n", i);
+        emit(&st, line);
+        for (j = 0; j < cfg->macro_size; j++) {
+            /* macro bodies only use registers and immediates so every call site is valid */
+            sprintf(line, "    %s r%d, r%d\n", two_operand[random_below(&st, 4)], random_below(&st, 8), random_below(&st, 8));
+            emit(&st, line);
+        }
+        emit(&st, "macroend\n");
+    }
+
+    for (i = 0; i < cfg->lines; i++) {
+        int labelled = defined < total_labels
+                       && (cfg->lines - i <= total_labels - defined || chance(&st, cfg->label_density));
+        char label[40] = "";
+
+        if (labelled) {
+            sprintf(label, "L%d: ", defined);
+        }
+
+        if (cfg->macros > 0 && !labelled && chance(&st, cfg->macro_calls)) {
+            sprintf(line, "    M%d\n", random_below(&st, cfg->macros));
+        } else if (labelled && depth < cfg->nesting && random_below(&st, 2) == 0) {
+            /* open a loop at this label */
+            loop_stack[depth++] = defined;
+            random_instruction(&st, cfg, defined + 1, total_labels, instr);
+            snprintf(line, sizeof(line), "%s%s\n", label, instr);
+        } else if (!labelled && depth > 0 && random_below(&st, 8) == 0) {
+            /* close the innermost loop */
+            sprintf(line, "    bne &L%d\n", loop_stack[--depth]);
+        } else if (!labelled && random_below(&st, 20) == 0 && defined > 0) {
+            sprintf(line, "    %s L%d\n", random_below(&st, 2) ? "jmp" : "jsr", random_below(&st, defined));
+        } else {
+            random_instruction(&st, cfg, labelled ? defined + 1 : defined, total_labels, instr);
+            snprintf(line, sizeof(line), "%s%s\n", label, instr);
+        }
+
+        if (labelled) defined++;
+        emit(&st, line);
+    }
+
+    while (depth > 0) {
+        sprintf(line, "    bne &L%d\n", loop_stack[--depth]);
+        emit(&st, line);
+    }
+    emit(&st, "    stop\n");
+
+    for (i = 0; i < cfg->data_lines; i++) {
+        int count = 1 + random_below(&st, 8);
+        size_t len = (size_t)sprintf(line, "D%d: .data ", i);
+        for (j = 0; j < count; j++) {
+            len += (size_t)sprintf(line + len, "%s%d", j ? ", " : "", random_below(&st, 16000) - 8000);
+        }
+        strcpy(line + len, "\n");
+        emit(&st, line);
+    }
+
+    for (i = 0; i < cfg->string_lines; i++) {
+        sprintf(line, "S%d: .string \"%s %s %d\"\n", i, words[random_below(&st, 8)], words[random_below(&st, 8)], i);
+        emit(&st, line);
+    }
+
+    free(loop_stack);
+    if (out_len) *out_len = st.length;
+    return st.text;
+}
@@ -0,0 +1,29 @@
+#ifndef BENCH_GEN_H
+#define BENCH_GEN_H
+
+#include <stddef.h>
+
+/*
+ * Synthetic source generator for the benchmarks. The output is valid input
+ * for the assembler and depends only on the configuration (including the
+ * seed), so the same config always produces the same file.
+ */
+typedef struct {
+    unsigned long seed;
+    int lines;              /* instruction lines, macro calls included */
+    int macros;             /* macro definitions */
+    int macro_size;         /* instructions per macro body */
+    double macro_calls;     /* fraction of lines that call a macro */
+    int nesting;            /* maximum depth of nested loops (label ... bne &label) */
+    double label_density;   /* fraction of instruction lines carrying a label */
+    double forward_refs;    /* fraction of label operands that refer forward */
+    int data_lines;         /* .data lines */
+    int string_lines;       /* .string lines */
+} GenConfig;
+
+void gen_config_init(GenConfig *cfg);
+
+/* Returns the generated source as a heap buffer; its length goes to *out_len */
+char *gen_source(const GenConfig *cfg, size_t *out_len);
+
+#endif
@@ -0,0 +1,187 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gen.h"
+#include "asm_context.h"
+#include "pre_asm.h"
+#include "file_writer.h"
+#include "stats.h"
+#include "logger.h"
+#include "asm_alloc.h"
+
+/*
+ * End-to-end benchmark: generates sources of several shapes and runs the
+ * assembler pipeline on each, reporting the best time of a few repeats and
+ * the peak RSS of every phase.
+ *
+ * Output format (one record per line, whitespace separated, stable across
+ * versions so results can be diffed between commits):
+ *
+ *   config phase lines seconds lines_per_sec peak_rss_kb
+ */
+
+#define REPEATS 3
+#define OUTPUT_FILE "bench_tmp.ob"
+
+typedef struct {
+    const char *name;
+    int lines;
+    int macros;
+    double macro_calls;
+    double label_density;
+    double forward_refs;
+    int data_lines;
+    int string_lines;
+} BenchConfig;
+
+static const BenchConfig configs[] = {
+    /* name           lines  macros calls  labels forward data   strings */
+    {"baseline",      20000, 20,    0.10,  0.05,  0.30,   500,   200},
+    {"macro_heavy",   20000, 200,   0.60,  0.05,  0.30,   200,   100},
+    {"label_heavy",   20000, 10,    0.05,  0.40,  0.50,   2000,  200},
+    {"data_heavy",    5000,  10,    0.05,  0.05,  0.30,   20000, 10000}
+};
+
+typedef struct {
+    double seconds[PHASE_COUNT];
+    long peak_rss_kb[PHASE_COUNT];
+    unsigned long lines;
+} BenchResult;
+
+static void phase_start(void) {
+    stats_reset_peak_rss();
+}
+
+static void phase_stop(BenchResult *run, AsmPhase phase, double start) {
+    run->seconds[phase] = stats_now() - start;
+    run->peak_rss_kb[phase] = stats_peak_rss_kb();
+}
+
+/*
+ * run_pipeline:
+ * One assembly of source, timing each phase. Returns 0 on failure.
+ */
+static int run_pipeline(const char *source, size_t length, BenchResult *run) {
+    AsmContext ctx;
+    MacroTable *table;
+    char *expanded, *object;
+    size_t expanded_length, object_length;
+    FILE *out;
+    double start;
+    int ok;
+
+    asm_context_init(&ctx, "bench.as", "bench.am");
+    /* The generated programs outgrow the machine; only the passes are timed */
+    ctx.memory_size = INT_MAX;
+
+    phase_start();
+    start = stats_now();
+    table = create_macro_table();
+    expanded = table ? pre_assemble(&ctx, table, source, length, &expanded_length) : NULL;
+    if (table) free_macro_table(table);
+    phase_stop(run, PHASE_PRE_ASSEMBLE, start);
+
+    ok = expanded != NULL;
+
+    if (ok) {
+        phase_start();
+        start = stats_now();
+        ok = first_pass(&ctx, expanded, expanded_length);
+        phase_stop(run, PHASE_FIRST_PASS, start);
+    }
+
+    if (ok) {
+        phase_start();
+        start = stats_now();
+        ok = second_pass(&ctx, expanded, expanded_length);
+        phase_stop(run, PHASE_SECOND_PASS, start);
+    }
+
+    if (ok) {
+        phase_start();
+        start = stats_now();
+        object = format_object(&ctx, &object_length);
+        out = fopen(OUTPUT_FILE, "w");
+        ok = object && out && fwrite(object, 1, object_length, out) == object_length;
+        if (out) fclose(out);
+        ASM_FREE(object);
+        remove(OUTPUT_FILE);
+        phase_stop(run, PHASE_WRITE_OUTPUT, start);
+    }
+
+    if (!ok) {
+        diag_flush(&ctx.diagnostics, stderr);
+    }
+
+    run->lines = ctx.counters.source_lines;
+    ASM_FREE(expanded);
+    asm_context_free(&ctx);
+    return ok;
+}
+
+static void print_record(const char *config, const char *phase, unsigned long lines, double seconds, long rss) {
+    printf("%-12s %-13s %8lu %10.6f %12.0f %10ld\n", config, phase, lines, seconds,
+           seconds > 0 ? (double)lines / seconds : 0.0, rss);
+}
+
+int main(void) {
+    size_t c;
+
+    asm_log_set_level(LOG_WARN);
+
+    printf("# asm-bench 1\n");
+    printf("# %-10s %-13s %8s %10s %12s %10s\n", "config", "phase", "lines", "seconds", "lines_per_sec", "peak_rss_kb");
+
+    for (c = 0; c < sizeof(configs) / sizeof(configs[0]); c++) {
+        const BenchConfig *bc = &configs[c];
+        GenConfig cfg;
+        BenchResult best, run;
+        char *source;
+        size_t length;
+        double total = 0;
+        long peak = 0;
+        int r, p;
+
+        gen_config_init(&cfg);
+        cfg.lines = bc->lines;
+        cfg.macros = bc->macros;
+        cfg.macro_calls = bc->macro_calls;
+        cfg.label_density = bc->label_density;
+        cfg.forward_refs = bc->forward_refs;
+        cfg.data_lines = bc->data_lines;
+        cfg.string_lines = bc->string_lines;
+
+        source = gen_source(&cfg, &length);
+        if (!source) {
+            fprintf(stderr, "Failed to generate %s\n", bc->name);
+            return 1;
+        }
+
+        memset(&best, 0, sizeof(best));
+        for (r = 0; r < REPEATS; r++) {
+            memset(&run, 0, sizeof(run));
+            if (!run_pipeline(source, length, &run)) {
+                fprintf(stderr, "Assembly of %s failed\n", bc->name);
+                ASM_FREE(source);
+                return 1;
+            }
+            for (p = 0; p < PHASE_COUNT; p++) {
+                if (r == 0 || run.seconds[p] < best.seconds[p]) best.seconds[p] = run.seconds[p];
+                if (run.peak_rss_kb[p] > best.peak_rss_kb[p]) best.peak_rss_kb[p] = run.peak_rss_kb[p];
+            }
+            best.lines = run.lines;
+        }
+
+        for (p = 0; p < PHASE_COUNT; p++) {
+            print_record(bc->name, stats_phase_name((AsmPhase)p), best.lines, best.seconds[p], best.peak_rss_kb[p]);
+            total += best.seconds[p];
+            if (best.peak_rss_kb[p] > peak) peak = best.peak_rss_kb[p];
+        }
+        print_record(bc->name, "total", best.lines, total, peak);
+
+        ASM_FREE(source);
+    }
+
+    return 0;
+}
@@ -0,0 +1,239 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "parser.h"
+#include "pre_asm.h"
+#include "symbol_table.h"
+#include "code_generator.h"
+#include "asm_context.h"
+#include "utils.h"
+#include "stats.h"
+
+/*
+ * Microbenchmarks for the inner-loop functions of the assembler. Each case
+ * is warmed up, calibrated to a sample length of about SAMPLE_SECONDS and
+ * then sampled SAMPLES times. The report gives nanoseconds per call:
+ *
+ *   function mean_ns stddev_ns min_ns calls_per_sample
+ */
+
+#define WARMUP_SECONDS 0.05
+#define SAMPLE_SECONDS 0.02
+#define SAMPLES 15
+#define SYMBOL_COUNT 1000
+#define MACRO_COUNT 100
+
+typedef void (*BenchFn)(long iterations);
+
+/* Results are folded into this sink so calls cannot be optimized away */
+static volatile unsigned long sink;
+
+static SymbolTable symbols;
+static MacroTable *macros;
+static AsmContext data_ctx;
+
+static const char *lines[] = {
+    "MAIN:\tadd   r3,LIST\n",
+    "LOOP:\tprn   #48\n",
+    "\t\tlea\tSTR, r6\n",
+    "\t\tbne\t&END\n",
+    "STR:\t.string\t\"abcd\"\n",
+    "LIST:\t.data\t6, -9\n",
+    "; comment line\n",
+    "END:\tstop\n"
+};
+
+static const char *operands[] = {"#48", "r3", "LIST", "&END", "#-9", "K", "r7", "LOOP"};
+static const char *mnemonics[] = {"mov", "stop", "jsr", "prn", "foo", "lea", "rts", "bne"};
+static const char *padded[] = {"   mov r1, r2   \n", "\tLIST\t", "x", "  spaced  words  here  \n"};
+
+#define COUNT(a) (sizeof(a) / sizeof(a[0]))
+
+static char symbol_names[SYMBOL_COUNT][16];
+static char macro_names[MACRO_COUNT][16];
+static ParsedLine parsed_commands[4];
+static ParsedLine parsed_data[4];
+static Operand parsed_operands[4];
+
+static void bench_parse_line(long n) {
+    ParsedLine pl;
+    long i;
+    for (i = 0; i < n; i++) {
+        parse_line(lines[i % COUNT(lines)], (int)i, &pl);
+        sink += (unsigned long)pl.type;
+    }
+}
+
+static void bench_parse_operand(long n) {
+    long i;
+    for (i = 0; i < n; i++) {
+        Operand op = parse_operand(operands[i % COUNT(operands)]);
+        sink += (unsigned long)op.type;
+    }
+}
+
+static void bench_lookup_instruction(long n) {
+    long i;
+    for (i = 0; i < n; i++) {
+        sink += (unsigned long)lookup_instruction(mnemonics[i % COUNT(mnemonics)]);
+    }
+}
+
+static void bench_lookup_macro(long n) {
+    long i;
+    for (i = 0; i < n; i++) {
+        /* every other lookup misses, like a token that is not a macro */
+        const char *name = (i & 1) ? macro_names[(i >> 1) % MACRO_COUNT] : "mov";
+        sink += (unsigned long)(lookup_macro(macros, name) != NULL);
+    }
+}
+
+static void bench_find_symbol(long n) {
+    long i;
+    for (i = 0; i < n; i++) {
+        Symbol *sym = find_symbol(&symbols, symbol_names[(i * 7919) % SYMBOL_COUNT]);
+        sink += (unsigned long)(sym ? sym->address : 0);
+    }
+}
+
+static void bench_encode_instruction(long n) {
+    unsigned short words[MAX_WORDS_PER_LINE];
+    long i;
+    for (i = 0; i < n; i++) {
+        sink += (unsigned long)encode_instruction(&parsed_commands[i & 3], 100, words);
+        sink += words[0];
+    }
+}
+
+static void bench_encode_operand_word(long n) {
+    unsigned short word = 0;
+    long i;
+    for (i = 0; i < n; i++) {
+        sink += (unsigned long)encode_operand_word(&parsed_operands[i & 3], 100, &symbols, &word);
+        sink += word;
+    }
+}
+
+static void bench_add_data(long n) {
+    int dc = 0;
+    long i;
+    for (i = 0; i < n; i++) {
+        if ((i & 1023) == 0) data_image_reset(&data_ctx.data);
+        sink += (unsigned long)add_data(&data_ctx, &parsed_data[i & 3], &dc);
+    }
+    sink += (unsigned long)dc;
+}
+
+static void bench_trim_whitespace(long n) {
+    char buffer[64];
+    long i;
+    for (i = 0; i < n; i++) {
+        strcpy(buffer, padded[i % COUNT(padded)]);
+        sink += (unsigned long)(unsigned char)trim_whitespace(buffer)[0];
+    }
+}
+
+static double time_calls(BenchFn fn, long iterations) {
+    double start = stats_now();
+    fn(iterations);
+    return stats_now() - start;
+}
+
+/*
+ * measure:
+ * Warms up, calibrates the number of calls per sample and prints the stats.
+ */
+static void measure(const char *name, BenchFn fn) {
+    double samples[SAMPLES];
+    double mean = 0, variance = 0, min;
+    double start = stats_now();
+    long iterations = 1;
+    int s;
+
+    while (stats_now() - start < WARMUP_SECONDS) {
+        fn(1000);
+    }
+
+    while (time_calls(fn, iterations) < SAMPLE_SECONDS) {
+        iterations *= 2;
+    }
+
+    for (s = 0; s < SAMPLES; s++) {
+        samples[s] = time_calls(fn, iterations) * 1e9 / (double)iterations;
+        mean += samples[s];
+    }
+    mean /= SAMPLES;
+
+    min = samples[0];
+    for (s = 0; s < SAMPLES; s++) {
+        variance += (samples[s] - mean) * (samples[s] - mean);
+        if (samples[s] < min) min = samples[s];
+    }
+    variance /= SAMPLES - 1;
+
+    printf("%-22s %10.2f %10.2f %10.2f %12ld\n", name, mean, sqrt(variance), min, iterations);
+    fflush(stdout);
+}
+
+static int setup(void) {
+    int i;
+
+    memset(&symbols, 0, sizeof(symbols));
+    for (i = 0; i < SYMBOL_COUNT; i++) {
+        sprintf(symbol_names[i], "SYM%d", i);
+        add_symbol(&symbols, symbol_names[i], 100 + i, (i % 5 == 0) ? SYMBOL_EXTERN : SYMBOL_CODE);
+    }
+    /* names used by the operand and command cases */
+    add_symbol(&symbols, "LIST", 140, SYMBOL_DATA);
+    add_symbol(&symbols, "END", 120, SYMBOL_CODE);
+
+    macros = create_macro_table();
+    if (!macros) return 0;
+    for (i = 0; i < MACRO_COUNT; i++) {
+        sprintf(macro_names[i], "MAC%d", i);
+        insert_macro(macros, macro_names[i], "inc r3\ninc r3\n");
+    }
+
+    parse_line("add r3, LIST\n", 1, &parsed_commands[0]);
+    parse_line("prn #48\n", 2, &parsed_commands[1]);
+    parse_line("bne &END\n", 3, &parsed_commands[2]);
+    parse_line("stop\n", 4, &parsed_commands[3]);
+
+    parse_line("LIST:\t.data\t6, -9, 120, +4, -8192, 77\n", 5, &parsed_data[0]);
+    parse_line("STR:\t.string\t\"abcdefghijklmnopqrstuvwxyz\"\n", 6, &parsed_data[1]);
+    parse_line("\t.data 1\n", 7, &parsed_data[2]);
+    parse_line("\t.string \"a\"\n", 8, &parsed_data[3]);
+    asm_context_init(&data_ctx, "bench.as", "bench.am");
+
+    parsed_operands[0] = parse_operand("#-9");
+    parsed_operands[1] = parse_operand("LIST");
+    parsed_operands[2] = parse_operand("&END");
+    parsed_operands[3] = parse_operand("SYM500");
+    return 1;
+}
+
+int main(void) {
+    if (!setup()) {
+        fprintf(stderr, "Failed to set up benchmarks\n");
+        return 1;
+    }
+
+    printf("# asm-microbench 1 (%d symbols, %d macros)\n", SYMBOL_COUNT, MACRO_COUNT);
+    printf("# %-20s %10s %10s %10s %12s\n", "function", "mean_ns", "stddev_ns", "min_ns", "calls");
+
+    measure("parse_line", bench_parse_line);
+    measure("parse_operand", bench_parse_operand);
+    measure("lookup_instruction", bench_lookup_instruction);
+    measure("lookup_macro", bench_lookup_macro);
+    measure("find_symbol", bench_find_symbol);
+    measure("encode_instruction", bench_encode_instruction);
+    measure("encode_operand_word", bench_encode_operand_word);
+    measure("trim_whitespace", bench_trim_whitespace);
+    measure("add_data", bench_add_data);
+
+    free_symbol_table(&symbols);
+    free_macro_table(macros);
+    asm_context_free(&data_ctx);
+    return 0;
+}
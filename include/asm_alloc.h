@@ -0,0 +1,58 @@
+#ifndef ASM_ALLOC_H
+#define ASM_ALLOC_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Allocation front end. Every heap allocation in the assembler goes through
+ * these macros with the subsystem that owns it. In a normal build they are
+ * plain malloc()/free(); building with -DASM_MEM_TRACKING ('make memtrack')
+ * routes them through a tracker that reports live bytes, peak bytes and
+ * allocation counts per pipeline phase and subsystem.
+ */
+
+typedef enum {
+    MEM_MACRO,      /* MacroTable and macro bodies */
+    MEM_SYMBOL,     /* symbol table nodes */
+    MEM_DATA,       /* data segment values */
+    MEM_CODE,       /* machine code image */
+    MEM_LINE,       /* per-line working copies */
+    MEM_TEXT,       /* source, expanded and object text buffers */
+    MEM_DIAG,       /* diagnostics */
+    MEM_RESULT,     /* library results and sessions */
+    MEM_OTHER,      /* statistics, tracing, server buffers */
+    MEM_TAG_COUNT
+} MemTag;
+
+char *asm_strdup(const char *src, MemTag tag);
+
+#ifdef ASM_MEM_TRACKING
+
+void *asm_malloc(size_t size, MemTag tag);
+void *asm_calloc(size_t count, size_t size, MemTag tag);
+void *asm_realloc(void *ptr, size_t size, MemTag tag);
+void asm_free(void *ptr);
+
+/* Attributes following allocations to a pipeline phase (an AsmPhase value) */
+void mem_set_phase(int phase);
+void mem_report(FILE *out);
+
+#define ASM_MALLOC(size, tag) asm_malloc((size), (tag))
+#define ASM_CALLOC(count, size, tag) asm_calloc((count), (size), (tag))
+#define ASM_REALLOC(ptr, size, tag) asm_realloc((ptr), (size), (tag))
+#define ASM_FREE(ptr) asm_free(ptr)
+
+#else
+
+#define ASM_MALLOC(size, tag) malloc(size)
+#define ASM_CALLOC(count, size, tag) calloc((count), (size))
+#define ASM_REALLOC(ptr, size, tag) realloc((ptr), (size))
+#define ASM_FREE(ptr) free(ptr)
+
+#define mem_set_phase(phase) ((void)0)
+#define mem_report(out) ((void)0)
+
+#endif
+
+#endif
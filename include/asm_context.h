@@ -0,0 +1,79 @@
+#ifndef ASM_CONTEXT_H
+#define ASM_CONTEXT_H
+
+#include "assembler.h"
+#include "symbol_table.h"
+#include "code_generator.h"
+#include "logger.h"
+#include "stats.h"
+#include "source_map.h"
+#include "data_image.h"
+#include "data_pool.h"
+#include "data_strip.h"
+#include "peephole.h"
+
+/*
+ * An operand left for the end of a one-pass assembly. Its label was still
+ * undefined, or was data, whose address waits for the code size.
+ */
+typedef struct {
+    int address;        /* of the operand word; 0 for an .entry line */
+    int line_number;
+    size_t text;        /* offset of the operand (or .entry name) in FixupList.text */
+} Fixup;
+
+typedef struct {
+    Fixup *items;
+    int count;
+    int capacity;
+    char *text;         /* NUL-terminated operand texts, packed */
+    size_t text_length;
+    size_t text_capacity;
+} FixupList;
+
+/* State of a single assembly, shared by the pre-assembler and both passes */
+struct AsmContext {
+    const char *source_name;    /* .as name used in pre-assembly diagnostics */
+    const char *expanded_name;  /* .am name used in pass diagnostics */
+    SymbolTable symbols;
+    MachineCode code;
+    DataImage data;             /* data segment; written after the code */
+    DataPool pool;              /* pooled .string/.data literals (opt-in) */
+    DataStrip strip;            /* unreferenced data removal (opt-in) */
+    Peephole peep;              /* peephole optimizer over the sized instructions (opt-in) */
+    int IC;
+    int DC;
+    int code_length;            /* words emitted by the second pass */
+    int memory_size;            /* words the code and data may reach; MEMORY_SIZE */
+    DiagnosticList diagnostics;
+    AsmCounters counters;
+    SourceMap map;              /* address -> .as line, through macro expansion */
+    bool one_pass;              /* encode while reading; see one_pass_line() */
+    FixupList fixups;           /* one-pass operands resolved at the end */
+};
+
+void asm_context_init(AsmContext *ctx, const char *source_name, const char *expanded_name);
+void asm_context_reset(AsmContext *ctx, const char *source_name, const char *expanded_name);
+void asm_context_free(AsmContext *ctx);
+
+/* Appends the words of a data directive line to the data image; reports its own errors */
+bool add_data(AsmContext *ctx, const ParsedLine *parsed, int *DC);
+
+/*
+ * Per-line steps of the two passes, also used by incremental reassembly:
+ * first_pass_line() defines the symbols of a line and sizes it,
+ * add_command() adds the size of an instruction to *IC,
+ * finish_first_pass() places the data after the code, encode_words()
+ * encodes an instruction and mark_entry_line() handles an .entry line.
+ * Each reports its own errors.
+ */
+bool first_pass_line(AsmContext *ctx, const ParsedLine *parsed, int line_number);
+void add_command(const ParsedLine *pline, int *IC);
+bool finish_first_pass(AsmContext *ctx, bool has_error);
+int encode_words(AsmContext *ctx, const ParsedLine *parsed, int IC, int line_number, unsigned short *words, bool *has_error);
+bool mark_entry_line(AsmContext *ctx, const char *name, int line_number);
+
+/* Copies the context counters, completed with the symbol table and image sizes */
+void asm_context_counters(const AsmContext *ctx, AsmCounters *out);
+
+#endif
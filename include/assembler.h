@@ -7,14 +7,25 @@
 #include "symbol_table.h"
 
 #define START_ADDRESS 100
+#define MEMORY_SIZE 4096        /* words a 12-bit address reaches */
 #define LINE_LENGTH 80
 #define LABEL_LENGTH 31
 #define MAX_FILENAME_LEN 512
 #define MAX_WORDS_PER_LINE 3
 
-/* Main passes */
-bool first_pass(const char *filename);
-bool second_pass(const char *filename);
+typedef struct AsmContext AsmContext;
+
+/* Main passes, run over the pre-assembled (.am) text */
+bool first_pass(AsmContext *ctx, const char *source, size_t length);
+bool second_pass(AsmContext *ctx, const char *source, size_t length);
+
+/*
+ * One-pass mode (ctx->one_pass) for input that is read only once: each
+ * expanded line is encoded as it arrives, and operands that refer forward
+ * or to data are patched by one_pass_finish(). The .am text is never held.
+ */
+bool one_pass_line(AsmContext *ctx, const char *line, int line_number);
+bool one_pass_finish(AsmContext *ctx, bool has_error);
 
 #endif 
 
@@ -11,10 +11,28 @@ typedef struct {
     unsigned short value;
 } MemoryWord;
 
+/* Growable image of emitted machine words */
+typedef struct {
+    MemoryWord *words;
+    int size;
+    int capacity;
+} MachineCode;
+
+
+/* Errors of encode_operand_word() */
+#define ENCODE_UNDEFINED -1         /* unknown symbol */
+#define ENCODE_RANGE -2             /* value or address does not fit its field */
+#define ENCODE_SYNTAX -3            /* malformed expression */
+#define ENCODE_NOT_CONSTANT -4      /* a label in an immediate */
+#define ENCODE_NOT_ADDRESS -5       /* a constant where a label is needed */
+#define ENCODE_EXTERN_OFFSET -6     /* an offset from an external symbol */
+#define ENCODE_DIVIDE_BY_ZERO -7
 
 int encode_instruction(const ParsedLine *pline, int ic, unsigned short *out_words);
-int encode_operand_word(const Operand *op, int curr_ic, unsigned short *word_out);
+/* Returns 1 with the word, 0 for a register operand, or an ENCODE_* error */
+int encode_operand_word(const Operand *op, int curr_ic, SymbolTable *symbols, unsigned short *word_out);
 int encode_registers_word(const Operand *src, const Operand *dst, unsigned short *word_out);
-int add_machine_word(int address, unsigned short value);
+int add_machine_word(MachineCode *code, int address, unsigned short value);
+void free_machine_code(MachineCode *code);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,91 @@
+#ifndef DATA_IMAGE_H
+#define DATA_IMAGE_H
+
+#include <stddef.h>
+
+/*
+ * Data segment of an assembly, kept as a list of segments instead of one
+ * word per address. Parsed .data/.string words are stored literally; .fill
+ * and .space are a count and a value; .incbin points into a read-only
+ * mapping of the file. The words of a segment are only produced when the
+ * image is written out (data_segment_word()).
+ */
+
+typedef enum {
+    DATA_LITERAL,       /* words[first .. first + count) */
+    DATA_FILL,          /* count copies of value */
+    DATA_BYTES          /* one word per byte of a mapped file */
+} DataSegmentKind;
+
+typedef struct {
+    DataSegmentKind kind;
+    int count;                      /* words */
+    int first;                      /* DATA_LITERAL: index into DataImage.words */
+    unsigned short value;           /* DATA_FILL */
+    const unsigned char *bytes;     /* DATA_BYTES */
+} DataSegment;
+
+typedef struct {
+    void *address;
+    size_t length;
+} DataMapping;
+
+/* A word range of the image, in data offsets */
+typedef struct {
+    int start;
+    int count;
+} DataRange;
+
+typedef struct {
+    unsigned short *words;          /* literal words, already masked to 14 bits */
+    int word_count;
+    int word_capacity;
+    DataSegment *segments;
+    int segment_count;
+    int segment_capacity;
+    DataMapping *mappings;          /* .incbin files, unmapped on reset */
+    int mapping_count;
+    int mapping_capacity;
+    int size;                       /* words in the image */
+} DataImage;
+
+/* Errors of data_image_include() */
+#define DATA_INCLUDE_OK 0
+#define DATA_INCLUDE_OPEN 1
+#define DATA_INCLUDE_TOO_LARGE 2
+#define DATA_INCLUDE_NO_MEMORY 3
+
+/*
+ * Literal words are added in two steps: reserve room for at most count
+ * words, fill them, then commit the number used.
+ */
+unsigned short *data_image_reserve(DataImage *image, int count);
+int data_image_commit(DataImage *image, int count);
+
+int data_image_fill(DataImage *image, int count, unsigned short value);
+
+/*
+ * Maps a file and appends its bytes as words; the word count goes to
+ * *count. A file of more than limit bytes is DATA_INCLUDE_TOO_LARGE.
+ */
+int data_image_include(DataImage *image, const char *path, int limit, int *count);
+
+/*
+ * Keeps only the given ranges (sorted, not overlapping) and closes the gaps
+ * between them. Returns 0 on allocation failure, leaving the image as it was.
+ */
+int data_image_compact(DataImage *image, const DataRange *keep, int count);
+
+/*
+ * Rebuilds the image from the given ranges in the given order; they may
+ * move words (such as words just appended) without copying them. Returns 0
+ * on allocation failure, leaving the image as it was.
+ */
+int data_image_arrange(DataImage *image, const DataRange *ranges, int count);
+
+unsigned short data_segment_word(const DataImage *image, const DataSegment *segment, int i);
+
+void data_image_reset(DataImage *image);
+void data_image_free(DataImage *image);
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef DATA_POOL_H
+#define DATA_POOL_H
+
+#include "assembler.h"
+#include "data_image.h"
+
+/*
+ * Opt-in pooling of data literals. With pooling on, the words of each
+ * .string (and, with POOL_DATA, each .data) line are interned instead of
+ * being appended in place: identical contents are stored once, and a
+ * sequence that ends another one ("world" in "hello world") is placed
+ * inside it. The pooled literals are laid out after the other data at the
+ * end of the first pass, and their labels are pointed at the shared copy.
+ *
+ * Pooled lines lose their position relative to neighbouring data, and
+ * aliased labels share storage, so pooling is only for read-only data.
+ */
+
+#define POOL_STRINGS 1
+#define POOL_DATA 2
+
+typedef struct {
+    int first;              /* index of the words in DataPool.words */
+    int count;
+    int offset;             /* data offset, set by data_pool_layout() */
+    unsigned long hash;
+    int next;               /* next entry in the hash chain, -1 at the end */
+} PoolEntry;
+
+typedef struct {
+    char name[LABEL_LENGTH + 1];
+    int entry;
+} PoolLabel;
+
+typedef struct {
+    int mode;                       /* POOL_STRINGS | POOL_DATA; 0 = off */
+    unsigned short *words;
+    int word_count;
+    int word_capacity;
+    PoolEntry *entries;             /* distinct contents in order of first use */
+    int entry_count;
+    int entry_capacity;
+    int *buckets;                   /* hash heads, -1 = empty */
+    int bucket_count;
+    PoolLabel *labels;
+    int label_count;
+    int label_capacity;
+    unsigned long pooled_words;     /* words of all pooled lines */
+    unsigned long saved_words;      /* pooled_words minus the words laid out */
+} DataPool;
+
+/* Interns a word sequence; returns its entry, or -1 on allocation failure */
+int data_pool_add(DataPool *pool, const unsigned short *words, int count);
+
+int data_pool_add_label(DataPool *pool, const char *name, int entry);
+
+/*
+ * Appends the distinct pooled contents to the data image and sets every
+ * entry offset. Returns the number of words appended, or -1.
+ */
+int data_pool_layout(DataPool *pool, DataImage *image);
+
+void data_pool_reset(DataPool *pool);
+void data_pool_free(DataPool *pool);
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef DATA_STRIP_H
+#define DATA_STRIP_H
+
+#include "assembler.h"
+#include "data_image.h"
+
+/*
+ * Opt-in removal of unreferenced data. Every labelled data line starts a
+ * block that runs up to the next labelled data line, so unlabelled lines
+ * stay with the label above them. While the first pass runs, the names used
+ * by instruction operands and .entry lines are collected; at its end every
+ * block whose label is not among them is dropped from the data image and
+ * the remaining data symbols are moved down.
+ *
+ * Data reached only through the address of another block (a label plus an
+ * offset that runs past its own block) is not seen as referenced. Data
+ * before the first label and pooled literals are always kept.
+ */
+
+typedef struct {
+    char name[LABEL_LENGTH + 1];
+    int start;              /* data offset before stripping */
+    int new_start;          /* data offset after stripping; set by data_strip_run() */
+    int live;
+} DataBlock;
+
+typedef struct {
+    int enabled;
+    DataBlock *blocks;      /* in address order */
+    int block_count;
+    int block_capacity;
+    char (*roots)[LABEL_LENGTH + 1];    /* referenced names, sorted by data_strip_run() */
+    int root_count;
+    int root_capacity;
+    int removed_blocks;
+    unsigned long removed_words;
+} DataStrip;
+
+/* Starts a block at a labelled data line */
+int data_strip_add_block(DataStrip *strip, const char *label, int start);
+
+/* Records a name used by an operand or an .entry line */
+int data_strip_add_root(DataStrip *strip, const char *name);
+
+/*
+ * Drops the unreferenced blocks of the image. Returns the number of words
+ * removed, or -1 on allocation failure.
+ */
+int data_strip_run(DataStrip *strip, DataImage *image);
+
+/* Maps a data offset from before data_strip_run() to the compacted image */
+int data_strip_relocate(const DataStrip *strip, int offset);
+
+void data_strip_reset(DataStrip *strip);
+void data_strip_free(DataStrip *strip);
+
+#endif
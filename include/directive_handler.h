@@ -1,18 +1,25 @@
 #ifndef DIRECTIVE_HANDLER_H
 #define DIRECTIVE_HANDLER_H
 
+#include <stdbool.h>
+#include "logger.h"
+
 typedef enum {
     DIRECTIVE_NONE,
     DIRECTIVE_DATA,
     DIRECTIVE_STRING,
     DIRECTIVE_ENTRY,
-    DIRECTIVE_EXTERN
+    DIRECTIVE_EXTERN,
+    DIRECTIVE_INCBIN,
+    DIRECTIVE_FILL,
+    DIRECTIVE_SPACE,
+    DIRECTIVE_DEFINE
 } DirectiveType;
 
 DirectiveType get_directive_type(const char *word);
 
-/* Placeholder handlers for each directive */
-void handle_data_directive(const char *content);
+/* Placeholder handlers for each directive; problems are reported to diags */
+bool handle_data_directive(const char *content, DiagnosticList *diags, const char *file, int line);
 void handle_string_directive(const char *content);
 void handle_entry_directive(const char *content);
 void handle_extern_directive(const char *content);
@@ -0,0 +1,49 @@
+#ifndef DISASM_H
+#define DISASM_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * Disassembler for object images (.ob text or .bin binary).
+ *
+ * The code is decoded in one linear sweep from START_ADDRESS. The first
+ * word of an instruction is looked up in a table built once for all 2^14
+ * words, which gives its opcode, addressing modes and length (or marks it
+ * invalid); operand words are then read as encode_operand_word() and
+ * encode_registers_word() write them. The data follows the code as .data
+ * lines.
+ *
+ * The output is a source the assembler accepts and that assembles back to
+ * the same image. Labels are named after their address (L105). Every
+ * address an operand refers to gets a label when it starts an instruction
+ * or a data word, and is otherwise written as an offset from the nearest
+ * one (L104 + 2). External references become one .extern EXT. Words the
+ * assembler cannot produce (invalid instructions or operand words) are
+ * written as comments and counted in DisOutput.invalid.
+ */
+
+typedef struct {
+    unsigned short *words;      /* code then data, from START_ADDRESS */
+    int code_count;
+    int data_count;
+} DisImage;
+
+typedef struct {
+    char *text;                 /* the source, NUL-terminated */
+    size_t length;
+    int instructions;
+    int invalid;                /* words that could not be written as source */
+} DisOutput;
+
+/* Loads an image in either format (picked by the binary magic); false with a message in error,
+ * including for any word wider than 14 bits */
+bool dis_load_image(const char *data, size_t length, DisImage *image, char *error, size_t error_size);
+
+/* Disassembles an image; false if memory ran out */
+bool disassemble(const DisImage *image, DisOutput *out);
+
+void dis_image_free(DisImage *image);
+void dis_output_free(DisOutput *out);
+
+#endif
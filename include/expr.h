@@ -0,0 +1,26 @@
+#ifndef EXPR_H
+#define EXPR_H
+
+#include "symbol_table.h"
+
+/*
+ * Assembly-time expressions: decimal numbers and .define constants joined
+ * by + - * / % with unary signs and parentheses, evaluated with the usual
+ * precedence. Division truncates toward zero. Intermediate values must stay
+ * within +/-2^30; range checks against the target field are the caller's.
+ */
+
+#define EXPR_OK 0
+#define EXPR_SYNTAX 1
+#define EXPR_UNDEFINED 2        /* a name that is not a symbol */
+#define EXPR_NOT_CONSTANT 3     /* a label where a constant is needed */
+#define EXPR_DIVIDE_BY_ZERO 4
+#define EXPR_OVERFLOW 5
+
+/* Evaluates the whole of text; the value is stored only on EXPR_OK */
+int expr_eval(const char *text, SymbolTable *symbols, long *value);
+
+/* True if c may appear in an expression */
+int expr_char(int c);
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef FILE_WRITER_H
+#define FILE_WRITER_H
+
+#include <stdbool.h>
+#include "assembler.h"
+
+/* Builds the .ob file name for a .am file name (".am" is replaced by ".ob") */
+void object_file_name(const char *expanded_name, char *out, size_t size);
+
+bool write_expanded_file(const char *path, const char *text, size_t length);
+char *format_object(const AsmContext *ctx, size_t *out_length);
+bool write_object_file(const AsmContext *ctx, const char *path, size_t *bytes_written);
+
+/* Prints the .ob text to a stream a line at a time, without building it in memory */
+bool print_object(const AsmContext *ctx, FILE *out, size_t *bytes_written);
+
+/*
+ * Binary object image (.bin): the magic "ASMB", then little-endian 16-bit
+ * fields - load address, code words, data words - followed by one 16-bit
+ * word per image word, code first. Loading it needs no parsing.
+ */
+#define OBJECT_BINARY_MAGIC "ASMB"
+#define OBJECT_BINARY_HEADER 10
+
+/*
+ * Source map (.map): a "source <name>" line, then one line per instruction:
+ * "<address> <words> <line>", followed by " <macro> <call line>" when the
+ * instruction came from a macro expansion.
+ */
+char *format_source_map(const AsmContext *ctx, size_t *out_length);
+bool write_source_map_file(const AsmContext *ctx, const char *path, size_t *bytes_written);
+
+unsigned char *format_object_binary(const AsmContext *ctx, size_t *out_length);
+bool write_binary_object_file(const AsmContext *ctx, const char *path, size_t *bytes_written);
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef INCREMENTAL_H
+#define INCREMENTAL_H
+
+#include "asm_context.h"
+#include "pre_asm.h"
+
+/*
+ * Incremental reassembly of one source. The state of the last assembly
+ * is kept: the source split into lines, the expanded lines with their
+ * addresses and sizes, the symbols each instruction uses, and the context
+ * itself (symbol table, code and data image). A new version of the source
+ * is diffed against the old one by lines; only the changed range is
+ * expanded and parsed again, the items after it are shifted by the size
+ * difference, and only instructions whose operand symbols moved are
+ * encoded again. The code before the change is left as it is.
+ *
+ * Edits that this cannot follow fall back to a full assembly: macro
+ * definitions, .define/.extern/.entry lines, removed or duplicate labels,
+ * references to unknown symbols and errors of any kind. The state is only
+ * kept after an assembly without errors.
+ */
+
+typedef enum {
+    INC_NONE,               /* empty line or comment */
+    INC_CODE,
+    INC_DATA,
+    INC_SYMBOLIC            /* .define, .extern or .entry */
+} IncKind;
+
+/* A source line, as split by the pre-assembler */
+typedef struct {
+    size_t offset;          /* in IncState.source */
+    int length;
+    int first;              /* first expanded line it produced */
+    unsigned char inside;   /* inside a macro definition after this line */
+} IncSourceLine;
+
+/* An expanded (.am) line */
+typedef struct {
+    size_t offset;          /* in IncState.expanded */
+    int length;
+    unsigned char kind;     /* IncKind */
+    unsigned char relative; /* has a relative (&) operand, so it depends on its own address */
+    int ic;                 /* IC and DC before the line */
+    int dc;
+    int size;               /* words of code or data */
+    Symbol *label;          /* symbol defined by the line */
+    Symbol *uses[2];        /* symbols of the operands */
+    int used[2];            /* their addresses when the line was encoded */
+} IncLine;
+
+typedef struct {
+    bool valid;                 /* the context holds an error-free assembly of source */
+    bool expanded_ok;           /* pre-assembly succeeded: expanded is the .am text */
+    bool first_pass_ok;         /* the first pass succeeded: the context holds the images */
+    MacroTable *table;          /* macros defined by the source, for re-expansion */
+    char *source;
+    size_t source_length;
+    size_t source_capacity;
+    IncSourceLine *lines;
+    int line_count;
+    int line_capacity;
+    char *expanded;
+    size_t expanded_length;
+    size_t expanded_capacity;
+    IncLine *items;
+    int item_count;
+    int item_capacity;
+    bool incremental;           /* the last assembly was incremental */
+    int reparsed;               /* expanded lines parsed by the last assembly */
+    int reencoded;              /* instructions outside the edit encoded again */
+} IncState;
+
+void inc_init(IncState *st);
+
+/*
+ * Assembles src into ctx (whose names and options are kept), reusing the
+ * previous assembly where possible. Returns true if there were no errors.
+ */
+bool inc_assemble(IncState *st, AsmContext *ctx, MacroTable *library, const char *src, size_t len);
+
+/* Forgets the kept state; the next assembly is a full one */
+void inc_invalidate(IncState *st);
+
+void inc_free(IncState *st);
+
+#endif
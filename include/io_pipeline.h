@@ -0,0 +1,44 @@
+#ifndef IO_PIPELINE_H
+#define IO_PIPELINE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * Overlapped file I/O for the command-line assembler. A reader thread
+ * loads the sources a few files ahead of the one being assembled, and a
+ * writer thread drains a queue of finished outputs, so the passes do not
+ * wait on the file system. If the threads cannot be started (or with
+ * --sync-io) every call does its I/O directly instead.
+ */
+
+/* Sources read ahead of the one being assembled */
+#define IO_PREFETCH_FILES 4
+
+/* Output bytes queued before io_pipeline_write() waits for the writer */
+#define IO_WRITE_LIMIT (32UL * 1024 * 1024)
+
+typedef struct IoPipeline IoPipeline;
+
+/*
+ * Starts reading paths[0 .. count) in order. The paths are borrowed and
+ * must stay valid until io_pipeline_finish(). Returns NULL if memory ran out.
+ */
+IoPipeline *io_pipeline_start(const char *const *paths, int count, bool threaded);
+
+/*
+ * Returns the contents of paths[index] (NUL-terminated, to be freed by the
+ * caller) or NULL if it could not be read. Files are taken in order.
+ */
+char *io_pipeline_read(IoPipeline *io, int index, size_t *length);
+
+/*
+ * Queues data to be written to path and takes ownership of it. Write errors
+ * are reported on stderr by the writer and counted by io_pipeline_finish().
+ */
+bool io_pipeline_write(IoPipeline *io, const char *path, char *data, size_t length);
+
+/* Waits for the queued writes and frees the pipeline; returns the failed writes */
+int io_pipeline_finish(IoPipeline *io);
+
+#endif
@@ -0,0 +1,142 @@
+#ifndef LIBASSEMBLER_H
+#define LIBASSEMBLER_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * In-memory assembler API.
+ *
+ * assemble_buffer() runs the same pre-assembly, first pass and second pass
+ * as the command line tool, but takes the source from memory and returns
+ * the images, symbols and diagnostics in an AsmResult instead of writing
+ * .am/.ob files. All state lives in the call, so separate calls may run
+ * concurrently.
+ */
+
+#define ASM_NAME_LEN 256
+#define ASM_SYMBOL_NAME_LEN 32
+#define ASM_MESSAGE_LEN 256
+
+typedef struct {
+    const char *name;           /* source name used in diagnostics (default "input.as") */
+    bool echo_diagnostics;      /* also print diagnostics to stderr as they are found */
+    bool format_object;         /* also render the image in .ob text format */
+    int max_errors;             /* stop after this many errors; 0 = no limit */
+    int pool;                   /* ASM_POOL_* flags; pooled literals move to the end of the data */
+    bool strip_data;            /* drop data blocks no instruction or .entry refers to */
+    bool optimize;              /* run the peephole optimizer over the instructions */
+} AsmOptions;
+
+/* Literal pooling: identical and suffix-sharing contents are stored once */
+#define ASM_POOL_STRINGS 1      /* .string lines */
+#define ASM_POOL_DATA 2         /* .data lines (read-only data only) */
+
+typedef enum {
+    ASM_SYMBOL_CODE,
+    ASM_SYMBOL_DATA,
+    ASM_SYMBOL_EXTERN,
+    ASM_SYMBOL_ENTRY,
+    ASM_SYMBOL_CONSTANT         /* .define; address holds the value */
+} AsmSymbolKind;
+
+typedef enum {
+    ASM_DIAG_WARNING,
+    ASM_DIAG_ERROR
+} AsmDiagLevel;
+
+typedef struct {
+    int address;
+    unsigned short value;
+} AsmWord;
+
+typedef struct {
+    char name[ASM_SYMBOL_NAME_LEN];
+    int address;
+    AsmSymbolKind kind;
+} AsmSymbol;
+
+typedef struct {
+    AsmDiagLevel level;
+    const char *file;           /* points at AsmResult.source_name or expanded_name */
+    int line;
+    int column;
+    char message[ASM_MESSAGE_LEN];
+} AsmDiagnostic;
+
+typedef struct {
+    bool success;
+    char source_name[ASM_NAME_LEN];
+    char expanded_name[ASM_NAME_LEN];
+
+    char *expanded;             /* macro-expanded (.am) text */
+    size_t expanded_length;
+
+    char *object;               /* .ob text, when AsmOptions.format_object is set */
+    size_t object_length;
+
+    AsmWord *code;              /* instruction image, starting at address 100 */
+    int code_count;
+    AsmWord *data;              /* data image, placed right after the code */
+    int data_count;
+
+    AsmSymbol *symbols;
+    int symbol_count;
+
+    AsmDiagnostic *diagnostics;
+    int diagnostic_count;
+    int error_count;
+
+    bool incremental;           /* asm_document_assemble() reused the previous assembly */
+    int reencoded;              /* instructions outside the edit it encoded again */
+} AsmResult;
+
+void asm_options_init(AsmOptions *options);
+
+/*
+ * Assembles len bytes of source. Returns true if no errors were found.
+ * The result must be released with asm_result_free() in either case.
+ */
+bool assemble_buffer(const char *src, size_t len, const AsmOptions *options, AsmResult *result);
+
+void asm_result_free(AsmResult *result);
+
+/*
+ * Sessions serve many assemblies from one process. A session keeps a macro
+ * library that every source can call, and reuses its internal tables and
+ * buffers between calls. A session must not be used by two threads at once.
+ */
+typedef struct AsmSession AsmSession;
+
+AsmSession *asm_session_create(void);
+
+/* Adds the macros defined in src to the session library */
+bool asm_session_load_macros(AsmSession *session, const char *src, size_t len, const AsmOptions *options);
+
+bool asm_session_assemble(AsmSession *session, const char *src, size_t len, const AsmOptions *options, AsmResult *result);
+
+void asm_session_destroy(AsmSession *session);
+
+/*
+ * Documents assemble successive versions of one source, such as a file
+ * being edited. After an error-free assembly the document keeps its state,
+ * and the next version only parses and encodes the lines that changed and
+ * the instructions whose operands moved; edits it cannot follow (macro
+ * definitions, .define/.extern/.entry lines, label removals, errors) are
+ * assembled in full. The results are the same as asm_session_assemble(),
+ * except that symbols added by an edit are listed last.
+ * A document uses the macro library of its session, and must be reset
+ * after more macros are loaded into it.
+ */
+typedef struct AsmDocument AsmDocument;
+
+AsmDocument *asm_document_create(AsmSession *session);
+
+bool asm_document_assemble(AsmDocument *doc, const char *src, size_t len, const AsmOptions *options, AsmResult *result);
+
+/* Drops the kept state; the next assembly is a full one */
+void asm_document_reset(AsmDocument *doc);
+
+void asm_document_destroy(AsmDocument *doc);
+
+#endif
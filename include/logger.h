@@ -11,7 +11,61 @@ typedef enum {
     LOG_ERR
 } LogLevel;
 
+/* How assembler diagnostics are rendered */
+typedef enum {
+    DIAG_FORMAT_TEXT,   /* file:line:col: error: message (coloured on a terminal) */
+    DIAG_FORMAT_JSON    /* one JSON object per line */
+} DiagFormat;
+
+#define DIAG_MSG_LEN 256
+
+/* A single assembler diagnostic, kept for callers that want them in memory */
+typedef struct {
+    LogLevel level;
+    const char *file;
+    int line;
+    int col;
+    int seq;        /* report order, keeps the line sort stable */
+    char message[DIAG_MSG_LEN];
+} Diagnostic;
+
+/* Diagnostics collected for one assembly */
+typedef struct {
+    Diagnostic *items;
+    int count;
+    int capacity;
+    int error_count;
+    int max_errors;     /* errors kept before the rest are suppressed; 0 = no limit */
+    int suppressed;     /* errors reported after max_errors was reached */
+    int echo;           /* also print each record as it is reported */
+    int flushed;        /* records already written by diag_flush() */
+} DiagnosticList;
+
 void asm_log_set_level(LogLevel level);
+void asm_diag_set_format(DiagFormat format);
+
+/* Current minimum level of log lines; set with asm_log_set_level() */
+extern LogLevel asm_log_level;
+
+/*
+ * Lowest level the ASM_LOG_* macros compile in: 0 debug, 1 info,
+ * 2 warnings, 3 errors. Calls below it compile to nothing; calls above
+ * it test asm_log_level before their arguments are evaluated. The
+ * arguments go in double parentheses, as C90 has no variadic macros:
+ *
+ *     ASM_LOG_DBG(("Found macro definition: %s", name));
+ */
+#ifndef ASM_LOG_MIN
+#define ASM_LOG_MIN 0
+#endif
+
+#define ASM_LOG_AT(level, min, call) \
+    do { if (ASM_LOG_MIN <= (min) && asm_log_level <= (level)) call; } while (0)
+
+#define ASM_LOG_DBG(args) ASM_LOG_AT(LOG_DEBUG, 0, log_dbg args)
+#define ASM_LOG_INFO(args) ASM_LOG_AT(LOG_INF, 1, log_info args)
+#define ASM_LOG_WARN(args) ASM_LOG_AT(LOG_WARN, 2, log_warn args)
+#define ASM_LOG_ERR(args) ASM_LOG_AT(LOG_ERR, 3, log_err args)
 
 void log_internal(LogLevel level, const char *fmt, va_list args);
 void log_asm_internal(LogLevel level, const char *file, int line, int col, const char *fmt, va_list args);
@@ -24,4 +78,14 @@ void log_err(const char *fmt, ...);
 void asm_warn(const char *file, int line, int col, const char *fmt, ...);
 void asm_err(const char *file, int line, int col, const char *fmt, ...);
 
+void diag_report(DiagnosticList *list, LogLevel level, const char *file, int line, int col, const char *fmt, ...);
+
+/* True once max_errors errors have been recorded; passes stop early on it */
+int diag_limit_reached(const DiagnosticList *list);
+
+/* Sorts the records not yet flushed by line and writes them to out in a single write */
+void diag_flush(DiagnosticList *list, FILE *out);
+
+void diag_free(DiagnosticList *list);
+
 #endif /* ASM_LOGGER_H */
@@ -2,11 +2,15 @@
 #define PARSER_H
 
 #include "assembler.h"
+#include "directive_handler.h"
 
 /* Max label length from doc */
 #define OP_PER_INST(ints_type) (ints_type < INST_CLR ? 2 : ints_type < INST_RTS ? 1 : 0)
 #define MAX_MSG 512
 
+/* Operands may be expressions (#SIZE*4+1, LABEL+2), so they get a whole line */
+#define OPERAND_LENGTH LINE_LENGTH
+
 /* Type of line parsed from source */
 typedef enum {
     LINE_EMPTY,
@@ -56,7 +60,7 @@ typedef enum {
 /* Structure for a single operand */
 typedef struct {
     OperandType type;
-    char value[LABEL_LENGTH + 1];
+    char value[OPERAND_LENGTH + 1];
 } Operand;
 
 /* Parsed line result */
@@ -64,6 +68,7 @@ typedef struct {
     LineType type;
     int line_number;
     char label[LABEL_LENGTH + 1];  
+    DirectiveType directive;           /* LINE_DIRECTIVE: which one */
     InstructionType instruction;
     Operand operands[2];               
     int operand_count;
@@ -74,6 +79,12 @@ typedef struct {
 InstructionType lookup_instruction(const char *token);
 Operand parse_operand(const char *str);
 
+/*
+ * For a direct or relative operand, copies the label into name and returns
+ * the offset expression after it ("" if none); otherwise returns NULL.
+ */
+const char *operand_label(const Operand *op, char *name);
+
 /**
  * Parses a single line of assembly code.
  *
@@ -0,0 +1,64 @@
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+
+#include "parser.h"
+#include "symbol_table.h"
+
+/*
+ * Opt-in peephole optimizer. With it on, the first pass keeps every sized
+ * instruction; at the end of the pass the list is rewritten, the code
+ * labels are moved to the new addresses, and the second pass encodes the
+ * list instead of the lines it reads. The rewrites are:
+ *
+ *   - consecutive inc, dec, add #k and sub #k of the same operand become a
+ *     single inc, dec, add or sub of the sum, or nothing if it is 0
+ *   - mov x, x is removed
+ *   - mov #0, x becomes clr x
+ *   - jmp and bne to the next instruction are removed
+ *
+ * Only cmp sets the flags, so none of these changes a later bne. A run is
+ * never merged across a label, since a jump may land inside it.
+ */
+
+typedef struct {
+    InstructionType instruction;
+    Operand operands[2];
+    int operand_count;
+    int line_number;
+    int address;            /* before the rewrite */
+    int new_address;
+    int words;
+    int labelled;           /* a label is defined on this line */
+    int deleted;
+} PeepInsn;
+
+typedef struct {
+    int enabled;
+    PeepInsn *insns;        /* in source order */
+    int count;
+    int capacity;
+    int end;                /* IC after the last instruction, before the rewrite */
+    int rewrites;
+    unsigned long words_saved;
+    unsigned long cycles_saved;
+} Peephole;
+
+/* Keeps a sized instruction; returns 0 on allocation failure */
+int peephole_add(Peephole *peep, const ParsedLine *parsed, int address, int words);
+
+/*
+ * Rewrites the list and assigns the new addresses; code labels are looked
+ * up in symbols. Returns the IC after the last kept instruction.
+ */
+int peephole_run(Peephole *peep, SymbolTable *symbols);
+
+/* Maps a code address from before peephole_run() to its new address */
+int peephole_relocate(const Peephole *peep, int address);
+
+/* Copies a kept instruction into a parsed line for encoding */
+void peephole_load(const PeepInsn *insn, ParsedLine *parsed);
+
+void peephole_reset(Peephole *peep);
+void peephole_free(Peephole *peep);
+
+#endif
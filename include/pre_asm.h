@@ -11,23 +11,59 @@
 typedef struct MacroEntry {
     char *name;
     char *content;
+    int line;                   /* line of the 'macro' statement, 0 if unknown */
+    int *body_lines;            /* source line of each body line */
+    int body_line_count;
     struct MacroEntry *next;
 } MacroEntry;
 
 /* MacroTable structure */
-typedef struct {
+typedef struct MacroTable {
     MacroEntry **buckets;
     size_t size;
     size_t count;
+    struct MacroTable *parent;  /* searched when a name is not found here */
+    unsigned long lookups;
+    unsigned long probes;       /* entries compared during lookups */
 } MacroTable;
 
+/* Macro expansion state of one source, fed a line at a time */
+typedef struct {
+    AsmContext *ctx;
+    MacroTable *table;
+    int line_num;
+    int inside_macro;
+    char current_macro_name[LINE_LENGTH];
+    char *macro_buffer;
+    size_t buffer_size;
+    size_t content_length;
+    int macro_line;
+    int *body_lines;
+    int body_line_count;
+    int body_line_capacity;
+    int had_error;
+    int track_origins;          /* record the origin of each output line in ctx->map */
+    unsigned long lookups_before;
+    unsigned long probes_before;
+} PreAsm;
+
 /* Function prototypes */
 char *strdup_c90(const char *src);
 unsigned int hash(const char *str, size_t table_size);
 MacroTable *create_macro_table(void);
-void insert_macro(MacroTable *table, const char *name, const char *content);
+MacroEntry *insert_macro(MacroTable *table, const char *name, const char *content);
+MacroEntry *find_macro(MacroTable *table, const char *name);
 char *lookup_macro(MacroTable *table, const char *name);
 void free_macro_table(MacroTable *table);
-char *pre_assemble(const char *source_filename, MacroTable *table);
+char *pre_assemble(AsmContext *ctx, MacroTable *table, const char *source, size_t length, size_t *out_length);
+
+/*
+ * Line-at-a-time expansion, as used by pre_assemble(): each call appends
+ * the expansion of one source line (possibly several lines, or none) to a
+ * growable buffer and returns 0 only if memory ran out.
+ */
+void pre_asm_begin(PreAsm *pa, AsmContext *ctx, MacroTable *table);
+int pre_asm_line(PreAsm *pa, const char *line, char **output, size_t *output_length, size_t *output_capacity);
+int pre_asm_end(PreAsm *pa);
 
 #endif /* PRE_ASM_H */
\ No newline at end of file
@@ -0,0 +1,31 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+/*
+ * Server mode: a long-running assembler that answers framed requests on
+ * stdin/stdout or on a Unix stream socket.
+ *
+ *   request:   ASSEMBLE <name> <length>\n<length bytes of source>
+ *              PING\n
+ *              QUIT\n                   (stops the server)
+ *
+ *   response:  OK|ERROR <object length> <diagnostics length> <microseconds>\n
+ *              <object text (.ob format)><diagnostic lines>
+ *              PONG\n
+ *
+ * Diagnostic lines have the form "file:line:col: error: message\n".
+ *
+ * A request longer than SERVER_MAX_SOURCE bytes, or one whose source
+ * cannot be read, is answered with "ERROR 0 0 0" and ends the stream.
+ */
+
+#define SERVER_MAX_SOURCE (64UL * 1024 * 1024)
+
+typedef struct {
+    const char *socket_path;    /* NULL to serve stdin/stdout */
+    const char *macro_library;  /* optional .as file whose macros every request can use */
+} ServerOptions;
+
+int serve(const ServerOptions *options);
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef SIM_JIT_H
+#define SIM_JIT_H
+
+#include <stdbool.h>
+#include "simulator.h"
+
+/*
+ * Translation of hot basic blocks to native code (x86-64 Linux only).
+ *
+ * The interpreter counts entries into each block start (every jmp, bne,
+ * jsr and rts target). Once a count reaches the threshold the straight-line
+ * run of instructions from there is translated, up to and including a
+ * closing jmp/bne. jsr, rts, stop, red and prn end a block and stay in the
+ * interpreter, as does any store into the code area, so translated code
+ * never modifies code; stores made by the interpreter invalidate the blocks
+ * they overlap.
+ *
+ * On other platforms sim_jit_create() returns NULL and the simulator only
+ * interprets.
+ */
+
+typedef struct {
+    unsigned long translations;
+    unsigned long invalidations;
+    unsigned long block_runs;
+    unsigned long native_steps;     /* instructions executed in translated code */
+    unsigned long code_bytes;
+    double translate_seconds;
+    double native_seconds;          /* only measured when timing was requested */
+} SimJitStats;
+
+bool sim_jit_supported(void);
+
+/* threshold: block entries before translation; timing: measure native time */
+SimJit *sim_jit_create(int threshold, bool timing);
+void sim_jit_destroy(SimJit *jit);
+
+/* Drops every translation (called when a new image is loaded) */
+void sim_jit_reset(SimJit *jit);
+
+/* Drops the translations that contain addr */
+void sim_jit_invalidate(SimJit *jit, int addr);
+
+/*
+ * Runs translated blocks from pc while they exist and fit in the remaining
+ * budget; *steps is advanced by the instructions executed. Returns the pc
+ * where interpretation continues.
+ */
+int sim_jit_execute(Simulator *sim, SimJit *jit, int pc, unsigned long remaining, unsigned long *steps);
+
+void sim_jit_stats(const SimJit *jit, SimJitStats *out);
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef SIM_TRACE_H
+#define SIM_TRACE_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "simulator.h"
+
+/*
+ * Execution trace of a simulator run.
+ *
+ * Every executed instruction appends a step event whose pc is delta-encoded
+ * against the previous one (one byte for fall-through), followed by the
+ * register, memory, flag, stack and I/O changes it made. Events go into
+ * fixed-size blocks, and a full machine checkpoint is taken every
+ * TRACE_CHECKPOINT_BLOCKS blocks. When the trace exceeds its size limit the
+ * oldest checkpoint interval is dropped, so memory stays bounded (within
+ * one interval of the limit) and the trace keeps the most recent part of
+ * the run.
+ *
+ * Seeking restores the nearest checkpoint at or before the requested step
+ * and applies the events from there; nothing is re-executed. Program
+ * output is not part of the restored state (prn events are in the trace).
+ */
+
+#define TRACE_BLOCK_SIZE (64 * 1024)
+#define TRACE_CHECKPOINT_BLOCKS 4
+#define TRACE_DEFAULT_LIMIT (64UL * 1024 * 1024)
+
+typedef struct {
+    unsigned long first_step;       /* first step still in the trace */
+    unsigned long steps;            /* steps recorded up to now */
+    unsigned long event_bytes;
+    unsigned long blocks;
+    unsigned long checkpoints;
+    unsigned long dropped_blocks;
+    unsigned long memory_bytes;     /* blocks and checkpoints held */
+} SimTraceStats;
+
+/* max_bytes: limit for blocks and checkpoints; 0 = TRACE_DEFAULT_LIMIT */
+SimTrace *sim_trace_create(unsigned long max_bytes);
+void sim_trace_destroy(SimTrace *trace);
+
+/* Recording hooks, called by the simulator while sim->trace is set */
+void sim_trace_step(SimTrace *trace, const Simulator *sim, int pc);
+void sim_trace_reg(SimTrace *trace, int reg, int value);
+void sim_trace_mem(SimTrace *trace, int addr, int value);
+void sim_trace_flags(SimTrace *trace, int zero, int negative);
+void sim_trace_push(SimTrace *trace, int value);
+void sim_trace_pop(SimTrace *trace);
+void sim_trace_input(SimTrace *trace);
+void sim_trace_output(SimTrace *trace, int c);
+/* Where sim_run() stopped; the state after the last recorded step */
+void sim_trace_end(SimTrace *trace, int pc, SimStatus status);
+
+void sim_trace_stats(const SimTrace *trace, SimTraceStats *out);
+
+/* Puts the machine in the state it had after `step` instructions */
+bool sim_trace_seek(const SimTrace *trace, Simulator *sim, unsigned long step);
+
+/* Prints the events of steps first..last, one instruction per line */
+void sim_trace_dump(const SimTrace *trace, FILE *out, unsigned long first, unsigned long last);
+
+/*
+ * Trace files hold the raw blocks and checkpoints; they are not portable
+ * between hosts. Loading rejects a file with an event a seek could not apply.
+ */
+bool sim_trace_save(const SimTrace *trace, const char *path);
+SimTrace *sim_trace_load(const char *path);
+
+#endif
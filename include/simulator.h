@@ -0,0 +1,117 @@
+#ifndef SIMULATOR_H
+#define SIMULATOR_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "parser.h"
+#include "libassembler.h"
+
+/*
+ * Simulator for the target machine.
+ *
+ * An object image (.ob text or .bin binary) is loaded into a flat array of
+ * 14-bit words. Every address is then predecoded once into a SimInsn record
+ * holding the handler, the instruction length and both operands already
+ * resolved to a register number, an address or an immediate value, so the
+ * interpreter loop never looks at addressing modes. Stores into the code
+ * area re-decode the records they overlap. Only the code area is
+ * executable: jumping into the data or beyond it, or running off the end of
+ * the code, faults, so data written at run time is never executed.
+ *
+ * With a profile array attached every executed instruction is counted at
+ * its address; translated blocks are not entered while profiling. The same
+ * holds while a trace (sim_trace.h) is recording.
+ *
+ * red reads one character from an in-memory input buffer (-1 at the end)
+ * and prn appends one character to an in-memory output buffer.
+ */
+
+#define SIM_MEMORY_SIZE 4096    /* direct operands carry 12-bit addresses */
+#define SIM_REGISTERS 8
+#define SIM_STACK_SIZE 256
+
+/* Native translation of hot blocks (sim_jit.h) */
+typedef struct SimJit SimJit;
+
+/* Execution trace recording (sim_trace.h) */
+typedef struct SimTrace SimTrace;
+
+/* Handler index of records that cannot be executed */
+#define SIM_OP_BAD 16
+
+typedef enum {
+    SIM_READY,
+    SIM_HALTED,     /* executed stop */
+    SIM_BUDGET,     /* instruction budget used up; sim_run() may resume */
+    SIM_FAULT       /* invalid instruction, execution outside the code, stack overflow/underflow */
+} SimStatus;
+
+typedef enum {
+    SIM_OPND_NONE,
+    SIM_OPND_IMM,
+    SIM_OPND_MEM,
+    SIM_OPND_REG
+} SimOperandKind;
+
+/* Predecoded instruction */
+typedef struct {
+    unsigned char op;           /* InstructionType, or SIM_OP_BAD */
+    unsigned char length;       /* words, including operand words */
+    unsigned char src_kind;     /* SimOperandKind */
+    unsigned char dst_kind;
+    short src;                  /* immediate value, address or register */
+    short dst;
+} SimInsn;
+
+typedef struct {
+    unsigned short memory[SIM_MEMORY_SIZE];
+    /* one record per address, plus padding records for a fall-through off the end */
+    SimInsn decoded[SIM_MEMORY_SIZE + MAX_WORDS_PER_LINE];
+    int regs[SIM_REGISTERS];
+    int pc;
+    int zero;                   /* flags set by cmp */
+    int negative;
+    int stack[SIM_STACK_SIZE];
+    int sp;
+    int code_start;
+    int code_end;
+    int image_end;
+    const char *input;          /* borrowed */
+    size_t input_length;
+    size_t input_pos;
+    char *output;
+    size_t output_length;
+    size_t output_capacity;
+    unsigned long steps;        /* instructions executed since the last load */
+    SimStatus status;
+    char error[128];
+    SimJit *jit;                /* borrowed; NULL = interpret only */
+    unsigned long *profile;     /* borrowed, SIM_MEMORY_SIZE execution counts per address; NULL = off */
+    SimTrace *trace;            /* borrowed; NULL = not recording */
+} Simulator;
+
+void sim_init(Simulator *sim);
+void sim_free(Simulator *sim);
+
+/* Load an image and reset the machine; false (with sim->error) if malformed */
+bool sim_load_object(Simulator *sim, const char *text, size_t length);
+bool sim_load_binary(Simulator *sim, const unsigned char *data, size_t length);
+/* Picks the format by the binary magic */
+bool sim_load_image(Simulator *sim, const char *data, size_t length);
+/* Loads the image of an in-memory assembly */
+bool sim_load_result(Simulator *sim, const AsmResult *result);
+
+/* Rebuilds every predecoded record after memory was replaced directly */
+void sim_predecode(Simulator *sim);
+
+/* Resets registers, flags, stack, I/O and the step count; memory is kept */
+void sim_reset(Simulator *sim);
+
+void sim_set_input(Simulator *sim, const char *input, size_t length);
+
+/* Runs at most max_steps instructions (0 = no limit) */
+SimStatus sim_run(Simulator *sim, unsigned long max_steps);
+
+const char *sim_status_name(SimStatus status);
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef SOURCE_MAP_H
+#define SOURCE_MAP_H
+
+/*
+ * Address-to-source map of an assembly. The pre-assembler records where
+ * each expanded (.am) line came from, and the second pass records which
+ * expanded line each instruction address was encoded from. Together they
+ * map an address back to its .as line, and for macro text to the macro and
+ * the line that called it.
+ */
+
+/* Origin of one expanded line */
+typedef struct {
+    int line;           /* .as line; the macro body line for expanded macro text */
+    int call_line;      /* line of the macro call, 0 outside macros */
+    int macro;          /* index into SourceMap.macros, -1 outside macros */
+} LineOrigin;
+
+/* An instruction and the expanded line it was encoded from */
+typedef struct {
+    int address;
+    int length;
+    int expanded_line;
+} MapInstruction;
+
+typedef struct {
+    LineOrigin *origins;        /* indexed by expanded line - 1 */
+    int origin_count;
+    int origin_capacity;
+    char **macros;              /* names of the expanded macros */
+    int macro_count;
+    int macro_capacity;
+    MapInstruction *instructions;
+    int instruction_count;
+    int instruction_capacity;
+} SourceMap;
+
+int source_map_add_origin(SourceMap *map, int line, int macro, int call_line);
+
+/* Returns the index of a macro name, adding it on first use; -1 on allocation failure */
+int source_map_intern_macro(SourceMap *map, const char *name);
+
+int source_map_add_instruction(SourceMap *map, int address, int length, int expanded_line);
+
+/* Origin of an expanded line, or NULL if unknown */
+const LineOrigin *source_map_origin(const SourceMap *map, int expanded_line);
+
+void source_map_reset(SourceMap *map);
+void source_map_free(SourceMap *map);
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+
+/* Pipeline phases timed by --stats */
+typedef enum {
+    PHASE_PRE_ASSEMBLE,
+    PHASE_FIRST_PASS,
+    PHASE_SECOND_PASS,
+    PHASE_WRITE_OUTPUT,
+    PHASE_COUNT
+} AsmPhase;
+
+/* Event counters of one assembly; always maintained, they are just increments */
+typedef struct {
+    unsigned long source_lines;
+    unsigned long expanded_lines;
+    unsigned long macro_expansions;
+    unsigned long macro_lookups;
+    unsigned long macro_probes;
+    unsigned long symbols;
+    unsigned long symbol_lookups;
+    unsigned long symbol_probes;
+    unsigned long words_emitted;
+    unsigned long bytes_written;
+    unsigned long pooled_words;     /* words of pooled .string/.data lines */
+    unsigned long pool_words_saved; /* of those, words not written thanks to pooling */
+    unsigned long data_words_stripped;  /* unreferenced data words removed (--strip-data) */
+    unsigned long peephole_words_saved; /* code words removed by the peephole optimizer */
+    unsigned long peephole_cycles_saved;    /* their estimated cycles, one execution each */
+} AsmCounters;
+
+typedef enum {
+    STATS_OFF,
+    STATS_TABLE,
+    STATS_JSON
+} StatsFormat;
+
+/* Timing and counters recorded for one input file */
+typedef struct {
+    char file[256];
+    double phase_seconds[PHASE_COUNT];
+    double phase_start;
+    AsmCounters counters;
+} FileStats;
+
+void stats_enable(StatsFormat format);
+
+/* Returns a record for a new file, or NULL when statistics are off */
+FileStats *stats_add_file(const char *name);
+
+void stats_phase_begin(FileStats *fs, AsmPhase phase);
+void stats_phase_end(FileStats *fs, AsmPhase phase);
+void stats_add_counters(FileStats *fs, const AsmCounters *counters);
+
+const char *stats_phase_name(AsmPhase phase);
+double stats_now(void);
+
+/* Process peak resident set size in KiB */
+long stats_peak_rss_kb(void);
+
+/* Restarts peak RSS tracking (Linux); returns 0 where unsupported */
+int stats_reset_peak_rss(void);
+
+/* Prints all recorded files and the totals, then releases them */
+void stats_report(FILE *out);
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "assembler.h"
+#include "pre_asm.h"
+
+/*
+ * Streaming mode: assembles a source read once from a stream (a pipe from
+ * a generator, say) and writes the .ob text to another. Each source line
+ * is macro-expanded and encoded as it is read, so neither the source nor
+ * its expansion is kept; memory grows with the symbol table, the encoded
+ * words and the fixups of forward references. The .ob header carries the
+ * final word counts, so the object is written once the input ends.
+ *
+ * ctx is set up by the caller and switched to one-pass mode. Diagnostics
+ * name the source lines. Returns false if the source had errors or the
+ * output could not be written.
+ */
+bool assemble_stream(AsmContext *ctx, MacroTable *table, FILE *in, FILE *out, size_t *bytes_written);
+
+#endif
@@ -1,5 +1,3 @@
-
-
 #ifndef LABEL_SYM_H
 #define LABEL_SYM_H
 
@@ -15,7 +13,8 @@ typedef enum {
     SYMBOL_CODE,
     SYMBOL_DATA,
     SYMBOL_EXTERN,
-    SYMBOL_ENTRY
+    SYMBOL_ENTRY,
+    SYMBOL_CONSTANT     /* .define; address holds the value */
 } SymbolType;
 
 /* Symbol structure */
@@ -24,15 +23,29 @@ typedef struct Symbol {
     int address;
     SymbolType type;
     struct Symbol *next;
+    struct Symbol *chain;   /* next symbol in the same hash bucket */
 } Symbol;
 
+/* Symbol table of a single assembly */
+typedef struct {
+    Symbol *head;       /* all symbols, most recent first */
+    Symbol *spare;      /* nodes kept by reset_symbol_table() for reuse */
+    Symbol **buckets;   /* hash chains; grown to keep about one symbol per bucket */
+    unsigned long bucket_count;
+    unsigned long count;
+    unsigned long lookups;
+    unsigned long probes;   /* entries compared during lookups */
+} SymbolTable;
+
+
+void free_symbol_table(SymbolTable *table);
 
-void free_symbol_table();
+void reset_symbol_table(SymbolTable *table);
 
-void add_symbol(const char *name, int address, SymbolType type);
+void add_symbol(SymbolTable *table, const char *name, int address, SymbolType type);
 
-Symbol* find_symbol(const char *name);
+Symbol* find_symbol(SymbolTable *table, const char *name);
 
-void mark_entry(const char *name);
+void mark_entry(SymbolTable *table, const char *name);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,23 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+/*
+ * Chrome Trace Event output (--trace out.json).
+ *
+ * Begin/end events are appended to a buffer owned by the calling thread and
+ * written out by trace_close(), so tracing does not serialize threads.
+ * While tracing is off every call is a single flag test.
+ */
+
+#define TRACE_NAME_LEN 96
+
+/* Starts recording; events are written to path by trace_close() */
+int trace_open(const char *path);
+
+void trace_begin(const char *category, const char *name);
+void trace_end(const char *category, const char *name);
+
+/* Writes every thread's events to the trace file and stops recording */
+void trace_close(void);
+
+#endif
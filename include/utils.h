@@ -1,12 +1,20 @@
-
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <stddef.h>
 #include <stdbool.h>
 
 char *trim_whitespace(char *str);
 bool is_register(const char *str);
 char *strdup_c90(const char *src);
 
+/* Reentrant tokenizer (strtok replacement that keeps its state in *cursor) */
+char *next_token(char **cursor, const char *delims);
+
+/* fgets() equivalent over an in-memory buffer */
+bool read_buffer_line(const char **pos, const char *end, char *line, size_t size);
+
+/* Reads a whole file into a NUL-terminated heap buffer */
+char *read_file(const char *path, size_t *out_len);
 
-#endif
\ No newline at end of file
+#endif
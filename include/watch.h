@@ -0,0 +1,31 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <stdbool.h>
+
+/*
+ * Watch mode: assembles every .as file of a directory, then waits on
+ * inotify and reassembles a file as soon as it is saved. A file is also
+ * reassembled when a file it pulls in with .incbin changes, and all of them
+ * when the macro library (--macros) changes. The assembler session, the
+ * macro library and the last assembly of every file stay in memory, so a
+ * save costs one assembly, and an edit that only changes instructions and
+ * data lines is reassembled incrementally (see AsmDocument). Saves that
+ * leave a file unchanged, and objects that come out the same, are skipped.
+ *
+ * Each reassembly prints one status line on stdout, followed by its
+ * diagnostics on stderr. Runs until interrupted (SIGINT/SIGTERM).
+ */
+
+typedef struct {
+    const char *directory;
+    const char *macro_library;  /* optional .as file whose macros every file can use */
+    int max_errors;
+    int pool;                   /* ASM_POOL_* flags */
+    bool strip_data;
+    bool optimize;
+} WatchOptions;
+
+int watch(const WatchOptions *options);
+
+#endif
@@ -0,0 +1,163 @@
+#include <string.h>
+#include "asm_alloc.h"
+
+/*
+ * asm_strdup:
+ * Tagged strdup; available in every build.
+ */
+char *asm_strdup(const char *src, MemTag tag) {
+    size_t len = strlen(src) + 1;
+    char *copy = (char *)ASM_MALLOC(len, tag);
+    (void)tag;
+    if (copy != NULL) {
+        memcpy(copy, src, len);
+    }
+    return copy;
+}
+
+#ifdef ASM_MEM_TRACKING
+
+#include <pthread.h>
+#include "stats.h"
+
+/* Header in front of every tracked block; a union keeps the payload aligned */
+typedef union {
+    struct {
+        size_t size;
+        int tag;
+    } info;
+    long double align_ld;
+    void *align_ptr;
+} BlockHeader;
+
+/* Counters for one (phase, tag) cell */
+typedef struct {
+    unsigned long allocs;
+    unsigned long frees;
+    unsigned long bytes_allocated;
+    size_t peak_live;
+} MemCell;
+
+/* Row PHASE_COUNT collects allocations made outside any phase */
+#define PHASE_ROWS (PHASE_COUNT + 1)
+
+static const char *tag_names[MEM_TAG_COUNT] = {
+    "macro", "symbol", "data", "code", "line", "text", "diag", "result", "other"
+};
+
+static pthread_mutex_t mem_lock = PTHREAD_MUTEX_INITIALIZER;
+static MemCell cells[PHASE_ROWS][MEM_TAG_COUNT];
+static size_t live[MEM_TAG_COUNT];
+static size_t peak_live[MEM_TAG_COUNT];
+static size_t live_total;
+static size_t peak_total;
+static int current_phase = PHASE_COUNT;
+
+void mem_set_phase(int phase) {
+    pthread_mutex_lock(&mem_lock);
+    current_phase = (phase >= 0 && phase < PHASE_COUNT) ? phase : PHASE_COUNT;
+    pthread_mutex_unlock(&mem_lock);
+}
+
+static void account_alloc(size_t size, int tag) {
+    MemCell *cell;
+
+    pthread_mutex_lock(&mem_lock);
+    cell = &cells[current_phase][tag];
+    cell->allocs++;
+    cell->bytes_allocated += size;
+    live[tag] += size;
+    live_total += size;
+    if (live[tag] > cell->peak_live) cell->peak_live = live[tag];
+    if (live[tag] > peak_live[tag]) peak_live[tag] = live[tag];
+    if (live_total > peak_total) peak_total = live_total;
+    pthread_mutex_unlock(&mem_lock);
+}
+
+static void account_free(size_t size, int tag) {
+    pthread_mutex_lock(&mem_lock);
+    cells[current_phase][tag].frees++;
+    live[tag] -= size;
+    live_total -= size;
+    pthread_mutex_unlock(&mem_lock);
+}
+
+void *asm_malloc(size_t size, MemTag tag) {
+    BlockHeader *block = (BlockHeader *)malloc(sizeof(BlockHeader) + size);
+    if (!block) return NULL;
+    block->info.size = size;
+    block->info.tag = (int)tag;
+    account_alloc(size, (int)tag);
+    return block + 1;
+}
+
+void *asm_calloc(size_t count, size_t size, MemTag tag) {
+    void *ptr;
+    if (size != 0 && count > ((size_t)-1 - sizeof(BlockHeader)) / size) return NULL;
+    ptr = asm_malloc(count * size, tag);
+    if (ptr) memset(ptr, 0, count * size);
+    return ptr;
+}
+
+void *asm_realloc(void *ptr, size_t size, MemTag tag) {
+    BlockHeader *block;
+    size_t old_size;
+    int old_tag;
+
+    if (!ptr) return asm_malloc(size, tag);
+
+    block = (BlockHeader *)ptr - 1;
+    old_size = block->info.size;
+    old_tag = block->info.tag;
+
+    block = (BlockHeader *)realloc(block, sizeof(BlockHeader) + size);
+    if (!block) return NULL;
+
+    account_free(old_size, old_tag);
+    block->info.size = size;
+    block->info.tag = (int)tag;
+    account_alloc(size, (int)tag);
+    return block + 1;
+}
+
+void asm_free(void *ptr) {
+    BlockHeader *block;
+
+    if (!ptr) return;
+    block = (BlockHeader *)ptr - 1;
+    account_free(block->info.size, block->info.tag);
+    free(block);
+}
+
+/*
+ * mem_report:
+ * Prints allocation counts and peaks per phase and subsystem, the bytes
+ * still live (not freed) and the process peak RSS.
+ */
+void mem_report(FILE *out) {
+    int p, t;
+
+    pthread_mutex_lock(&mem_lock);
+
+    fprintf(out, "%-14s %-8s %10s %10s %14s %14s\n", "phase", "tag", "allocs", "frees", "bytes_alloc", "peak_live");
+    for (p = 0; p < PHASE_ROWS; p++) {
+        for (t = 0; t < MEM_TAG_COUNT; t++) {
+            const MemCell *cell = &cells[p][t];
+            if (cell->allocs == 0 && cell->frees == 0) continue;
+            fprintf(out, "%-14s %-8s %10lu %10lu %14lu %14lu\n",
+                    p < PHASE_COUNT ? stats_phase_name((AsmPhase)p) : "(none)", tag_names[t],
+                    cell->allocs, cell->frees, cell->bytes_allocated, (unsigned long)cell->peak_live);
+        }
+    }
+
+    fprintf(out, "\n%-8s %14s %14s\n", "tag", "peak_live", "live_at_exit");
+    for (t = 0; t < MEM_TAG_COUNT; t++) {
+        fprintf(out, "%-8s %14lu %14lu\n", tag_names[t], (unsigned long)peak_live[t], (unsigned long)live[t]);
+    }
+    fprintf(out, "%-8s %14lu %14lu\n", "total", (unsigned long)peak_total, (unsigned long)live_total);
+    fprintf(out, "process peak RSS: %ld KiB\n", stats_peak_rss_kb());
+
+    pthread_mutex_unlock(&mem_lock);
+}
+
+#endif
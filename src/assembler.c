@@ -2,247 +2,830 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <limits.h>
 #include "assembler.h"
+#include "asm_context.h"
 #include "parser.h"
 #include "logger.h"
 #include "utils.h"
 #include "code_generator.h"
+#include "directive_handler.h"
+#include "asm_alloc.h"
+#include "expr.h"
+
+/*
+ * asm_context_init:
+ * Prepares an empty assembly context. The names are borrowed, not copied.
+ */
+void asm_context_init(AsmContext *ctx, const char *source_name, const char *expanded_name) {
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->source_name = source_name;
+    ctx->expanded_name = expanded_name;
+    ctx->IC = START_ADDRESS;
+    ctx->memory_size = MEMORY_SIZE;
+}
 
-/* Pointer to the head of the symbol table linked list */
-extern Symbol *symbol_table;
-extern MemoryWord *machine_code;
-extern int machine_code_size;
-extern int machine_code_capacity;
+/*
+ * asm_context_reset:
+ * Empties a context for the next assembly while keeping its allocations.
+ */
+void asm_context_reset(AsmContext *ctx, const char *source_name, const char *expanded_name) {
+    ctx->source_name = source_name;
+    ctx->expanded_name = expanded_name;
+    reset_symbol_table(&ctx->symbols);
+    ctx->code.size = 0;
+    data_image_reset(&ctx->data);
+    data_pool_reset(&ctx->pool);
+    data_strip_reset(&ctx->strip);
+    peephole_reset(&ctx->peep);
+    ctx->fixups.count = 0;
+    ctx->fixups.text_length = 0;
+    ctx->IC = START_ADDRESS;
+    ctx->DC = 0;
+    ctx->code_length = 0;
+    ctx->diagnostics.count = 0;
+    ctx->diagnostics.error_count = 0;
+    ctx->diagnostics.suppressed = 0;
+    ctx->diagnostics.flushed = 0;
+    memset(&ctx->counters, 0, sizeof(ctx->counters));
+    source_map_reset(&ctx->map);
+}
 
-int IC = 100;
-int DC = 0;
+void asm_context_free(AsmContext *ctx) {
+    free_symbol_table(&ctx->symbols);
+    free_machine_code(&ctx->code);
+    data_image_free(&ctx->data);
+    data_pool_free(&ctx->pool);
+    data_strip_free(&ctx->strip);
+    peephole_free(&ctx->peep);
+    ASM_FREE(ctx->fixups.items);
+    ASM_FREE(ctx->fixups.text);
+    diag_free(&ctx->diagnostics);
+    source_map_free(&ctx->map);
+}
 
-int *data_values = NULL;
-int data_count = 0;
-int data_capacity = 0;
+void asm_context_counters(const AsmContext *ctx, AsmCounters *out) {
+    *out = ctx->counters;
+    out->symbols = ctx->symbols.count;
+    out->symbol_lookups = ctx->symbols.lookups;
+    out->symbol_probes = ctx->symbols.probes;
+    out->words_emitted = (unsigned long)ctx->code.size + (unsigned long)ctx->data.size;
+    out->pooled_words = ctx->pool.pooled_words;
+    out->pool_words_saved = ctx->pool.saved_words;
+    out->data_words_stripped = ctx->strip.removed_words;
+    out->peephole_words_saved = ctx->peep.words_saved;
+    out->peephole_cycles_saved = ctx->peep.cycles_saved;
+}
 
 void add_command(const ParsedLine *pline, int *IC) {
-    int words = 1;
+    int words = 1 + pline->operand_count;
 
-    if (pline->operand_count >= 1) {
-        OperandType type = pline->operands[0].type;
-        if (type != OPERAND_REGISTER_DIRECT) {
-            words++;
-        }
+    /* Two register operands share a single extra word */
+    if (pline->operand_count == 2
+        && pline->operands[0].type == OPERAND_REGISTER_DIRECT
+        && pline->operands[1].type == OPERAND_REGISTER_DIRECT) {
+        words--;
     }
 
-    if (pline->operand_count == 2) {
-        OperandType type = pline->operands[1].type;
-        if (type != OPERAND_REGISTER_DIRECT) {
-            words++;
+    *IC += words;
+}
+
+/*
+ * parse_data_list:
+ * Parses the comma separated integers of a .data line straight into data
+ * words: one pass over the span, no copies and no strtol(). A number must be
+ * followed by a comma or the end of the line. The words are left in the
+ * reserved tail of the data image; returns their count, 0 on errors.
+ */
+static int parse_data_list(AsmContext *ctx, const char *p, unsigned short **words) {
+    const char *c;
+    const char *digits;
+    unsigned short *out;
+    unsigned long magnitude;
+    int bound = 1;
+    int n = 0;
+    int negative;
+
+    for (c = p; *c != '\0'; c++) {
+        if (*c == ',') bound++;
+    }
+    out = data_image_reserve(&ctx->data, bound);
+    if (!out) return 0;
+    *words = out;
+
+    for (;;) {
+        while (*p == ',' || isspace((unsigned char)*p)) p++;
+        if (*p == '\0') break;
+
+        negative = 0;
+        if (*p == '+' || *p == '-') negative = (*p++ == '-');
+        digits = p;
+        magnitude = 0;
+        while (*p >= '0' && *p <= '9') {
+            magnitude = magnitude * 10 + (unsigned long)(*p++ - '0');
         }
+        if (p == digits) return 0;
+
+        while (isspace((unsigned char)*p)) p++;
+        if (*p != ',' && *p != '\0') return 0;
+
+        out[n++] = (unsigned short)((negative ? 0 - magnitude : magnitude) & 0x3FFF);
     }
 
-    *IC += words;
+    return n;
 }
 
-int add_data_value(int value) {
-    int *temp;
-    if (data_count >= data_capacity) {
-        int new_capacity = (data_capacity == 0) ? 64 : data_capacity * 2;
-        temp = realloc(data_values, new_capacity * sizeof(int));
-        if (!temp) return 0;
-        data_values = temp;
-        data_capacity = new_capacity;
+/*
+ * widen_chars:
+ * Character to data word conversion of .string. A plain counted loop with
+ * no calls or early exits, which the compiler turns into vector widening
+ * and masking when optimizing.
+ */
+static void widen_chars(unsigned short *out, const char *text, int count) {
+    int i;
+    for (i = 0; i < count; i++) {
+        out[i] = (unsigned short)(text[i] & 0x3FFF);
     }
+}
 
-    data_values[data_count++] = value;
-    return 1;
+/* Copies a quoted .string operand and its terminating zero word */
+static int copy_string(AsmContext *ctx, const char *p, unsigned short **words) {
+    const char *open, *close, *last;
+    unsigned short *out;
+    int count;
+
+    while (isspace((unsigned char)*p)) p++;
+    open = p;
+    last = p + strlen(p);
+    while (last > open && isspace((unsigned char)last[-1])) last--;
+    if (*open != '"' || last - open < 2 || last[-1] != '"') return 0;
+
+    close = strchr(open + 1, '"');
+    count = (int)(close - (open + 1));
+
+    out = data_image_reserve(&ctx->data, count + 1);
+    if (!out) return 0;
+    widen_chars(out, open + 1, count);
+    out[count] = 0;
+    *words = out;
+    return count + 1;
 }
 
-bool add_data(const ParsedLine *parsed, int *DC) {
-    char *copy = NULL, *token = NULL, *args = NULL, *trimmed = NULL;
-    int value, i;
-    char *endptr;
+/* Parses an integer operand; returns the position after it, or NULL */
+static const char *parse_count(const char *p, long *value) {
+    const char *digits;
+    int negative = 0;
+
+    while (isspace((unsigned char)*p)) p++;
+    if (*p == '+' || *p == '-') negative = (*p++ == '-');
+    digits = p;
+    *value = 0;
+    while (*p >= '0' && *p <= '9' && *value <= INT_MAX) {
+        *value = *value * 10 + (*p++ - '0');
+    }
+    if (p == digits || (*p >= '0' && *p <= '9')) return NULL;
+    if (negative) *value = -*value;
+    while (isspace((unsigned char)*p)) p++;
+    return p;
+}
 
-    copy = strdup_c90(parsed->original_line);
-    if (!copy) return 0;
+/*
+ * add_fill:
+ * ".fill count, value" and ".space count" (value 0): one run-length
+ * segment, expanded when the image is written. The count may not take
+ * the code and data so far past the end of memory.
+ */
+static bool add_fill(AsmContext *ctx, const ParsedLine *parsed, const char *p, bool has_value, int *DC) {
+    long count, value = 0;
+
+    p = parse_count(p, &count);
+    if (p && has_value) {
+        p = (*p == ',') ? parse_count(p + 1, &value) : NULL;
+    }
+    if (!p || *p != '\0' || count < 0) {
+        diag_report(&ctx->diagnostics, LOG_ERR, ctx->expanded_name, parsed->line_number, 0,
+                    has_value ? "Invalid .fill syntax; expected '.fill count, value'." : "Invalid .space syntax; expected '.space count'.");
+        return false;
+    }
+    if (count > ctx->memory_size - ctx->IC - *DC) {
+        diag_report(&ctx->diagnostics, LOG_ERR, ctx->expanded_name, parsed->line_number, 0,
+                    ".%s count %ld does not fit in memory; %d words are left.", has_value ? "fill" : "space", count,
+                    ctx->IC + *DC < ctx->memory_size ? ctx->memory_size - ctx->IC - *DC : 0);
+        return false;
+    }
 
-    token = strtok(copy, " \t");  /* label or directive */
-    if (!token) goto fail;
+    if (!data_image_fill(&ctx->data, (int)count, (unsigned short)((unsigned long)value & 0x3FFF))) {
+        diag_report(&ctx->diagnostics, LOG_ERR, ctx->expanded_name, parsed->line_number, 0, "Memory allocation failed while adding data.");
+        return false;
+    }
+    *DC += (int)count;
+    return true;
+}
 
-    if (strchr(token, ':')) {
-        token = strtok(NULL, " \t");
-        if (!token) goto fail;
+/*
+ * add_incbin:
+ * '.incbin "file"': the file is mapped and its bytes become data words
+ * without being parsed. A relative name is looked up next to the source,
+ * and the file may not take the code and data so far past the end of memory.
+ */
+static bool add_incbin(AsmContext *ctx, const ParsedLine *parsed, const char *p, int *DC) {
+    char path[MAX_FILENAME_LEN];
+    const char *open, *close, *slash;
+    size_t dir_length = 0;
+    int count, status;
+
+    while (isspace((unsigned char)*p)) p++;
+    open = p;
+    close = (*open == '"') ? strchr(open + 1, '"') : NULL;
+    if (close) {
+        p = close + 1;
+        while (isspace((unsigned char)*p)) p++;
+    }
+    if (!close || close == open + 1 || *p != '\0') {
+        diag_report(&ctx->diagnostics, LOG_ERR, ctx->expanded_name, parsed->line_number, 0, "Invalid .incbin syntax; expected '.incbin \"file\"'.");
+        return false;
     }
 
-    if (strcmp(token, ".data") == 0) {
-        args = strtok(NULL, "\n");
-        if (!args) goto fail;
+    slash = ctx->source_name ? strrchr(ctx->source_name, '/') : NULL;
+    if (open[1] != '/' && slash) dir_length = (size_t)(slash - ctx->source_name) + 1;
+    if (dir_length + (size_t)(close - open - 1) >= sizeof(path)) {
+        diag_report(&ctx->diagnostics, LOG_ERR, ctx->expanded_name, parsed->line_number, 0, ".incbin file name is too long.");
+        return false;
+    }
+    memcpy(path, ctx->source_name, dir_length);
+    memcpy(path + dir_length, open + 1, (size_t)(close - open - 1));
+    path[dir_length + (size_t)(close - open - 1)] = '\0';
 
-        token = strtok(args, ",");
-        while (token) {
-            trimmed = trim_whitespace(token);
-            value = (int)strtol(trimmed, &endptr, 10);
-            if (trimmed == endptr) goto fail;
+    status = data_image_include(&ctx->data, path, ctx->IC + *DC < ctx->memory_size ? ctx->memory_size - ctx->IC - *DC : 0, &count);
+    if (status == DATA_INCLUDE_OPEN) {
+        diag_report(&ctx->diagnostics, LOG_ERR, ctx->expanded_name, parsed->line_number, 0, "Cannot read .incbin file '%s'.", path);
+        return false;
+    }
+    if (status == DATA_INCLUDE_TOO_LARGE) {
+        diag_report(&ctx->diagnostics, LOG_ERR, ctx->expanded_name, parsed->line_number, 0, ".incbin file '%s' does not fit in memory.", path);
+        return false;
+    }
+    if (status != DATA_INCLUDE_OK) {
+        diag_report(&ctx->diagnostics, LOG_ERR, ctx->expanded_name, parsed->line_number, 0, "Memory allocation failed while adding data.");
+        return false;
+    }
+    *DC += count;
+    return true;
+}
 
-            if (!add_data_value(value)) goto fail;
-            (*DC)++;
-            token = strtok(NULL, ",");
-        }
+/*
+ * pool_literal:
+ * Interns the words of a pooled line instead of appending them; its label
+ * gets the address of the shared copy when the pool is laid out.
+ */
+static bool pool_literal(AsmContext *ctx, const ParsedLine *parsed, const unsigned short *words, int count) {
+    int entry = data_pool_add(&ctx->pool, words, count);
 
-        free(copy);
-        return 1;
+    if (entry < 0 || (parsed->label[0] != '\0' && !data_pool_add_label(&ctx->pool, parsed->label, entry))) {
+        diag_report(&ctx->diagnostics, LOG_ERR, ctx->expanded_name, parsed->line_number, 0, "Memory allocation failed while adding data.");
+        return false;
     }
+    return true;
+}
 
-    if (strcmp(token, ".string") == 0) {
-        args = strtok(NULL, "\n");
-        if (!args) goto fail;
+/*
+ * add_data:
+ * Appends the words of a data directive line (.data, .string, .fill,
+ * .space, .incbin) to the data image, or to the pool when pooling is on.
+ * Problems are reported here.
+ */
+bool add_data(AsmContext *ctx, const ParsedLine *parsed, int *DC) {
+    const char *p = parsed->original_line;
+    const char *word;
+    char name[16];
+    size_t length;
+    unsigned short *words = NULL;
+    int count = 0;
+    int pooled = 0;
+    DirectiveType type;
+
+    /* Skip the label, then find the directive */
+    while (isspace((unsigned char)*p)) p++;
+    word = p;
+    while (*p != '\0' && !isspace((unsigned char)*p)) p++;
+    if (memchr(word, ':', (size_t)(p - word))) {
+        while (isspace((unsigned char)*p)) p++;
+        word = p;
+        while (*p != '\0' && !isspace((unsigned char)*p)) p++;
+    }
+    length = (size_t)(p - word);
 
-        trimmed = trim_whitespace(args);
-        i = (int)strlen(trimmed);
-        if (i < 2 || trimmed[0] != '"' || trimmed[i - 1] != '"') goto fail;
+    name[0] = '\0';
+    if (length > 1 && length < sizeof(name) && word[0] == '.') {
+        memcpy(name, word + 1, length - 1);
+        name[length - 1] = '\0';
+    }
 
-        for (i = 1; trimmed[i] != '"' && trimmed[i] != '\0'; i++) {
-            if (!add_data_value((int)trimmed[i])) goto fail;
-            (*DC)++;
-        }
+    type = get_directive_type(name);
+    if (ctx->strip.enabled && parsed->label[0] != '\0'
+        && !(type == DIRECTIVE_DATA && (ctx->pool.mode & POOL_DATA))
+        && !(type == DIRECTIVE_STRING && (ctx->pool.mode & POOL_STRINGS))
+        && !data_strip_add_block(&ctx->strip, parsed->label, *DC)) {
+        diag_report(&ctx->diagnostics, LOG_ERR, ctx->expanded_name, parsed->line_number, 0, "Memory allocation failed while adding data.");
+        return false;
+    }
 
-        if (!add_data_value(0)) goto fail;
-        (*DC)++;
-        free(copy);
-        return 1;
+    switch (type) {
+        case DIRECTIVE_DATA:
+            count = parse_data_list(ctx, p, &words);
+            pooled = ctx->pool.mode & POOL_DATA;
+            break;
+        case DIRECTIVE_STRING:
+            count = copy_string(ctx, p, &words);
+            pooled = ctx->pool.mode & POOL_STRINGS;
+            break;
+        case DIRECTIVE_FILL:
+            return add_fill(ctx, parsed, p, true, DC);
+        case DIRECTIVE_SPACE:
+            return add_fill(ctx, parsed, p, false, DC);
+        case DIRECTIVE_INCBIN:
+            return add_incbin(ctx, parsed, p, DC);
+        default:
+            diag_report(&ctx->diagnostics, LOG_ERR, ctx->expanded_name, parsed->line_number, 0, "Unknown directive.");
+            return false;
     }
 
-fail:
-    if (copy) free(copy);
-    return 0;
+    if (count == 0) {
+        diag_report(&ctx->diagnostics, LOG_ERR, ctx->expanded_name, parsed->line_number, 0, "Invalid .data or .string syntax.");
+        return false;
+    }
+    if (pooled) {
+        return pool_literal(ctx, parsed, words, count);
+    }
+    if (!data_image_commit(&ctx->data, count)) {
+        diag_report(&ctx->diagnostics, LOG_ERR, ctx->expanded_name, parsed->line_number, 0, "Memory allocation failed while adding data.");
+        return false;
+    }
+    *DC += count;
+    return true;
 }
 
+/*
+ * note_references:
+ * Records the symbols named by the operands of an instruction, for --strip-data.
+ */
+static bool note_references(AsmContext *ctx, const ParsedLine *parsed) {
+    int i;
 
+    for (i = 0; i < parsed->operand_count; i++) {
+        char name[LABEL_LENGTH + 1];
 
-bool first_pass(const char *filename) {
-    FILE *file = fopen(filename, "r");
-    char line[LINE_LENGTH + 2];
-    int line_number = 0;
-    bool has_error = false;
-    IC = 100;
-    DC = 0;
+        if (operand_label(&parsed->operands[i], name) && !data_strip_add_root(&ctx->strip, name)) return false;
+    }
+    return true;
+}
 
-    if (!file) {
-        fprintf(stderr, "Error: Cannot open file %s\n", filename);
+/*
+ * strip_data:
+ * Drops the unreferenced data blocks and moves the data symbols to their
+ * new offsets. Runs before the pool is laid out, so pooled literals are
+ * placed after the compacted data.
+ */
+static bool strip_data(AsmContext *ctx) {
+    Symbol *sym;
+
+    if (data_strip_run(&ctx->strip, &ctx->data) < 0) {
+        diag_report(&ctx->diagnostics, LOG_ERR, ctx->expanded_name, 0, 0, "Memory allocation failed while removing unreferenced data.");
         return false;
     }
+    for (sym = ctx->symbols.head; sym != NULL; sym = sym->next) {
+        if (sym->type == SYMBOL_DATA) {
+            sym->address = data_strip_relocate(&ctx->strip, sym->address);
+        }
+    }
+    ctx->DC = ctx->data.size;
+    return true;
+}
 
-    while (fgets(line, sizeof(line), file)) {
-        ParsedLine parsed;
-        line_number++;
+/*
+ * optimize_code:
+ * Runs the peephole optimizer over the sized instructions and moves the
+ * code labels; the data that follows the code starts at the new IC.
+ */
+static void optimize_code(AsmContext *ctx) {
+    Symbol *sym;
+    int i, j;
+
+    /* Fold constant immediates so the rewrites see their values; errors are left to the second pass */
+    for (i = 0; i < ctx->peep.count; i++) {
+        PeepInsn *insn = &ctx->peep.insns[i];
+
+        for (j = 0; j < insn->operand_count; j++) {
+            Operand *op = &insn->operands[j];
+            long value;
+
+            if (op->type == OPERAND_IMMEDIATE && expr_eval(op->value + 1, &ctx->symbols, &value) == EXPR_OK
+                && value >= -8192 && value <= 8191) {
+                sprintf(op->value, "#%ld", value);
+            }
+        }
+    }
 
-        if (!parse_line(line, line_number, &parsed)) {
-            asm_err(filename, line_number, 0, "%s", parsed.err_msg[0] ? parsed.err_msg : "Syntax error or invalid line.");
-            has_error = true;
-            continue;
+    ctx->IC = peephole_run(&ctx->peep, &ctx->symbols);
+    for (sym = ctx->symbols.head; sym != NULL; sym = sym->next) {
+        if (sym->type == SYMBOL_CODE) {
+            sym->address = peephole_relocate(&ctx->peep, sym->address);
         }
+    }
+}
 
-        switch (parsed.type) {
-            case LINE_EMPTY:
-            case LINE_COMMENT:
-                break;
+/*
+ * define_constant:
+ * Handles .define NAME expression. The expression is folded now, so it may
+ * only use constants defined above it.
+ */
+static bool define_constant(AsmContext *ctx, const ParsedLine *parsed) {
+    long value;
+    int error;
+
+    if (find_symbol(&ctx->symbols, parsed->label)) {
+        diag_report(&ctx->diagnostics, LOG_ERR, ctx->expanded_name, parsed->line_number, 0, "Duplicate symbol '%s' declaration.", parsed->label);
+        return false;
+    }
 
-            case LINE_LABEL_ONLY:
-                asm_err(filename, line_number, 0, "Label declared without a directive or instruction.");
-                has_error = true;
-                break;
+    error = expr_eval(parsed->operands[0].value, &ctx->symbols, &value);
+    switch (error) {
+        case EXPR_OK:
+            add_symbol(&ctx->symbols, parsed->label, (int)value, SYMBOL_CONSTANT);
+            return true;
+        case EXPR_UNDEFINED:
+            diag_report(&ctx->diagnostics, LOG_ERR, ctx->expanded_name, parsed->line_number, 0, "Undefined constant in .define %s: '%s'", parsed->label, parsed->operands[0].value);
+            break;
+        case EXPR_NOT_CONSTANT:
+            diag_report(&ctx->diagnostics, LOG_ERR, ctx->expanded_name, parsed->line_number, 0, "Labels are not constants: .define %s %s", parsed->label, parsed->operands[0].value);
+            break;
+        case EXPR_DIVIDE_BY_ZERO:
+            diag_report(&ctx->diagnostics, LOG_ERR, ctx->expanded_name, parsed->line_number, 0, "Division by zero in .define %s.", parsed->label);
+            break;
+        case EXPR_OVERFLOW:
+            diag_report(&ctx->diagnostics, LOG_ERR, ctx->expanded_name, parsed->line_number, 0, "Value of .define %s is out of range.", parsed->label);
+            break;
+        default:
+            diag_report(&ctx->diagnostics, LOG_ERR, ctx->expanded_name, parsed->line_number, 0, "Invalid expression in .define %s: '%s'", parsed->label, parsed->operands[0].value);
+            break;
+    }
+    return false;
+}
 
-            case LINE_DIRECTIVE:
-                if (strstr(line, ".extern")) {
-                    Symbol *existing = find_symbol(parsed.label);
-                    if (existing) {
-                        if (existing->type != SYMBOL_EXTERN) {
-                            asm_err(filename, line_number, 0, "Symbol '%s' already defined; cannot redeclare as extern.", parsed.label);
-                            has_error = true;
-                            break;
-                        }
-                    } else {
-                        add_symbol(parsed.label, 0, SYMBOL_EXTERN);
+/*
+ * layout_pool:
+ * Places the pooled literals after the rest of the data and points their
+ * labels at them.
+ */
+static bool layout_pool(AsmContext *ctx) {
+    int appended, i;
+
+    if (ctx->pool.entry_count == 0) return true;
+
+    appended = data_pool_layout(&ctx->pool, &ctx->data);
+    if (appended < 0) {
+        diag_report(&ctx->diagnostics, LOG_ERR, ctx->expanded_name, 0, 0, "Memory allocation failed while adding data.");
+        return false;
+    }
+    ctx->DC += appended;
+
+    for (i = 0; i < ctx->pool.label_count; i++) {
+        Symbol *sym = find_symbol(&ctx->symbols, ctx->pool.labels[i].name);
+        if (sym && sym->type == SYMBOL_DATA) {
+            sym->address = ctx->pool.entries[ctx->pool.labels[i].entry].offset;
+        }
+    }
+    return true;
+}
+
+
+
+/*
+ * first_pass_line:
+ * Defines the symbols of one parsed line, appends its data and sizes its
+ * instruction. Returns false if the line has an error.
+ */
+bool first_pass_line(AsmContext *ctx, const ParsedLine *parsed, int line_number) {
+    const char *filename = ctx->expanded_name;
+    Symbol *existing;
+    int address;
+
+    switch (parsed->type) {
+        case LINE_EMPTY:
+        case LINE_COMMENT:
+            return true;
+
+        case LINE_LABEL_ONLY:
+            diag_report(&ctx->diagnostics, LOG_ERR, filename, line_number, 0, "Label declared without a directive or instruction.");
+            return false;
+
+        case LINE_DIRECTIVE:
+            if (parsed->directive == DIRECTIVE_DEFINE) {
+                return define_constant(ctx, parsed);
+            }
+
+            if (parsed->directive == DIRECTIVE_EXTERN) {
+                existing = find_symbol(&ctx->symbols, parsed->label);
+                if (existing) {
+                    if (existing->type != SYMBOL_EXTERN) {
+                        diag_report(&ctx->diagnostics, LOG_ERR, filename, line_number, 0, "Symbol '%s' already defined; cannot redeclare as extern.", parsed->label);
+                        return false;
                     }
-                    break;
+                } else {
+                    add_symbol(&ctx->symbols, parsed->label, 0, SYMBOL_EXTERN);
                 }
+                return true;
+            }
 
-                if (strstr(line, ".entry")) {
-                    break;
+            if (parsed->directive == DIRECTIVE_ENTRY) {
+                if (ctx->strip.enabled && !data_strip_add_root(&ctx->strip, parsed->label)) {
+                    diag_report(&ctx->diagnostics, LOG_ERR, filename, line_number, 0, "Memory allocation failed while reading .entry.");
+                    return false;
                 }
+                return true;
+            }
 
-                if (parsed.label[0] != '\0') {
-                    Symbol *existing = find_symbol(parsed.label);
-                    if (existing) {
-                        asm_err(filename, line_number, 0, "Duplicate symbol '%s' declaration.", parsed.label);
-                        has_error = true;
-                        break;
-                    }
-                    add_symbol(parsed.label, DC, SYMBOL_DATA);
+            if (parsed->label[0] != '\0') {
+                existing = find_symbol(&ctx->symbols, parsed->label);
+                if (existing) {
+                    diag_report(&ctx->diagnostics, LOG_ERR, filename, line_number, 0, "Duplicate symbol '%s' declaration.", parsed->label);
+                    return false;
                 }
+                add_symbol(&ctx->symbols, parsed->label, ctx->DC, SYMBOL_DATA);
+            }
 
-                if (strstr(line, ".data") || strstr(line, ".string")) {
-                    if (!add_data(&parsed, &DC)) {
-                        asm_err(filename, line_number, 0, "Invalid .data or .string syntax.");
-                        has_error = true;
-                    }
-                } else {
-                    asm_err(filename, line_number, 0, "Unknown directive.");
-                    has_error = true;
-                }
-                break;
+            return add_data(ctx, parsed, &ctx->DC);
 
-            case LINE_COMMAND:
-                if (parsed.label[0] != '\0') {
-                    Symbol *existing = find_symbol(parsed.label);
-                    if (existing) {
-                        asm_err(filename, line_number, 0, "Duplicate label '%s'.", parsed.label);
-                        has_error = true;
-                        break;
-                    }
-                    add_symbol(parsed.label, IC, SYMBOL_CODE);
+        case LINE_COMMAND:
+            if (parsed->label[0] != '\0') {
+                existing = find_symbol(&ctx->symbols, parsed->label);
+                if (existing) {
+                    diag_report(&ctx->diagnostics, LOG_ERR, filename, line_number, 0, "Duplicate label '%s'.", parsed->label);
+                    return false;
                 }
+                add_symbol(&ctx->symbols, parsed->label, ctx->IC, SYMBOL_CODE);
+            }
 
-                add_command(&parsed, &IC);
-                break;
+            if (ctx->strip.enabled && !note_references(ctx, parsed)) {
+                diag_report(&ctx->diagnostics, LOG_ERR, filename, line_number, 0, "Memory allocation failed while reading operands.");
+                return false;
+            }
 
-            case LINE_INVALID:
-            default:
-                asm_err(filename, line_number, 0, "Unrecognized or malformed line.");
-                has_error = true;
-                break;
-        }
+            address = ctx->IC;
+            add_command(parsed, &ctx->IC);
+            if (ctx->peep.enabled && !peephole_add(&ctx->peep, parsed, address, ctx->IC - address)) {
+                diag_report(&ctx->diagnostics, LOG_ERR, filename, line_number, 0, "Memory allocation failed while keeping instructions.");
+                return false;
+            }
+            return true;
+
+        case LINE_INVALID:
+        default:
+            diag_report(&ctx->diagnostics, LOG_ERR, filename, line_number, 0, "Unrecognized or malformed line.");
+            return false;
     }
+}
 
-    fclose(file);
+/*
+ * finish_first_pass:
+ * Runs the opt-in rewrites once every symbol is known, checks that the
+ * code and data fit in memory, then places the data after the code.
+ */
+bool finish_first_pass(AsmContext *ctx, bool has_error) {
+    Symbol *sym;
+
+    if (ctx->peep.enabled && !has_error) optimize_code(ctx);
+    if (ctx->strip.enabled && !has_error && !strip_data(ctx)) has_error = true;
+    if (!layout_pool(ctx)) has_error = true;
+    if (ctx->IC + ctx->DC > ctx->memory_size) {
+        diag_report(&ctx->diagnostics, LOG_ERR, ctx->expanded_name, 0, 0,
+                    "The program takes %d words from address %d; only %d fit in memory.",
+                    ctx->IC - START_ADDRESS + ctx->DC, START_ADDRESS, ctx->memory_size - START_ADDRESS);
+        has_error = true;
+    }
 
-    {
-        Symbol *sym;
-        for (sym = symbol_table; sym != NULL; sym = sym->next) {
-            if (sym->type == SYMBOL_DATA) {
-                sym->address += IC;
-            }
+    for (sym = ctx->symbols.head; sym != NULL; sym = sym->next) {
+        if (sym->type == SYMBOL_DATA) {
+            sym->address += ctx->IC;
         }
     }
 
     return !has_error;
 }
 
-
-bool second_pass(const char *filename) {
-    FILE *file = fopen(filename, "r");
+bool first_pass(AsmContext *ctx, const char *source, size_t length) {
+    const char *filename = ctx->expanded_name;
+    const char *pos = source;
+    const char *end = source + length;
     char line[LINE_LENGTH + 2];
     int line_number = 0;
-    int IC = 100;
-    int original_IC = 100;
     bool has_error = false;
+    ctx->IC = 100;
+    ctx->DC = 0;
 
-    if (!file) {
-        fprintf(stderr, "Error: Cannot open file %s\n", filename);
+    while (read_buffer_line(&pos, end, line, sizeof(line))) {
+        ParsedLine parsed;
+
+        if (diag_limit_reached(&ctx->diagnostics)) break;
+
+        line_number++;
+        ctx->counters.expanded_lines++;
+
+        if (!parse_line(line, line_number, &parsed)) {
+            diag_report(&ctx->diagnostics, LOG_ERR, filename, line_number, 0, "%s", parsed.err_msg[0] ? parsed.err_msg : "Syntax error or invalid line.");
+            has_error = true;
+            continue;
+        }
+
+        if (!first_pass_line(ctx, &parsed, line_number)) has_error = true;
+    }
+
+    return finish_first_pass(ctx, has_error);
+}
+
+
+/*
+ * report_operand_error:
+ * Reports an encode_operand_word() error for the operand.
+ */
+static void report_operand_error(AsmContext *ctx, int line_number, const Operand *op, int error) {
+    const char *filename = ctx->expanded_name;
+
+    switch (error) {
+        case ENCODE_UNDEFINED:
+            diag_report(&ctx->diagnostics, LOG_ERR, filename, line_number, 0, "Undefined symbol '%s'", op->value);
+            break;
+        case ENCODE_RANGE:
+            diag_report(&ctx->diagnostics, LOG_ERR, filename, line_number, 0, "Operand '%s' is out of range", op->value);
+            break;
+        case ENCODE_NOT_CONSTANT:
+            diag_report(&ctx->diagnostics, LOG_ERR, filename, line_number, 0, "Immediate '%s' uses a label; only .define constants can be folded", op->value);
+            break;
+        case ENCODE_NOT_ADDRESS:
+            diag_report(&ctx->diagnostics, LOG_ERR, filename, line_number, 0, "Operand '%s' uses a constant as an address; constants need '#'", op->value);
+            break;
+        case ENCODE_EXTERN_OFFSET:
+            diag_report(&ctx->diagnostics, LOG_ERR, filename, line_number, 0, "Operand '%s' adds an offset to an external symbol", op->value);
+            break;
+        case ENCODE_DIVIDE_BY_ZERO:
+            diag_report(&ctx->diagnostics, LOG_ERR, filename, line_number, 0, "Division by zero in operand '%s'", op->value);
+            break;
+        default:
+            diag_report(&ctx->diagnostics, LOG_ERR, filename, line_number, 0, "Invalid expression in operand '%s'", op->value);
+            break;
+    }
+}
+
+/*
+ * mark_entry_line:
+ * Handles an .entry line once every symbol is defined.
+ */
+bool mark_entry_line(AsmContext *ctx, const char *name, int line_number) {
+    Symbol *sym = find_symbol(&ctx->symbols, name);
+
+    if (sym && sym->type == SYMBOL_CONSTANT) {
+        diag_report(&ctx->diagnostics, LOG_ERR, ctx->expanded_name, line_number, 0, "Constant '%s' cannot be an entry.", name);
         return false;
     }
+    if (!sym) {
+        diag_report(&ctx->diagnostics, LOG_ERR, ctx->expanded_name, line_number, 0, "Unknown symbol in .entry: '%s'", name);
+        return false;
+    }
+    sym->type = SYMBOL_ENTRY;
+    return true;
+}
+
+static bool add_fixup(AsmContext *ctx, int address, int line_number, const char *text) {
+    FixupList *list = &ctx->fixups;
+    size_t length = strlen(text) + 1;
+    Fixup *fixup;
+
+    if (list->count >= list->capacity) {
+        int new_capacity = (list->capacity == 0) ? 64 : list->capacity * 2;
+        Fixup *temp = ASM_REALLOC(list->items, new_capacity * sizeof(Fixup), MEM_CODE);
+        if (!temp) return false;
+        list->items = temp;
+        list->capacity = new_capacity;
+    }
+    if (list->text_length + length > list->text_capacity) {
+        size_t new_capacity = (list->text_capacity == 0) ? 1024 : list->text_capacity;
+        char *temp;
+
+        while (new_capacity < list->text_length + length) new_capacity *= 2;
+        temp = ASM_REALLOC(list->text, new_capacity, MEM_CODE);
+        if (!temp) return false;
+        list->text = temp;
+        list->text_capacity = new_capacity;
+    }
+    fixup = &list->items[list->count++];
+    fixup->address = address;
+    fixup->line_number = line_number;
+    fixup->text = list->text_length;
+    memcpy(list->text + list->text_length, text, length);
+    list->text_length += length;
+    return true;
+}
+
+/*
+ * deferred:
+ * In one-pass mode, true if an operand cannot be encoded yet: its label is
+ * still undefined or is data, whose address waits for the code size.
+ */
+static bool deferred(AsmContext *ctx, const Operand *op) {
+    char name[LABEL_LENGTH + 1];
+    const Symbol *sym;
+
+    if (!ctx->one_pass || !operand_label(op, name)) return false;
+    sym = find_symbol(&ctx->symbols, name);
+    return !sym || sym->type == SYMBOL_DATA;
+}
 
-    while (fgets(line, sizeof(line), file)) {
+/*
+ * encode_words:
+ * Encodes an instruction at IC into words. Returns the number of words, or
+ * -1 if memory ran out. Operand errors are reported and set *has_error; in
+ * one-pass mode, operands that cannot be encoded yet get a zero word and a
+ * fixup.
+ */
+int encode_words(AsmContext *ctx, const ParsedLine *parsed, int IC, int line_number, unsigned short *words, bool *has_error) {
+    const char *filename = ctx->expanded_name;
+    int word_count, w;
+
+    word_count = encode_instruction(parsed, IC, words);
+
+    if (parsed->operand_count == 2
+        && parsed->operands[0].type == OPERAND_REGISTER_DIRECT
+        && parsed->operands[1].type == OPERAND_REGISTER_DIRECT) {
+        encode_registers_word(&parsed->operands[0], &parsed->operands[1], &words[word_count++]);
+    } else {
+        for (w = 0; w < parsed->operand_count; w++) {
+            const Operand *op = &parsed->operands[w];
+            bool is_src = (parsed->operand_count == 2 && w == 0);
+
+            if (op->type == OPERAND_REGISTER_DIRECT) {
+                encode_registers_word(is_src ? op : NULL, is_src ? NULL : op, &words[word_count]);
+            } else {
+                int error = deferred(ctx, op) ? ENCODE_UNDEFINED
+                          : encode_operand_word(op, IC + word_count, &ctx->symbols, &words[word_count]);
+
+                if (error == ENCODE_UNDEFINED && ctx->one_pass) {
+                    if (!add_fixup(ctx, IC + word_count, line_number, op->value)) {
+                        diag_report(&ctx->diagnostics, LOG_ERR, filename, line_number, 0, "Memory allocation failed while writing machine code");
+                        return -1;
+                    }
+                    words[word_count] = 0;
+                } else if (error < 0) {
+                    report_operand_error(ctx, line_number, op, error);
+                    *has_error = true;
+                    break;
+                }
+            }
+            word_count++;
+        }
+    }
+    return word_count;
+}
+
+/*
+ * encode_command:
+ * Encodes an instruction at IC and appends its words. Returns the number
+ * of words, or -1 if memory ran out.
+ */
+static int encode_command(AsmContext *ctx, const ParsedLine *parsed, int IC, int line_number, bool *has_error) {
+    const char *filename = ctx->expanded_name;
+    unsigned short words[MAX_WORDS_PER_LINE];
+    int word_count = encode_words(ctx, parsed, IC, line_number, words, has_error);
+    int j;
+
+    if (word_count < 0) return -1;
+    for (j = 0; j < word_count; j++) {
+        if (!add_machine_word(&ctx->code, IC + j, words[j])) {
+            diag_report(&ctx->diagnostics, LOG_ERR, filename, line_number, 0, "Memory allocation failed while writing machine code");
+            return -1;
+        }
+    }
+    if (!ctx->one_pass && !source_map_add_instruction(&ctx->map, IC, word_count, line_number)) {
+        diag_report(&ctx->diagnostics, LOG_ERR, filename, line_number, 0, "Memory allocation failed while writing machine code");
+        return -1;
+    }
+    return word_count;
+}
+
+bool second_pass(AsmContext *ctx, const char *source, size_t length) {
+    const char *pos = source;
+    const char *end = source + length;
+    char line[LINE_LENGTH + 2];
+    int line_number = 0;
+    int IC = 100;
+    int original_IC = 100;
+    int next_insn = 0;
+    bool has_error = false;
+
+    while (read_buffer_line(&pos, end, line, sizeof(line))) {
         ParsedLine parsed;
-        int word_count, w, j;
-        unsigned short words[MAX_WORDS_PER_LINE];
+        int word_count;
+
+        if (diag_limit_reached(&ctx->diagnostics)) break;
 
         line_number++;
 
@@ -256,39 +839,21 @@ bool second_pass(const char *filename) {
                 break;
 
             case LINE_DIRECTIVE:
-                if (strstr(line, ".entry")) {
-                    Symbol *sym = find_symbol(parsed.label);
-                    if (sym) {
-                        sym->type = SYMBOL_ENTRY;
-                    } else {
-                        asm_err(filename, line_number, 0, "Unknown symbol in .entry: '%s'", parsed.label);
-                        has_error = true;
-                    }
+                if (parsed.directive == DIRECTIVE_ENTRY && !mark_entry_line(ctx, parsed.label, line_number)) {
+                    has_error = true;
                 }
                 break;
 
             case LINE_COMMAND:
-                word_count = encode_instruction(&parsed, IC, words);
-
-                for (w = 0; w < parsed.operand_count; w++) {
-                    if (parsed.operands[w].type != OPERAND_REGISTER_DIRECT) {
-                        if (encode_operand_word(&parsed.operands[w], IC + word_count, &words[word_count]) < 0) {
-                            asm_err(filename, line_number, 0, "Undefined symbol '%s'", parsed.operands[w].value);
-                            has_error = true;
-                            break;
-                        }
-                        word_count++;
-                    }
-                }
-
-                for (j = 0; j < word_count; j++) {
-                    if (!add_machine_word(IC + j, words[j])) {
-                        fprintf(stderr, "Memory allocation failed while writing machine code\n");
-                        fclose(file);
-                        return false;
-                    }
+                /* With the optimizer on, encode the rewritten instruction of this line */
+                if (ctx->peep.enabled && next_insn < ctx->peep.count) {
+                    const PeepInsn *insn = &ctx->peep.insns[next_insn++];
+                    if (insn->deleted) break;
+                    peephole_load(insn, &parsed);
                 }
 
+                word_count = encode_command(ctx, &parsed, IC, line_number, &has_error);
+                if (word_count < 0) return false;
                 IC += word_count;
                 break;
 
@@ -297,62 +862,73 @@ bool second_pass(const char *filename) {
         }
     }
 
-    fclose(file);
 
-    {
-        int data_start = IC;
-        int i;
+    ctx->code_length = IC - original_IC;
 
-        for (i = 0; i < data_count; i++) {
-            if (!add_machine_word(data_start + i, (unsigned short)(data_values[i] & 0x3FFF))) {
-                fprintf(stderr, "Memory allocation failed while writing data words\n");
-                return false;
-            }
-        }
-    }
+    return !has_error;
+}
 
-    {
-        char ob_name[FILENAME_MAX];
-        FILE *ob_file;
-        int i;
-        char *dot_ext;
+/*
+ * one_pass_line:
+ * One-pass mode: defines the symbols of an expanded line and encodes its
+ * instruction right away. Operands that refer forward or to data become
+ * fixups, and .entry lines wait until one_pass_finish().
+ */
+bool one_pass_line(AsmContext *ctx, const char *line, int line_number) {
+    ParsedLine parsed;
+    bool has_error = false;
+    int address = ctx->IC;
 
-        /* Copy filename safely */
-        strncpy(ob_name, filename, sizeof(ob_name) - 1);
-        ob_name[sizeof(ob_name) - 1] = '\0';
+    ctx->counters.expanded_lines++;
 
-        /* Look for ".am" at the end */
-        dot_ext = strstr(ob_name, ".am");
-        if (dot_ext && strlen(dot_ext) == 3) {
-            *dot_ext = '\0';  /* Truncate the ".am" */
-        }
+    if (!parse_line(line, line_number, &parsed)) {
+        diag_report(&ctx->diagnostics, LOG_ERR, ctx->expanded_name, line_number, 0, "%s", parsed.err_msg[0] ? parsed.err_msg : "Syntax error or invalid line.");
+        return false;
+    }
+    if (!first_pass_line(ctx, &parsed, line_number)) return false;
 
-        /* Append ".ob" */
-        strncat(ob_name, ".ob", sizeof(ob_name) - strlen(ob_name) - 1);
-        ob_file = fopen(ob_name, "w");
-        if (!ob_file) {
-            fprintf(stderr, "Error: Cannot write to output file %s\n", ob_name);
+    if (parsed.type == LINE_DIRECTIVE && parsed.directive == DIRECTIVE_ENTRY) {
+        if (!add_fixup(ctx, 0, line_number, parsed.label)) {
+            diag_report(&ctx->diagnostics, LOG_ERR, ctx->expanded_name, line_number, 0, "Memory allocation failed while reading .entry.");
             return false;
         }
+    } else if (parsed.type == LINE_COMMAND) {
+        if (encode_command(ctx, &parsed, address, line_number, &has_error) < 0) return false;
+    }
+    return !has_error;
+}
 
-        fprintf(ob_file, "%d %d\n", IC - original_IC, DC);
-
-        for (i = 0; i < machine_code_size; i++) {
-            fprintf(ob_file, "%06d %06x\n", machine_code[i].address, machine_code[i].value & 0x3FFF);
+/*
+ * one_pass_finish:
+ * Places the data after the code and patches the fixups.
+ */
+bool one_pass_finish(AsmContext *ctx, bool has_error) {
+    int i;
+
+    /* Resolve the fixups even after an error, so that they are reported too */
+    if (!finish_first_pass(ctx, has_error)) has_error = true;
+    ctx->code_length = ctx->IC - START_ADDRESS;
+
+    for (i = 0; i < ctx->fixups.count; i++) {
+        const Fixup *fixup = &ctx->fixups.items[i];
+        const char *text = ctx->fixups.text + fixup->text;
+        Operand op;
+        unsigned short word;
+        int error;
+
+        if (fixup->address == 0) {
+            if (!mark_entry_line(ctx, text, fixup->line_number)) has_error = true;
+            continue;
         }
 
-        fclose(ob_file);
+        op = parse_operand(text);
+        error = encode_operand_word(&op, fixup->address, &ctx->symbols, &word);
+        if (error < 0) {
+            report_operand_error(ctx, fixup->line_number, &op, error);
+            has_error = true;
+        } else {
+            ctx->code.words[fixup->address - START_ADDRESS].value = word;
+        }
     }
-
-    free(machine_code);
-    machine_code = NULL;
-    machine_code_size = 0;
-    machine_code_capacity = 0;
-
-    free(data_values);
-    data_values = NULL;
-    data_count = 0;
-    data_capacity = 0;
-
     return !has_error;
 }
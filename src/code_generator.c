@@ -1,10 +1,8 @@
 
 
 #include "code_generator.h"
-
-MemoryWord *machine_code = NULL;
-int machine_code_size = 0;
-int machine_code_capacity = 0;
+#include "asm_alloc.h"
+#include "expr.h"
 
 unsigned short encode_addressing_mode(OperandType type) {
     if (type == OPERAND_IMMEDIATE) return 0;
@@ -51,14 +49,50 @@ int encode_instruction(const ParsedLine *pline, int ic, unsigned short *out_word
 }
 
 
-int encode_operand_word(const Operand *op, int curr_ic, unsigned short *word_out) {
+/* Maps an expr_eval() error to an ENCODE_* one */
+static int expr_error(int error) {
+    switch (error) {
+        case EXPR_UNDEFINED: return ENCODE_UNDEFINED;
+        case EXPR_NOT_CONSTANT: return ENCODE_NOT_CONSTANT;
+        case EXPR_DIVIDE_BY_ZERO: return ENCODE_DIVIDE_BY_ZERO;
+        case EXPR_OVERFLOW: return ENCODE_RANGE;
+    }
+    return ENCODE_SYNTAX;
+}
+
+/*
+ * resolve_label:
+ * Finds the label of a direct or relative operand and folds its offset
+ * expression; the symbol goes to *sym and label + offset to *address.
+ */
+static int resolve_label(const Operand *op, SymbolTable *symbols, Symbol **sym, long *address) {
+    char name[LABEL_LENGTH + 1];
+    const char *offset = operand_label(op, name);
+    long value = 0;
+    int error;
+
+    *sym = find_symbol(symbols, name);
+    if (!*sym) return ENCODE_UNDEFINED;
+    if ((*sym)->type == SYMBOL_CONSTANT) return ENCODE_NOT_ADDRESS;
+    if (*offset != '\0') {
+        if ((*sym)->type == SYMBOL_EXTERN) return ENCODE_EXTERN_OFFSET;
+        error = expr_eval(offset, symbols, &value);
+        if (error != EXPR_OK) return expr_error(error);
+    }
+    *address = (*sym)->address + value;
+    return 0;
+}
+
+int encode_operand_word(const Operand *op, int curr_ic, SymbolTable *symbols, unsigned short *word_out) {
     unsigned short word = 0;
     Symbol *sym;
     long value;
+    int error;
 
     if (op->type == OPERAND_IMMEDIATE) {
-        value = strtol(op->value + 1, NULL, 10);
-        if (value < -8192 || value > 8191) return -1;  /* 14-bit signed range */
+        error = expr_eval(op->value + 1, symbols, &value);
+        if (error != EXPR_OK) return expr_error(error);
+        if (value < -8192 || value > 8191) return ENCODE_RANGE;  /* 14-bit signed range */
         if (value < 0) value = (1 << 14) + value;
         word = (unsigned short)value;
         word |= (0 << 12);  /* ARE = 00 */
@@ -67,10 +101,10 @@ int encode_operand_word(const Operand *op, int curr_ic, unsigned short *word_out
     }
 
     if (op->type == OPERAND_RELATIVE) {
-        sym = find_symbol(op->value + 1);
-        if (!sym) return -1;
-        value = sym->address - curr_ic;
-        if (value < -8192 || value > 8191) return -1;
+        error = resolve_label(op, symbols, &sym, &value);
+        if (error < 0) return error;
+        value -= curr_ic;
+        if (value < -8192 || value > 8191) return ENCODE_RANGE;
         if (value < 0) value = (1 << 14) + value;
         word = (unsigned short)value;
         word |= (2 << 12);  /* ARE = 10 */
@@ -79,9 +113,11 @@ int encode_operand_word(const Operand *op, int curr_ic, unsigned short *word_out
     }
 
     if (op->type == OPERAND_DIRECT) {
-        sym = find_symbol(op->value);
-        if (!sym) return -1;
-        word = (unsigned short)(sym->address & 0x0FFF);
+        error = resolve_label(op, symbols, &sym, &value);
+        if (error < 0) return error;
+        /* A computed address must fit the 12-bit field; plain labels are masked as before */
+        if (value != sym->address && (value < 0 || value > 0x0FFF)) return ENCODE_RANGE;
+        word = (unsigned short)(value & 0x0FFF);
         word |= (sym->type == SYMBOL_EXTERN) ? (1 << 12) : (2 << 12);
         *word_out = word;
         return 1;
@@ -90,20 +126,53 @@ int encode_operand_word(const Operand *op, int curr_ic, unsigned short *word_out
     return 0;
 }
 
+/*
+ * encode_registers_word:
+ * Encodes the extra word of register operands: source register in bits 8-6,
+ * destination register in bits 5-3, ARE = 00. When both operands are
+ * registers they share one word; either operand may be NULL.
+ */
+int encode_registers_word(const Operand *src, const Operand *dst, unsigned short *word_out) {
+    unsigned short word = 0;
+    unsigned short reg;
 
-int add_machine_word(int address, unsigned short value) {
+    if (src) {
+        reg = encode_register(src->value);
+        if (reg == 0xFFFF) return -1;
+        word |= (reg & 0x7) << 6;
+    }
+
+    if (dst) {
+        reg = encode_register(dst->value);
+        if (reg == 0xFFFF) return -1;
+        word |= (reg & 0x7) << 3;
+    }
+
+    *word_out = word;
+    return 1;
+}
+
+
+int add_machine_word(MachineCode *code, int address, unsigned short value) {
     MemoryWord *temp;
 
-    if (machine_code_size >= machine_code_capacity) {
-        int new_capacity = (machine_code_capacity == 0) ? 64 : machine_code_capacity * 2;
-        temp = realloc(machine_code, new_capacity * sizeof(MemoryWord));
+    if (code->size >= code->capacity) {
+        int new_capacity = (code->capacity == 0) ? 64 : code->capacity * 2;
+        temp = ASM_REALLOC(code->words, new_capacity * sizeof(MemoryWord), MEM_CODE);
         if (!temp) return 0;
-        machine_code = temp;
-        machine_code_capacity = new_capacity;
+        code->words = temp;
+        code->capacity = new_capacity;
     }
 
-    machine_code[machine_code_size].address = address;
-    machine_code[machine_code_size].value = value;
-    machine_code_size++;
+    code->words[code->size].address = address;
+    code->words[code->size].value = value;
+    code->size++;
     return 1;
+}
+
+void free_machine_code(MachineCode *code) {
+    ASM_FREE(code->words);
+    code->words = NULL;
+    code->size = 0;
+    code->capacity = 0;
 }
\ No newline at end of file
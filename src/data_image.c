@@ -0,0 +1,262 @@
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "data_image.h"
+#include "asm_alloc.h"
+
+/* Returns a new segment at the end of the list, or NULL */
+static DataSegment *add_segment(DataImage *image, DataSegmentKind kind, int count) {
+    DataSegment *segment;
+
+    if (image->segment_count >= image->segment_capacity) {
+        int new_capacity = (image->segment_capacity == 0) ? 16 : image->segment_capacity * 2;
+        DataSegment *temp = ASM_REALLOC(image->segments, new_capacity * sizeof(DataSegment), MEM_DATA);
+        if (!temp) return NULL;
+        image->segments = temp;
+        image->segment_capacity = new_capacity;
+    }
+
+    segment = &image->segments[image->segment_count++];
+    memset(segment, 0, sizeof(*segment));
+    segment->kind = kind;
+    segment->count = count;
+    image->size += count;
+    return segment;
+}
+
+unsigned short *data_image_reserve(DataImage *image, int count) {
+    if (image->word_count + count > image->word_capacity) {
+        int new_capacity = (image->word_capacity == 0) ? 64 : image->word_capacity;
+        unsigned short *temp;
+
+        while (new_capacity < image->word_count + count) new_capacity *= 2;
+        temp = ASM_REALLOC(image->words, new_capacity * sizeof(unsigned short), MEM_DATA);
+        if (!temp) return NULL;
+        image->words = temp;
+        image->word_capacity = new_capacity;
+    }
+    return image->words + image->word_count;
+}
+
+/*
+ * data_image_commit:
+ * Adds the reserved words that were filled in; consecutive literal lines
+ * extend the same segment.
+ */
+int data_image_commit(DataImage *image, int count) {
+    DataSegment *last = image->segment_count ? &image->segments[image->segment_count - 1] : NULL;
+
+    if (last && last->kind == DATA_LITERAL && last->first + last->count == image->word_count) {
+        last->count += count;
+        image->size += count;
+    } else {
+        DataSegment *segment = add_segment(image, DATA_LITERAL, count);
+        if (!segment) return 0;
+        segment->first = image->word_count;
+    }
+    image->word_count += count;
+    return 1;
+}
+
+int data_image_fill(DataImage *image, int count, unsigned short value) {
+    DataSegment *segment;
+
+    if (count == 0) return 1;
+    segment = add_segment(image, DATA_FILL, count);
+    if (!segment) return 0;
+    segment->value = (unsigned short)(value & 0x3FFF);
+    return 1;
+}
+
+static int add_mapping(DataImage *image, void *address, size_t length) {
+    if (image->mapping_count >= image->mapping_capacity) {
+        int new_capacity = (image->mapping_capacity == 0) ? 4 : image->mapping_capacity * 2;
+        DataMapping *temp = ASM_REALLOC(image->mappings, new_capacity * sizeof(DataMapping), MEM_DATA);
+        if (!temp) return 0;
+        image->mappings = temp;
+        image->mapping_capacity = new_capacity;
+    }
+    image->mappings[image->mapping_count].address = address;
+    image->mappings[image->mapping_count].length = length;
+    image->mapping_count++;
+    return 1;
+}
+
+/*
+ * data_image_include:
+ * Maps the file read-only; its bytes (0-255) become data words when the
+ * image is written. The mapping lives until the image is reset.
+ */
+int data_image_include(DataImage *image, const char *path, int limit, int *count) {
+    struct stat st;
+    void *address;
+    DataSegment *segment;
+    int fd = open(path, O_RDONLY);
+
+    *count = 0;
+    if (fd < 0) return DATA_INCLUDE_OPEN;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return DATA_INCLUDE_OPEN;
+    }
+    if ((unsigned long)st.st_size > (unsigned long)limit
+        || (unsigned long)st.st_size > (unsigned long)(INT_MAX - image->size)) {
+        close(fd);
+        return DATA_INCLUDE_TOO_LARGE;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        return DATA_INCLUDE_OK;
+    }
+
+    address = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (address == MAP_FAILED) return DATA_INCLUDE_OPEN;
+
+    if (!add_mapping(image, address, (size_t)st.st_size)) {
+        munmap(address, (size_t)st.st_size);
+        return DATA_INCLUDE_NO_MEMORY;
+    }
+    segment = add_segment(image, DATA_BYTES, (int)st.st_size);
+    if (!segment) return DATA_INCLUDE_NO_MEMORY;
+    segment->bytes = (const unsigned char *)address;
+    *count = (int)st.st_size;
+    return DATA_INCLUDE_OK;
+}
+
+/*
+ * data_image_compact:
+ * Rebuilds the segment list from the parts of each segment that fall in a
+ * kept range. Literal words and mappings stay where they are; the new
+ * segments point into them.
+ */
+int data_image_compact(DataImage *image, const DataRange *keep, int count) {
+    int capacity = image->segment_count + count;
+    DataSegment *segments;
+    int new_count = 0, size = 0;
+    int i, r = 0, start = 0;
+
+    if (capacity == 0) return 1;
+    segments = (DataSegment *)ASM_MALLOC(capacity * sizeof(DataSegment), MEM_DATA);
+    if (!segments) return 0;
+
+    for (i = 0; i < image->segment_count; i++) {
+        const DataSegment *segment = &image->segments[i];
+        int end = start + segment->count;
+        int k;
+
+        while (r < count && keep[r].start + keep[r].count <= start) r++;
+
+        for (k = r; k < count && keep[k].start < end; k++) {
+            int lo = keep[k].start > start ? keep[k].start : start;
+            int hi = keep[k].start + keep[k].count < end ? keep[k].start + keep[k].count : end;
+            DataSegment *last = new_count ? &segments[new_count - 1] : NULL;
+
+            if (hi <= lo) continue;
+            if (segment->kind == DATA_LITERAL && last && last->kind == DATA_LITERAL
+                && last->first + last->count == segment->first + (lo - start)) {
+                last->count += hi - lo;
+            } else {
+                segments[new_count] = *segment;
+                segments[new_count].count = hi - lo;
+                if (segment->kind == DATA_LITERAL) segments[new_count].first += lo - start;
+                if (segment->kind == DATA_BYTES) segments[new_count].bytes += lo - start;
+                new_count++;
+            }
+            size += hi - lo;
+        }
+        start = end;
+    }
+
+    ASM_FREE(image->segments);
+    image->segments = segments;
+    image->segment_count = new_count;
+    image->segment_capacity = capacity;
+    image->size = size;
+    return 1;
+}
+
+/*
+ * data_image_arrange:
+ * Like data_image_compact(), but the ranges are taken in the order given,
+ * each one walking the segment list from the start.
+ */
+int data_image_arrange(DataImage *image, const DataRange *ranges, int count) {
+    int capacity = image->segment_count + 2 * count;
+    DataSegment *segments;
+    int new_count = 0, size = 0;
+    int r;
+
+    if (capacity == 0) return 1;
+    segments = (DataSegment *)ASM_MALLOC(capacity * sizeof(DataSegment), MEM_DATA);
+    if (!segments) return 0;
+
+    for (r = 0; r < count; r++) {
+        int start = 0, i;
+
+        for (i = 0; i < image->segment_count && start < ranges[r].start + ranges[r].count; i++) {
+            const DataSegment *segment = &image->segments[i];
+            int end = start + segment->count;
+            int lo = ranges[r].start > start ? ranges[r].start : start;
+            int hi = ranges[r].start + ranges[r].count < end ? ranges[r].start + ranges[r].count : end;
+            DataSegment *last = new_count ? &segments[new_count - 1] : NULL;
+
+            if (hi > lo) {
+                if (segment->kind == DATA_LITERAL && last && last->kind == DATA_LITERAL
+                    && last->first + last->count == segment->first + (lo - start)) {
+                    last->count += hi - lo;
+                } else {
+                    segments[new_count] = *segment;
+                    segments[new_count].count = hi - lo;
+                    if (segment->kind == DATA_LITERAL) segments[new_count].first += lo - start;
+                    if (segment->kind == DATA_BYTES) segments[new_count].bytes += lo - start;
+                    new_count++;
+                }
+                size += hi - lo;
+            }
+            start = end;
+        }
+    }
+
+    ASM_FREE(image->segments);
+    image->segments = segments;
+    image->segment_count = new_count;
+    image->segment_capacity = capacity;
+    image->size = size;
+    return 1;
+}
+
+unsigned short data_segment_word(const DataImage *image, const DataSegment *segment, int i) {
+    switch (segment->kind) {
+        case DATA_LITERAL: return image->words[segment->first + i];
+        case DATA_FILL: return segment->value;
+        case DATA_BYTES: return segment->bytes[i];
+    }
+    return 0;
+}
+
+/*
+ * data_image_reset:
+ * Empties the image for the next assembly while keeping its arrays.
+ */
+void data_image_reset(DataImage *image) {
+    int i;
+    for (i = 0; i < image->mapping_count; i++) {
+        munmap(image->mappings[i].address, image->mappings[i].length);
+    }
+    image->mapping_count = 0;
+    image->word_count = 0;
+    image->segment_count = 0;
+    image->size = 0;
+}
+
+void data_image_free(DataImage *image) {
+    data_image_reset(image);
+    ASM_FREE(image->words);
+    ASM_FREE(image->segments);
+    ASM_FREE(image->mappings);
+    memset(image, 0, sizeof(*image));
+}
@@ -0,0 +1,225 @@
+#include <string.h>
+#include "data_pool.h"
+#include "asm_alloc.h"
+
+#define POOL_INITIAL_BUCKETS 256
+
+static unsigned long hash_words(const unsigned short *words, int count) {
+    unsigned long hash = 5381;
+    int i;
+    for (i = 0; i < count; i++) {
+        hash = hash * 33 + words[i];
+    }
+    return hash ^ (unsigned long)count;
+}
+
+static int grow_buckets(DataPool *pool) {
+    int new_count = (pool->bucket_count == 0) ? POOL_INITIAL_BUCKETS : pool->bucket_count * 2;
+    int *buckets = (int *)ASM_MALLOC(new_count * sizeof(int), MEM_DATA);
+    int i;
+
+    if (!buckets) return 0;
+    for (i = 0; i < new_count; i++) buckets[i] = -1;
+    for (i = 0; i < pool->entry_count; i++) {
+        int b = (int)(pool->entries[i].hash % (unsigned long)new_count);
+        pool->entries[i].next = buckets[b];
+        buckets[b] = i;
+    }
+    ASM_FREE(pool->buckets);
+    pool->buckets = buckets;
+    pool->bucket_count = new_count;
+    return 1;
+}
+
+/*
+ * data_pool_add:
+ * Returns the entry with the same contents, or adds one.
+ */
+int data_pool_add(DataPool *pool, const unsigned short *words, int count) {
+    unsigned long hash = hash_words(words, count);
+    PoolEntry *entry;
+    int i, b;
+
+    pool->pooled_words += (unsigned long)count;
+
+    if (pool->bucket_count > 0) {
+        for (i = pool->buckets[hash % (unsigned long)pool->bucket_count]; i >= 0; i = pool->entries[i].next) {
+            entry = &pool->entries[i];
+            if (entry->hash == hash && entry->count == count
+                && memcmp(pool->words + entry->first, words, count * sizeof(unsigned short)) == 0) {
+                return i;
+            }
+        }
+    }
+
+    if (pool->entry_count >= pool->bucket_count && !grow_buckets(pool)) return -1;
+
+    if (pool->entry_count >= pool->entry_capacity) {
+        int new_capacity = (pool->entry_capacity == 0) ? 64 : pool->entry_capacity * 2;
+        PoolEntry *temp = ASM_REALLOC(pool->entries, new_capacity * sizeof(PoolEntry), MEM_DATA);
+        if (!temp) return -1;
+        pool->entries = temp;
+        pool->entry_capacity = new_capacity;
+    }
+    if (pool->word_count + count > pool->word_capacity) {
+        int new_capacity = (pool->word_capacity == 0) ? 256 : pool->word_capacity;
+        unsigned short *temp;
+
+        while (new_capacity < pool->word_count + count) new_capacity *= 2;
+        temp = ASM_REALLOC(pool->words, new_capacity * sizeof(unsigned short), MEM_DATA);
+        if (!temp) return -1;
+        pool->words = temp;
+        pool->word_capacity = new_capacity;
+    }
+
+    memcpy(pool->words + pool->word_count, words, count * sizeof(unsigned short));
+    i = pool->entry_count++;
+    entry = &pool->entries[i];
+    entry->first = pool->word_count;
+    entry->count = count;
+    entry->offset = -1;
+    entry->hash = hash;
+    b = (int)(hash % (unsigned long)pool->bucket_count);
+    entry->next = pool->buckets[b];
+    pool->buckets[b] = i;
+    pool->word_count += count;
+    return i;
+}
+
+int data_pool_add_label(DataPool *pool, const char *name, int entry) {
+    if (pool->label_count >= pool->label_capacity) {
+        int new_capacity = (pool->label_capacity == 0) ? 64 : pool->label_capacity * 2;
+        PoolLabel *temp = ASM_REALLOC(pool->labels, new_capacity * sizeof(PoolLabel), MEM_SYMBOL);
+        if (!temp) return 0;
+        pool->labels = temp;
+        pool->label_capacity = new_capacity;
+    }
+    strncpy(pool->labels[pool->label_count].name, name, LABEL_LENGTH);
+    pool->labels[pool->label_count].name[LABEL_LENGTH] = '\0';
+    pool->labels[pool->label_count].entry = entry;
+    pool->label_count++;
+    return 1;
+}
+
+/* Orders entries by their contents read backwards, so suffixes sort first */
+static int compare_reversed(const DataPool *pool, int a, int b) {
+    const PoolEntry *x = &pool->entries[a];
+    const PoolEntry *y = &pool->entries[b];
+    const unsigned short *p = pool->words + x->first + x->count;
+    const unsigned short *q = pool->words + y->first + y->count;
+    int n = x->count < y->count ? x->count : y->count;
+
+    while (n-- > 0) {
+        --p;
+        --q;
+        if (*p != *q) return *p < *q ? -1 : 1;
+    }
+    return x->count - y->count;
+}
+
+/* Merge sort of entry indices; qsort() has no way to pass the pool */
+static void sort_reversed(const DataPool *pool, int *order, int *scratch, int n) {
+    int half = n / 2;
+    int i = 0, j = half, k = 0;
+
+    if (n < 2) return;
+    sort_reversed(pool, order, scratch, half);
+    sort_reversed(pool, order + half, scratch, n - half);
+
+    while (i < half && j < n) {
+        scratch[k++] = (compare_reversed(pool, order[i], order[j]) <= 0) ? order[i++] : order[j++];
+    }
+    while (i < half) scratch[k++] = order[i++];
+    while (j < n) scratch[k++] = order[j++];
+    memcpy(order, scratch, n * sizeof(int));
+}
+
+/* True if entry a is a suffix of entry b */
+static int is_suffix(const DataPool *pool, int a, int b) {
+    const PoolEntry *x = &pool->entries[a];
+    const PoolEntry *y = &pool->entries[b];
+
+    if (x->count > y->count) return 0;
+    return memcmp(pool->words + x->first, pool->words + y->first + (y->count - x->count),
+                  x->count * sizeof(unsigned short)) == 0;
+}
+
+/*
+ * data_pool_layout:
+ * Sorted by reversed contents, every entry that is a suffix of another
+ * one sorts right before an entry it ends, so one backward scan finds the
+ * longest entry (the owner) each suffix can live in. Owners are written in
+ * order of first use; the others point into their owner's tail.
+ */
+int data_pool_layout(DataPool *pool, DataImage *image) {
+    int n = pool->entry_count;
+    int *order, *scratch, *owner;
+    int i, appended = 0;
+
+    if (n == 0) return 0;
+
+    order = (int *)ASM_MALLOC(n * sizeof(int), MEM_DATA);
+    scratch = (int *)ASM_MALLOC(n * sizeof(int), MEM_DATA);
+    owner = (int *)ASM_MALLOC(n * sizeof(int), MEM_DATA);
+    if (!order || !scratch || !owner) {
+        ASM_FREE(order);
+        ASM_FREE(scratch);
+        ASM_FREE(owner);
+        return -1;
+    }
+
+    for (i = 0; i < n; i++) order[i] = i;
+    sort_reversed(pool, order, scratch, n);
+
+    owner[order[n - 1]] = order[n - 1];
+    for (i = n - 2; i >= 0; i--) {
+        owner[order[i]] = is_suffix(pool, order[i], order[i + 1]) ? owner[order[i + 1]] : order[i];
+    }
+
+    for (i = 0; i < n; i++) {
+        PoolEntry *entry = &pool->entries[i];
+        unsigned short *out;
+
+        if (owner[i] != i) continue;
+        out = data_image_reserve(image, entry->count);
+        if (!out) break;
+        memcpy(out, pool->words + entry->first, entry->count * sizeof(unsigned short));
+        entry->offset = image->size;
+        if (!data_image_commit(image, entry->count)) break;
+        appended += entry->count;
+    }
+    if (i < n) appended = -1;
+
+    for (i = 0; appended >= 0 && i < n; i++) {
+        const PoolEntry *host = &pool->entries[owner[i]];
+        if (owner[i] != i) pool->entries[i].offset = host->offset + host->count - pool->entries[i].count;
+    }
+
+    if (appended >= 0) pool->saved_words = pool->pooled_words - (unsigned long)appended;
+    ASM_FREE(order);
+    ASM_FREE(scratch);
+    ASM_FREE(owner);
+    return appended;
+}
+
+/*
+ * data_pool_reset:
+ * Empties the pool for the next assembly; the mode and arrays are kept.
+ */
+void data_pool_reset(DataPool *pool) {
+    int i;
+    for (i = 0; i < pool->bucket_count; i++) pool->buckets[i] = -1;
+    pool->word_count = 0;
+    pool->entry_count = 0;
+    pool->label_count = 0;
+    pool->pooled_words = 0;
+    pool->saved_words = 0;
+}
+
+void data_pool_free(DataPool *pool) {
+    ASM_FREE(pool->words);
+    ASM_FREE(pool->entries);
+    ASM_FREE(pool->buckets);
+    ASM_FREE(pool->labels);
+    memset(pool, 0, sizeof(*pool));
+}
@@ -0,0 +1,132 @@
+#include <stdlib.h>
+#include <string.h>
+#include "data_strip.h"
+#include "asm_alloc.h"
+
+int data_strip_add_block(DataStrip *strip, const char *label, int start) {
+    DataBlock *block;
+
+    if (strip->block_count >= strip->block_capacity) {
+        int new_capacity = (strip->block_capacity == 0) ? 64 : strip->block_capacity * 2;
+        DataBlock *temp = ASM_REALLOC(strip->blocks, new_capacity * sizeof(DataBlock), MEM_DATA);
+        if (!temp) return 0;
+        strip->blocks = temp;
+        strip->block_capacity = new_capacity;
+    }
+    block = &strip->blocks[strip->block_count++];
+    strncpy(block->name, label, LABEL_LENGTH);
+    block->name[LABEL_LENGTH] = '\0';
+    block->start = start;
+    block->new_start = start;
+    block->live = 0;
+    return 1;
+}
+
+int data_strip_add_root(DataStrip *strip, const char *name) {
+    if (strip->root_count >= strip->root_capacity) {
+        int new_capacity = (strip->root_capacity == 0) ? 64 : strip->root_capacity * 2;
+        char (*temp)[LABEL_LENGTH + 1] = ASM_REALLOC(strip->roots, new_capacity * sizeof(*strip->roots), MEM_SYMBOL);
+        if (!temp) return 0;
+        strip->roots = temp;
+        strip->root_capacity = new_capacity;
+    }
+    strncpy(strip->roots[strip->root_count], name, LABEL_LENGTH);
+    strip->roots[strip->root_count][LABEL_LENGTH] = '\0';
+    strip->root_count++;
+    return 1;
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp((const char *)a, (const char *)b);
+}
+
+/*
+ * data_strip_run:
+ * Marks the blocks named by a root, then keeps the live blocks and the
+ * data before the first block. The last block ends where the image does.
+ */
+int data_strip_run(DataStrip *strip, DataImage *image) {
+    DataRange *keep;
+    int keep_count = 0;
+    int removed = 0;
+    int i;
+
+    if (strip->block_count == 0) return 0;
+
+    qsort(strip->roots, (size_t)strip->root_count, sizeof(*strip->roots), compare_names);
+
+    keep = (DataRange *)ASM_MALLOC((strip->block_count + 1) * sizeof(DataRange), MEM_DATA);
+    if (!keep) return -1;
+
+    if (strip->blocks[0].start > 0) {
+        keep[keep_count].start = 0;
+        keep[keep_count].count = strip->blocks[0].start;
+        keep_count++;
+    }
+
+    for (i = 0; i < strip->block_count; i++) {
+        DataBlock *block = &strip->blocks[i];
+        int end = (i + 1 < strip->block_count) ? strip->blocks[i + 1].start : image->size;
+
+        block->live = strip->root_count > 0
+            && bsearch(block->name, strip->roots, (size_t)strip->root_count, sizeof(*strip->roots), compare_names) != NULL;
+        block->new_start = block->start - removed;
+
+        if (!block->live) {
+            if (end > block->start) strip->removed_blocks++;
+            removed += end - block->start;
+        } else if (keep_count > 0 && keep[keep_count - 1].start + keep[keep_count - 1].count == block->start) {
+            keep[keep_count - 1].count += end - block->start;
+        } else {
+            keep[keep_count].start = block->start;
+            keep[keep_count].count = end - block->start;
+            keep_count++;
+        }
+    }
+
+    if (removed > 0 && !data_image_compact(image, keep, keep_count)) {
+        ASM_FREE(keep);
+        return -1;
+    }
+    ASM_FREE(keep);
+    strip->removed_words += (unsigned long)removed;
+    return removed;
+}
+
+/*
+ * data_strip_relocate:
+ * Offsets inside a live block move with it; those inside a removed block
+ * map to where the block would have been.
+ */
+int data_strip_relocate(const DataStrip *strip, int offset) {
+    int lo = 0, hi = strip->block_count - 1;
+    const DataBlock *block;
+
+    if (strip->block_count == 0 || offset < strip->blocks[0].start) return offset;
+
+    /* Last block starting at or before the offset */
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (strip->blocks[mid].start <= offset) lo = mid;
+        else hi = mid - 1;
+    }
+    block = &strip->blocks[lo];
+    return block->live ? block->new_start + (offset - block->start) : block->new_start;
+}
+
+/*
+ * data_strip_reset:
+ * Empties the lists for the next assembly; the flag and arrays are kept.
+ */
+void data_strip_reset(DataStrip *strip) {
+    strip->block_count = 0;
+    strip->root_count = 0;
+    strip->removed_blocks = 0;
+    strip->removed_words = 0;
+}
+
+void data_strip_free(DataStrip *strip) {
+    ASM_FREE(strip->blocks);
+    ASM_FREE(strip->roots);
+    memset(strip, 0, sizeof(*strip));
+}
@@ -18,6 +18,14 @@ DirectiveType get_directive_type(const char *word) {
         return DIRECTIVE_ENTRY;
     } else if (strcmp(word, "extern") == 0) {
         return DIRECTIVE_EXTERN;
+    } else if (strcmp(word, "incbin") == 0) {
+        return DIRECTIVE_INCBIN;
+    } else if (strcmp(word, "fill") == 0) {
+        return DIRECTIVE_FILL;
+    } else if (strcmp(word, "space") == 0) {
+        return DIRECTIVE_SPACE;
+    } else if (strcmp(word, "define") == 0) {
+        return DIRECTIVE_DEFINE;
     }
 
     return DIRECTIVE_NONE;
@@ -34,7 +42,7 @@ static int is_valid_number(const char *s) {
     return 1;
 }
 
-void handle_data_directive(const char *content) {
+bool handle_data_directive(const char *content, DiagnosticList *diags, const char *file, int line) {
     char buffer[1024];
     int i = 0, len, has_number = 0;
     const char *p;
@@ -42,8 +50,8 @@ void handle_data_directive(const char *content) {
     int token_i = 0;
 
     if (!content) {
-        printf("Error: .data directive is empty.\n");
-        return;
+        diag_report(diags, LOG_ERR, file, line, 0, ".data directive is empty.");
+        return false;
     }
 
     strncpy(buffer, content, sizeof(buffer) - 1);
@@ -53,27 +61,26 @@ void handle_data_directive(const char *content) {
     len = strlen(p);
 
     if (len == 0) {
-        printf("Error: .data directive must contain at least one number.\n");
-        return;
+        diag_report(diags, LOG_ERR, file, line, 0, ".data directive must contain at least one number.");
+        return false;
     }
 
     if (p[0] == ',' || p[len - 1] == ',') {
-        printf("Error: .data cannot start or end with a comma.\n");
-        return;
+        diag_report(diags, LOG_ERR, file, line, 0, ".data cannot start or end with a comma.");
+        return false;
     }
 
     for (i = 0; i <= len; i++) {
         if (p[i] == ',' || p[i] == '\0') {
             token[token_i] = '\0';
             if (token_i == 0) {
-                printf("Error: .data has empty value between commas.\n");
-                return;
+                diag_report(diags, LOG_ERR, file, line, 0, ".data has empty value between commas.");
+                return false;
             }
             if (!is_valid_number(token)) {
-                printf("Error: Invalid number '%s' in .data directive.\n", token);
-                return;
+                diag_report(diags, LOG_ERR, file, line, 0, "Invalid number '%s' in .data directive.", token);
+                return false;
             }
-            printf("Valid number: %s\n", token);
             has_number = 1;
             token_i = 0; /* Reset for next token */
         } else {
@@ -84,24 +91,26 @@ void handle_data_directive(const char *content) {
     }
 
     if (!has_number) {
-        printf("Error: .data directive must contain at least one number.\n");
+        diag_report(diags, LOG_ERR, file, line, 0, ".data directive must contain at least one number.");
+        return false;
     }
+    return true;
 }
 
 
 void handle_string_directive(const char *content) {
     /* Placeholder for .string directive logic */
-    printf("Handling .string with content: %s\n", content);
+    ASM_LOG_DBG(("Handling .string with content: %s", content));
 }
 
 void handle_entry_directive(const char *content) {
     /* Placeholder for .entry directive logic */
-    printf("Handling .entry with content: %s\n", content);
+    ASM_LOG_DBG(("Handling .entry with content: %s", content));
 }
 
 void handle_extern_directive(const char *content) {
     /* Placeholder for .extern directive logic */
-    printf("Handling .extern with content: %s\n", content);
+    ASM_LOG_DBG(("Handling .extern with content: %s", content));
 }
 
 
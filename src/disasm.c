@@ -0,0 +1,509 @@
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "disasm.h"
+#include "parser.h"
+#include "file_writer.h"
+#include "asm_alloc.h"
+
+#define DIS_DATA_PER_LINE 8
+
+/* Room for any one line of output */
+#define DIS_LINE_MAX 160
+
+/* DisState.flags */
+#define DIS_START 1         /* an instruction or a data word starts here */
+#define DIS_LABEL 2         /* an operand refers here */
+
+typedef enum {
+    DIS_IMMEDIATE,
+    DIS_ADDRESS,            /* direct: the low 12 bits of the address */
+    DIS_RELATIVE,           /* &label: the address itself */
+    DIS_REGISTER,
+    DIS_EXTERN
+} DisOperandKind;
+
+typedef struct {
+    DisOperandKind kind;
+    int value;              /* immediate, address or register */
+} DisOperand;
+
+typedef struct {
+    int op;
+    int length;
+    int operand_count;
+    DisOperand operands[2];
+} DisInsn;
+
+/* Decoding of a first word; op is -1 if no instruction starts with it */
+typedef struct {
+    signed char op;
+    unsigned char src_mode;
+    unsigned char dst_mode;
+    unsigned char length;
+} DisFormat;
+
+static const char *const opcode_names[16] = {
+    "mov", "cmp", "add", "sub", "lea", "clr", "not", "inc",
+    "dec", "jmp", "bne", "jsr", "red", "prn", "rts", "stop"
+};
+
+static DisFormat formats[1 << 14];
+static pthread_once_t formats_once = PTHREAD_ONCE_INIT;
+
+/*
+ * build_formats:
+ * Decodes every possible first word the way encode_instruction() builds
+ * them: opcode in bits 7-4, source mode in 9-8, destination mode in 11-10,
+ * and the rest zero. Unused modes must be zero.
+ */
+static void build_formats(void) {
+    unsigned int word;
+
+    for (word = 0; word < (1u << 14); word++) {
+        DisFormat *f = &formats[word];
+        int op = (int)((word >> 4) & 0xF);
+        int operands = OP_PER_INST(op);
+
+        f->op = -1;
+        f->src_mode = (unsigned char)((word >> 8) & 0x3);
+        f->dst_mode = (unsigned char)((word >> 10) & 0x3);
+        if ((word & 0x300F) != 0) continue;
+        if (operands < 2 && f->src_mode != 0) continue;
+        if (operands < 1 && f->dst_mode != 0) continue;
+
+        f->op = (signed char)op;
+        if (operands == 2 && f->src_mode == 3 && f->dst_mode == 3) f->length = 2;
+        else f->length = (unsigned char)(1 + operands);
+    }
+}
+
+static int sign14(unsigned int word) {
+    return (word & 0x2000) ? (int)word - 0x4000 : (int)word;
+}
+
+/*
+ * decode_operand:
+ * Reads the operand word at address for an operand in the given mode.
+ * Returns false for words encode_operand_word() never writes.
+ */
+static bool decode_operand(unsigned int word, int mode, int address, int is_src, int image_end, DisOperand *op) {
+    unsigned int reps[2];
+    int r;
+
+    switch (mode) {
+        case 0:
+            op->kind = DIS_IMMEDIATE;
+            op->value = sign14(word);
+            return true;
+        case 1:
+            if ((word >> 12) == 1 && (word & 0x0FFF) == 0) {
+                op->kind = DIS_EXTERN;
+                op->value = 0;
+                return true;
+            }
+            if ((word >> 12) != 2) return false;
+            op->kind = DIS_ADDRESS;
+            op->value = (int)(word & 0x0FFF);
+            return true;
+        case 2:
+            /* The distance is stored in 14 bits with bit 13 forced on; of the two
+               distances that give the word, take one landing in the image */
+            if (!(word & 0x2000)) return false;
+            reps[0] = word;
+            reps[1] = word & ~0x2000u;
+            op->kind = DIS_RELATIVE;
+            for (r = 1; r >= 0; r--) {
+                op->value = address + sign14(reps[r]);
+                if (op->value >= START_ADDRESS && op->value < image_end) break;
+            }
+            if (r < 0) op->value = address + sign14(word);
+            return true;
+        default:
+            if ((word & ~(0x7u << (is_src ? 6 : 3))) != 0) return false;
+            op->kind = DIS_REGISTER;
+            op->value = (int)((word >> (is_src ? 6 : 3)) & 0x7);
+            return true;
+    }
+}
+
+/*
+ * decode_insn:
+ * Decodes the instruction at index i of the code. Returns its length, or
+ * 0 if the words there are not an instruction.
+ */
+static int decode_insn(const DisImage *image, int i, DisInsn *insn) {
+    const unsigned short *words = image->words;
+    const DisFormat *f = &formats[words[i] & 0x3FFF];
+    int image_end = START_ADDRESS + image->code_count + image->data_count;
+    int next = i + 1;
+
+    if (f->op < 0 || i + f->length > image->code_count) return 0;
+
+    insn->op = f->op;
+    insn->length = f->length;
+    insn->operand_count = OP_PER_INST(f->op);
+
+    if (insn->operand_count == 2 && f->length == 2) {
+        if ((words[next] & ~0x1F8u) != 0) return 0;
+        insn->operands[0].kind = insn->operands[1].kind = DIS_REGISTER;
+        insn->operands[0].value = (words[next] >> 6) & 0x7;
+        insn->operands[1].value = (words[next] >> 3) & 0x7;
+        return 2;
+    }
+    if (insn->operand_count == 2) {
+        if (!decode_operand(words[next], f->src_mode, START_ADDRESS + next, 1, image_end, &insn->operands[0])) return 0;
+        next++;
+    }
+    if (insn->operand_count >= 1) {
+        DisOperand *dst = &insn->operands[insn->operand_count - 1];
+        if (!decode_operand(words[next], f->dst_mode, START_ADDRESS + next, 0, image_end, dst)) return 0;
+    }
+    return insn->length;
+}
+
+typedef struct {
+    const DisImage *image;
+    unsigned char *flags;   /* per image word */
+    int count;              /* code + data words */
+    int first_start;        /* index of the first start, the base of far addresses */
+    bool has_extern;
+    char *text;
+    size_t length;
+    size_t capacity;
+} DisState;
+
+/*
+ * label_base:
+ * The labelled address an operand address is written from: itself if it
+ * starts a word of source, else the instruction holding it, else the
+ * first start of the image.
+ */
+static int label_base(const DisState *st, int address) {
+    int index = address - START_ADDRESS;
+    int back;
+
+    if (index >= 0 && index < st->count) {
+        for (back = 0; back < MAX_WORDS_PER_LINE && index - back >= 0; back++) {
+            if (st->flags[index - back] & DIS_START) return address - back;
+        }
+    }
+    return START_ADDRESS + st->first_start;
+}
+
+static bool reserve(DisState *st, size_t extra) {
+    if (st->length + extra + 1 > st->capacity) {
+        size_t new_capacity = st->capacity ? st->capacity : 4096;
+        char *temp;
+
+        while (new_capacity < st->length + extra + 1) new_capacity *= 2;
+        temp = (char *)ASM_REALLOC(st->text, new_capacity, MEM_TEXT);
+        if (!temp) return false;
+        st->text = temp;
+        st->capacity = new_capacity;
+    }
+    return true;
+}
+
+/* Appends a string; the caller reserved room */
+static void put_str(DisState *st, const char *s) {
+    while (*s) st->text[st->length++] = *s++;
+}
+
+static void put_int(DisState *st, long value) {
+    char digits[24];
+    int n = 0;
+    unsigned long v = value < 0 ? (unsigned long)-value : (unsigned long)value;
+
+    if (value < 0) st->text[st->length++] = '-';
+    do {
+        digits[n++] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v);
+    while (n > 0) st->text[st->length++] = digits[--n];
+}
+
+static void put_label(DisState *st, int address) {
+    st->text[st->length++] = 'L';
+    put_int(st, address);
+}
+
+static void put_operand(DisState *st, const DisOperand *op) {
+    int base;
+
+    switch (op->kind) {
+        case DIS_IMMEDIATE:
+            st->text[st->length++] = '#';
+            put_int(st, op->value);
+            return;
+        case DIS_REGISTER:
+            st->text[st->length++] = 'r';
+            st->text[st->length++] = (char)('0' + op->value);
+            return;
+        case DIS_EXTERN:
+            put_str(st, "EXT");
+            return;
+        default:
+            break;
+    }
+
+    if (op->kind == DIS_RELATIVE) st->text[st->length++] = '&';
+    base = label_base(st, op->value);
+    put_label(st, base);
+    if (op->value != base) {
+        put_str(st, op->value > base ? " + " : " - ");
+        put_int(st, op->value > base ? op->value - base : base - op->value);
+    }
+}
+
+/* Marks the label an operand is written with */
+static void mark_operand(DisState *st, const DisOperand *op) {
+    if (op->kind == DIS_EXTERN) st->has_extern = true;
+    if (op->kind == DIS_ADDRESS || op->kind == DIS_RELATIVE) {
+        st->flags[label_base(st, op->value) - START_ADDRESS] |= DIS_LABEL;
+    }
+}
+
+static void put_invalid(DisState *st, int index) {
+    static const char hex[] = "0123456789abcdef";
+    unsigned int word = st->image->words[index];
+    int shift;
+
+    put_str(st, "; ");
+    put_int(st, START_ADDRESS + index);
+    put_str(st, ": ");
+    for (shift = 12; shift >= 0; shift -= 4) st->text[st->length++] = hex[(word >> shift) & 0xF];
+    put_str(st, " is not an instruction\n");
+}
+
+/*
+ * disassemble:
+ * Three sweeps over the code: find where instructions start, mark the
+ * addresses operands refer to, then write the source.
+ */
+bool disassemble(const DisImage *image, DisOutput *out) {
+    DisState st;
+    DisInsn insn;
+    int code = image->code_count;
+    int i, k;
+
+    memset(out, 0, sizeof(*out));
+    memset(&st, 0, sizeof(st));
+    pthread_once(&formats_once, build_formats);
+
+    st.image = image;
+    st.count = image->code_count + image->data_count;
+    st.first_start = -1;
+    st.flags = (unsigned char *)ASM_CALLOC((size_t)st.count + 1, 1, MEM_OTHER);
+    if (!st.flags) return false;
+
+    for (i = 0; i < code; i += k) {
+        k = decode_insn(image, i, &insn);
+        if (k == 0) k = 1;
+        else st.flags[i] |= DIS_START;
+    }
+    for (i = code; i < st.count; i++) st.flags[i] |= DIS_START;
+    for (i = 0; i < st.count && st.first_start < 0; i++) {
+        if (st.flags[i] & DIS_START) st.first_start = i;
+    }
+
+    for (i = 0; i < code; i += k) {
+        int o;
+
+        k = decode_insn(image, i, &insn);
+        if (k == 0) {
+            k = 1;
+            continue;
+        }
+        for (o = 0; o < insn.operand_count; o++) mark_operand(&st, &insn.operands[o]);
+    }
+
+    if (!reserve(&st, DIS_LINE_MAX)) goto fail;
+    put_str(&st, "; ");
+    put_int(&st, code);
+    put_str(&st, " code words, ");
+    put_int(&st, image->data_count);
+    put_str(&st, " data words\n");
+    if (st.has_extern) put_str(&st, ".extern EXT\n");
+
+    for (i = 0; i < code; i += k) {
+        int o;
+
+        if (!reserve(&st, DIS_LINE_MAX)) goto fail;
+        k = decode_insn(image, i, &insn);
+        if (k == 0) {
+            put_invalid(&st, i);
+            out->invalid++;
+            k = 1;
+            continue;
+        }
+
+        if (st.flags[i] & DIS_LABEL) {
+            put_label(&st, START_ADDRESS + i);
+            st.text[st.length++] = ':';
+        }
+        st.text[st.length++] = '\t';
+        put_str(&st, opcode_names[insn.op]);
+        for (o = 0; o < insn.operand_count; o++) {
+            put_str(&st, o == 0 ? " " : ", ");
+            put_operand(&st, &insn.operands[o]);
+        }
+        st.text[st.length++] = '\n';
+        out->instructions++;
+    }
+
+    /* Data, a line per DIS_DATA_PER_LINE words or per label */
+    for (i = code; i < st.count; i = k) {
+        if (!reserve(&st, DIS_LINE_MAX)) goto fail;
+        if (st.flags[i] & DIS_LABEL) {
+            put_label(&st, START_ADDRESS + i);
+            st.text[st.length++] = ':';
+        }
+        put_str(&st, "\t.data ");
+        put_int(&st, sign14(image->words[i]));
+        for (k = i + 1; k < st.count && k < i + DIS_DATA_PER_LINE && !(st.flags[k] & DIS_LABEL); k++) {
+            put_str(&st, ", ");
+            put_int(&st, sign14(image->words[k]));
+        }
+        st.text[st.length++] = '\n';
+    }
+
+    st.text[st.length] = '\0';
+    ASM_FREE(st.flags);
+    out->text = st.text;
+    out->length = st.length;
+    return true;
+
+fail:
+    ASM_FREE(st.flags);
+    ASM_FREE(st.text);
+    return false;
+}
+
+/*
+ * load_text:
+ * Reads the .ob text format; the words must be listed in address order
+ * from START_ADDRESS, as format_object() writes them.
+ */
+static bool load_text(const char *p, const char *end, DisImage *image, char *error, size_t error_size) {
+    long fields[2];
+    int f, count = 0, total;
+
+    for (f = 0; f < 2; f++) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) p++;
+        if (p == end || *p < '0' || *p > '9') {
+            snprintf(error, error_size, "malformed object header");
+            return false;
+        }
+        for (fields[f] = 0; p < end && *p >= '0' && *p <= '9' && fields[f] < 100000000L; p++) {
+            fields[f] = fields[f] * 10 + (*p - '0');
+        }
+    }
+    if (fields[0] + fields[1] > 100000000L) {
+        snprintf(error, error_size, "image of %ld words is too large", fields[0] + fields[1]);
+        return false;
+    }
+
+    total = (int)(fields[0] + fields[1]);
+    image->words = (unsigned short *)ASM_MALLOC((size_t)total * sizeof(unsigned short) + 1, MEM_OTHER);
+    if (!image->words) {
+        snprintf(error, error_size, "out of memory");
+        return false;
+    }
+    image->code_count = (int)fields[0];
+    image->data_count = (int)fields[1];
+
+    for (;;) {
+        long address = 0;
+        unsigned int value = 0;
+        int digits = 0;
+
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) p++;
+        if (p == end) break;
+
+        while (p < end && *p >= '0' && *p <= '9' && address < 100000000L) address = address * 10 + (*p++ - '0');
+        while (p < end && (*p == ' ' || *p == '\t')) p++;
+        for (; p < end; p++) {
+            int c = *p;
+            if (c >= '0' && c <= '9') value = value * 16 + (unsigned int)(c - '0');
+            else if (c >= 'a' && c <= 'f') value = value * 16 + (unsigned int)(c - 'a' + 10);
+            else if (c >= 'A' && c <= 'F') value = value * 16 + (unsigned int)(c - 'A' + 10);
+            else break;
+            digits++;
+            if (value > 0x3FFF) value = 0x4000;
+        }
+
+        /* A word wider than 14 bits is a corrupt image, not something to mask */
+        if (digits == 0 || value > 0x3FFF || (p < end && *p != '\n' && *p != '\r' && *p != ' ' && *p != '\t')) {
+            snprintf(error, error_size, "malformed object line %d", count + 2);
+            break;
+        }
+        if (count >= total || address != START_ADDRESS + count) {
+            snprintf(error, error_size, "unexpected address %ld on line %d", address, count + 2);
+            break;
+        }
+        image->words[count++] = (unsigned short)value;
+    }
+
+    if (p == end && count != total) {
+        snprintf(error, error_size, "%d words listed, the header counts %d", count, total);
+    }
+    if (p != end || count != total) {
+        dis_image_free(image);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * load_binary:
+ * Reads the binary format written by format_object_binary().
+ */
+static bool load_binary(const unsigned char *data, size_t length, DisImage *image, char *error, size_t error_size) {
+    int load_address = data[4] | (data[5] << 8);
+    int code_words = data[6] | (data[7] << 8);
+    int data_words = data[8] | (data[9] << 8);
+    int i;
+
+    if (load_address != START_ADDRESS || length != OBJECT_BINARY_HEADER + (size_t)(code_words + data_words) * 2) {
+        snprintf(error, error_size, "corrupt binary object header");
+        return false;
+    }
+
+    image->words = (unsigned short *)ASM_MALLOC((size_t)(code_words + data_words) * sizeof(unsigned short) + 1, MEM_OTHER);
+    if (!image->words) {
+        snprintf(error, error_size, "out of memory");
+        return false;
+    }
+    image->code_count = code_words;
+    image->data_count = data_words;
+
+    data += OBJECT_BINARY_HEADER;
+    for (i = 0; i < code_words + data_words; i++) {
+        image->words[i] = (unsigned short)(data[i * 2] | (data[i * 2 + 1] << 8));
+        if (image->words[i] > 0x3FFF) {
+            snprintf(error, error_size, "malformed object word %d (%04x)", i, image->words[i]);
+            dis_image_free(image);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool dis_load_image(const char *data, size_t length, DisImage *image, char *error, size_t error_size) {
+    memset(image, 0, sizeof(*image));
+    if (length >= OBJECT_BINARY_HEADER && memcmp(data, OBJECT_BINARY_MAGIC, 4) == 0) {
+        return load_binary((const unsigned char *)data, length, image, error, error_size);
+    }
+    return load_text(data, data + length, image, error, error_size);
+}
+
+void dis_image_free(DisImage *image) {
+    ASM_FREE(image->words);
+    memset(image, 0, sizeof(*image));
+}
+
+void dis_output_free(DisOutput *out) {
+    ASM_FREE(out->text);
+    memset(out, 0, sizeof(*out));
+}
@@ -0,0 +1,161 @@
+#include <ctype.h>
+#include <string.h>
+#include "expr.h"
+
+/* Half the 32-bit range, so a sum of two checked values cannot overflow a long */
+#define EXPR_LIMIT 0x3FFFFFFFL
+#define EXPR_MAX_DEPTH 32
+
+typedef struct {
+    const char *p;
+    SymbolTable *symbols;
+    int depth;
+    int error;
+} ExprParser;
+
+static long parse_sum(ExprParser *ep);
+
+static void skip_blanks(ExprParser *ep) {
+    while (*ep->p == ' ' || *ep->p == '\t') ep->p++;
+}
+
+/* Records the first error only; the value returned after an error is 0 */
+static long fail(ExprParser *ep, int error) {
+    if (ep->error == EXPR_OK) ep->error = error;
+    return 0;
+}
+
+static long checked(ExprParser *ep, long value) {
+    return (value > EXPR_LIMIT || value < -EXPR_LIMIT) ? fail(ep, EXPR_OVERFLOW) : value;
+}
+
+static long parse_primary(ExprParser *ep) {
+    long value = 0;
+
+    skip_blanks(ep);
+    if (*ep->p == '(') {
+        if (++ep->depth > EXPR_MAX_DEPTH) return fail(ep, EXPR_SYNTAX);
+        ep->p++;
+        value = parse_sum(ep);
+        skip_blanks(ep);
+        if (*ep->p != ')') return fail(ep, EXPR_SYNTAX);
+        ep->p++;
+        ep->depth--;
+        return value;
+    }
+
+    if (isdigit((unsigned char)*ep->p)) {
+        while (isdigit((unsigned char)*ep->p)) {
+            int digit = *ep->p++ - '0';
+            if (value > (EXPR_LIMIT - digit) / 10) return fail(ep, EXPR_OVERFLOW);
+            value = value * 10 + digit;
+        }
+        return value;
+    }
+
+    if (isalpha((unsigned char)*ep->p)) {
+        char name[MAX_SYMBOL_NAME];
+        size_t length = 0;
+        const Symbol *sym;
+
+        while (isalnum((unsigned char)*ep->p)) {
+            if (length + 1 >= sizeof(name)) return fail(ep, EXPR_UNDEFINED);
+            name[length++] = *ep->p++;
+        }
+        name[length] = '\0';
+        sym = find_symbol(ep->symbols, name);
+        if (!sym) return fail(ep, EXPR_UNDEFINED);
+        if (sym->type != SYMBOL_CONSTANT) return fail(ep, EXPR_NOT_CONSTANT);
+        return sym->address;
+    }
+
+    return fail(ep, EXPR_SYNTAX);
+}
+
+static long parse_unary(ExprParser *ep) {
+    long value;
+
+    skip_blanks(ep);
+    if (*ep->p == '-' || *ep->p == '+') {
+        int negate = (*ep->p == '-');
+
+        if (++ep->depth > EXPR_MAX_DEPTH) return fail(ep, EXPR_SYNTAX);
+        ep->p++;
+        value = parse_unary(ep);
+        ep->depth--;
+        return negate ? -value : value;
+    }
+    return parse_primary(ep);
+}
+
+static long parse_product(ExprParser *ep) {
+    long value = parse_unary(ep);
+
+    for (;;) {
+        char op;
+        long rhs;
+
+        skip_blanks(ep);
+        op = *ep->p;
+        if (ep->error || (op != '*' && op != '/' && op != '%')) return value;
+        ep->p++;
+        rhs = parse_unary(ep);
+        if (ep->error) return 0;
+
+        if (op == '*') {
+            if (rhs != 0 && (value > EXPR_LIMIT / (rhs < 0 ? -rhs : rhs) || value < -EXPR_LIMIT / (rhs < 0 ? -rhs : rhs))) {
+                return fail(ep, EXPR_OVERFLOW);
+            }
+            value *= rhs;
+        } else if (rhs == 0) {
+            return fail(ep, EXPR_DIVIDE_BY_ZERO);
+        } else {
+            /* C90 leaves the rounding of negative quotients to the compiler */
+            long q = (value < 0 ? -value : value) / (rhs < 0 ? -rhs : rhs);
+            if ((value < 0) != (rhs < 0)) q = -q;
+            value = (op == '/') ? q : value - q * rhs;
+        }
+    }
+}
+
+static long parse_sum(ExprParser *ep) {
+    long value = parse_product(ep);
+
+    for (;;) {
+        char op;
+        long rhs;
+
+        skip_blanks(ep);
+        op = *ep->p;
+        if (ep->error || (op != '+' && op != '-')) return value;
+        ep->p++;
+        rhs = parse_product(ep);
+        if (ep->error) return 0;
+        value = checked(ep, op == '+' ? value + rhs : value - rhs);
+    }
+}
+
+/*
+ * expr_eval:
+ * Recursive descent over the text; anything left after the expression is
+ * a syntax error.
+ */
+int expr_eval(const char *text, SymbolTable *symbols, long *value) {
+    ExprParser ep;
+    long result;
+
+    ep.p = text;
+    ep.symbols = symbols;
+    ep.depth = 0;
+    ep.error = EXPR_OK;
+
+    result = parse_sum(&ep);
+    skip_blanks(&ep);
+    if (ep.error == EXPR_OK && *ep.p != '\0') ep.error = EXPR_SYNTAX;
+    if (ep.error == EXPR_OK) *value = result;
+    return ep.error;
+}
+
+int expr_char(int c) {
+    return isalnum(c) || c == ' ' || c == '\t' || (c != '\0' && strchr("+-*/%()", c) != NULL);
+}
@@ -0,0 +1,270 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "file_writer.h"
+#include "asm_context.h"
+#include "asm_alloc.h"
+
+/*
+ * object_file_name:
+ * Derives the object file name from the pre-assembled file name.
+ */
+void object_file_name(const char *expanded_name, char *out, size_t size) {
+    char *dot_ext;
+
+    /* Copy filename safely */
+    strncpy(out, expanded_name, size - 1);
+    out[size - 1] = '\0';
+
+    /* Look for ".am" at the end */
+    dot_ext = strstr(out, ".am");
+    if (dot_ext && strlen(dot_ext) == 3) {
+        *dot_ext = '\0';  /* Truncate the ".am" */
+    }
+
+    /* Append ".ob" */
+    strncat(out, ".ob", size - strlen(out) - 1);
+}
+
+/*
+ * write_expanded_file:
+ * Writes the macro-expanded source to its .am file.
+ */
+bool write_expanded_file(const char *path, const char *text, size_t length) {
+    FILE *file = fopen(path, "w");
+    bool ok;
+
+    if (!file) {
+        fprintf(stderr, "Error: Could not create output file %s\n", path);
+        return false;
+    }
+
+    ok = fwrite(text, 1, length, file) == length;
+    if (fclose(file) != 0) ok = false;
+    return ok;
+}
+
+/*
+ * format_object:
+ * Renders the code/data image of an assembly in the .ob text format:
+ * a "<code words> <data words>" header, then one "address value" per line.
+ * Returns a heap buffer; its length is stored in *out_length.
+ */
+char *format_object(const AsmContext *ctx, size_t *out_length) {
+    /* header: two ints; each word: "%06d %06x\n" (at most 19 bytes) */
+    size_t capacity = 32 + ((size_t)ctx->code.size + (size_t)ctx->data.size) * 20;
+    char *text = (char *)ASM_MALLOC(capacity, MEM_TEXT);
+    size_t length;
+    int address = START_ADDRESS + ctx->code_length;
+    int i, s;
+
+    if (!text) return NULL;
+
+    length = (size_t)sprintf(text, "%d %d\n", ctx->code_length, ctx->DC);
+    for (i = 0; i < ctx->code.size; i++) {
+        length += (size_t)sprintf(text + length, "%06d %06x\n", ctx->code.words[i].address, ctx->code.words[i].value & 0x3FFF);
+    }
+
+    /* Data segments are expanded here, after the code */
+    for (s = 0; s < ctx->data.segment_count; s++) {
+        const DataSegment *segment = &ctx->data.segments[s];
+        for (i = 0; i < segment->count; i++) {
+            length += (size_t)sprintf(text + length, "%06d %06x\n", address++, data_segment_word(&ctx->data, segment, i));
+        }
+    }
+
+    if (out_length) *out_length = length;
+    return text;
+}
+
+/*
+ * write_object_file:
+ * Writes the .ob file of an assembly.
+ */
+bool write_object_file(const AsmContext *ctx, const char *path, size_t *bytes_written) {
+    FILE *ob_file;
+    char *text;
+    size_t length;
+    bool ok;
+
+    text = format_object(ctx, &length);
+    if (!text) {
+        fprintf(stderr, "Error: Memory allocation failed for output file %s\n", path);
+        return false;
+    }
+
+    ob_file = fopen(path, "w");
+    if (!ob_file) {
+        fprintf(stderr, "Error: Cannot write to output file %s\n", path);
+        ASM_FREE(text);
+        return false;
+    }
+
+    ok = fwrite(text, 1, length, ob_file) == length;
+    if (fclose(ob_file) != 0) ok = false;
+    ASM_FREE(text);
+    if (ok && bytes_written) *bytes_written = length;
+    return ok;
+}
+
+/*
+ * print_object:
+ * Writes the .ob text of an assembly to an open stream, such as stdout.
+ */
+bool print_object(const AsmContext *ctx, FILE *out, size_t *bytes_written) {
+    int address = START_ADDRESS + ctx->code_length;
+    size_t length;
+    int i, s;
+
+    length = (size_t)fprintf(out, "%d %d\n", ctx->code_length, ctx->DC);
+    for (i = 0; i < ctx->code.size; i++) {
+        length += (size_t)fprintf(out, "%06d %06x\n", ctx->code.words[i].address, ctx->code.words[i].value & 0x3FFF);
+    }
+    for (s = 0; s < ctx->data.segment_count; s++) {
+        const DataSegment *segment = &ctx->data.segments[s];
+        for (i = 0; i < segment->count; i++) {
+            length += (size_t)fprintf(out, "%06d %06x\n", address++, data_segment_word(&ctx->data, segment, i));
+        }
+    }
+
+    if (fflush(out) != 0 || ferror(out)) {
+        fprintf(stderr, "Error: Cannot write the object file\n");
+        return false;
+    }
+    if (bytes_written) *bytes_written = length;
+    return true;
+}
+
+/*
+ * format_source_map:
+ * Renders the address-to-source map of an assembly.
+ * Returns a heap buffer; its length is stored in *out_length.
+ */
+char *format_source_map(const AsmContext *ctx, size_t *out_length) {
+    const SourceMap *map = &ctx->map;
+    /* each line: three ints, a macro name and another int (at most 32 + LABEL_LENGTH + 16 bytes) */
+    size_t capacity = strlen(ctx->source_name) + 16 + (size_t)map->instruction_count * (48 + LABEL_LENGTH);
+    char *text = (char *)ASM_MALLOC(capacity, MEM_TEXT);
+    size_t length;
+    int i;
+
+    if (!text) return NULL;
+
+    length = (size_t)sprintf(text, "source %s\n", ctx->source_name);
+    for (i = 0; i < map->instruction_count; i++) {
+        const MapInstruction *ins = &map->instructions[i];
+        const LineOrigin *origin = source_map_origin(map, ins->expanded_line);
+
+        if (!origin) {
+            length += (size_t)sprintf(text + length, "%d %d 0\n", ins->address, ins->length);
+        } else if (origin->macro < 0) {
+            length += (size_t)sprintf(text + length, "%d %d %d\n", ins->address, ins->length, origin->line);
+        } else {
+            length += (size_t)sprintf(text + length, "%d %d %d %.*s %d\n", ins->address, ins->length, origin->line,
+                                      LABEL_LENGTH, map->macros[origin->macro], origin->call_line);
+        }
+    }
+
+    if (out_length) *out_length = length;
+    return text;
+}
+
+/*
+ * write_source_map_file:
+ * Writes the .map file of an assembly.
+ */
+bool write_source_map_file(const AsmContext *ctx, const char *path, size_t *bytes_written) {
+    FILE *file;
+    char *text;
+    size_t length;
+    bool ok;
+
+    text = format_source_map(ctx, &length);
+    if (!text) {
+        fprintf(stderr, "Error: Memory allocation failed for output file %s\n", path);
+        return false;
+    }
+
+    file = fopen(path, "w");
+    if (!file) {
+        fprintf(stderr, "Error: Cannot write to output file %s\n", path);
+        ASM_FREE(text);
+        return false;
+    }
+
+    ok = fwrite(text, 1, length, file) == length;
+    if (fclose(file) != 0) ok = false;
+    ASM_FREE(text);
+    if (ok && bytes_written) *bytes_written = length;
+    return ok;
+}
+
+static void put_u16(unsigned char *out, unsigned int value) {
+    out[0] = (unsigned char)(value & 0xFF);
+    out[1] = (unsigned char)((value >> 8) & 0xFF);
+}
+
+/*
+ * format_object_binary:
+ * Renders the code/data image in the binary object format.
+ * Returns a heap buffer; its length is stored in *out_length.
+ */
+unsigned char *format_object_binary(const AsmContext *ctx, size_t *out_length) {
+    size_t length = OBJECT_BINARY_HEADER + ((size_t)ctx->code.size + (size_t)ctx->data.size) * 2;
+    unsigned char *image;
+    unsigned char *out;
+    int i, s;
+
+    /* The header counts are 16-bit */
+    if (ctx->code.size > 0xFFFF || ctx->data.size > 0xFFFF) return NULL;
+    image = (unsigned char *)ASM_MALLOC(length, MEM_TEXT);
+    if (!image) return NULL;
+
+    memcpy(image, OBJECT_BINARY_MAGIC, 4);
+    put_u16(image + 4, START_ADDRESS);
+    put_u16(image + 6, (unsigned int)ctx->code.size);
+    put_u16(image + 8, (unsigned int)ctx->data.size);
+    out = image + OBJECT_BINARY_HEADER;
+    for (i = 0; i < ctx->code.size; i++, out += 2) {
+        put_u16(out, ctx->code.words[i].value & 0x3FFF);
+    }
+    for (s = 0; s < ctx->data.segment_count; s++) {
+        const DataSegment *segment = &ctx->data.segments[s];
+        for (i = 0; i < segment->count; i++, out += 2) {
+            put_u16(out, data_segment_word(&ctx->data, segment, i));
+        }
+    }
+
+    if (out_length) *out_length = length;
+    return image;
+}
+
+/*
+ * write_binary_object_file:
+ * Writes the binary object image of an assembly.
+ */
+bool write_binary_object_file(const AsmContext *ctx, const char *path, size_t *bytes_written) {
+    FILE *file;
+    unsigned char *image;
+    size_t length;
+    bool ok;
+
+    image = format_object_binary(ctx, &length);
+    if (!image) {
+        fprintf(stderr, "Error: Memory allocation failed for output file %s\n", path);
+        return false;
+    }
+
+    file = fopen(path, "wb");
+    if (!file) {
+        fprintf(stderr, "Error: Cannot write to output file %s\n", path);
+        ASM_FREE(image);
+        return false;
+    }
+
+    ok = fwrite(image, 1, length, file) == length;
+    if (fclose(file) != 0) ok = false;
+    ASM_FREE(image);
+    if (ok && bytes_written) *bytes_written = length;
+    return ok;
+}
@@ -0,0 +1,686 @@
+#include <stdio.h>
+#include <string.h>
+#include "incremental.h"
+#include "parser.h"
+#include "logger.h"
+#include "utils.h"
+#include "asm_alloc.h"
+
+/* An edit larger than this (old labels x new labels) is cheaper to redo in full */
+#define INC_MAX_LABEL_CHECKS 1000000L
+
+void inc_init(IncState *st) {
+    memset(st, 0, sizeof(*st));
+}
+
+void inc_invalidate(IncState *st) {
+    st->valid = false;
+}
+
+void inc_free(IncState *st) {
+    if (st->table) free_macro_table(st->table);
+    ASM_FREE(st->source);
+    ASM_FREE(st->lines);
+    ASM_FREE(st->expanded);
+    ASM_FREE(st->items);
+    memset(st, 0, sizeof(*st));
+}
+
+/* Grows an array to hold needed elements; returns the (moved) array or NULL */
+static void *grow(void *array, int *capacity, int needed, size_t size) {
+    int new_capacity = (*capacity == 0) ? 64 : *capacity;
+    void *temp;
+
+    if (needed <= *capacity) return array;
+    while (new_capacity < needed) new_capacity *= 2;
+    temp = ASM_REALLOC(array, (size_t)new_capacity * size, MEM_LINE);
+    if (temp) *capacity = new_capacity;
+    return temp;
+}
+
+static bool reserve_text(char **text, size_t *capacity, size_t needed) {
+    if (needed > *capacity) {
+        size_t new_capacity = (*capacity == 0) ? 4096 : *capacity;
+        char *temp;
+
+        while (new_capacity < needed) new_capacity *= 2;
+        temp = (char *)ASM_REALLOC(*text, new_capacity, MEM_TEXT);
+        if (!temp) return false;
+        *text = temp;
+        *capacity = new_capacity;
+    }
+    return true;
+}
+
+/*
+ * split_source:
+ * Splits a source into lines the way the pre-assembler reads them: at
+ * most LINE_LENGTH - 1 characters, the newline included.
+ */
+static bool split_source(const char *src, size_t len, IncSourceLine **lines, int *count, int *capacity) {
+    size_t pos = 0;
+
+    *count = 0;
+    while (pos < len) {
+        size_t start = pos;
+        int n = 0;
+        IncSourceLine *temp;
+
+        while (pos < len && n < LINE_LENGTH - 1) {
+            n++;
+            if (src[pos++] == '\n') break;
+        }
+        temp = (IncSourceLine *)grow(*lines, capacity, *count + 1, sizeof(IncSourceLine));
+        if (!temp) return false;
+        *lines = temp;
+        memset(&temp[*count], 0, sizeof(IncSourceLine));
+        temp[*count].offset = start;
+        temp[*count].length = n;
+        (*count)++;
+    }
+    return true;
+}
+
+/*
+ * split_items:
+ * Appends an item for each line of text[from, to), split the way the
+ * passes read the expanded text.
+ */
+static bool split_items(const char *text, size_t from, size_t to, IncLine **items, int *count, int *capacity) {
+    size_t pos = from;
+
+    while (pos < to) {
+        size_t start = pos;
+        int n = 0;
+        IncLine *temp;
+
+        while (pos < to && n < LINE_LENGTH + 1) {
+            n++;
+            if (text[pos++] == '\n') break;
+        }
+        temp = (IncLine *)grow(*items, capacity, *count + 1, sizeof(IncLine));
+        if (!temp) return false;
+        *items = temp;
+        memset(&temp[*count], 0, sizeof(IncLine));
+        temp[*count].offset = start;
+        temp[*count].length = n;
+        (*count)++;
+    }
+    return true;
+}
+
+/* Copies a piece of text into a NUL-terminated line buffer of LINE_LENGTH + 2 */
+static void copy_line(char *line, const char *text, int length) {
+    memcpy(line, text, (size_t)length);
+    line[length] = '\0';
+}
+
+static IncKind line_kind(const ParsedLine *parsed) {
+    if (parsed->type == LINE_COMMAND) return INC_CODE;
+    if (parsed->type != LINE_DIRECTIVE) return INC_NONE;
+    if (parsed->directive == DIRECTIVE_ENTRY || parsed->directive == DIRECTIVE_EXTERN
+        || parsed->directive == DIRECTIVE_DEFINE) {
+        return INC_SYMBOLIC;
+    }
+    return INC_DATA;
+}
+
+/* Index of the first expanded line of a source line; the end for the last one */
+static int first_item(const IncState *st, int line) {
+    return line < st->line_count ? st->lines[line].first : st->item_count;
+}
+
+/*
+ * record_uses:
+ * Notes the symbols an instruction refers to and their current addresses.
+ */
+static void record_uses(AsmContext *ctx, IncLine *item, const ParsedLine *parsed) {
+    int w;
+
+    item->relative = 0;
+    item->uses[0] = item->uses[1] = NULL;
+    item->used[0] = item->used[1] = 0;
+    for (w = 0; w < parsed->operand_count && w < 2; w++) {
+        char name[LABEL_LENGTH + 1];
+
+        if (!operand_label(&parsed->operands[w], name)) continue;
+        item->uses[w] = find_symbol(&ctx->symbols, name);
+        if (item->uses[w]) item->used[w] = item->uses[w]->address;
+        if (parsed->operands[w].type == OPERAND_RELATIVE) item->relative = 1;
+    }
+}
+
+/*
+ * encode_item:
+ * Encodes an instruction into its place in the code image, which already
+ * holds item->size words for it. Returns false on errors.
+ */
+static bool encode_item(AsmContext *ctx, IncLine *item, const ParsedLine *parsed, int line_number) {
+    unsigned short words[MAX_WORDS_PER_LINE];
+    bool has_error = false;
+    int count = encode_words(ctx, parsed, item->ic, line_number, words, &has_error);
+    int j;
+
+    if (count != item->size || has_error) return false;
+    for (j = 0; j < count; j++) {
+        ctx->code.words[item->ic - START_ADDRESS + j].value = words[j];
+    }
+    record_uses(ctx, item, parsed);
+    return true;
+}
+
+/*
+ * full_assembly:
+ * Assembles the whole source, as pre_assemble(), first_pass() and
+ * second_pass() do, while recording the lines, their addresses and the
+ * symbols they use.
+ */
+static bool full_assembly(IncState *st, AsmContext *ctx, MacroTable *library, const char *src, size_t len) {
+    char line[LINE_LENGTH + 2];
+    bool has_error = false;
+    PreAsm pa;
+    int IC = START_ADDRESS;
+    int i;
+
+    asm_context_reset(ctx, ctx->source_name, ctx->expanded_name);
+    st->valid = false;
+    st->expanded_ok = false;
+    st->first_pass_ok = false;
+    st->incremental = false;
+    st->reencoded = 0;
+    st->item_count = 0;
+    st->expanded_length = 0;
+
+    if (st->table) free_macro_table(st->table);
+    st->table = create_macro_table();
+    if (!st->table || !reserve_text(&st->source, &st->source_capacity, len + 1)
+        || !split_source(src, len, &st->lines, &st->line_count, &st->line_capacity)) {
+        diag_report(&ctx->diagnostics, LOG_ERR, ctx->source_name, 0, 0, "Memory allocation failed during pre-assembly");
+        return false;
+    }
+    st->table->parent = library;
+    memcpy(st->source, src, len);
+    st->source[len] = '\0';
+    st->source_length = len;
+
+    pre_asm_begin(&pa, ctx, st->table);
+    pa.track_origins = 0;
+    for (i = 0; i < st->line_count; i++) {
+        IncSourceLine *source_line = &st->lines[i];
+        size_t before = st->expanded_length;
+
+        if (diag_limit_reached(&ctx->diagnostics)) {
+            pa.had_error = 1;
+            break;
+        }
+        copy_line(line, st->source + source_line->offset, source_line->length);
+        source_line->first = st->item_count;
+        if (!pre_asm_line(&pa, line, &st->expanded, &st->expanded_length, &st->expanded_capacity)) break;
+        source_line->inside = (unsigned char)pa.inside_macro;
+        if (!split_items(st->expanded, before, st->expanded_length, &st->items, &st->item_count, &st->item_capacity)) {
+            diag_report(&ctx->diagnostics, LOG_ERR, ctx->source_name, pa.line_num, 0, "Memory allocation failed during pre-assembly");
+            pa.had_error = 1;
+            break;
+        }
+    }
+    if (!pre_asm_end(&pa)) return false;
+    st->expanded_ok = true;
+
+    ctx->IC = START_ADDRESS;
+    ctx->DC = 0;
+    for (i = 0; i < st->item_count; i++) {
+        IncLine *item = &st->items[i];
+        ParsedLine parsed;
+
+        if (diag_limit_reached(&ctx->diagnostics)) break;
+        ctx->counters.expanded_lines++;
+
+        copy_line(line, st->expanded + item->offset, item->length);
+        if (!parse_line(line, i + 1, &parsed)) {
+            diag_report(&ctx->diagnostics, LOG_ERR, ctx->expanded_name, i + 1, 0, "%s", parsed.err_msg[0] ? parsed.err_msg : "Syntax error or invalid line.");
+            has_error = true;
+            continue;
+        }
+
+        item->ic = ctx->IC;
+        item->dc = ctx->DC;
+        if (!first_pass_line(ctx, &parsed, i + 1)) has_error = true;
+        item->kind = (unsigned char)line_kind(&parsed);
+        item->size = (item->kind == INC_CODE) ? ctx->IC - item->ic : ctx->DC - item->dc;
+        if (parsed.label[0] != '\0' && (item->kind == INC_CODE || item->kind == INC_DATA)) {
+            item->label = find_symbol(&ctx->symbols, parsed.label);
+        }
+    }
+    if (!finish_first_pass(ctx, has_error)) return false;
+    st->first_pass_ok = true;
+
+    for (i = 0; i < st->item_count; i++) {
+        IncLine *item = &st->items[i];
+        unsigned short words[MAX_WORDS_PER_LINE];
+        ParsedLine parsed;
+        int count, j;
+
+        if (item->kind != INC_CODE && item->kind != INC_SYMBOLIC) continue;
+        if (diag_limit_reached(&ctx->diagnostics)) break;
+
+        copy_line(line, st->expanded + item->offset, item->length);
+        parse_line(line, i + 1, &parsed);
+        if (item->kind == INC_SYMBOLIC) {
+            if (parsed.directive == DIRECTIVE_ENTRY && !mark_entry_line(ctx, parsed.label, i + 1)) has_error = true;
+            continue;
+        }
+
+        count = encode_words(ctx, &parsed, IC, i + 1, words, &has_error);
+        if (count < 0) return false;
+        for (j = 0; j < count; j++) {
+            if (!add_machine_word(&ctx->code, IC + j, words[j])) {
+                diag_report(&ctx->diagnostics, LOG_ERR, ctx->expanded_name, i + 1, 0, "Memory allocation failed while writing machine code");
+                return false;
+            }
+        }
+        record_uses(ctx, item, &parsed);
+        IC += count;
+    }
+    ctx->code_length = IC - START_ADDRESS;
+
+    st->reparsed = st->item_count;
+    st->valid = !has_error && ctx->diagnostics.count == 0;
+    return !has_error;
+}
+
+static bool same_line(const IncState *st, int old_line, const char *src, const IncSourceLine *new_line) {
+    const IncSourceLine *old = &st->lines[old_line];
+    return old->length == new_line->length && memcmp(st->source + old->offset, src + new_line->offset, (size_t)old->length) == 0;
+}
+
+/* The pre-assembler takes any line containing "macro" for a definition */
+static bool mentions_macro(const char *text, int length) {
+    char line[LINE_LENGTH + 2];
+    copy_line(line, text, length);
+    return strstr(line, "macro") != NULL;
+}
+
+/*
+ * calls_later_macro:
+ * True if the line uses a macro of the source defined after line after
+ * (1-based): in order, it would not have been expanded there.
+ */
+static bool calls_later_macro(MacroTable *table, const char *text, int length, int after) {
+    char code_part[LINE_LENGTH + 2];
+    char *cursor = code_part;
+    char *semicolon;
+    char *token;
+    MacroTable *parent = table->parent;
+    bool later = false;
+
+    copy_line(code_part, text, length);
+    semicolon = strchr(code_part, ';');
+    if (semicolon) *semicolon = '\0';
+
+    table->parent = NULL;
+    for (token = next_token(&cursor, " \t\n"); token && !later; token = next_token(&cursor, " \t\n")) {
+        MacroEntry *macro = find_macro(table, token);
+        later = macro && macro->line > after;
+    }
+    table->parent = parent;
+    return later;
+}
+
+/* Moves the definition lines of the source macros after line after */
+static void shift_macro_lines(MacroTable *table, int after, int delta) {
+    size_t b;
+    for (b = 0; b < table->size; b++) {
+        MacroEntry *entry;
+        for (entry = table->buckets[b]; entry; entry = entry->next) {
+            if (entry->line > after) entry->line += delta;
+        }
+    }
+}
+
+/* True if an old item in [from, to) defines sym with the given kind */
+static bool defined_in(const IncState *st, int from, int to, const Symbol *sym, unsigned char kind) {
+    int j;
+    for (j = from; j < to; j++) {
+        if (st->items[j].label == sym) return st->items[j].kind == kind;
+    }
+    return false;
+}
+
+/* True if one of the new lines defines name */
+static bool defined_by(const ParsedLine *parsed, int count, const char *name) {
+    int k;
+    for (k = 0; k < count; k++) {
+        if ((parsed[k].type == LINE_COMMAND || parsed[k].type == LINE_DIRECTIVE) && strcmp(parsed[k].label, name) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * check_edit:
+ * The new lines must not have errors, and their labels must keep the
+ * symbol table consistent: each label of the old lines is defined again
+ * with the same kind, new labels are not defined elsewhere, and every
+ * operand label exists.
+ */
+static bool check_edit(IncState *st, AsmContext *ctx, const ParsedLine *parsed, int count, int E0, int E1) {
+    long labels = 0;
+    int j, k, w;
+
+    for (j = E0; j < E1; j++) {
+        if (st->items[j].kind == INC_SYMBOLIC) return false;
+        if (st->items[j].label) labels++;
+    }
+    if (labels * (long)count > INC_MAX_LABEL_CHECKS) return false;
+
+    for (j = E0; j < E1; j++) {
+        if (st->items[j].label && !defined_by(parsed, count, st->items[j].label->name)) return false;
+    }
+
+    for (k = 0; k < count; k++) {
+        IncKind kind = line_kind(&parsed[k]);
+
+        if (parsed[k].type == LINE_LABEL_ONLY || parsed[k].type == LINE_INVALID || kind == INC_SYMBOLIC) return false;
+
+        if (parsed[k].label[0] != '\0' && kind != INC_NONE) {
+            Symbol *sym = find_symbol(&ctx->symbols, parsed[k].label);
+
+            if (defined_by(parsed, k, parsed[k].label)) return false;
+            if (sym && !defined_in(st, E0, E1, sym, (unsigned char)kind)) return false;
+        }
+
+        for (w = 0; kind == INC_CODE && w < parsed[k].operand_count; w++) {
+            char name[LABEL_LENGTH + 1];
+
+            if (!operand_label(&parsed[k].operands[w], name)) continue;
+            if (!find_symbol(&ctx->symbols, name) && !defined_by(parsed, count, name)) return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * place_code:
+ * Resizes the code of the edited lines from old_words to new_words words,
+ * moving the code after them.
+ */
+static bool place_code(AsmContext *ctx, int ic_start, int old_words, int new_words) {
+    MachineCode *code = &ctx->code;
+    int delta = new_words - old_words;
+    int start = ic_start - START_ADDRESS;
+    int tail = code->size - (start + old_words);
+    int j;
+
+    if (code->size + delta > code->capacity) {
+        int new_capacity = code->capacity ? code->capacity : 64;
+        MemoryWord *temp;
+
+        while (new_capacity < code->size + delta) new_capacity *= 2;
+        temp = (MemoryWord *)ASM_REALLOC(code->words, new_capacity * sizeof(MemoryWord), MEM_CODE);
+        if (!temp) return false;
+        code->words = temp;
+        code->capacity = new_capacity;
+    }
+
+    memmove(code->words + start + new_words, code->words + start + old_words, tail * sizeof(MemoryWord));
+    code->size += delta;
+    for (j = start + new_words; delta != 0 && j < code->size; j++) {
+        code->words[j].address += delta;
+    }
+    for (j = 0; j < new_words; j++) {
+        code->words[start + j].address = ic_start + j;
+        code->words[start + j].value = 0;
+    }
+    return true;
+}
+
+/*
+ * update:
+ * Applies an edit to the kept assembly. Returns false if the edit cannot
+ * be followed; the context may then be half updated and must be
+ * assembled in full.
+ */
+static bool update(IncState *st, AsmContext *ctx, const char *src, size_t len) {
+    IncSourceLine *new_lines = NULL;
+    int new_count = 0, new_capacity = 0;
+    int old_count = st->line_count;
+    IncLine *fresh = NULL;
+    int fresh_count = 0, fresh_capacity = 0;
+    ParsedLine *parsed = NULL;
+    char *text = NULL;
+    size_t text_length = 0, text_capacity = 0;
+    char line[LINE_LENGTH + 2];
+    int p = 0, s = 0, old_end, new_end, E0, E1;
+    int ic_start, ic_end, dc_start, dc_end, ic, dc, dIC, dDC, dItems;
+    size_t byte_start, byte_end;
+    bool ok = false;
+    PreAsm pa;
+    int i, k;
+
+    if (!st->valid || !st->table) return false;
+    if (!split_source(src, len, &new_lines, &new_count, &new_capacity)) return false;
+
+    while (p < old_count && p < new_count && same_line(st, p, src, &new_lines[p])) p++;
+    while (s < old_count - p && s < new_count - p
+           && same_line(st, old_count - 1 - s, src, &new_lines[new_count - 1 - s])) {
+        s++;
+    }
+    old_end = old_count - s;
+    new_end = new_count - s;
+
+    st->incremental = true;
+    st->reparsed = 0;
+    st->reencoded = 0;
+    if (p == old_end && p == new_end) {
+        ASM_FREE(new_lines);
+        return true;
+    }
+
+    /* The macro state must be the same before, inside and after the edit */
+    if (p > 0 && st->lines[p - 1].inside) goto done;
+    for (i = p; i < old_end; i++) {
+        if (mentions_macro(st->source + st->lines[i].offset, st->lines[i].length)) goto done;
+    }
+    for (i = p; i < new_end; i++) {
+        if (mentions_macro(src + new_lines[i].offset, new_lines[i].length)
+            || calls_later_macro(st->table, src + new_lines[i].offset, new_lines[i].length, p)) {
+            goto done;
+        }
+    }
+
+    E0 = first_item(st, p);
+    E1 = first_item(st, old_end);
+
+    ctx->diagnostics.count = 0;
+    ctx->diagnostics.error_count = 0;
+    ctx->diagnostics.suppressed = 0;
+    ctx->diagnostics.flushed = 0;
+
+    pre_asm_begin(&pa, ctx, st->table);
+    pa.track_origins = 0;
+    pa.line_num = p;
+    for (i = p; i < new_end; i++) {
+        size_t before = text_length;
+
+        copy_line(line, src + new_lines[i].offset, new_lines[i].length);
+        new_lines[i].first = E0 + fresh_count;
+        if (!pre_asm_line(&pa, line, &text, &text_length, &text_capacity)) break;
+        if (!split_items(text, before, text_length, &fresh, &fresh_count, &fresh_capacity)) {
+            pa.had_error = 1;
+            break;
+        }
+    }
+    if (!pre_asm_end(&pa)) goto done;
+
+    if (fresh_count > 0) {
+        parsed = (ParsedLine *)ASM_MALLOC(fresh_count * sizeof(ParsedLine), MEM_LINE);
+        if (!parsed) goto done;
+    }
+    for (k = 0; k < fresh_count; k++) {
+        copy_line(line, text + fresh[k].offset, fresh[k].length);
+        if (!parse_line(line, E0 + k + 1, &parsed[k])) goto done;
+    }
+    st->reparsed = fresh_count;
+    if (!check_edit(st, ctx, parsed, fresh_count, E0, E1)) goto done;
+
+    /* Size the new lines; their data is appended to the image for now */
+    ic_start = E0 < st->item_count ? st->items[E0].ic : ctx->IC;
+    dc_start = E0 < st->item_count ? st->items[E0].dc : ctx->DC;
+    ic_end = E1 < st->item_count ? st->items[E1].ic : ctx->IC;
+    dc_end = E1 < st->item_count ? st->items[E1].dc : ctx->DC;
+    ic = ic_start;
+    dc = dc_start;
+    for (k = 0; k < fresh_count; k++) {
+        fresh[k].kind = (unsigned char)line_kind(&parsed[k]);
+        fresh[k].ic = ic;
+        fresh[k].dc = dc;
+        if (fresh[k].kind == INC_CODE) {
+            add_command(&parsed[k], &ic);
+            fresh[k].size = ic - fresh[k].ic;
+        } else if (fresh[k].kind == INC_DATA) {
+            if (!add_data(ctx, &parsed[k], &dc)) goto done;
+            fresh[k].size = dc - fresh[k].dc;
+        }
+    }
+    dIC = ic - ic_end;
+    dDC = dc - dc_end;
+
+    /* Data: before the edit, the new words, then the rest */
+    if (dc_end > dc_start || dc > dc_start) {
+        DataRange ranges[3];
+        int image_size = ctx->DC;
+
+        ranges[0].start = 0;
+        ranges[0].count = dc_start;
+        ranges[1].start = image_size;
+        ranges[1].count = dc - dc_start;
+        ranges[2].start = dc_end;
+        ranges[2].count = image_size - dc_end;
+        if (!data_image_arrange(&ctx->data, ranges, 3)) goto done;
+
+        /* Replaced literal words stay in the word array until the next full assembly */
+        if (ctx->data.word_count > 2 * ctx->data.size + 4096) goto done;
+    }
+
+    if (!place_code(ctx, ic_start, ic_end - ic_start, ic - ic_start)) goto done;
+
+    /* Move the symbols: the code after the edit by dIC, all data by the new code size */
+    for (i = 0; i < E0; i++) {
+        if (st->items[i].label && st->items[i].kind == INC_DATA) st->items[i].label->address += dIC;
+    }
+    for (i = E1; i < st->item_count; i++) {
+        IncLine *item = &st->items[i];
+        item->ic += dIC;
+        item->dc += dDC;
+        if (item->label) item->label->address += (item->kind == INC_DATA) ? dIC + dDC : dIC;
+    }
+    ctx->IC += dIC;
+    ctx->DC += dDC;
+    ctx->code_length = ctx->IC - START_ADDRESS;
+
+    /* A program the edit pushed past the end of memory is reported by a full assembly */
+    if (ctx->IC + ctx->DC > ctx->memory_size) goto done;
+
+    for (k = 0; k < fresh_count; k++) {
+        int address = (fresh[k].kind == INC_DATA) ? fresh[k].dc + ctx->IC : fresh[k].ic;
+        Symbol *sym;
+
+        if (parsed[k].label[0] == '\0' || (fresh[k].kind != INC_CODE && fresh[k].kind != INC_DATA)) continue;
+        sym = find_symbol(&ctx->symbols, parsed[k].label);
+        if (sym) {
+            sym->address = address;
+        } else {
+            add_symbol(&ctx->symbols, parsed[k].label, address, fresh[k].kind == INC_DATA ? SYMBOL_DATA : SYMBOL_CODE);
+            sym = find_symbol(&ctx->symbols, parsed[k].label);
+            if (!sym) goto done;
+        }
+        fresh[k].label = sym;
+    }
+
+    for (k = 0; k < fresh_count; k++) {
+        if (fresh[k].kind == INC_CODE && !encode_item(ctx, &fresh[k], &parsed[k], E0 + k + 1)) goto done;
+    }
+
+    /* Splice the expanded text and the items */
+    byte_start = E0 < st->item_count ? st->items[E0].offset : st->expanded_length;
+    byte_end = E1 < st->item_count ? st->items[E1].offset : st->expanded_length;
+    if (!reserve_text(&st->expanded, &st->expanded_capacity, st->expanded_length - (byte_end - byte_start) + text_length + 1)) goto done;
+    memmove(st->expanded + byte_start + text_length, st->expanded + byte_end, st->expanded_length - byte_end + 1);
+    if (text_length > 0) memcpy(st->expanded + byte_start, text, text_length);
+    st->expanded_length = st->expanded_length - (byte_end - byte_start) + text_length;
+
+    dItems = fresh_count - (E1 - E0);
+    {
+        IncLine *temp = (IncLine *)grow(st->items, &st->item_capacity, st->item_count + dItems, sizeof(IncLine));
+        if (!temp) goto done;
+        st->items = temp;
+    }
+    memmove(st->items + E0 + fresh_count, st->items + E1, (st->item_count - E1) * sizeof(IncLine));
+    for (k = 0; k < fresh_count; k++) {
+        fresh[k].offset += byte_start;
+        st->items[E0 + k] = fresh[k];
+    }
+    st->item_count += dItems;
+    for (i = E0 + fresh_count; i < st->item_count; i++) {
+        st->items[i].offset = st->items[i].offset + text_length - (byte_end - byte_start);
+    }
+
+    /* Source lines: the kept ones move by the change in expanded lines */
+    for (i = 0; i < p; i++) {
+        new_lines[i].first = st->lines[i].first;
+        new_lines[i].inside = st->lines[i].inside;
+    }
+    for (i = new_end; i < new_count; i++) {
+        new_lines[i].first = st->lines[i - new_count + old_count].first + dItems;
+        new_lines[i].inside = st->lines[i - new_count + old_count].inside;
+    }
+    shift_macro_lines(st->table, old_end, new_end - old_end);
+    ASM_FREE(st->lines);
+    st->lines = new_lines;
+    st->line_count = new_count;
+    st->line_capacity = new_capacity;
+    new_lines = NULL;
+
+    if (!reserve_text(&st->source, &st->source_capacity, len + 1)) {
+        st->valid = false;
+        goto done;
+    }
+    memcpy(st->source, src, len);
+    st->source[len] = '\0';
+    st->source_length = len;
+
+    /* Encode again the instructions whose operands moved */
+    for (i = 0; i < st->item_count; i++) {
+        IncLine *item = &st->items[i];
+        bool moved = i >= E0 + fresh_count && dIC != 0;
+        ParsedLine kept;
+
+        if (item->kind != INC_CODE || (i >= E0 && i < E0 + fresh_count)) continue;
+        if (!(moved && item->relative)
+            && !(item->uses[0] && item->uses[0]->address != item->used[0])
+            && !(item->uses[1] && item->uses[1]->address != item->used[1])) {
+            continue;
+        }
+        copy_line(line, st->expanded + item->offset, item->length);
+        parse_line(line, i + 1, &kept);
+        if (!encode_item(ctx, item, &kept, i + 1)) goto done;
+        st->reencoded++;
+    }
+
+    st->valid = ctx->diagnostics.count == 0;
+    ok = st->valid;
+
+done:
+    ASM_FREE(new_lines);
+    ASM_FREE(fresh);
+    ASM_FREE(parsed);
+    ASM_FREE(text);
+    if (!ok) st->valid = false;
+    return ok;
+}
+
+bool inc_assemble(IncState *st, AsmContext *ctx, MacroTable *library, const char *src, size_t len) {
+    if (update(st, ctx, src, len)) return true;
+    return full_assembly(st, ctx, library, src, len);
+}
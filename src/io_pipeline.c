@@ -0,0 +1,250 @@
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "io_pipeline.h"
+#include "utils.h"
+#include "trace.h"
+#include "asm_alloc.h"
+
+typedef enum {
+    SLOT_PENDING,
+    SLOT_READY,
+    SLOT_FAILED,
+    SLOT_TAKEN
+} SlotState;
+
+typedef struct {
+    SlotState state;
+    char *data;
+    size_t length;
+} IoSlot;
+
+typedef struct IoWrite {
+    char *path;
+    char *data;
+    size_t length;
+    struct IoWrite *next;
+} IoWrite;
+
+struct IoPipeline {
+    const char *const *paths;
+    int count;
+    IoSlot *slots;
+    int taken;                  /* files handed out by io_pipeline_read() */
+    IoWrite *head;              /* queued writes, oldest first */
+    IoWrite *tail;
+    size_t queued_bytes;
+    int failed_writes;
+    int stopping;
+    bool threaded;
+    bool has_reader;
+    bool has_writer;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;     /* any state change; waiters recheck their condition */
+    pthread_t reader;
+    pthread_t writer;
+};
+
+/*
+ * write_whole_file:
+ * Writes one output file. Returns false (and reports it) on failure.
+ */
+static bool write_whole_file(const char *path, const char *data, size_t length) {
+    FILE *file;
+    bool ok;
+
+    trace_begin("io", path);
+    file = fopen(path, "wb");
+    if (!file) {
+        trace_end("io", path);
+        fprintf(stderr, "Error: Cannot write to output file %s\n", path);
+        return false;
+    }
+    ok = fwrite(data, 1, length, file) == length;
+    if (fclose(file) != 0) ok = false;
+    trace_end("io", path);
+    if (!ok) fprintf(stderr, "Error: Cannot write to output file %s\n", path);
+    return ok;
+}
+
+static void *reader_main(void *arg) {
+    IoPipeline *io = (IoPipeline *)arg;
+    int i;
+
+    for (i = 0; i < io->count; i++) {
+        char *data;
+        size_t length = 0;
+
+        pthread_mutex_lock(&io->lock);
+        while (!io->stopping && i - io->taken >= IO_PREFETCH_FILES) {
+            pthread_cond_wait(&io->changed, &io->lock);
+        }
+        if (io->stopping) {
+            pthread_mutex_unlock(&io->lock);
+            break;
+        }
+        pthread_mutex_unlock(&io->lock);
+
+        trace_begin("io", io->paths[i]);
+        data = read_file(io->paths[i], &length);
+        trace_end("io", io->paths[i]);
+
+        pthread_mutex_lock(&io->lock);
+        io->slots[i].data = data;
+        io->slots[i].length = length;
+        io->slots[i].state = data ? SLOT_READY : SLOT_FAILED;
+        pthread_cond_broadcast(&io->changed);
+        pthread_mutex_unlock(&io->lock);
+    }
+    return NULL;
+}
+
+static void *writer_main(void *arg) {
+    IoPipeline *io = (IoPipeline *)arg;
+
+    pthread_mutex_lock(&io->lock);
+    for (;;) {
+        IoWrite *item;
+        bool ok;
+
+        while (!io->head && !io->stopping) {
+            pthread_cond_wait(&io->changed, &io->lock);
+        }
+        if (!io->head) break;
+
+        item = io->head;
+        io->head = item->next;
+        if (!io->head) io->tail = NULL;
+        pthread_mutex_unlock(&io->lock);
+
+        ok = write_whole_file(item->path, item->data, item->length);
+
+        pthread_mutex_lock(&io->lock);
+        io->queued_bytes -= item->length;
+        if (!ok) io->failed_writes++;
+        pthread_cond_broadcast(&io->changed);
+        ASM_FREE(item->data);
+        ASM_FREE(item->path);
+        ASM_FREE(item);
+    }
+    pthread_mutex_unlock(&io->lock);
+    return NULL;
+}
+
+IoPipeline *io_pipeline_start(const char *const *paths, int count, bool threaded) {
+    IoPipeline *io = (IoPipeline *)ASM_CALLOC(1, sizeof(IoPipeline), MEM_OTHER);
+
+    if (!io) return NULL;
+    io->paths = paths;
+    io->count = count;
+    if (count > 0) {
+        io->slots = (IoSlot *)ASM_CALLOC((size_t)count, sizeof(IoSlot), MEM_OTHER);
+        if (!io->slots) {
+            ASM_FREE(io);
+            return NULL;
+        }
+    }
+
+    pthread_mutex_init(&io->lock, NULL);
+    pthread_cond_init(&io->changed, NULL);
+
+    /* Without a helper, the reads and writes happen in the calling thread */
+    if (threaded) {
+        io->has_reader = count > 0 && pthread_create(&io->reader, NULL, reader_main, io) == 0;
+        io->has_writer = pthread_create(&io->writer, NULL, writer_main, io) == 0;
+    }
+    io->threaded = io->has_reader;
+    return io;
+}
+
+char *io_pipeline_read(IoPipeline *io, int index, size_t *length) {
+    IoSlot *slot = &io->slots[index];
+    char *data;
+
+    if (!io->threaded) {
+        data = read_file(io->paths[index], length);
+        slot->state = SLOT_TAKEN;
+        return data;
+    }
+
+    pthread_mutex_lock(&io->lock);
+    if (index + 1 > io->taken) {
+        io->taken = index + 1;
+        pthread_cond_broadcast(&io->changed);
+    }
+    while (slot->state == SLOT_PENDING) {
+        pthread_cond_wait(&io->changed, &io->lock);
+    }
+    data = slot->data;
+    if (length) *length = slot->length;
+    slot->data = NULL;
+    slot->state = SLOT_TAKEN;
+    pthread_mutex_unlock(&io->lock);
+    return data;
+}
+
+bool io_pipeline_write(IoPipeline *io, const char *path, char *data, size_t length) {
+    IoWrite *item;
+    bool ok;
+
+    if (!io->has_writer) {
+        ok = write_whole_file(path, data, length);
+        if (!ok) io->failed_writes++;
+        ASM_FREE(data);
+        return ok;
+    }
+
+    item = (IoWrite *)ASM_MALLOC(sizeof(IoWrite), MEM_OTHER);
+    if (item) item->path = strdup_c90(path);
+    if (!item || !item->path) {
+        /* No room to queue it; write it now */
+        ASM_FREE(item);
+        ok = write_whole_file(path, data, length);
+        pthread_mutex_lock(&io->lock);
+        if (!ok) io->failed_writes++;
+        pthread_mutex_unlock(&io->lock);
+        ASM_FREE(data);
+        return ok;
+    }
+    item->data = data;
+    item->length = length;
+    item->next = NULL;
+
+    pthread_mutex_lock(&io->lock);
+    while (io->head && io->queued_bytes + length > IO_WRITE_LIMIT) {
+        pthread_cond_wait(&io->changed, &io->lock);
+    }
+    if (io->tail) {
+        io->tail->next = item;
+    } else {
+        io->head = item;
+    }
+    io->tail = item;
+    io->queued_bytes += length;
+    pthread_cond_broadcast(&io->changed);
+    pthread_mutex_unlock(&io->lock);
+    return true;
+}
+
+int io_pipeline_finish(IoPipeline *io) {
+    int failed;
+    int i;
+
+    pthread_mutex_lock(&io->lock);
+    io->stopping = 1;
+    pthread_cond_broadcast(&io->changed);
+    pthread_mutex_unlock(&io->lock);
+
+    if (io->has_reader) pthread_join(io->reader, NULL);
+    if (io->has_writer) pthread_join(io->writer, NULL);
+
+    for (i = 0; i < io->count; i++) {
+        ASM_FREE(io->slots[i].data);
+    }
+    failed = io->failed_writes;
+    pthread_cond_destroy(&io->changed);
+    pthread_mutex_destroy(&io->lock);
+    ASM_FREE(io->slots);
+    ASM_FREE(io);
+    return failed;
+}
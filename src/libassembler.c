@@ -0,0 +1,378 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libassembler.h"
+#include "asm_context.h"
+#include "pre_asm.h"
+#include "incremental.h"
+#include "file_writer.h"
+#include "asm_alloc.h"
+
+struct AsmSession {
+    AsmContext ctx;
+    MacroTable *library;
+};
+
+struct AsmDocument {
+    AsmSession *session;
+    char source_name[ASM_NAME_LEN];     /* names the kept context points at */
+    char expanded_name[ASM_NAME_LEN];
+    AsmContext ctx;
+    IncState inc;
+};
+
+/*
+ * asm_options_init:
+ * Fills options with the defaults used by assemble_buffer().
+ */
+void asm_options_init(AsmOptions *options) {
+    options->name = "input.as";
+    options->echo_diagnostics = false;
+    options->format_object = false;
+    options->max_errors = 0;
+    options->pool = 0;
+    options->strip_data = false;
+    options->optimize = false;
+}
+
+/*
+ * copy_symbols:
+ * Copies the context symbol table into the result, in definition order.
+ */
+static bool copy_symbols(const AsmContext *ctx, AsmResult *result) {
+    const Symbol *sym;
+    int count = 0, i;
+
+    for (sym = ctx->symbols.head; sym; sym = sym->next) count++;
+    if (count == 0) return true;
+
+    result->symbols = (AsmSymbol *)ASM_MALLOC(count * sizeof(AsmSymbol), MEM_RESULT);
+    if (!result->symbols) return false;
+
+    /* The table is a stack; fill from the back to restore source order */
+    i = count;
+    for (sym = ctx->symbols.head; sym; sym = sym->next) {
+        AsmSymbol *out = &result->symbols[--i];
+        strncpy(out->name, sym->name, ASM_SYMBOL_NAME_LEN - 1);
+        out->name[ASM_SYMBOL_NAME_LEN - 1] = '\0';
+        out->address = sym->address;
+        out->kind = (AsmSymbolKind)sym->type;
+    }
+    result->symbol_count = count;
+    return true;
+}
+
+/*
+ * copy_words:
+ * Copies count machine words starting at the given index into a new array.
+ */
+static AsmWord *copy_words(const MachineCode *code, int first, int count) {
+    AsmWord *words;
+    int i;
+
+    if (count <= 0) return NULL;
+    words = (AsmWord *)ASM_MALLOC(count * sizeof(AsmWord), MEM_RESULT);
+    if (!words) return NULL;
+
+    for (i = 0; i < count; i++) {
+        words[i].address = code->words[first + i].address;
+        words[i].value = code->words[first + i].value;
+    }
+    return words;
+}
+
+/*
+ * expand_data:
+ * Writes out the data image as words from the given address.
+ */
+static AsmWord *expand_data(const DataImage *data, int address) {
+    AsmWord *words;
+    int s, i, n = 0;
+
+    if (data->size <= 0) return NULL;
+    words = (AsmWord *)ASM_MALLOC(data->size * sizeof(AsmWord), MEM_RESULT);
+    if (!words) return NULL;
+
+    for (s = 0; s < data->segment_count; s++) {
+        const DataSegment *segment = &data->segments[s];
+        for (i = 0; i < segment->count; i++, n++) {
+            words[n].address = address + n;
+            words[n].value = data_segment_word(data, segment, i);
+        }
+    }
+    return words;
+}
+
+static bool copy_diagnostics(const AsmContext *ctx, AsmResult *result) {
+    int i;
+
+    result->error_count = ctx->diagnostics.error_count;
+    if (ctx->diagnostics.count == 0) return true;
+
+    result->diagnostics = (AsmDiagnostic *)ASM_MALLOC(ctx->diagnostics.count * sizeof(AsmDiagnostic), MEM_RESULT);
+    if (!result->diagnostics) return false;
+
+    for (i = 0; i < ctx->diagnostics.count; i++) {
+        const Diagnostic *in = &ctx->diagnostics.items[i];
+        AsmDiagnostic *out = &result->diagnostics[i];
+        out->level = (in->level == LOG_ERR) ? ASM_DIAG_ERROR : ASM_DIAG_WARNING;
+        /* A document context keeps its own copy of the names */
+        if (in->file == ctx->source_name) out->file = result->source_name;
+        else if (in->file == ctx->expanded_name) out->file = result->expanded_name;
+        else out->file = in->file;
+        out->line = in->line;
+        out->column = in->col;
+        strncpy(out->message, in->message, ASM_MESSAGE_LEN - 1);
+        out->message[ASM_MESSAGE_LEN - 1] = '\0';
+    }
+    result->diagnostic_count = ctx->diagnostics.count;
+    return true;
+}
+
+/*
+ * set_result_names:
+ * Stores the source name and the derived .am name in the result; the
+ * diagnostics recorded during the run point at these copies.
+ */
+static void set_result_names(AsmResult *result, const AsmOptions *options) {
+    size_t name_len;
+
+    memset(result, 0, sizeof(*result));
+    strncpy(result->source_name, options->name ? options->name : "input.as", ASM_NAME_LEN - 1);
+
+    strcpy(result->expanded_name, result->source_name);
+    name_len = strlen(result->expanded_name);
+    if (name_len >= 3 && strcmp(result->expanded_name + name_len - 3, ".as") == 0) {
+        result->expanded_name[name_len - 1] = 'm';
+    } else if (name_len + 3 < ASM_NAME_LEN) {
+        strcat(result->expanded_name, ".am");
+    }
+}
+
+/*
+ * copy_images:
+ * Copies the code and data images into the result, and the .ob text if
+ * it was asked for.
+ */
+static bool copy_images(AsmContext *ctx, const AsmOptions *options, AsmResult *result) {
+    result->code_count = ctx->code.size;
+    result->data_count = ctx->data.size;
+    result->code = copy_words(&ctx->code, 0, result->code_count);
+    result->data = expand_data(&ctx->data, START_ADDRESS + ctx->code_length);
+    if ((result->code_count > 0 && !result->code) || (result->data_count > 0 && !result->data)) {
+        diag_report(&ctx->diagnostics, LOG_ERR, ctx->source_name, 0, 0, "Memory allocation failed while copying the image");
+        return false;
+    }
+
+    if (options->format_object) {
+        result->object = format_object(ctx, &result->object_length);
+        if (!result->object) return false;
+    }
+    return true;
+}
+
+/*
+ * run_assembly:
+ * Runs pre-assembly and both passes over an in-memory source using the
+ * given (fresh or reset) context, and fills in the result.
+ */
+static bool run_assembly(AsmContext *ctx, MacroTable *library, const char *src, size_t len, const AsmOptions *options, AsmResult *result) {
+    MacroTable *table;
+    bool ok = false;
+
+    ctx->diagnostics.echo = options->echo_diagnostics;
+    ctx->diagnostics.max_errors = options->max_errors;
+    ctx->pool.mode = (options->pool & ASM_POOL_STRINGS ? POOL_STRINGS : 0)
+                   | (options->pool & ASM_POOL_DATA ? POOL_DATA : 0);
+    ctx->strip.enabled = options->strip_data;
+    ctx->peep.enabled = options->optimize;
+
+    table = create_macro_table();
+    if (!table) {
+        diag_report(&ctx->diagnostics, LOG_ERR, ctx->source_name, 0, 0, "Failed to allocate macro table.");
+    } else {
+        table->parent = library;
+        result->expanded = pre_assemble(ctx, table, src, len, &result->expanded_length);
+        free_macro_table(table);
+    }
+
+    if (result->expanded && first_pass(ctx, result->expanded, result->expanded_length)) {
+        ok = second_pass(ctx, result->expanded, result->expanded_length);
+        if (!copy_images(ctx, options, result)) ok = false;
+    }
+
+    if (!copy_symbols(ctx, result)) ok = false;
+    if (!copy_diagnostics(ctx, result)) ok = false;
+
+    result->success = ok;
+    return ok;
+}
+
+/*
+ * assemble_buffer:
+ * One-shot assembly of an in-memory source.
+ */
+bool assemble_buffer(const char *src, size_t len, const AsmOptions *options, AsmResult *result) {
+    AsmOptions defaults;
+    AsmContext ctx;
+    bool ok;
+
+    if (!options) {
+        asm_options_init(&defaults);
+        options = &defaults;
+    }
+
+    set_result_names(result, options);
+    asm_context_init(&ctx, result->source_name, result->expanded_name);
+    ok = run_assembly(&ctx, NULL, src, len, options, result);
+    asm_context_free(&ctx);
+    return ok;
+}
+
+AsmSession *asm_session_create(void) {
+    AsmSession *session = (AsmSession *)ASM_MALLOC(sizeof(AsmSession), MEM_RESULT);
+    if (!session) return NULL;
+
+    session->library = create_macro_table();
+    if (!session->library) {
+        ASM_FREE(session);
+        return NULL;
+    }
+    asm_context_init(&session->ctx, NULL, NULL);
+    return session;
+}
+
+/*
+ * asm_session_load_macros:
+ * Pre-assembles a macro library source; its definitions stay in the session
+ * and are visible to every later assembly. Code outside macros is ignored.
+ */
+bool asm_session_load_macros(AsmSession *session, const char *src, size_t len, const AsmOptions *options) {
+    AsmOptions defaults;
+    AsmContext *ctx = &session->ctx;
+    char *expanded;
+
+    if (!options) {
+        asm_options_init(&defaults);
+        options = &defaults;
+    }
+
+    asm_context_reset(ctx, options->name ? options->name : "library.as", NULL);
+    ctx->diagnostics.echo = options->echo_diagnostics;
+
+    expanded = pre_assemble(ctx, session->library, src, len, NULL);
+    ASM_FREE(expanded);
+    return expanded != NULL;
+}
+
+bool asm_session_assemble(AsmSession *session, const char *src, size_t len, const AsmOptions *options, AsmResult *result) {
+    AsmOptions defaults;
+
+    if (!options) {
+        asm_options_init(&defaults);
+        options = &defaults;
+    }
+
+    set_result_names(result, options);
+    asm_context_reset(&session->ctx, result->source_name, result->expanded_name);
+    return run_assembly(&session->ctx, session->library, src, len, options, result);
+}
+
+void asm_session_destroy(AsmSession *session) {
+    if (!session) return;
+    free_macro_table(session->library);
+    asm_context_free(&session->ctx);
+    ASM_FREE(session);
+}
+
+AsmDocument *asm_document_create(AsmSession *session) {
+    AsmDocument *doc = (AsmDocument *)ASM_MALLOC(sizeof(AsmDocument), MEM_RESULT);
+    if (!doc) return NULL;
+
+    doc->session = session;
+    doc->source_name[0] = '\0';
+    doc->expanded_name[0] = '\0';
+    asm_context_init(&doc->ctx, doc->source_name, doc->expanded_name);
+    inc_init(&doc->inc);
+    return doc;
+}
+
+/*
+ * asm_document_assemble:
+ * Assembles the next version of the document. Pooling, stripping and the
+ * optimizer rewrite the whole image, so with any of them on the source
+ * is assembled in full and nothing is kept.
+ */
+bool asm_document_assemble(AsmDocument *doc, const char *src, size_t len, const AsmOptions *options, AsmResult *result) {
+    AsmOptions defaults;
+    AsmContext *ctx = &doc->ctx;
+    MacroTable *library = doc->session ? doc->session->library : NULL;
+    bool ok;
+
+    if (!options) {
+        asm_options_init(&defaults);
+        options = &defaults;
+    }
+
+    set_result_names(result, options);
+    if (strcmp(doc->source_name, result->source_name) != 0) {
+        strcpy(doc->source_name, result->source_name);
+        strcpy(doc->expanded_name, result->expanded_name);
+        inc_invalidate(&doc->inc);
+    }
+
+    if (options->pool || options->strip_data || options->optimize) {
+        inc_invalidate(&doc->inc);
+        asm_context_reset(ctx, doc->source_name, doc->expanded_name);
+        return run_assembly(ctx, library, src, len, options, result);
+    }
+
+    ctx->diagnostics.echo = options->echo_diagnostics;
+    ctx->diagnostics.max_errors = options->max_errors;
+    ctx->pool.mode = 0;
+    ctx->strip.enabled = false;
+    ctx->peep.enabled = false;
+
+    ok = inc_assemble(&doc->inc, ctx, library, src, len);
+
+    if (doc->inc.expanded_ok) {
+        result->expanded = (char *)ASM_MALLOC(doc->inc.expanded_length + 1, MEM_RESULT);
+        if (result->expanded) {
+            memcpy(result->expanded, doc->inc.expanded ? doc->inc.expanded : "", doc->inc.expanded_length);
+            result->expanded[doc->inc.expanded_length] = '\0';
+            result->expanded_length = doc->inc.expanded_length;
+        } else {
+            ok = false;
+        }
+    }
+    if (doc->inc.first_pass_ok && !copy_images(ctx, options, result)) ok = false;
+    if (!copy_symbols(ctx, result)) ok = false;
+    if (!copy_diagnostics(ctx, result)) ok = false;
+
+    /* A failed copy leaves the kept state intact; only errors in the source drop it */
+    result->incremental = doc->inc.incremental;
+    result->reencoded = doc->inc.reencoded;
+    result->success = ok;
+    return ok;
+}
+
+void asm_document_reset(AsmDocument *doc) {
+    inc_invalidate(&doc->inc);
+}
+
+void asm_document_destroy(AsmDocument *doc) {
+    if (!doc) return;
+    inc_free(&doc->inc);
+    asm_context_free(&doc->ctx);
+    ASM_FREE(doc);
+}
+
+void asm_result_free(AsmResult *result) {
+    ASM_FREE(result->expanded);
+    ASM_FREE(result->object);
+    ASM_FREE(result->code);
+    ASM_FREE(result->data);
+    ASM_FREE(result->symbols);
+    ASM_FREE(result->diagnostics);
+    memset(result, 0, sizeof(*result));
+}
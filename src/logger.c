@@ -1,9 +1,24 @@
 #include "logger.h"
+#include "asm_alloc.h"
 #include <time.h>
 #include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
 
-/* Current minimum log level to display */
-static LogLevel current_log_level = LOG_DEBUG;
+#define LOG_LINE_LEN 1024
+
+/* Current minimum log level to display; read inline by the ASM_LOG_* macros */
+LogLevel asm_log_level = LOG_DEBUG;
+
+/* Output format of assembler diagnostics */
+static DiagFormat diag_format = DIAG_FORMAT_TEXT;
+
+/* Timestamp of the last log line; reformatted only when the second changes */
+static pthread_mutex_t time_lock = PTHREAD_MUTEX_INITIALIZER;
+static time_t cached_time = (time_t)-1;
+static char cached_time_buf[9];
 
 /*
  * level_to_str:
@@ -29,7 +44,54 @@ static const char *level_to_str(LogLevel level) {
  * Sets the current logging level.
  */
 void asm_log_set_level(LogLevel level) {
-    current_log_level = level;
+    asm_log_level = level;
+}
+
+/*
+ * asm_diag_set_format:
+ * Selects text or JSON output for assembler diagnostics.
+ */
+void asm_diag_set_format(DiagFormat format) {
+    diag_format = format;
+}
+
+/*
+ * current_timestamp:
+ * Copies the "HH:MM:SS" of the current second into buf.
+ */
+static void current_timestamp(char *buf) {
+    time_t t = time(NULL);
+
+    pthread_mutex_lock(&time_lock);
+    if (t != cached_time) {
+        struct tm tm_info;
+        localtime_r(&t, &tm_info);
+        strftime(cached_time_buf, sizeof(cached_time_buf), "%H:%M:%S", &tm_info);
+        cached_time = t;
+    }
+    memcpy(buf, cached_time_buf, sizeof(cached_time_buf));
+    pthread_mutex_unlock(&time_lock);
+}
+
+/*
+ * write_all:
+ * Writes a fully formatted block with one call so that lines coming from
+ * different threads do not interleave.
+ */
+static void write_all(FILE *out, const char *buf, size_t len) {
+    flockfile(out);
+    fwrite(buf, 1, len, out);
+    fflush(out);
+    funlockfile(out);
+}
+
+/*
+ * bounded_length:
+ * Length actually stored by a vsnprintf() that returned n into a size buffer.
+ */
+static size_t bounded_length(int n, size_t size) {
+    if (n < 0) return 0;
+    return ((size_t)n < size) ? (size_t)n : size - 1;
 }
 
 /*
@@ -37,51 +99,87 @@ void asm_log_set_level(LogLevel level) {
  * Generic logger for normal messages with timestamp and level.
  */
 void log_internal(LogLevel level, const char *fmt, va_list args) {
-    time_t t;
-    struct tm *tm_info;
+    char line[LOG_LINE_LEN];
     char time_buf[9];
+    size_t len;
 
-    if (level < current_log_level) {
+    if (level < asm_log_level) {
         return;
     }
 
-    t = time(NULL);
-    tm_info = localtime(&t);
-    strftime(time_buf, sizeof(time_buf), "%H:%M:%S", tm_info);
+    current_timestamp(time_buf);
 
-    printf("[%s] %s | ", time_buf, level_to_str(level));
+    len = bounded_length(sprintf(line, "[%s] %s | ", time_buf, level_to_str(level)), sizeof(line));
+    len += bounded_length(vsnprintf(line + len, sizeof(line) - len - 1, fmt, args), sizeof(line) - len - 1);
+    line[len++] = '\n';
 
-    vprintf(fmt, args);
+    write_all(stdout, line, len);
+}
 
-    printf("\n");
+/*
+ * json_escape:
+ * Appends s to out as the body of a JSON string. Returns the new length.
+ */
+static size_t json_escape(char *out, size_t len, size_t size, const char *s) {
+    for (; *s && len + 7 < size; s++) {
+        if (*s == '"' || *s == '\\') {
+            out[len++] = '\\';
+            out[len++] = *s;
+        } else if ((unsigned char)*s < 0x20) {
+            len += (size_t)sprintf(out + len, "\\u%04x", (unsigned char)*s);
+        } else {
+            out[len++] = *s;
+        }
+    }
+    return len;
 }
 
-void log_asm_internal(LogLevel level, const char *file, int line, int col, const char *fmt, va_list args) {
-    const char *bold = "\033[1m";
-    const char *reset = "\033[0m";
-    const char *red_bold = "\033[1;31m";
-    const char *yellow_bold = "\033[1;33m";
-    const char *label_color;
-    const char *label;
-
-    if (level < current_log_level) {
-        return;
+/*
+ * format_diagnostic:
+ * Renders one diagnostic, including its newline, in the selected format.
+ * Returns the number of characters written.
+ */
+static size_t format_diagnostic(char *out, size_t size, const Diagnostic *diag, int color) {
+    const char *label = (diag->level == LOG_WARN) ? "warning" : "error";
+    size_t len;
+
+    if (diag_format == DIAG_FORMAT_JSON) {
+        len = (size_t)sprintf(out, "{\"file\": \"");
+        len = json_escape(out, len, size - 80, diag->file);
+        len += (size_t)sprintf(out + len, "\", \"line\": %d, \"column\": %d, \"severity\": \"%s\", \"message\": \"",
+                               diag->line, diag->col, label);
+        len = json_escape(out, len, size - 4, diag->message);
+        len += (size_t)sprintf(out + len, "\"}\n");
+        return len;
     }
 
-    if (level == LOG_WARN) {
-        label = "warning";
-        label_color = yellow_bold;
+    if (color) {
+        const char *label_color = (diag->level == LOG_WARN) ? "\033[1;33m" : "\033[1;31m";
+        len = bounded_length(snprintf(out, size, "\033[1m%s:%d:%d:\033[0m %s%s:\033[0m %s\n",
+                                      diag->file, diag->line, diag->col, label_color, label, diag->message), size);
     } else {
-        label = "error";
-        label_color = red_bold;
+        len = bounded_length(snprintf(out, size, "%s:%d:%d: %s: %s\n",
+                                      diag->file, diag->line, diag->col, label, diag->message), size);
+    }
+    return len;
+}
+
+void log_asm_internal(LogLevel level, const char *file, int line, int col, const char *fmt, va_list args) {
+    char buf[LOG_LINE_LEN];
+    Diagnostic diag;
+
+    if (level < asm_log_level) {
+        return;
     }
 
-    fprintf(stderr, "%s%s:%d:%d:%s ", bold, file, line, col, reset);
-    fprintf(stderr, "%s%s:%s ", label_color, label, reset);
+    diag.level = level;
+    diag.file = file;
+    diag.line = line;
+    diag.col = col;
+    diag.seq = 0;
+    vsnprintf(diag.message, DIAG_MSG_LEN, fmt, args);
 
-    vfprintf(stderr, fmt, args);
-    fprintf(stderr, "\n");
-    fflush(stderr);
+    write_all(stderr, buf, format_diagnostic(buf, sizeof(buf), &diag, isatty(fileno(stderr))));
 }
 
 /* Simple wrappers for different log levels */
@@ -127,3 +225,111 @@ void asm_err(const char *file, int line, int col, const char *fmt, ...) {
     log_asm_internal(LOG_ERR, file, line, col, fmt, args);
     va_end(args);
 }
+
+/*
+ * diag_report:
+ * Records a diagnostic in the given list and, when the list is in echo mode,
+ * prints it the same way asm_err()/asm_warn() do. Errors past max_errors are
+ * only counted.
+ */
+void diag_report(DiagnosticList *list, LogLevel level, const char *file, int line, int col, const char *fmt, ...) {
+    va_list args;
+    Diagnostic *diag;
+
+    if (level == LOG_ERR) {
+        if (diag_limit_reached(list)) {
+            list->suppressed++;
+            return;
+        }
+        list->error_count++;
+    }
+
+    if (list->echo) {
+        va_start(args, fmt);
+        log_asm_internal(level, file, line, col, fmt, args);
+        va_end(args);
+    }
+
+    if (list->count >= list->capacity) {
+        int new_capacity = (list->capacity == 0) ? 16 : list->capacity * 2;
+        Diagnostic *temp = ASM_REALLOC(list->items, new_capacity * sizeof(Diagnostic), MEM_DIAG);
+        if (!temp) return;
+        list->items = temp;
+        list->capacity = new_capacity;
+    }
+
+    diag = &list->items[list->count];
+    diag->level = level;
+    diag->file = file;
+    diag->line = line;
+    diag->col = col;
+    diag->seq = list->count++;
+
+    va_start(args, fmt);
+    vsnprintf(diag->message, DIAG_MSG_LEN, fmt, args);
+    va_end(args);
+}
+
+int diag_limit_reached(const DiagnosticList *list) {
+    return list->max_errors > 0 && list->error_count >= list->max_errors;
+}
+
+static int compare_diagnostics(const void *a, const void *b) {
+    const Diagnostic *da = (const Diagnostic *)a;
+    const Diagnostic *db = (const Diagnostic *)b;
+
+    if (da->line != db->line) return (da->line < db->line) ? -1 : 1;
+    return (da->seq < db->seq) ? -1 : (da->seq > db->seq);
+}
+
+/*
+ * diag_flush:
+ * Writes the records not yet echoed or flushed, ordered by line, with one
+ * write call. A pass stops at its first fatal problem, so the records of
+ * one flush always refer to the same file.
+ */
+void diag_flush(DiagnosticList *list, FILE *out) {
+    char *text;
+    size_t len = 0;
+    int pending = list->count - list->flushed;
+    int color = isatty(fileno(out));
+    int i;
+
+    if (list->echo || pending <= 0) {
+        return;
+    }
+
+    qsort(list->items + list->flushed, pending, sizeof(Diagnostic), compare_diagnostics);
+
+    text = (char *)ASM_MALLOC((size_t)(pending + 1) * LOG_LINE_LEN, MEM_DIAG);
+    if (!text) return;
+
+    for (i = list->flushed; i < list->count; i++) {
+        len += format_diagnostic(text + len, LOG_LINE_LEN, &list->items[i], color);
+    }
+
+    if (diag_limit_reached(list)) {
+        Diagnostic note;
+        note.level = LOG_ERR;
+        note.file = list->count > 0 ? list->items[list->count - 1].file : "";
+        note.line = 0;
+        note.col = 0;
+        note.seq = list->count;
+        sprintf(note.message, "error limit (%d) reached; remaining errors not shown", list->max_errors);
+        len += format_diagnostic(text + len, LOG_LINE_LEN, &note, color);
+    }
+
+    write_all(out, text, len);
+    ASM_FREE(text);
+    list->flushed = list->count;
+}
+
+void diag_free(DiagnosticList *list) {
+    ASM_FREE(list->items);
+    list->items = NULL;
+    list->count = 0;
+    list->capacity = 0;
+    list->error_count = 0;
+    list->suppressed = 0;
+    list->flushed = 0;
+}
@@ -6,59 +6,439 @@
 #include "symbol_table.h"
 #include "logger.h"
 #include "pre_asm.h"
+#include "asm_context.h"
+#include "file_writer.h"
+#include "server.h"
+#include "watch.h"
+#include "stats.h"
+#include "trace.h"
+#include "asm_alloc.h"
+#include "stream.h"
+#include "io_pipeline.h"
 
 #define MAX_FILENAME 256
 
-extern Symbol *symbol_table;
+/* Errors shown per file before the passes stop (--max-errors) */
+static int max_errors = 0;
+
+/* Also write the binary object image <base>.bin (--binary) */
+static int write_binary = 0;
+
+/* Also write the address-to-source map <base>.map (--map) */
+static int write_map = 0;
+
+/* Pool identical .string (--pool) or .string and .data (--pool=all) literals */
+static int pool_mode = 0;
+
+/* Drop data blocks that no instruction or .entry refers to (--strip-data) */
+static int strip_data = 0;
+
+/* Run the peephole optimizer over the instructions (--optimize) */
+static int optimize = 0;
+
+/* Source reads and output writes, overlapped with assembly unless --sync-io */
+static IoPipeline *io = NULL;
+
+static void print_usage(const char *prog) {
+    printf("Usage: %s <file1> [file2 ...] (without .as extension)\n", prog);
+    printf("       %s --serve[=<socket path>] [--macros <library.as>]\n", prog);
+    printf("       %s -    (assemble stdin, write the object to stdout)\n", prog);
+    printf("       %s --watch <dir> [--macros <library.as>]\n", prog);
+    printf("Options:\n");
+    printf("  --stats[=table|json]   print per-phase timing and counters at exit (stderr)\n");
+    printf("  --trace <out.json>     record a Chrome trace of files, phases and I/O\n");
+    printf("  --max-errors <n>       stop a file after n errors\n");
+    printf("  --binary               also write a binary object image (<file>.bin)\n");
+    printf("  --map                  also write an address-to-source map (<file>.map)\n");
+    printf("  --pool[=all]           share identical and suffix .string literals (all: .data too);\n");
+    printf("                         pooled literals move to the end of the data and must be read-only\n");
+    printf("  --strip-data           drop labelled data blocks that no instruction or .entry uses\n");
+    printf("  --optimize             merge inc/dec/add/sub runs, drop no-op moves and jumps to the next line\n");
+    printf("  --sync-io              read and write files in the assembling thread\n");
+    printf("  --diag-format=text|json\n");
+    printf("                         diagnostic output format (stderr)\n");
+}
+
+/* Phase boundaries feed --stats, --trace and the memtrack build */
+static void phase_begin(FileStats *fs, AsmPhase phase) {
+    mem_set_phase(phase);
+    stats_phase_begin(fs, phase);
+    trace_begin("phase", stats_phase_name(phase));
+}
+
+static void phase_end(FileStats *fs, AsmPhase phase) {
+    trace_end("phase", stats_phase_name(phase));
+    stats_phase_end(fs, phase);
+    mem_set_phase(PHASE_COUNT);
+}
+
+/*
+ * finish_file:
+ * Records the counters of a finished file and releases its state.
+ */
+static void finish_file(AsmContext *ctx, FileStats *fs, char *expanded) {
+    AsmCounters counters;
+
+    trace_end("file", ctx->source_name);
+    diag_flush(&ctx->diagnostics, stderr);
+    asm_context_counters(ctx, &counters);
+    stats_add_counters(fs, &counters);
+    ASM_FREE(expanded);
+    asm_context_free(ctx);
+}
+
+/*
+ * report_savings:
+ * Prints what the opt-in data and code rewrites saved (stderr).
+ */
+static void report_savings(const AsmContext *ctx) {
+    const char *name = ctx->source_name;
+
+    if (pool_mode) {
+        /* Each .ob line is "%06d %06x\n" */
+        fprintf(stderr, "%s: pooled %lu data words into %lu, saved %lu words (%lu .ob bytes)\n",
+                name, ctx->pool.pooled_words, ctx->pool.pooled_words - ctx->pool.saved_words,
+                ctx->pool.saved_words, ctx->pool.saved_words * 14);
+    }
+
+    if (strip_data) {
+        fprintf(stderr, "%s: stripped %d unreferenced data blocks, %lu words (%lu .ob bytes)\n",
+                name, ctx->strip.removed_blocks, ctx->strip.removed_words, ctx->strip.removed_words * 14);
+    }
+
+    if (optimize) {
+        fprintf(stderr, "%s: peephole made %d rewrites, saved %lu words and about %lu cycles\n",
+                name, ctx->peep.rewrites, ctx->peep.words_saved, ctx->peep.cycles_saved);
+    }
+}
+
+/*
+ * queue_output:
+ * Hands a formatted output to the writer; it owns and frees the buffer.
+ */
+static bool queue_output(AsmContext *ctx, const char *path, char *data, size_t length) {
+    if (!data) {
+        fprintf(stderr, "Error: Memory allocation failed for output file %s\n", path);
+        return false;
+    }
+    if (!io_pipeline_write(io, path, data, length)) return false;
+    ctx->counters.bytes_written += length;
+    return true;
+}
+
+/*
+ * assemble_file:
+ * Assembles <base>.as (the index-th source of the pipeline) into <base>.am
+ * and <base>.ob.
+ */
+static void assemble_file(const char *base, int index) {
+    char input_filename[MAX_FILENAME];
+    char expanded_filename[MAX_FILENAME];
+    char object_filename[MAX_FILENAME];
+    char *source;
+    char *expanded;
+    char *text;
+    size_t source_length, expanded_length;
+    size_t object_length;
+    MacroTable *table;
+    AsmContext ctx;
+    FileStats *fs;
+    bool first_ok;
+    bool ok = false;
+
+    snprintf(input_filename, sizeof(input_filename), "%s.as", base);
+    snprintf(expanded_filename, sizeof(expanded_filename), "%s.am", base);
+    object_file_name(expanded_filename, object_filename, sizeof(object_filename));
+
+    fs = stats_add_file(input_filename);
+
+    /* Waiting for the source is accounted to pre-assembly */
+    trace_begin("file", input_filename);
+    phase_begin(fs, PHASE_PRE_ASSEMBLE);
+
+    trace_begin("io", input_filename);
+    source = io_pipeline_read(io, index, &source_length);
+    trace_end("io", input_filename);
+    if (!source) {
+        phase_end(fs, PHASE_PRE_ASSEMBLE);
+        trace_end("file", input_filename);
+        ASM_LOG_ERR(("Error: Could not open source file %s\n", input_filename));
+        fprintf(stderr, "Failed to preprocess %s\n", input_filename);
+        return;
+    }
+
+    table = create_macro_table();
+    if (!table) {
+        fprintf(stderr, "Failed to allocate macro table.\n");
+        phase_end(fs, PHASE_PRE_ASSEMBLE);
+        trace_end("file", input_filename);
+        ASM_FREE(source);
+        return;
+    }
+
+    asm_context_init(&ctx, input_filename, expanded_filename);
+    ctx.diagnostics.max_errors = max_errors;
+    ctx.pool.mode = pool_mode;
+    ctx.strip.enabled = strip_data;
+    ctx.peep.enabled = optimize;
+
+    expanded = pre_assemble(&ctx, table, source, source_length, &expanded_length);
+    free_macro_table(table);
+    ASM_FREE(source);
+    phase_end(fs, PHASE_PRE_ASSEMBLE);
+
+    if (!expanded) {
+        diag_flush(&ctx.diagnostics, stderr);
+        fprintf(stderr, "Failed to preprocess %s\n", input_filename);
+        finish_file(&ctx, fs, expanded);
+        return;
+    }
+
+    phase_begin(fs, PHASE_FIRST_PASS);
+    first_ok = first_pass(&ctx, expanded, expanded_length);
+    phase_end(fs, PHASE_FIRST_PASS);
+
+    if (first_ok) {
+        phase_begin(fs, PHASE_SECOND_PASS);
+        ok = second_pass(&ctx, expanded, expanded_length);
+        phase_end(fs, PHASE_SECOND_PASS);
+    }
+
+    /* The passes read the .am text, so it is queued once they are done */
+    phase_begin(fs, PHASE_WRITE_OUTPUT);
+    queue_output(&ctx, expanded_filename, expanded, expanded_length);
+    expanded = NULL;
+
+    if (!first_ok) {
+        phase_end(fs, PHASE_WRITE_OUTPUT);
+        diag_flush(&ctx.diagnostics, stderr);
+        fprintf(stderr, "First pass failed for %s\n", expanded_filename);
+        finish_file(&ctx, fs, expanded);
+        return;
+    }
+
+    text = format_object(&ctx, &object_length);
+    ok = queue_output(&ctx, object_filename, text, object_length) && ok;
+    if (ok && write_binary) {
+        char binary_filename[MAX_FILENAME];
+
+        snprintf(binary_filename, sizeof(binary_filename), "%s.bin", base);
+        text = (char *)format_object_binary(&ctx, &object_length);
+        ok = queue_output(&ctx, binary_filename, text, object_length);
+    }
+    if (ok && write_map) {
+        char map_filename[MAX_FILENAME];
+
+        snprintf(map_filename, sizeof(map_filename), "%s.map", base);
+        text = format_source_map(&ctx, &object_length);
+        ok = queue_output(&ctx, map_filename, text, object_length);
+    }
+    phase_end(fs, PHASE_WRITE_OUTPUT);
+
+    if (ok) report_savings(&ctx);
+
+    if (!ok) {
+        diag_flush(&ctx.diagnostics, stderr);
+        fprintf(stderr, "Second pass failed for %s\n", expanded_filename);
+    }
+
+    finish_file(&ctx, fs, expanded);
+}
+
+/*
+ * assemble_stdin:
+ * Assembles a source piped on stdin in one pass and prints its object to
+ * stdout. Nothing is written to disk. Returns false if the assembly failed.
+ */
+static bool assemble_stdin(void) {
+    const char *name = "<stdin>";
+    size_t object_length = 0;
+    MacroTable *table;
+    AsmContext ctx;
+    FileStats *fs;
+    bool ok;
+
+    fs = stats_add_file(name);
+    trace_begin("file", name);
+
+    table = create_macro_table();
+    if (!table) {
+        fprintf(stderr, "Failed to allocate macro table.\n");
+        trace_end("file", name);
+        return false;
+    }
+
+    asm_context_init(&ctx, name, name);
+    ctx.diagnostics.max_errors = max_errors;
+    ctx.pool.mode = pool_mode;
+    ctx.strip.enabled = strip_data;
+
+    /* Reading, expansion and encoding are interleaved; all of it is one phase */
+    phase_begin(fs, PHASE_FIRST_PASS);
+    ok = assemble_stream(&ctx, table, stdin, stdout, &object_length);
+    phase_end(fs, PHASE_FIRST_PASS);
+    free_macro_table(table);
+    ctx.counters.bytes_written += object_length;
+
+    if (ok) {
+        report_savings(&ctx);
+    } else {
+        diag_flush(&ctx.diagnostics, stderr);
+        fprintf(stderr, "Assembly failed for %s\n", name);
+    }
+
+    finish_file(&ctx, fs, NULL);
+    return ok;
+}
 
 int main(int argc, char *argv[]) {
+    ServerOptions server;
+    WatchOptions watcher;
+    const char *trace_path = NULL;
+    int serve_mode = 0;
+    int file_count = 0;
+    int use_stdin = 0;
+    int sync_io = 0;
+    int status = 0;
+    int failed_writes;
+    char (*inputs)[MAX_FILENAME];
+    const char **paths;
+    int input_count = 0;
     int i;
 
-    if (argc < 2) {
-        printf("Usage: %s <file1> [file2 ...] (without .as extension)\n", argv[0]);
-        return 1;
-    }
+    memset(&server, 0, sizeof(server));
+    memset(&watcher, 0, sizeof(watcher));
 
     for (i = 1; i < argc; ++i) {
-        char input_filename[MAX_FILENAME];
-        char *expanded_file;
-        Symbol *sym;
-        MacroTable *table;
+        if (strcmp(argv[i], "--serve") == 0) {
+            serve_mode = 1;
+        } else if (strncmp(argv[i], "--serve=", 8) == 0) {
+            serve_mode = 1;
+            server.socket_path = argv[i] + 8;
+        } else if (strcmp(argv[i], "--watch") == 0 && i + 1 < argc) {
+            watcher.directory = argv[++i];
+        } else if (strcmp(argv[i], "--stats") == 0 || strcmp(argv[i], "--stats=table") == 0) {
+            stats_enable(STATS_TABLE);
+        } else if (strcmp(argv[i], "--stats=json") == 0) {
+            stats_enable(STATS_JSON);
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            trace_path = argv[++i];
+        } else if (strcmp(argv[i], "--max-errors") == 0 && i + 1 < argc) {
+            max_errors = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--binary") == 0) {
+            write_binary = 1;
+        } else if (strcmp(argv[i], "--map") == 0) {
+            write_map = 1;
+        } else if (strcmp(argv[i], "--pool") == 0) {
+            pool_mode = POOL_STRINGS;
+        } else if (strcmp(argv[i], "--pool=all") == 0) {
+            pool_mode = POOL_STRINGS | POOL_DATA;
+        } else if (strcmp(argv[i], "--strip-data") == 0) {
+            strip_data = 1;
+        } else if (strcmp(argv[i], "--optimize") == 0) {
+            optimize = 1;
+        } else if (strcmp(argv[i], "--sync-io") == 0) {
+            sync_io = 1;
+        } else if (strcmp(argv[i], "--diag-format=text") == 0) {
+            asm_diag_set_format(DIAG_FORMAT_TEXT);
+        } else if (strcmp(argv[i], "--diag-format=json") == 0) {
+            asm_diag_set_format(DIAG_FORMAT_JSON);
+        } else if (strcmp(argv[i], "--macros") == 0 && i + 1 < argc) {
+            server.macro_library = argv[++i];
+        } else if (strncmp(argv[i], "--", 2) == 0) {
+            fprintf(stderr, "Unknown option '%s'\n", argv[i]);
+            print_usage(argv[0]);
+            return 1;
+        } else {
+            if (strcmp(argv[i], "-") == 0) use_stdin = 1;
+            file_count++;
+        }
+    }
 
-        snprintf(input_filename, sizeof(input_filename), "%s.as", argv[i]);
+    /* Streaming encodes each line as it is read and writes only the object */
+    if (use_stdin && (optimize || write_binary || write_map)) {
+        fprintf(stderr, "--optimize, --binary and --map cannot be used with '-' (stdin)\n");
+        return 1;
+    }
+    if (use_stdin) {
+        /* Debug logging goes to stdout, which carries the object */
+        asm_log_set_level(LOG_WARN);
+    }
+
+    if (serve_mode) {
+        return serve(&server);
+    }
 
-        table = create_macro_table();
-        if (!table) {
-            fprintf(stderr, "Failed to allocate macro table.\n");
-            continue;
+    if (watcher.directory) {
+        if (write_binary || write_map) {
+            fprintf(stderr, "--binary and --map cannot be used with --watch\n");
+            return 1;
         }
+        watcher.macro_library = server.macro_library;
+        watcher.max_errors = max_errors;
+        watcher.pool = pool_mode;
+        watcher.strip_data = strip_data != 0;
+        watcher.optimize = optimize != 0;
+        i = watch(&watcher);
+        mem_report(stderr);
+        return i;
+    }
 
-        expanded_file = pre_assemble(input_filename, table);
-        free_macro_table(table);
+    if (file_count == 0) {
+        print_usage(argv[0]);
+        return 1;
+    }
 
-        if (!expanded_file) {
-            fprintf(stderr, "Failed to preprocess %s\n", input_filename);
-            continue;
-        }
+    if (trace_path && !trace_open(trace_path)) {
+        fprintf(stderr, "Failed to start trace %s\n", trace_path);
+        return 1;
+    }
 
-        if (!first_pass(expanded_file)) {
-            fprintf(stderr, "First pass failed for %s\n", expanded_file);
-            free(expanded_file);
-            free_symbol_table();
-            continue;
+    /* The sources are read ahead in command-line order */
+    inputs = (char (*)[MAX_FILENAME])ASM_MALLOC(file_count * sizeof(*inputs), MEM_OTHER);
+    paths = (const char **)ASM_MALLOC(file_count * sizeof(*paths), MEM_OTHER);
+    for (i = 1; inputs && paths && i < argc; ++i) {
+        if (strcmp(argv[i], "--macros") == 0 || strcmp(argv[i], "--trace") == 0
+            || strcmp(argv[i], "--max-errors") == 0 || strcmp(argv[i], "--watch") == 0) {
+            i++;
+        } else if (strcmp(argv[i], "-") != 0 && strncmp(argv[i], "--", 2) != 0) {
+            snprintf(inputs[input_count], MAX_FILENAME, "%s.as", argv[i]);
+            paths[input_count] = inputs[input_count];
+            input_count++;
         }
+    }
+    io = (inputs && paths) ? io_pipeline_start(paths, input_count, !sync_io) : NULL;
+    if (!io) {
+        fprintf(stderr, "Failed to allocate the I/O pipeline.\n");
+        ASM_FREE(inputs);
+        ASM_FREE(paths);
+        return 1;
+    }
 
-    
-        if (!second_pass(expanded_file)) {
-            fprintf(stderr, "Second pass failed for %s\n", expanded_file);
-            free(expanded_file);
-            free_symbol_table();
-            continue;
+    input_count = 0;
+    for (i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--macros") == 0 || strcmp(argv[i], "--trace") == 0
+            || strcmp(argv[i], "--max-errors") == 0 || strcmp(argv[i], "--watch") == 0) {
+            i++;
+        } else if (strcmp(argv[i], "-") == 0) {
+            if (!assemble_stdin()) status = 1;
+        } else if (strncmp(argv[i], "--", 2) != 0) {
+            assemble_file(argv[i], input_count++);
         }
+    }
 
-        free(expanded_file);
-        free_symbol_table();
+    /* The writer has named each file it could not write */
+    failed_writes = io_pipeline_finish(io);
+    if (failed_writes > 0) {
+        fprintf(stderr, "%d output file%s could not be written.\n", failed_writes, failed_writes == 1 ? "" : "s");
+        status = 1;
     }
+    ASM_FREE(inputs);
+    ASM_FREE(paths);
+
+    stats_report(stderr);
+    trace_close();
+    mem_report(stderr);
 
-    return 0;
+    return status;
 }
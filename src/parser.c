@@ -5,6 +5,8 @@
 #include <stdbool.h>
 #include "parser.h"
 #include "utils.h"
+#include "directive_handler.h"
+#include "expr.h"
 
 
 /* Structure mapping instruction names to types */
@@ -36,39 +38,71 @@ InstructionType lookup_instruction(const char *token) {
     return INST_NONE;
 }
 
+/* True if the rest of an operand is empty or an offset expression (+..., -...) */
+static bool is_offset(const char *p) {
+    while (*p == ' ' || *p == '\t') p++;
+    if (*p == '\0') return true;
+    if (*p != '+' && *p != '-') return false;
+    for (; *p; p++) {
+        if (!expr_char((unsigned char)*p)) return false;
+    }
+    return true;
+}
+
+/*
+ * parse_operand:
+ * Classifies an operand by its form. Immediates may be any expression of
+ * constants and labels may carry an offset; both are only checked for the
+ * characters they use here and evaluated when encoded.
+ */
 Operand parse_operand(const char *str) {
     Operand op;
-    size_t i;
-    size_t len;
+    const char *p;
 
     op.type = OPERAND_NONE;
-    strncpy(op.value, str, LABEL_LENGTH);
-    op.value[LABEL_LENGTH] = '\0';
+    strncpy(op.value, str, OPERAND_LENGTH);
+    op.value[OPERAND_LENGTH] = '\0';
 
     if (str[0] == '#') {
-        if (str[1] == '-' || str[1] == '+' || isdigit(str[1])) {
-            op.type = OPERAND_IMMEDIATE;
+        for (p = str + 1; *p == ' ' || *p == '\t'; p++) {
         }
+        if (*p == '\0') return op;
+        for (p = str + 1; *p; p++) {
+            if (!expr_char((unsigned char)*p)) return op;
+        }
+        op.type = OPERAND_IMMEDIATE;
     } else if (str[0] == '&') {
         if (isalpha(str[1])) {
-            len = strlen(str);
-            for (i = 1; i < len; i++) {
-                if (!isalnum(str[i])) return op;
+            for (p = str + 1; isalnum(*p); p++) {
             }
-            op.type = OPERAND_RELATIVE;
+            if (is_offset(p)) op.type = OPERAND_RELATIVE;
         }
     } else if (is_register(str)) {
         op.type = OPERAND_REGISTER_DIRECT;
     } else if (isalpha(str[0])) {
-        len = strlen(str);
-        for (i = 0; i < len; i++) {
-            if (!isalnum(str[i])) return op;
+        for (p = str; isalnum(*p); p++) {
         }
-        op.type = OPERAND_DIRECT;
+        if (is_offset(p)) op.type = OPERAND_DIRECT;
     }
 
     return op;
 }
+
+const char *operand_label(const Operand *op, char *name) {
+    const char *p = op->value;
+    size_t length = 0;
+
+    if (op->type == OPERAND_RELATIVE) p++;
+    else if (op->type != OPERAND_DIRECT) return NULL;
+
+    while (isalnum((unsigned char)*p)) {
+        if (length < LABEL_LENGTH) name[length++] = *p;
+        p++;
+    }
+    name[length] = '\0';
+    while (*p == ' ' || *p == '\t') p++;
+    return p;
+}
 /*
  * parse_line:
  * Parses a full line of assembly code into a ParsedLine structure.
@@ -82,6 +116,7 @@ bool parse_line(const char *line_input, int line_number, ParsedLine *result) {
     char *op_str;
     char *first;
     char *second;
+    char *cursor;
     size_t i;
 
     strncpy(line_copy, line_input, sizeof(line_copy) - 1);
@@ -97,6 +132,7 @@ bool parse_line(const char *line_input, int line_number, ParsedLine *result) {
     result->instruction = INST_NONE;
     result->operand_count = 0;
     result->label[0] = '\0';
+    result->directive = DIRECTIVE_NONE;
     result->type = LINE_INVALID;
     result->err_msg[0] = '\0';
     result->operands[0].type = OPERAND_NONE;
@@ -112,7 +148,8 @@ bool parse_line(const char *line_input, int line_number, ParsedLine *result) {
         return true;
     }
 
-    token = strtok(line, " \t");
+    cursor = line;
+    token = next_token(&cursor, " \t");
     if (!token) {
         snprintf(result->err_msg, MAX_MSG, "Empty token after stripping whitespace.");
         return false;
@@ -132,7 +169,7 @@ bool parse_line(const char *line_input, int line_number, ParsedLine *result) {
             }
         }
         strcpy(result->label, token);
-        token = strtok(NULL, " \t");
+        token = next_token(&cursor, " \t");
         if (!token) {
             result->type = LINE_LABEL_ONLY;
             return true;
@@ -140,13 +177,53 @@ bool parse_line(const char *line_input, int line_number, ParsedLine *result) {
     }
 
     if (token[0] == '.') {
-        if (strcmp(token, ".data") == 0 || strcmp(token, ".string") == 0) {
+        DirectiveType directive = get_directive_type(token + 1);
+
+        result->directive = directive;
+        if (directive == DIRECTIVE_DEFINE) {
+            /* .define NAME expression: the name goes in label, the expression in operands[0] */
+            if (result->label[0] != '\0') {
+                snprintf(result->err_msg, MAX_MSG, "A label cannot be placed on .define.");
+                return false;
+            }
+            token = next_token(&cursor, " \t");
+            if (!token || strlen(token) > LABEL_LENGTH || !isalpha(token[0])) {
+                snprintf(result->err_msg, MAX_MSG, "Invalid or missing name after .define.");
+                return false;
+            }
+            for (i = 0; i < strlen(token); i++) {
+                if (!isalnum(token[i])) {
+                    snprintf(result->err_msg, MAX_MSG, "Invalid character in .define name: '%c'", token[i]);
+                    return false;
+                }
+            }
+            if (is_register(token) || lookup_instruction(token) != INST_NONE) {
+                snprintf(result->err_msg, MAX_MSG, "Reserved word '%s' cannot be defined.", token);
+                return false;
+            }
+            strcpy(result->label, token);
+
+            op_str = next_token(&cursor, "");
+            op_str = op_str ? trim_whitespace(op_str) : NULL;
+            if (!op_str || *op_str == '\0') {
+                snprintf(result->err_msg, MAX_MSG, "Missing value after .define %s.", result->label);
+                return false;
+            }
+            strncpy(result->operands[0].value, op_str, OPERAND_LENGTH);
+            result->operands[0].value[OPERAND_LENGTH] = '\0';
+            result->operands[0].type = OPERAND_IMMEDIATE;
+            result->type = LINE_DIRECTIVE;
+            return true;
+        }
+
+        if (directive == DIRECTIVE_DATA || directive == DIRECTIVE_STRING || directive == DIRECTIVE_INCBIN
+            || directive == DIRECTIVE_FILL || directive == DIRECTIVE_SPACE) {
             result->type = LINE_DIRECTIVE;
             return true;
         } else if (strcmp(token, ".extern") == 0 || strcmp(token, ".entry") == 0) {
             result->type = LINE_DIRECTIVE;
 
-            token = strtok(NULL, " \t");
+            token = next_token(&cursor, " \t");
             if (!token || strlen(token) > LABEL_LENGTH || !isalpha(token[0])) {
                 snprintf(result->err_msg, MAX_MSG, "Invalid or missing label after directive.");
                 result->type = LINE_INVALID;
@@ -176,7 +253,7 @@ bool parse_line(const char *line_input, int line_number, ParsedLine *result) {
     }
 
     result->type = LINE_COMMAND;
-    op_str = strtok(NULL, "");
+    op_str = next_token(&cursor, "");
     if (!op_str) {
         if (OP_PER_INST(result->instruction) != 0) {
             snprintf(result->err_msg, MAX_MSG, "Missing operand(s) for instruction '%s'", token);
@@ -0,0 +1,280 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "peephole.h"
+#include "asm_alloc.h"
+
+/* Same sizing as add_command(): two register operands share a word */
+static int insn_words(const PeepInsn *insn) {
+    int words = 1 + insn->operand_count;
+
+    if (insn->operand_count == 2
+        && insn->operands[0].type == OPERAND_REGISTER_DIRECT
+        && insn->operands[1].type == OPERAND_REGISTER_DIRECT) {
+        words--;
+    }
+    return words;
+}
+
+/*
+ * insn_cycles:
+ * Estimated cost: one cycle per word fetched and one per memory operand
+ * read or written. Jump targets and the lea source are only addresses.
+ */
+static int insn_cycles(const PeepInsn *insn) {
+    int cycles = insn_words(insn);
+    int i;
+
+    if (insn->instruction == INST_JMP || insn->instruction == INST_BNE || insn->instruction == INST_JSR) {
+        return cycles;
+    }
+    for (i = 0; i < insn->operand_count; i++) {
+        if (insn->operands[i].type != OPERAND_DIRECT) continue;
+        if (insn->instruction == INST_LEA && i == 0) continue;
+        cycles++;
+    }
+    return cycles;
+}
+
+int peephole_add(Peephole *peep, const ParsedLine *parsed, int address, int words) {
+    PeepInsn *insn;
+
+    if (peep->count >= peep->capacity) {
+        int new_capacity = (peep->capacity == 0) ? 256 : peep->capacity * 2;
+        PeepInsn *temp = ASM_REALLOC(peep->insns, new_capacity * sizeof(PeepInsn), MEM_CODE);
+        if (!temp) return 0;
+        peep->insns = temp;
+        peep->capacity = new_capacity;
+    }
+    insn = &peep->insns[peep->count++];
+    insn->instruction = parsed->instruction;
+    insn->operand_count = parsed->operand_count;
+    memcpy(insn->operands, parsed->operands, sizeof(insn->operands));
+    insn->line_number = parsed->line_number;
+    insn->address = address;
+    insn->new_address = address;
+    insn->words = words;
+    insn->labelled = parsed->label[0] != '\0';
+    insn->deleted = 0;
+    peep->end = address + words;
+    return 1;
+}
+
+/* The value of an immediate that is a plain number (expressions are folded before the run) */
+static int immediate_value(const Operand *op, long *value) {
+    char *end;
+
+    if (op->type != OPERAND_IMMEDIATE) return 0;
+    *value = strtol(op->value + 1, &end, 10);
+    return end != op->value + 1 && *end == '\0';
+}
+
+static int same_operand(const Operand *a, const Operand *b) {
+    return a->type == b->type && strcmp(a->value, b->value) == 0;
+}
+
+/* The destination operand; single-operand instructions keep it in operands[0] */
+static const Operand *destination(const PeepInsn *insn) {
+    return &insn->operands[insn->operand_count - 1];
+}
+
+/*
+ * adjustment:
+ * If the instruction adds a constant to its destination (inc, dec, add #k,
+ * sub #k), stores the constant and returns 1.
+ */
+static int adjustment(const PeepInsn *insn, long *delta) {
+    switch (insn->instruction) {
+        case INST_INC: *delta = 1; break;
+        case INST_DEC: *delta = -1; break;
+        case INST_ADD:
+        case INST_SUB:
+            if (!immediate_value(&insn->operands[0], delta)) return 0;
+            if (insn->instruction == INST_SUB) *delta = -*delta;
+            break;
+        default:
+            return 0;
+    }
+    return destination(insn)->type == OPERAND_REGISTER_DIRECT || destination(insn)->type == OPERAND_DIRECT;
+}
+
+/* Sets insn to the cheapest instruction adding delta (already wrapped) to dst */
+static void make_adjustment(PeepInsn *insn, const Operand *dst, long delta) {
+    Operand target = *dst;
+
+    if (delta == 1 || delta == -1) {
+        insn->instruction = (delta == 1) ? INST_INC : INST_DEC;
+        insn->operand_count = 1;
+        insn->operands[0] = target;
+        return;
+    }
+    insn->instruction = (delta > 0 || delta == -8192) ? INST_ADD : INST_SUB;
+    insn->operand_count = 2;
+    insn->operands[0].type = OPERAND_IMMEDIATE;
+    sprintf(insn->operands[0].value, "#%ld", (delta > 0 || delta == -8192) ? delta : -delta);
+    insn->operands[1] = target;
+}
+
+/*
+ * merge_adjustments:
+ * Folds the run of adjustments of one operand starting at i into a single
+ * instruction (or none) when that is smaller. Returns the run length.
+ */
+static int merge_adjustments(Peephole *peep, int i) {
+    PeepInsn *first = &peep->insns[i];
+    Operand dst = *destination(first);
+    PeepInsn merged;
+    long delta, sum = 0;
+    int old_words = 0, old_cycles = 0, new_words = 0, new_cycles = 0;
+    int j, k;
+
+    for (j = i; j < peep->count; j++) {
+        const PeepInsn *insn = &peep->insns[j];
+
+        if (j > i && insn->labelled) break;
+        if (!adjustment(insn, &delta) || !same_operand(destination(insn), &dst)) break;
+        sum += delta;
+        old_words += insn_words(insn);
+        old_cycles += insn_cycles(insn);
+    }
+    if (j == i) return 1;
+
+    /* 14-bit arithmetic wraps, so only the sum modulo 2^14 matters */
+    sum %= 16384;
+    if (sum >= 8192) sum -= 16384;
+    if (sum < -8192) sum += 16384;
+
+    merged = *first;
+    if (sum != 0) {
+        make_adjustment(&merged, &dst, sum);
+        new_words = insn_words(&merged);
+        new_cycles = insn_cycles(&merged);
+    }
+    if (new_words >= old_words) return j - i;
+
+    if (sum != 0) *first = merged;
+    else first->deleted = 1;
+    first->words = new_words;
+    for (k = i + 1; k < j; k++) peep->insns[k].deleted = 1;
+
+    peep->rewrites++;
+    peep->words_saved += (unsigned long)(old_words - new_words);
+    peep->cycles_saved += (unsigned long)(old_cycles - new_cycles);
+    return j - i;
+}
+
+static void delete_insn(Peephole *peep, PeepInsn *insn) {
+    insn->deleted = 1;
+    peep->rewrites++;
+    peep->words_saved += (unsigned long)insn->words;
+    peep->cycles_saved += (unsigned long)insn_cycles(insn);
+}
+
+/*
+ * jumps_to_next:
+ * True if the jump at i lands on the next instruction that is kept.
+ */
+static int jumps_to_next(const Peephole *peep, int i, SymbolTable *symbols) {
+    const PeepInsn *insn = &peep->insns[i];
+    char name[LABEL_LENGTH + 1];
+    const char *offset;
+    const Symbol *sym;
+    int k;
+
+    if (insn->instruction != INST_JMP && insn->instruction != INST_BNE) return 0;
+    offset = operand_label(&insn->operands[0], name);
+    if (!offset || *offset != '\0') return 0;
+    sym = find_symbol(symbols, name);
+    if (!sym || sym->type != SYMBOL_CODE) return 0;
+
+    for (k = i + 1; k < peep->count && peep->insns[k].deleted && peep->insns[k].address < sym->address; k++) {
+    }
+    return k < peep->count && peep->insns[k].address == sym->address;
+}
+
+int peephole_run(Peephole *peep, SymbolTable *symbols) {
+    int i, address;
+
+    i = 0;
+    while (i < peep->count) {
+        PeepInsn *insn = &peep->insns[i];
+        long delta, value;
+
+        if (adjustment(insn, &delta)) {
+            i += merge_adjustments(peep, i);
+            continue;
+        }
+        if (insn->instruction == INST_MOV && insn->operands[1].type != OPERAND_IMMEDIATE
+            && same_operand(&insn->operands[0], &insn->operands[1])) {
+            delete_insn(peep, insn);
+        } else if (insn->instruction == INST_MOV && immediate_value(&insn->operands[0], &value) && value == 0) {
+            int old_cycles = insn_cycles(insn);
+
+            insn->instruction = INST_CLR;
+            insn->operands[0] = insn->operands[1];
+            insn->operand_count = 1;
+            peep->rewrites++;
+            peep->words_saved += (unsigned long)(insn->words - insn_words(insn));
+            peep->cycles_saved += (unsigned long)(old_cycles - insn_cycles(insn));
+            insn->words = insn_words(insn);
+        }
+        i++;
+    }
+
+    /* Backwards, so a jump over jumps that were removed is seen as a jump to the next */
+    for (i = peep->count - 1; i >= 0; i--) {
+        if (!peep->insns[i].deleted && jumps_to_next(peep, i, symbols)) {
+            delete_insn(peep, &peep->insns[i]);
+        }
+    }
+
+    address = peep->count ? peep->insns[0].address : 0;
+    for (i = 0; i < peep->count; i++) {
+        peep->insns[i].new_address = address;
+        if (!peep->insns[i].deleted) address += peep->insns[i].words;
+    }
+    return peep->count ? address : peep->end;
+}
+
+/*
+ * peephole_relocate:
+ * A removed instruction maps to the next kept one, so labels on it move
+ * there. Addresses past the code move by the total saving.
+ */
+int peephole_relocate(const Peephole *peep, int address) {
+    int lo = 0, hi = peep->count;
+
+    if (peep->count == 0 || address < peep->insns[0].address) return address;
+    if (address >= peep->end) return address - (int)peep->words_saved;
+
+    /* First instruction at or after the address */
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (peep->insns[mid].address < address) lo = mid + 1;
+        else hi = mid;
+    }
+    return peep->insns[lo].new_address;
+}
+
+void peephole_load(const PeepInsn *insn, ParsedLine *parsed) {
+    parsed->instruction = insn->instruction;
+    parsed->operand_count = insn->operand_count;
+    memcpy(parsed->operands, insn->operands, sizeof(parsed->operands));
+}
+
+/*
+ * peephole_reset:
+ * Empties the list for the next assembly; the flag and array are kept.
+ */
+void peephole_reset(Peephole *peep) {
+    peep->count = 0;
+    peep->end = 0;
+    peep->rewrites = 0;
+    peep->words_saved = 0;
+    peep->cycles_saved = 0;
+}
+
+void peephole_free(Peephole *peep) {
+    ASM_FREE(peep->insns);
+    memset(peep, 0, sizeof(*peep));
+}
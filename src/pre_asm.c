@@ -3,9 +3,11 @@
 #include <string.h>
 #include <ctype.h>
 #include "pre_asm.h"
+#include "asm_context.h"
 #include "logger.h"
 #include "parser.h"
 #include "utils.h"
+#include "asm_alloc.h"
 
 unsigned int hash(const char *str, size_t table_size) {
     unsigned int hash = 0;
@@ -16,293 +18,428 @@ unsigned int hash(const char *str, size_t table_size) {
 }
 
 MacroTable *create_macro_table(void) {
-    MacroTable *table = (MacroTable *)malloc(sizeof(MacroTable));
+    MacroTable *table = (MacroTable *)ASM_MALLOC(sizeof(MacroTable), MEM_MACRO);
     if (!table) return NULL;
     table->size = INITIAL_TABLE_SIZE;
     table->count = 0;
-    table->buckets = (MacroEntry **)calloc(table->size, sizeof(MacroEntry *));
+    table->parent = NULL;
+    table->lookups = 0;
+    table->probes = 0;
+    table->buckets = (MacroEntry **)ASM_CALLOC(table->size, sizeof(MacroEntry *), MEM_MACRO);
     if (!table->buckets) {
-        free(table);
+        ASM_FREE(table);
         return NULL;
     }
     return table;
 }
 
-void insert_macro(MacroTable *table, const char *name, const char *content) {
+MacroEntry *insert_macro(MacroTable *table, const char *name, const char *content) {
     unsigned int index = hash(name, table->size);
-    MacroEntry *new_entry = (MacroEntry *)malloc(sizeof(MacroEntry));
-    if (!new_entry) return;
-    new_entry->name = strdup_c90(name);
-    new_entry->content = strdup_c90(content);
+    MacroEntry *new_entry = (MacroEntry *)ASM_MALLOC(sizeof(MacroEntry), MEM_MACRO);
+    if (!new_entry) return NULL;
+    new_entry->name = asm_strdup(name, MEM_MACRO);
+    new_entry->content = asm_strdup(content, MEM_MACRO);
+    if (!new_entry->name || !new_entry->content) {
+        ASM_FREE(new_entry->name);
+        ASM_FREE(new_entry->content);
+        ASM_FREE(new_entry);
+        return NULL;
+    }
+    new_entry->line = 0;
+    new_entry->body_lines = NULL;
+    new_entry->body_line_count = 0;
     new_entry->next = table->buckets[index];
     table->buckets[index] = new_entry;
     table->count++;
+    return new_entry;
 }
 
-char *lookup_macro(MacroTable *table, const char *name) {
-    unsigned int index = hash(name, table->size);
-    MacroEntry *entry = table->buckets[index];
-    while (entry) {
-        if (strcmp(entry->name, name) == 0) {
-            return entry->content;
+/*
+ * find_macro:
+ * Looks a macro up in the table and then its parents.
+ */
+MacroEntry *find_macro(MacroTable *table, const char *name) {
+    MacroTable *first = table;
+    first->lookups++;
+    while (table) {
+        unsigned int index = hash(name, table->size);
+        MacroEntry *entry = table->buckets[index];
+        while (entry) {
+            first->probes++;
+            if (strcmp(entry->name, name) == 0) {
+                return entry;
+            }
+            entry = entry->next;
         }
-        entry = entry->next;
+        table = table->parent;
     }
     return NULL;
 }
 
+char *lookup_macro(MacroTable *table, const char *name) {
+    MacroEntry *entry = find_macro(table, name);
+    return entry ? entry->content : NULL;
+}
+
 void free_macro_table(MacroTable *table) {
     size_t i;
     for (i = 0; i < table->size; ++i) {
         MacroEntry *entry = table->buckets[i];
         while (entry) {
             MacroEntry *next = entry->next;
-            free(entry->name);
-            free(entry->content);
-            free(entry);
+            ASM_FREE(entry->name);
+            ASM_FREE(entry->body_lines);
+            ASM_FREE(entry->content);
+            ASM_FREE(entry);
             entry = next;
         }
     }
-    free(table->buckets);
-    free(table);
+    ASM_FREE(table->buckets);
+    ASM_FREE(table);
 }
 
 
-char *pre_assemble(const char *source_filename, MacroTable *table) {
-    FILE *source_file = fopen(source_filename, "r");
-    FILE *temp_file;
-    char *output_path;
-    char line[LINE_LENGTH];
-    int inside_macro = 0;
-    char current_macro_name[LINE_LENGTH];
-    char *macro_buffer = NULL;
-    size_t buffer_size = 0;
-    size_t content_length = 0;
-    int line_num = 0;
-    int had_error = 0;
-    char *original_line;
-
-    if (!source_file) {
-        log_err("Error: Could not open source file %s\n", source_filename);
-        return NULL;
+/*
+ * append_text:
+ * Appends len bytes to the growable expansion buffer.
+ */
+static int append_text(char **buffer, size_t *length, size_t *capacity, const char *text, size_t len) {
+    if (*length + len + 1 > *capacity) {
+        size_t new_capacity = (*capacity == 0) ? 1024 : *capacity;
+        char *temp;
+        while (*length + len + 1 > new_capacity) new_capacity *= 2;
+        temp = ASM_REALLOC(*buffer, new_capacity, MEM_TEXT);
+        if (!temp) return 0;
+        *buffer = temp;
+        *capacity = new_capacity;
     }
+    memcpy(*buffer + *length, text, len);
+    *length += len;
+    (*buffer)[*length] = '\0';
+    return 1;
+}
 
-    /* Allocate .am filename */
-    size_t len = strlen(source_filename);
-    if (len < 3 || strcmp(source_filename + len - 3, ".as") != 0) {
-        log_err("Error: Source file must end with .as\n");
-        fclose(source_file);
-        return NULL;
+/*
+ * append_line_number:
+ * Records the source line of a macro body line.
+ */
+static int append_line_number(int **lines, int *count, int *capacity, int line) {
+    if (*count >= *capacity) {
+        int new_capacity = (*capacity == 0) ? 16 : *capacity * 2;
+        int *temp = (int *)ASM_REALLOC(*lines, new_capacity * sizeof(int), MEM_MACRO);
+        if (!temp) return 0;
+        *lines = temp;
+        *capacity = new_capacity;
     }
+    (*lines)[(*count)++] = line;
+    return 1;
+}
 
-    output_path = malloc(len + 1); 
-    if (!output_path) {
-        log_err("Error: Memory allocation failed for filename\n");
-        fclose(source_file);
-        return NULL;
+/*
+ * append_macro_origins:
+ * Records the origin of each expanded line of a macro call: its body line
+ * in the definition, the macro and the calling line.
+ */
+static int append_macro_origins(AsmContext *ctx, const MacroEntry *entry, int call_line) {
+    const char *p;
+    int macro = source_map_intern_macro(&ctx->map, entry->name);
+    int k = 0;
+
+    if (macro < 0) return 0;
+    for (p = entry->content; *p; p++) {
+        if (*p == '\n') {
+            int line = (k < entry->body_line_count) ? entry->body_lines[k] : entry->line;
+            if (!source_map_add_origin(&ctx->map, line, macro, call_line)) return 0;
+            k++;
+        }
     }
+    return 1;
+}
 
-    snprintf(output_path, len, "%s", source_filename);
-    strcpy(output_path + len - 2, "am");              
+/*
+ * pre_asm_begin:
+ * Starts expanding a source into the given table.
+ */
+void pre_asm_begin(PreAsm *pa, AsmContext *ctx, MacroTable *table) {
+    memset(pa, 0, sizeof(*pa));
+    pa->ctx = ctx;
+    pa->table = table;
+    pa->track_origins = 1;
+    pa->lookups_before = table->lookups;
+    pa->probes_before = table->probes;
+}
 
-    temp_file = fopen(output_path, "w+");
-    if (!temp_file) {
-        log_err("Error: Could not create output file %s\n", output_path);
-        free(output_path);
-        fclose(source_file);
-        return NULL;
+/*
+ * pre_asm_line:
+ * Handles one source line: collects macro definitions and appends the
+ * expanded text of any other line to the output buffer. Errors are
+ * reported and remembered; 0 is returned only when memory runs out.
+ */
+int pre_asm_line(PreAsm *pa, const char *line, char **output, size_t *output_length, size_t *output_capacity) {
+    AsmContext *ctx = pa->ctx;
+    const char *source_filename = ctx->source_name;
+    const char *trim;
+
+    pa->line_num++;
+    ctx->counters.source_lines++;
+    trim = line;
+    while (isspace((unsigned char)*trim)) trim++;
+    if (*trim == ';') {
+        return 1;
     }
 
-    while (fgets(line, LINE_LENGTH, source_file)) {
-        char *trim;
-        line_num++;
-        original_line = strdup_c90(line);
-        trim = line;
-        while (isspace(*trim)) trim++;
-        if (*trim == ';') {
-            free(original_line);
-            continue;
-        }
+    if (pa->inside_macro) {
+        const char *macroend_pos = strstr(line, "macroend");
+        if (macroend_pos != NULL) {
+            char before_macroend[LINE_LENGTH];
+            int i, found_token_before = 0, col;
+            const char *after_macroend;
 
-        if (inside_macro) {
-            char *macroend_pos = strstr(line, "macroend");
-            if (macroend_pos != NULL) {
-                char before_macroend[LINE_LENGTH];
-                int i, found_token_before = 0, col;
-                char *after_macroend;
-
-                strncpy(before_macroend, line, macroend_pos - line);
-                before_macroend[macroend_pos - line] = '\0';
-
-                for (i = 0; before_macroend[i] != '\0'; i++) {
-                    if (!isspace(before_macroend[i])) {
-                        found_token_before = 1;
-                        break;
-                    }
-                }
+            strncpy(before_macroend, line, macroend_pos - line);
+            before_macroend[macroend_pos - line] = '\0';
 
-                if (found_token_before) {
-                    col = (int)(macroend_pos - line) + 1;
-                    asm_err(source_filename, line_num, col, "Unexpected token before 'macroend'");
-                    had_error = 1;
-                    free(original_line);
-                    continue;
+            for (i = 0; before_macroend[i] != '\0'; i++) {
+                if (!isspace(before_macroend[i])) {
+                    found_token_before = 1;
+                    break;
                 }
+            }
 
-                after_macroend = macroend_pos + strlen("macroend");
-                while (isspace(*after_macroend)) after_macroend++;
-                if (*after_macroend != '\0' && *after_macroend != ';') {
-                    col = (int)(after_macroend - line) + 1;
-                    asm_err(source_filename, line_num, col, "Unexpected token after 'macroend'");
-                    had_error = 1;
-                    free(original_line);
-                    continue;
-                }
+            if (found_token_before) {
+                col = (int)(macroend_pos - line) + 1;
+                diag_report(&ctx->diagnostics, LOG_ERR, source_filename, pa->line_num, col, "Unexpected token before 'macroend'");
+                pa->had_error = 1;
+                return 1;
+            }
 
-                if (!macro_buffer) {
-                    macro_buffer = malloc(1);
-                    if (!macro_buffer) exit(1);
-                    macro_buffer[0] = '\0';
-                } else {
-                    macro_buffer[content_length] = '\0';
-                }
+            after_macroend = macroend_pos + strlen("macroend");
+            while (isspace(*after_macroend)) after_macroend++;
+            if (*after_macroend != '\0' && *after_macroend != ';') {
+                col = (int)(after_macroend - line) + 1;
+                diag_report(&ctx->diagnostics, LOG_ERR, source_filename, pa->line_num, col, "Unexpected token after 'macroend'");
+                pa->had_error = 1;
+                return 1;
+            }
 
-                insert_macro(table, current_macro_name, macro_buffer);
-                inside_macro = 0;
-                free(macro_buffer);
-                macro_buffer = NULL;
-                buffer_size = content_length = 0;
-                free(original_line);
-                continue;
+            if (!pa->macro_buffer) {
+                pa->macro_buffer = ASM_MALLOC(1, MEM_MACRO);
+                if (!pa->macro_buffer) {
+                    diag_report(&ctx->diagnostics, LOG_ERR, source_filename, pa->line_num, 0, "Memory allocation failed during pre-assembly");
+                    pa->had_error = 1;
+                    return 0;
+                }
+                pa->macro_buffer[0] = '\0';
             } else {
-                size_t line_len = strlen(line);
-                if (content_length + line_len + 1 >= buffer_size) {
-                    buffer_size = (buffer_size + line_len + 1) * 2;
-                    macro_buffer = realloc(macro_buffer, buffer_size);
-                    if (!macro_buffer) exit(1);
+                pa->macro_buffer[pa->content_length] = '\0';
+            }
+
+            {
+                MacroEntry *entry = insert_macro(pa->table, pa->current_macro_name, pa->macro_buffer);
+                if (!entry) {
+                    diag_report(&ctx->diagnostics, LOG_ERR, source_filename, pa->line_num, 0, "Memory allocation failed during pre-assembly");
+                    pa->had_error = 1;
+                    return 0;
+                }
+                entry->line = pa->macro_line;
+                entry->body_lines = pa->body_lines;
+                entry->body_line_count = pa->body_line_count;
+                pa->body_lines = NULL;
+                pa->body_line_count = pa->body_line_capacity = 0;
+            }
+            pa->inside_macro = 0;
+            ASM_FREE(pa->macro_buffer);
+            pa->macro_buffer = NULL;
+            pa->buffer_size = pa->content_length = 0;
+            return 1;
+        } else {
+            size_t line_len = strlen(line);
+            char *temp = pa->macro_buffer;
+
+            if (pa->content_length + line_len + 1 >= pa->buffer_size) {
+                temp = ASM_REALLOC(pa->macro_buffer, (pa->buffer_size + line_len + 1) * 2, MEM_MACRO);
+                if (temp) {
+                    pa->macro_buffer = temp;
+                    pa->buffer_size = (pa->buffer_size + line_len + 1) * 2;
                 }
-                strcpy(macro_buffer + content_length, line);
-                content_length += line_len;
-                free(original_line);
-                continue;
             }
+            if (!temp || !append_line_number(&pa->body_lines, &pa->body_line_count, &pa->body_line_capacity, pa->line_num)) {
+                diag_report(&ctx->diagnostics, LOG_ERR, source_filename, pa->line_num, 0, "Memory allocation failed during pre-assembly");
+                pa->had_error = 1;
+                return 0;
+            }
+            strcpy(pa->macro_buffer + pa->content_length, line);
+            pa->content_length += line_len;
+            return 1;
         }
+    }
 
-        {
-            char *macro_pos = strstr(line, "macro");
-            if (macro_pos != NULL) {
-                char before_macro[LINE_LENGTH];
-                int found_token_before = 0, i, col;
-                char *after_macro, *check;
-
-                strncpy(before_macro, line, macro_pos - line);
-                before_macro[macro_pos - line] = '\0';
-
-                for (i = 0; before_macro[i] != '\0'; i++) {
-                    if (!isspace(before_macro[i])) {
-                        found_token_before = 1;
-                        break;
-                    }
-                }
+    {
+        const char *macro_pos = strstr(line, "macro");
+        if (macro_pos != NULL) {
+            char before_macro[LINE_LENGTH];
+            int found_token_before = 0, i, col;
+            const char *after_macro, *check;
+
+            strncpy(before_macro, line, macro_pos - line);
+            before_macro[macro_pos - line] = '\0';
 
-                if (found_token_before) {
-                    col = (int)(macro_pos - line) + 1;
-                    asm_err(source_filename, line_num, col, "Unexpected token before 'macro'");
-                    had_error = 1;
-                    free(original_line);
-                    continue;
+            for (i = 0; before_macro[i] != '\0'; i++) {
+                if (!isspace(before_macro[i])) {
+                    found_token_before = 1;
+                    break;
                 }
+            }
 
-                after_macro = macro_pos + strlen("macro");
-                while (isspace(*after_macro)) after_macro++;
+            if (found_token_before) {
+                col = (int)(macro_pos - line) + 1;
+                diag_report(&ctx->diagnostics, LOG_ERR, source_filename, pa->line_num, col, "Unexpected token before 'macro'");
+                pa->had_error = 1;
+                return 1;
+            }
 
-                i = 0;
-                while (!isspace(after_macro[i]) && after_macro[i] != '\0' && i < LINE_LENGTH - 1)
-                    i++;
+            after_macro = macro_pos + strlen("macro");
+            while (isspace(*after_macro)) after_macro++;
 
-                strncpy(current_macro_name, after_macro, i);
-                current_macro_name[i] = '\0';
+            i = 0;
+            while (!isspace(after_macro[i]) && after_macro[i] != '\0' && i < LINE_LENGTH - 1)
+                i++;
 
-                if (INST_NONE != lookup_instruction(current_macro_name)) {
-                    col = (int)(after_macro - line) + 1;
-                    asm_err(source_filename, line_num, col, "Macro name '%s' conflicts with an instruction", current_macro_name);
-                    had_error = 1;
-                    free(original_line);
-                    continue;
-                }
+            strncpy(pa->current_macro_name, after_macro, i);
+            pa->current_macro_name[i] = '\0';
 
-                check = after_macro + i;
-                while (isspace(*check)) check++;
-                if (*check != '\0' && *check != ';') {
-                    col = (int)(check - line) + 1;
-                    asm_err(source_filename, line_num, col, "Unexpected token after macro name '%s'", current_macro_name);
-                    had_error = 1;
-                    free(original_line);
-                    continue;
-                }
+            if (INST_NONE != lookup_instruction(pa->current_macro_name)) {
+                col = (int)(after_macro - line) + 1;
+                diag_report(&ctx->diagnostics, LOG_ERR, source_filename, pa->line_num, col, "Macro name '%s' conflicts with an instruction", pa->current_macro_name);
+                pa->had_error = 1;
+                return 1;
+            }
 
-                if (strlen(current_macro_name) > 0) {
-                    log_dbg("Found macro definition: %s\n", current_macro_name);
-                    inside_macro = 1;
-                    macro_buffer = NULL;
-                    buffer_size = content_length = 0;
-                }
+            check = after_macro + i;
+            while (isspace(*check)) check++;
+            if (*check != '\0' && *check != ';') {
+                col = (int)(check - line) + 1;
+                diag_report(&ctx->diagnostics, LOG_ERR, source_filename, pa->line_num, col, "Unexpected token after macro name '%s'", pa->current_macro_name);
+                pa->had_error = 1;
+                return 1;
+            }
 
-                free(original_line);
-                continue;
+            if (strlen(pa->current_macro_name) > 0) {
+                ASM_LOG_DBG(("Found macro definition: %s\n", pa->current_macro_name));
+                pa->inside_macro = 1;
+                pa->macro_line = pa->line_num;
+                pa->macro_buffer = NULL;
+                pa->buffer_size = pa->content_length = 0;
+                pa->body_line_count = 0;
             }
+
+            return 1;
         }
+    }
 
-        {
-            char output_line[LINE_LENGTH * 10] = "";
-            char code_part[LINE_LENGTH];
-            char *semicolon_pos = strchr(line, ';');
-            char *token;
+    {
+        size_t line_start = *output_length;
+        char code_part[LINE_LENGTH];
+        const char *semicolon_pos = strchr(line, ';');
+        char *token;
+        char *cursor = code_part;
+        int ok = 1;
+
+        if (semicolon_pos) {
+            strncpy(code_part, line, semicolon_pos - line);
+            code_part[semicolon_pos - line] = '\0';
+        } else {
+            strncpy(code_part, line, LINE_LENGTH - 1);
+            code_part[LINE_LENGTH - 1] = '\0';
+        }
 
-            if (semicolon_pos) {
-                strncpy(code_part, line, semicolon_pos - line);
-                code_part[semicolon_pos - line] = '\0';
+        token = next_token(&cursor, " \t\n");
+        while (token && ok) {
+            MacroEntry *macro = find_macro(pa->table, token);
+            if (macro != NULL) {
+                const char *macro_content = macro->content;
+                size_t macro_len = strlen(macro_content);
+                ctx->counters.macro_expansions++;
+                if (macro_len > 0) {
+                    ok = append_text(output, output_length, output_capacity, macro_content, macro_len)
+                        && (!pa->track_origins || append_macro_origins(ctx, macro, pa->line_num));
+                    if (ok && macro_content[macro_len - 1] != '\n')
+                        ok = append_text(output, output_length, output_capacity, " ", 1);
+                }
             } else {
-                strncpy(code_part, line, LINE_LENGTH - 1);
-                code_part[LINE_LENGTH - 1] = '\0';
+                ok = append_text(output, output_length, output_capacity, token, strlen(token))
+                    && append_text(output, output_length, output_capacity, " ", 1);
             }
+            token = next_token(&cursor, " \t\n");
+        }
 
-            token = strtok(code_part, " \t\n");
-            while (token) {
-                char *macro_content = lookup_macro(table, token);
-                if (macro_content != NULL) {
-                    if (macro_content[0] != '\0') {
-                        strcat(output_line, macro_content);
-                        if (macro_content[strlen(macro_content) - 1] != '\n')
-                            strcat(output_line, " ");
-                    }
-                } else {
-                    strcat(output_line, token);
-                    strcat(output_line, " ");
-                }
-                token = strtok(NULL, " \t\n");
-            }
+        if (ok && *output_length > line_start) {
+            if ((*output)[*output_length - 1] == ' ')
+                (*output)[--*output_length] = '\0';
+            ok = append_text(output, output_length, output_capacity, "\n", 1)
+                && (!pa->track_origins || source_map_add_origin(&ctx->map, pa->line_num, -1, 0));
+        }
 
-            if (strlen(output_line) > 0) {
-                size_t len = strlen(output_line);
-                if (len > 0 && output_line[len - 1] == ' ')
-                    output_line[len - 1] = '\0';
-                strcat(output_line, "\n");
-                fputs(output_line, temp_file);
-            }
+        if (!ok) {
+            diag_report(&ctx->diagnostics, LOG_ERR, source_filename, pa->line_num, 0, "Memory allocation failed during pre-assembly");
+            pa->had_error = 1;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * pre_asm_end:
+ * Releases the expansion state and adds the macro table counters to the
+ * context. Returns 1 if no errors were found.
+ */
+int pre_asm_end(PreAsm *pa) {
+    AsmContext *ctx = pa->ctx;
+
+    ASM_FREE(pa->macro_buffer);
+    ASM_FREE(pa->body_lines);
+    pa->macro_buffer = NULL;
+    pa->body_lines = NULL;
+
+    ctx->counters.macro_lookups += pa->table->lookups - pa->lookups_before;
+    ctx->counters.macro_probes += pa->table->probes - pa->probes_before;
+    return !pa->had_error;
+}
+
+/*
+ * pre_assemble:
+ * Expands macros in the source text and returns the resulting (.am) text
+ * as a heap buffer, or NULL if errors were found. Its length is stored in
+ * *out_length.
+ */
+char *pre_assemble(AsmContext *ctx, MacroTable *table, const char *source, size_t length, size_t *out_length) {
+    const char *pos = source;
+    const char *end = source + length;
+    char *output = NULL;
+    size_t output_length = 0;
+    size_t output_capacity = 0;
+    char line[LINE_LENGTH];
+    PreAsm pa;
+
+    if (!append_text(&output, &output_length, &output_capacity, "", 0)) {
+        diag_report(&ctx->diagnostics, LOG_ERR, ctx->source_name, 0, 0, "Memory allocation failed during pre-assembly");
+        return NULL;
+    }
 
-            free(original_line);
+    pre_asm_begin(&pa, ctx, table);
+    while (read_buffer_line(&pos, end, line, LINE_LENGTH)) {
+        if (diag_limit_reached(&ctx->diagnostics)) {
+            pa.had_error = 1;
+            break;
         }
+        if (!pre_asm_line(&pa, line, &output, &output_length, &output_capacity)) break;
     }
 
-    fclose(source_file);
-    if (had_error) {
-        fclose(temp_file);
-        remove(output_path);
-        free(output_path);
+    if (!pre_asm_end(&pa)) {
+        ASM_FREE(output);
         return NULL;
     }
 
-    fclose(temp_file);
-    return output_path;
+    if (out_length) *out_length = output_length;
+    return output;
 }
@@ -0,0 +1,240 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "server.h"
+#include "libassembler.h"
+#include "utils.h"
+#include "logger.h"
+#include "asm_alloc.h"
+
+#define HEADER_LENGTH 512
+
+/* Reusable per-server buffers */
+typedef struct {
+    char *source;
+    size_t source_capacity;
+    char *diagnostics;
+    size_t diagnostics_capacity;
+} ServerBuffers;
+
+static long elapsed_micros(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long)(now.tv_sec - start->tv_sec) * 1000000L + (now.tv_nsec - start->tv_nsec) / 1000L;
+}
+
+static int reserve(char **buffer, size_t *capacity, size_t needed) {
+    if (needed > *capacity) {
+        size_t new_capacity = (*capacity == 0) ? 4096 : *capacity;
+        char *temp;
+        while (new_capacity < needed) {
+            if (new_capacity > (size_t)-1 / 2) return 0;
+            new_capacity *= 2;
+        }
+        temp = (char *)ASM_REALLOC(*buffer, new_capacity, MEM_OTHER);
+        if (!temp) return 0;
+        *buffer = temp;
+        *capacity = new_capacity;
+    }
+    return 1;
+}
+
+/*
+ * format_diagnostics:
+ * Renders the result diagnostics as text lines into the reusable buffer.
+ */
+static size_t format_diagnostics(const AsmResult *result, ServerBuffers *buffers) {
+    size_t length = 0;
+    int i;
+
+    for (i = 0; i < result->diagnostic_count; i++) {
+        const AsmDiagnostic *d = &result->diagnostics[i];
+        size_t needed = strlen(d->file) + strlen(d->message) + 64;
+
+        if (!reserve(&buffers->diagnostics, &buffers->diagnostics_capacity, length + needed)) break;
+        length += (size_t)sprintf(buffers->diagnostics + length, "%s:%d:%d: %s: %s\n", d->file, d->line, d->column,
+                                  d->level == ASM_DIAG_ERROR ? "error" : "warning", d->message);
+    }
+    return length;
+}
+
+/*
+ * handle_assemble:
+ * Reads the source payload of an ASSEMBLE request and writes the response.
+ */
+static int handle_assemble(AsmSession *session, ServerBuffers *buffers, const char *name, size_t length, FILE *in, FILE *out) {
+    struct timespec start;
+    AsmOptions options;
+    AsmResult result;
+    size_t diag_length;
+    long micros;
+
+    if (!reserve(&buffers->source, &buffers->source_capacity, length + 1)) return 0;
+    if (fread(buffers->source, 1, length, in) != length) return 0;
+    buffers->source[length] = '\0';
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    asm_options_init(&options);
+    options.name = name;
+    options.format_object = true;
+    asm_session_assemble(session, buffers->source, length, &options, &result);
+
+    diag_length = format_diagnostics(&result, buffers);
+    micros = elapsed_micros(&start);
+
+    fprintf(out, "%s %lu %lu %ld\n", result.success ? "OK" : "ERROR",
+            (unsigned long)result.object_length, (unsigned long)diag_length, micros);
+    if (result.object_length > 0) fwrite(result.object, 1, result.object_length, out);
+    if (diag_length > 0) fwrite(buffers->diagnostics, 1, diag_length, out);
+    fflush(out);
+
+    asm_result_free(&result);
+    return 1;
+}
+
+/*
+ * serve_stream:
+ * Answers requests until end of input. Returns 1 when a QUIT was received.
+ */
+static int serve_stream(AsmSession *session, ServerBuffers *buffers, FILE *in, FILE *out) {
+    char header[HEADER_LENGTH];
+
+    while (fgets(header, sizeof(header), in)) {
+        char name[HEADER_LENGTH];
+        unsigned long length;
+
+        if (strcmp(header, "QUIT\n") == 0) {
+            return 1;
+        }
+
+        if (strcmp(header, "PING\n") == 0) {
+            fputs("PONG\n", out);
+            fflush(out);
+            continue;
+        }
+
+        if (sscanf(header, "ASSEMBLE %511s %lu", name, &length) == 2) {
+            /* The payload of a refused frame cannot be skipped, so the stream ends */
+            if (length > SERVER_MAX_SOURCE || !handle_assemble(session, buffers, name, (size_t)length, in, out)) {
+                fputs("ERROR 0 0 0\n", out);
+                fflush(out);
+                return 0;
+            }
+            continue;
+        }
+
+        fputs("ERROR 0 0 0\n", out);
+        fflush(out);
+    }
+
+    return 0;
+}
+
+static int serve_socket(AsmSession *session, ServerBuffers *buffers, const char *path) {
+    struct sockaddr_un addr;
+    int listen_fd;
+    int stop = 0;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Error: Socket path too long: %s\n", path);
+        return 1;
+    }
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        perror("socket");
+        return 1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listen_fd, 8) < 0) {
+        perror(path);
+        close(listen_fd);
+        return 1;
+    }
+
+    while (!stop) {
+        FILE *in, *out;
+        int client = accept(listen_fd, NULL, NULL);
+        if (client < 0) {
+            perror("accept");
+            break;
+        }
+
+        in = fdopen(client, "rb");
+        out = fdopen(dup(client), "wb");
+        if (in && out) {
+            stop = serve_stream(session, buffers, in, out);
+        }
+        if (in) fclose(in); else close(client);
+        if (out) fclose(out);
+    }
+
+    close(listen_fd);
+    unlink(path);
+    return 0;
+}
+
+/*
+ * serve:
+ * Entry point of server mode.
+ */
+int serve(const ServerOptions *options) {
+    AsmSession *session;
+    ServerBuffers buffers;
+    int status = 0;
+
+    /* Debug logging goes to stdout, which carries the responses */
+    asm_log_set_level(LOG_WARN);
+
+    session = asm_session_create();
+    if (!session) {
+        fprintf(stderr, "Failed to allocate assembler session.\n");
+        return 1;
+    }
+
+    if (options->macro_library) {
+        AsmOptions lib_options;
+        size_t length;
+        char *library = read_file(options->macro_library, &length);
+
+        if (!library) {
+            fprintf(stderr, "Error: Could not open macro library %s\n", options->macro_library);
+            asm_session_destroy(session);
+            return 1;
+        }
+
+        asm_options_init(&lib_options);
+        lib_options.name = options->macro_library;
+        lib_options.echo_diagnostics = true;
+        if (!asm_session_load_macros(session, library, length, &lib_options)) {
+            fprintf(stderr, "Failed to load macro library %s\n", options->macro_library);
+            ASM_FREE(library);
+            asm_session_destroy(session);
+            return 1;
+        }
+        ASM_FREE(library);
+    }
+
+    memset(&buffers, 0, sizeof(buffers));
+
+    if (options->socket_path) {
+        status = serve_socket(session, &buffers, options->socket_path);
+    } else {
+        serve_stream(session, &buffers, stdin, stdout);
+    }
+
+    ASM_FREE(buffers.source);
+    ASM_FREE(buffers.diagnostics);
+    asm_session_destroy(session);
+    return status;
+}
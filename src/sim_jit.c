@@ -0,0 +1,390 @@
+#if defined(__x86_64__) && defined(__linux__)
+#define _DEFAULT_SOURCE     /* MAP_ANONYMOUS */
+#define SIM_JIT_NATIVE 1
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include "sim_jit.h"
+#include "stats.h"
+#include "asm_alloc.h"
+
+#ifdef SIM_JIT_NATIVE
+
+#include <sys/mman.h>
+
+#define JIT_CODE_SIZE (1024 * 1024)
+#define JIT_MAX_BLOCK_INSNS 64
+#define JIT_MAX_INSN_BYTES 64       /* longest sequence emitted for one instruction */
+#define JIT_NEVER 0xFFFF            /* hot count of a start that cannot be translated */
+
+typedef int (*JitFn)(Simulator *sim);
+
+typedef struct {
+    unsigned char *code;            /* NULL when not translated */
+    int end;                        /* first address after the block */
+    int count;                      /* instructions in the block */
+} JitBlock;
+
+struct SimJit {
+    unsigned char *code;
+    size_t used;
+    int threshold;
+    bool timing;
+    JitBlock blocks[SIM_MEMORY_SIZE];
+    unsigned short hot[SIM_MEMORY_SIZE];
+    int starts[SIM_MEMORY_SIZE];    /* addresses with a live block */
+    int start_count;
+    SimJitStats stats;
+};
+
+/* Register operands of the emitted instructions */
+#define EAX 0
+#define ECX 1
+
+typedef struct {
+    unsigned char *p;
+} Emitter;
+
+static void emit1(Emitter *e, int byte) {
+    *e->p++ = (unsigned char)byte;
+}
+
+static void emit4(Emitter *e, long value) {
+    unsigned long v = (unsigned long)value;
+    emit1(e, (int)(v & 0xFF));
+    emit1(e, (int)((v >> 8) & 0xFF));
+    emit1(e, (int)((v >> 16) & 0xFF));
+    emit1(e, (int)((v >> 24) & 0xFF));
+}
+
+/* ModRM for [rdi + disp32] with the given register field */
+static void emit_rdi_disp(Emitter *e, int reg, long disp) {
+    emit1(e, 0x87 | (reg << 3));
+    emit4(e, disp);
+}
+
+static long reg_offset(int r) {
+    return (long)offsetof(Simulator, regs) + (long)r * (long)sizeof(int);
+}
+
+static long mem_offset(int addr) {
+    return (long)offsetof(Simulator, memory) + (long)addr * (long)sizeof(unsigned short);
+}
+
+/* shl reg, 18; sar reg, 18: sign-extends the low 14 bits */
+static void emit_wrap14(Emitter *e, int reg) {
+    emit1(e, 0xC1); emit1(e, 0xE0 | reg); emit1(e, 18);
+    emit1(e, 0xC1); emit1(e, 0xF8 | reg); emit1(e, 18);
+}
+
+static void emit_load(Emitter *e, int reg, int kind, int value) {
+    if (kind == SIM_OPND_REG) {
+        emit1(e, 0x8B);                         /* mov reg, [rdi + regs] */
+        emit_rdi_disp(e, reg, reg_offset(value));
+    } else if (kind == SIM_OPND_MEM) {
+        emit1(e, 0x0F); emit1(e, 0xB7);         /* movzx reg, word [rdi + memory] */
+        emit_rdi_disp(e, reg, mem_offset(value));
+        emit_wrap14(e, reg);
+    } else {
+        emit1(e, 0xB8 + reg);                   /* mov reg, imm32 */
+        emit4(e, value);
+    }
+}
+
+/* Stores eax (already wrapped) into the destination operand */
+static void emit_store(Emitter *e, int kind, int value) {
+    if (kind == SIM_OPND_REG) {
+        emit1(e, 0x89);                         /* mov [rdi + regs], eax */
+        emit_rdi_disp(e, EAX, reg_offset(value));
+    } else {
+        emit1(e, 0x25); emit4(e, 0x3FFF);       /* and eax, 0x3FFF */
+        emit1(e, 0x66); emit1(e, 0x89);         /* mov [rdi + memory], ax */
+        emit_rdi_disp(e, EAX, mem_offset(value));
+    }
+}
+
+/* Sets sim->zero and sim->negative from eax */
+static void emit_flags(Emitter *e) {
+    emit1(e, 0x31); emit1(e, 0xC9);             /* xor ecx, ecx */
+    emit1(e, 0x85); emit1(e, 0xC0);             /* test eax, eax */
+    emit1(e, 0x0F); emit1(e, 0x94); emit1(e, 0xC1);  /* sete cl */
+    emit1(e, 0x89); emit_rdi_disp(e, ECX, (long)offsetof(Simulator, zero));
+    emit1(e, 0x31); emit1(e, 0xC9);             /* xor ecx, ecx */
+    emit1(e, 0x85); emit1(e, 0xC0);             /* test eax, eax */
+    emit1(e, 0x0F); emit1(e, 0x98); emit1(e, 0xC1);  /* sets cl */
+    emit1(e, 0x89); emit_rdi_disp(e, ECX, (long)offsetof(Simulator, negative));
+}
+
+/* Returns next_pc to the caller */
+static void emit_exit(Emitter *e, int next_pc) {
+    emit1(e, 0xB8); emit4(e, next_pc);          /* mov eax, next_pc */
+    emit1(e, 0xC3);                             /* ret */
+}
+
+/*
+ * translatable:
+ * Whether the record can go into a block. Control transfers other than
+ * jmp/bne with a memory target, I/O and stores into code stay interpreted.
+ */
+static int translatable(const Simulator *sim, const SimInsn *d) {
+    switch (d->op) {
+        case INST_MOV: case INST_ADD: case INST_SUB: case INST_LEA:
+        case INST_CLR: case INST_NOT: case INST_INC: case INST_DEC:
+            if (d->dst_kind == SIM_OPND_MEM && d->dst >= sim->code_start && d->dst < sim->code_end) return 0;
+            return 1;
+        case INST_CMP:
+            return 1;
+        case INST_JMP: case INST_BNE:
+            return d->dst_kind == SIM_OPND_MEM;
+        default:
+            return 0;
+    }
+}
+
+/* Emits one non-branch instruction */
+static void emit_insn(Emitter *e, const SimInsn *d) {
+    switch (d->op) {
+        case INST_MOV:
+            emit_load(e, EAX, d->src_kind, d->src);
+            break;
+        case INST_CMP:
+            emit_load(e, EAX, d->src_kind, d->src);
+            emit_load(e, ECX, d->dst_kind, d->dst);
+            emit1(e, 0x29); emit1(e, 0xC8);     /* sub eax, ecx */
+            emit_wrap14(e, EAX);
+            emit_flags(e);
+            return;
+        case INST_ADD:
+            emit_load(e, EAX, d->dst_kind, d->dst);
+            emit_load(e, ECX, d->src_kind, d->src);
+            emit1(e, 0x01); emit1(e, 0xC8);     /* add eax, ecx */
+            emit_wrap14(e, EAX);
+            break;
+        case INST_SUB:
+            emit_load(e, EAX, d->dst_kind, d->dst);
+            emit_load(e, ECX, d->src_kind, d->src);
+            emit1(e, 0x29); emit1(e, 0xC8);     /* sub eax, ecx */
+            emit_wrap14(e, EAX);
+            break;
+        case INST_LEA:
+            emit_load(e, EAX, SIM_OPND_IMM, d->src);
+            break;
+        case INST_CLR:
+            emit_load(e, EAX, SIM_OPND_IMM, 0);
+            break;
+        case INST_NOT:
+            emit_load(e, EAX, d->dst_kind, d->dst);
+            emit1(e, 0xF7); emit1(e, 0xD0);     /* not eax */
+            emit_wrap14(e, EAX);
+            break;
+        case INST_INC:
+            emit_load(e, EAX, d->dst_kind, d->dst);
+            emit1(e, 0x83); emit1(e, 0xC0); emit1(e, 1);    /* add eax, 1 */
+            emit_wrap14(e, EAX);
+            break;
+        case INST_DEC:
+            emit_load(e, EAX, d->dst_kind, d->dst);
+            emit1(e, 0x83); emit1(e, 0xE8); emit1(e, 1);    /* sub eax, 1 */
+            emit_wrap14(e, EAX);
+            break;
+    }
+    emit_store(e, d->dst_kind, d->dst);
+}
+
+/*
+ * translate:
+ * Translates the block starting at pc. Returns 0 if nothing there can be
+ * translated or the code buffer is full.
+ */
+static int translate(Simulator *sim, SimJit *jit, int pc) {
+    Emitter e;
+    JitBlock *block = &jit->blocks[pc];
+    int addr = pc;
+    int count = 0;
+    double start = stats_now();
+
+    if (jit->used + (JIT_MAX_BLOCK_INSNS + 1) * JIT_MAX_INSN_BYTES > JIT_CODE_SIZE) return 0;
+    if (!translatable(sim, &sim->decoded[pc])) return 0;
+
+    e.p = jit->code + jit->used;
+    block->code = e.p;
+
+    while (count < JIT_MAX_BLOCK_INSNS && addr < SIM_MEMORY_SIZE) {
+        const SimInsn *d = &sim->decoded[addr];
+
+        if (!translatable(sim, d)) break;
+        count++;
+
+        if (d->op == INST_JMP) {
+            emit_exit(&e, d->dst);
+            addr += d->length;
+            break;
+        }
+        if (d->op == INST_BNE) {
+            emit1(&e, 0x8B);                    /* mov ecx, [rdi + zero] */
+            emit_rdi_disp(&e, ECX, (long)offsetof(Simulator, zero));
+            emit1(&e, 0xB8); emit4(&e, d->dst); /* mov eax, target */
+            emit1(&e, 0xBA); emit4(&e, addr + d->length);   /* mov edx, next */
+            emit1(&e, 0x85); emit1(&e, 0xC9);   /* test ecx, ecx */
+            emit1(&e, 0x0F); emit1(&e, 0x45); emit1(&e, 0xC2);  /* cmovnz eax, edx */
+            emit1(&e, 0xC3);                    /* ret */
+            addr += d->length;
+            break;
+        }
+
+        emit_insn(&e, d);
+        addr += d->length;
+        if (addr >= SIM_MEMORY_SIZE || count == JIT_MAX_BLOCK_INSNS || !translatable(sim, &sim->decoded[addr])) {
+            emit_exit(&e, addr);
+            break;
+        }
+    }
+
+    block->end = addr;
+    block->count = count;
+    jit->stats.code_bytes += (unsigned long)(e.p - block->code);
+    jit->used = (size_t)(e.p - jit->code);
+    jit->starts[jit->start_count++] = pc;
+    jit->stats.translations++;
+    jit->stats.translate_seconds += stats_now() - start;
+    return 1;
+}
+
+bool sim_jit_supported(void) {
+    return true;
+}
+
+SimJit *sim_jit_create(int threshold, bool timing) {
+    SimJit *jit = (SimJit *)ASM_CALLOC(1, sizeof(SimJit), MEM_OTHER);
+    void *code;
+
+    if (!jit) return NULL;
+
+    code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED) {
+        ASM_FREE(jit);
+        return NULL;
+    }
+
+    jit->code = (unsigned char *)code;
+    jit->threshold = (threshold > 0 && threshold < JIT_NEVER) ? threshold : 50;
+    jit->timing = timing;
+    return jit;
+}
+
+void sim_jit_destroy(SimJit *jit) {
+    if (!jit) return;
+    munmap(jit->code, JIT_CODE_SIZE);
+    ASM_FREE(jit);
+}
+
+void sim_jit_reset(SimJit *jit) {
+    int i;
+    for (i = 0; i < jit->start_count; i++) {
+        jit->blocks[jit->starts[i]].code = NULL;
+    }
+    jit->start_count = 0;
+    jit->used = 0;
+    memset(jit->hot, 0, sizeof(jit->hot));
+}
+
+void sim_jit_invalidate(SimJit *jit, int addr) {
+    int i = 0;
+
+    while (i < jit->start_count) {
+        int start = jit->starts[i];
+        JitBlock *block = &jit->blocks[start];
+
+        if (addr >= start && addr < block->end) {
+            block->code = NULL;
+            jit->hot[start] = 0;
+            jit->starts[i] = jit->starts[--jit->start_count];
+            jit->stats.invalidations++;
+        } else {
+            i++;
+        }
+    }
+}
+
+int sim_jit_execute(Simulator *sim, SimJit *jit, int pc, unsigned long remaining, unsigned long *steps) {
+    double start;
+    int ran = 0;
+
+    if (sim->profile || sim->trace) return pc;
+    start = jit->timing ? stats_now() : 0.0;
+
+    while (pc >= 0 && pc < SIM_MEMORY_SIZE) {
+        JitBlock *block = &jit->blocks[pc];
+        JitFn fn;
+
+        if (!block->code) {
+            if (jit->hot[pc] == JIT_NEVER || ++jit->hot[pc] < jit->threshold) break;
+            if (!translate(sim, jit, pc)) {
+                jit->hot[pc] = JIT_NEVER;
+                break;
+            }
+        }
+
+        if ((unsigned long)block->count > remaining) break;
+
+        memcpy(&fn, &block->code, sizeof(fn));
+        pc = fn(sim);
+        remaining -= (unsigned long)block->count;
+        *steps += (unsigned long)block->count;
+        jit->stats.native_steps += (unsigned long)block->count;
+        jit->stats.block_runs++;
+        ran = 1;
+    }
+
+    if (ran && jit->timing) jit->stats.native_seconds += stats_now() - start;
+    return pc;
+}
+
+void sim_jit_stats(const SimJit *jit, SimJitStats *out) {
+    *out = jit->stats;
+}
+
+#else
+
+/* No native backend for this platform: the simulator only interprets */
+
+bool sim_jit_supported(void) {
+    return false;
+}
+
+SimJit *sim_jit_create(int threshold, bool timing) {
+    (void)threshold;
+    (void)timing;
+    return NULL;
+}
+
+void sim_jit_destroy(SimJit *jit) {
+    (void)jit;
+}
+
+void sim_jit_reset(SimJit *jit) {
+    (void)jit;
+}
+
+void sim_jit_invalidate(SimJit *jit, int addr) {
+    (void)jit;
+    (void)addr;
+}
+
+int sim_jit_execute(Simulator *sim, SimJit *jit, int pc, unsigned long remaining, unsigned long *steps) {
+    (void)sim;
+    (void)jit;
+    (void)remaining;
+    (void)steps;
+    return pc;
+}
+
+void sim_jit_stats(const SimJit *jit, SimJitStats *out) {
+    (void)jit;
+    memset(out, 0, sizeof(*out));
+}
+
+#endif
@@ -0,0 +1,644 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sim_trace.h"
+#include "asm_alloc.h"
+
+/*
+ * Event encoding. A step starts with its pc; the events of the instruction
+ * follow it. Values are zigzag varints, so small magnitudes take one byte.
+ */
+#define EV_STEP_NEAR 0x00   /* 0x00..0x03: pc = previous pc + tag */
+#define EV_STEP_FAR 0x04    /* pc = previous pc + varint delta */
+#define EV_REG 0x10         /* 0x10 | reg, varint value */
+#define EV_MEM 0x20         /* varint address, varint value */
+#define EV_FLAGS 0x30       /* 0x30 | zero | negative << 1 */
+#define EV_PUSH 0x40        /* varint value */
+#define EV_POP 0x41
+#define EV_INPUT 0x50       /* one input character consumed */
+#define EV_OUTPUT 0x51      /* one byte: the character */
+
+/* Most bytes one instruction can append; steps never straddle blocks */
+#define TRACE_MAX_STEP_BYTES 24
+
+#define TRACE_FILE_MAGIC "ASMTRACE"
+
+typedef struct {
+    unsigned char *data;
+    unsigned long used;
+} TraceBlock;
+
+/* Machine state before the first step recorded in its block */
+typedef struct {
+    unsigned long step;
+    unsigned long block;            /* absolute index of that block */
+    unsigned long input_pos;
+    int pc;
+    int zero;
+    int negative;
+    int sp;
+    int code_start;
+    int code_end;
+    int image_end;
+    int regs[SIM_REGISTERS];
+    int stack[SIM_STACK_SIZE];
+    unsigned short memory[SIM_MEMORY_SIZE];
+} TraceCheckpoint;
+
+struct SimTrace {
+    TraceBlock *blocks;
+    unsigned long block_count;
+    unsigned long block_capacity;
+    unsigned long block_base;       /* absolute index of blocks[0] */
+    TraceCheckpoint **checkpoints;
+    unsigned long checkpoint_count;
+    unsigned long checkpoint_capacity;
+    unsigned char *cursor;          /* write position in the last block; NULL when not recording */
+    unsigned char *limit;
+    int last_pc;
+    unsigned long steps;            /* absolute step count */
+    unsigned long max_bytes;
+    unsigned long dropped_blocks;
+    int end_pc;
+    SimStatus end_status;
+    bool failed;
+};
+
+SimTrace *sim_trace_create(unsigned long max_bytes) {
+    SimTrace *trace = (SimTrace *)ASM_CALLOC(1, sizeof(SimTrace), MEM_OTHER);
+    if (!trace) return NULL;
+    trace->max_bytes = max_bytes ? max_bytes : TRACE_DEFAULT_LIMIT;
+    trace->end_status = SIM_READY;
+    return trace;
+}
+
+void sim_trace_destroy(SimTrace *trace) {
+    unsigned long i;
+    if (!trace) return;
+    for (i = 0; i < trace->block_count; i++) ASM_FREE(trace->blocks[i].data);
+    for (i = 0; i < trace->checkpoint_count; i++) ASM_FREE(trace->checkpoints[i]);
+    ASM_FREE(trace->blocks);
+    ASM_FREE(trace->checkpoints);
+    ASM_FREE(trace);
+}
+
+static unsigned long memory_bytes(const SimTrace *trace) {
+    return trace->block_count * (unsigned long)TRACE_BLOCK_SIZE
+         + trace->checkpoint_count * (unsigned long)sizeof(TraceCheckpoint);
+}
+
+/* Frees the oldest checkpoint and the blocks it covers */
+static void drop_oldest_interval(SimTrace *trace) {
+    unsigned long end = trace->checkpoints[1]->block - trace->block_base;
+    unsigned long i;
+
+    for (i = 0; i < end; i++) ASM_FREE(trace->blocks[i].data);
+    memmove(trace->blocks, trace->blocks + end, (trace->block_count - end) * sizeof(TraceBlock));
+    trace->block_count -= end;
+    trace->block_base += end;
+    trace->dropped_blocks += end;
+
+    ASM_FREE(trace->checkpoints[0]);
+    memmove(trace->checkpoints, trace->checkpoints + 1, (trace->checkpoint_count - 1) * sizeof(TraceCheckpoint *));
+    trace->checkpoint_count--;
+}
+
+static bool add_checkpoint(SimTrace *trace, const Simulator *sim, int pc) {
+    TraceCheckpoint *cp;
+
+    if (trace->checkpoint_count >= trace->checkpoint_capacity) {
+        unsigned long new_capacity = (trace->checkpoint_capacity == 0) ? 16 : trace->checkpoint_capacity * 2;
+        TraceCheckpoint **temp = (TraceCheckpoint **)ASM_REALLOC(trace->checkpoints, new_capacity * sizeof(TraceCheckpoint *), MEM_OTHER);
+        if (!temp) return false;
+        trace->checkpoints = temp;
+        trace->checkpoint_capacity = new_capacity;
+    }
+
+    cp = (TraceCheckpoint *)ASM_MALLOC(sizeof(TraceCheckpoint), MEM_OTHER);
+    if (!cp) return false;
+    cp->step = trace->steps;
+    cp->block = trace->block_base + trace->block_count;
+    cp->input_pos = (unsigned long)sim->input_pos;
+    cp->pc = pc;
+    cp->zero = sim->zero;
+    cp->negative = sim->negative;
+    cp->sp = sim->sp;
+    cp->code_start = sim->code_start;
+    cp->code_end = sim->code_end;
+    cp->image_end = sim->image_end;
+    memcpy(cp->regs, sim->regs, sizeof(cp->regs));
+    memcpy(cp->stack, sim->stack, sizeof(cp->stack));
+    memcpy(cp->memory, sim->memory, sizeof(cp->memory));
+    trace->checkpoints[trace->checkpoint_count++] = cp;
+    return true;
+}
+
+/*
+ * start_block:
+ * Opens the next block at a step boundary. Every TRACE_CHECKPOINT_BLOCKS
+ * blocks the block starts with a checkpoint, which is also where the oldest
+ * interval is dropped once the size limit is reached.
+ */
+static bool start_block(SimTrace *trace, const Simulator *sim, int pc) {
+    unsigned long index = trace->block_base + trace->block_count;
+    TraceBlock *block;
+
+    if (trace->block_count > 0) {
+        TraceBlock *last = &trace->blocks[trace->block_count - 1];
+        last->used = (unsigned long)(trace->cursor - last->data);
+    }
+
+    if (index % TRACE_CHECKPOINT_BLOCKS == 0) {
+        while (trace->checkpoint_count > 1
+               && memory_bytes(trace) + TRACE_BLOCK_SIZE + sizeof(TraceCheckpoint) > trace->max_bytes) {
+            drop_oldest_interval(trace);
+        }
+        if (!add_checkpoint(trace, sim, pc)) return false;
+        trace->last_pc = pc;
+    }
+
+    if (trace->block_count >= trace->block_capacity) {
+        unsigned long new_capacity = (trace->block_capacity == 0) ? 64 : trace->block_capacity * 2;
+        TraceBlock *temp = (TraceBlock *)ASM_REALLOC(trace->blocks, new_capacity * sizeof(TraceBlock), MEM_OTHER);
+        if (!temp) return false;
+        trace->blocks = temp;
+        trace->block_capacity = new_capacity;
+    }
+
+    block = &trace->blocks[trace->block_count];
+    block->data = (unsigned char *)ASM_MALLOC(TRACE_BLOCK_SIZE, MEM_OTHER);
+    if (!block->data) return false;
+    block->used = 0;
+    trace->block_count++;
+    trace->cursor = block->data;
+    trace->limit = block->data + TRACE_BLOCK_SIZE;
+    return true;
+}
+
+static void put_varint(SimTrace *trace, long value) {
+    unsigned long v = value < 0 ? ((unsigned long)(-(value + 1)) << 1) | 1 : (unsigned long)value << 1;
+    while (v >= 0x80) {
+        *trace->cursor++ = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    *trace->cursor++ = (unsigned char)v;
+}
+
+static long get_varint(const unsigned char **p) {
+    unsigned long v = 0;
+    int shift = 0;
+    while (**p & 0x80) {
+        v |= (unsigned long)(*(*p)++ & 0x7F) << shift;
+        shift += 7;
+    }
+    v |= (unsigned long)*(*p)++ << shift;
+    return (v & 1) ? -(long)(v >> 1) - 1 : (long)(v >> 1);
+}
+
+void sim_trace_step(SimTrace *trace, const Simulator *sim, int pc) {
+    int delta;
+
+    if (trace->failed) return;
+    if (trace->block_count == 0) trace->steps = sim->steps;
+    if (!trace->cursor || trace->cursor + TRACE_MAX_STEP_BYTES > trace->limit) {
+        if (!start_block(trace, sim, pc)) {
+            trace->failed = true;
+            trace->cursor = NULL;
+            return;
+        }
+    }
+
+    delta = pc - trace->last_pc;
+    if (delta >= 0 && delta <= 3) {
+        *trace->cursor++ = (unsigned char)(EV_STEP_NEAR + delta);
+    } else {
+        *trace->cursor++ = EV_STEP_FAR;
+        put_varint(trace, delta);
+    }
+    trace->last_pc = pc;
+    trace->steps++;
+}
+
+void sim_trace_reg(SimTrace *trace, int reg, int value) {
+    if (!trace->cursor) return;
+    *trace->cursor++ = (unsigned char)(EV_REG | reg);
+    put_varint(trace, value);
+}
+
+void sim_trace_mem(SimTrace *trace, int addr, int value) {
+    if (!trace->cursor) return;
+    *trace->cursor++ = EV_MEM;
+    put_varint(trace, addr);
+    put_varint(trace, value);
+}
+
+void sim_trace_flags(SimTrace *trace, int zero, int negative) {
+    if (!trace->cursor) return;
+    *trace->cursor++ = (unsigned char)(EV_FLAGS | (zero ? 1 : 0) | (negative ? 2 : 0));
+}
+
+void sim_trace_push(SimTrace *trace, int value) {
+    if (!trace->cursor) return;
+    *trace->cursor++ = EV_PUSH;
+    put_varint(trace, value);
+}
+
+void sim_trace_pop(SimTrace *trace) {
+    if (!trace->cursor) return;
+    *trace->cursor++ = EV_POP;
+}
+
+void sim_trace_input(SimTrace *trace) {
+    if (!trace->cursor) return;
+    *trace->cursor++ = EV_INPUT;
+}
+
+void sim_trace_output(SimTrace *trace, int c) {
+    if (!trace->cursor) return;
+    *trace->cursor++ = EV_OUTPUT;
+    *trace->cursor++ = (unsigned char)c;
+}
+
+void sim_trace_end(SimTrace *trace, int pc, SimStatus status) {
+    trace->end_pc = pc;
+    trace->end_status = status;
+}
+
+/* Bytes written to a block; the last one is still being filled */
+static unsigned long block_used(const SimTrace *trace, unsigned long i) {
+    if (i + 1 == trace->block_count && trace->cursor) {
+        return (unsigned long)(trace->cursor - trace->blocks[i].data);
+    }
+    return trace->blocks[i].used;
+}
+
+void sim_trace_stats(const SimTrace *trace, SimTraceStats *out) {
+    unsigned long i;
+
+    memset(out, 0, sizeof(*out));
+    out->first_step = trace->checkpoint_count ? trace->checkpoints[0]->step : trace->steps;
+    out->steps = trace->steps;
+    for (i = 0; i < trace->block_count; i++) out->event_bytes += block_used(trace, i);
+    out->blocks = trace->block_count;
+    out->checkpoints = trace->checkpoint_count;
+    out->dropped_blocks = trace->dropped_blocks;
+    out->memory_bytes = memory_bytes(trace);
+}
+
+/* Last checkpoint at or before step, or NULL if the step is not in the trace */
+static const TraceCheckpoint *find_checkpoint(const SimTrace *trace, unsigned long step) {
+    unsigned long lo = 0, hi = trace->checkpoint_count;
+
+    if (hi == 0 || step < trace->checkpoints[0]->step || step > trace->steps) return NULL;
+    while (hi - lo > 1) {
+        unsigned long mid = lo + (hi - lo) / 2;
+        if (trace->checkpoints[mid]->step <= step) lo = mid;
+        else hi = mid;
+    }
+    return trace->checkpoints[lo];
+}
+
+/*
+ * Walks the events from a checkpoint. next_event() returns the tag of the
+ * next event with its operands decoded, or -1 at the end of the trace.
+ */
+typedef struct {
+    const SimTrace *trace;
+    unsigned long block;            /* index into trace->blocks */
+    const unsigned char *p;
+    const unsigned char *end;
+    int pc;
+    long a;
+    long b;
+} TraceReader;
+
+static void reader_open(TraceReader *r, const SimTrace *trace, const TraceCheckpoint *cp) {
+    r->trace = trace;
+    r->block = cp->block - trace->block_base;
+    r->p = trace->blocks[r->block].data;
+    r->end = r->p + block_used(trace, r->block);
+    r->pc = cp->pc;
+}
+
+static int next_event(TraceReader *r) {
+    int tag;
+
+    while (r->p >= r->end) {
+        if (r->block + 1 >= r->trace->block_count) return -1;
+        r->block++;
+        r->p = r->trace->blocks[r->block].data;
+        r->end = r->p + block_used(r->trace, r->block);
+    }
+
+    tag = *r->p++;
+    if (tag <= EV_STEP_NEAR + 3) {
+        r->pc += tag - EV_STEP_NEAR;
+        return EV_STEP_NEAR;
+    }
+    switch (tag & 0xF0) {
+        case EV_REG:
+            r->a = tag & 0x7;
+            r->b = get_varint(&r->p);
+            return EV_REG;
+        case EV_FLAGS:
+            r->a = tag & 1;
+            r->b = (tag >> 1) & 1;
+            return EV_FLAGS;
+    }
+    switch (tag) {
+        case EV_STEP_FAR:
+            r->pc += (int)get_varint(&r->p);
+            return EV_STEP_NEAR;
+        case EV_MEM:
+            r->a = get_varint(&r->p);
+            r->b = get_varint(&r->p);
+            return EV_MEM;
+        case EV_PUSH:
+            r->a = get_varint(&r->p);
+            return EV_PUSH;
+        case EV_OUTPUT:
+            r->a = *r->p++;
+            return EV_OUTPUT;
+    }
+    return tag;     /* EV_POP, EV_INPUT */
+}
+
+/*
+ * sim_trace_seek:
+ * Restores the checkpoint nearest to step and applies the recorded writes
+ * up to it. The predecoded records are rebuilt, so the machine can resume
+ * with sim_run() from there (with the same input buffer set).
+ */
+bool sim_trace_seek(const SimTrace *trace, Simulator *sim, unsigned long step) {
+    const TraceCheckpoint *cp = find_checkpoint(trace, step);
+    TraceReader r;
+    unsigned long current;
+    int event;
+
+    if (!cp) {
+        sprintf(sim->error, "step %lu is not in the trace", step);
+        return false;
+    }
+
+    memcpy(sim->memory, cp->memory, sizeof(sim->memory));
+    memcpy(sim->regs, cp->regs, sizeof(sim->regs));
+    memcpy(sim->stack, cp->stack, sizeof(sim->stack));
+    sim->zero = cp->zero;
+    sim->negative = cp->negative;
+    sim->sp = cp->sp;
+    sim->code_start = cp->code_start;
+    sim->code_end = cp->code_end;
+    sim->image_end = cp->image_end;
+    sim->input_pos = (size_t)cp->input_pos;
+    sim->output_length = 0;
+    sim->status = SIM_READY;
+    sim->error[0] = '\0';
+
+    /* The first step event after a checkpoint is instruction number cp->step */
+    reader_open(&r, trace, cp);
+    current = cp->step;
+    event = next_event(&r);
+    for (;;) {
+        if (event == -1) {
+            sim->pc = trace->end_pc;
+            sim->status = trace->end_status;
+            break;
+        }
+        if (current == step) {
+            sim->pc = r.pc;
+            break;
+        }
+        current++;
+        while ((event = next_event(&r)) != -1 && event != EV_STEP_NEAR) {
+            switch (event) {
+                case EV_REG: sim->regs[r.a] = (int)r.b; break;
+                case EV_MEM: sim->memory[r.a] = (unsigned short)(r.b & 0x3FFF); break;
+                case EV_FLAGS: sim->zero = (int)r.a; sim->negative = (int)r.b; break;
+                case EV_PUSH: sim->stack[sim->sp++] = (int)r.a; break;
+                case EV_POP: sim->sp--; break;
+                case EV_INPUT: sim->input_pos++; break;
+            }
+        }
+    }
+
+    sim->steps = step;
+    sim_predecode(sim);
+    return true;
+}
+
+void sim_trace_dump(const SimTrace *trace, FILE *out, unsigned long first, unsigned long last) {
+    const TraceCheckpoint *cp = find_checkpoint(trace, first);
+    TraceReader r;
+    unsigned long current;
+    int event;
+
+    if (!cp) {
+        fprintf(out, "step %lu is not in the trace (steps %lu..%lu)\n", first,
+                trace->checkpoint_count ? trace->checkpoints[0]->step : trace->steps, trace->steps);
+        return;
+    }
+
+    reader_open(&r, trace, cp);
+    current = cp->step;
+    event = next_event(&r);
+    while (event != -1 && current <= last) {
+        bool shown = current >= first;
+
+        if (shown) fprintf(out, "%10lu  %4d ", current, r.pc);
+        while ((event = next_event(&r)) != -1 && event != EV_STEP_NEAR) {
+            if (!shown) continue;
+            switch (event) {
+                case EV_REG: fprintf(out, " r%ld=%ld", r.a, r.b); break;
+                case EV_MEM: fprintf(out, " [%ld]=%ld", r.a, r.b); break;
+                case EV_FLAGS: fprintf(out, " z=%ld n=%ld", r.a, r.b); break;
+                case EV_PUSH: fprintf(out, " push %ld", r.a); break;
+                case EV_POP: fprintf(out, " pop"); break;
+                case EV_INPUT: fprintf(out, " in"); break;
+                case EV_OUTPUT: fprintf(out, " out %ld", r.a); break;
+            }
+        }
+        if (shown) fprintf(out, "\n");
+        current++;
+    }
+}
+
+/* Reads a varint that must end before end; false if it does not or is too long */
+static bool read_varint(const unsigned char **p, const unsigned char *end, long *value) {
+    const unsigned char *q = *p;
+
+    while (q < end && (*q & 0x80)) q++;
+    if (q >= end || (size_t)(q - *p) * 7 >= sizeof(unsigned long) * CHAR_BIT) return false;
+    *value = get_varint(p);
+    return true;
+}
+
+/*
+ * check_events:
+ * Walks a loaded trace from each checkpoint to the next and rejects the
+ * first event a seek could not apply: a truncated or unknown event, a
+ * register or address out of range, or a push or pop past either end of
+ * the stack.
+ */
+static bool check_events(const SimTrace *trace) {
+    unsigned long c, i;
+
+    for (c = 0; c < trace->checkpoint_count; c++) {
+        const TraceCheckpoint *cp = trace->checkpoints[c];
+        unsigned long first = cp->block - trace->block_base;
+        unsigned long last = (c + 1 < trace->checkpoint_count)
+            ? trace->checkpoints[c + 1]->block - trace->block_base : trace->block_count;
+        int sp = cp->sp;
+
+        if (sp < 0 || sp > SIM_STACK_SIZE || last < first || last > trace->block_count) return false;
+        if (cp->code_start < 0 || cp->code_start > cp->code_end || cp->code_end > cp->image_end
+            || cp->image_end > SIM_MEMORY_SIZE) {
+            return false;
+        }
+
+        for (i = first; i < last; i++) {
+            const unsigned char *p = trace->blocks[i].data;
+            const unsigned char *end = p + trace->blocks[i].used;
+
+            while (p < end) {
+                int tag = *p++;
+                long a, b;
+
+                if (tag <= EV_STEP_NEAR + 3 || tag == EV_INPUT) continue;
+                switch (tag & 0xF0) {
+                    case EV_REG:
+                        if ((tag & 0x0F) >= SIM_REGISTERS || !read_varint(&p, end, &b)) return false;
+                        continue;
+                    case EV_FLAGS:
+                        if ((tag & 0x0F) > 3) return false;
+                        continue;
+                }
+                switch (tag) {
+                    case EV_STEP_FAR:
+                        if (!read_varint(&p, end, &a)) return false;
+                        break;
+                    case EV_MEM:
+                        if (!read_varint(&p, end, &a) || a < 0 || a >= SIM_MEMORY_SIZE) return false;
+                        if (!read_varint(&p, end, &b)) return false;
+                        break;
+                    case EV_PUSH:
+                        if (sp >= SIM_STACK_SIZE || !read_varint(&p, end, &a)) return false;
+                        sp++;
+                        break;
+                    case EV_POP:
+                        if (sp <= 0) return false;
+                        sp--;
+                        break;
+                    case EV_OUTPUT:
+                        if (p >= end) return false;
+                        p++;
+                        break;
+                    default:
+                        return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+bool sim_trace_save(const SimTrace *trace, const char *path) {
+    FILE *file = fopen(path, "wb");
+    unsigned long header[7];
+    unsigned long i;
+    int end[2];
+    bool ok;
+
+    if (!file) {
+        fprintf(stderr, "Error: Could not create trace file %s\n", path);
+        return false;
+    }
+
+    header[0] = trace->steps;
+    header[1] = trace->block_base;
+    header[2] = trace->block_count;
+    header[3] = trace->checkpoint_count;
+    header[4] = trace->dropped_blocks;
+    header[5] = (unsigned long)sizeof(TraceCheckpoint);
+    header[6] = trace->max_bytes;
+    end[0] = trace->end_pc;
+    end[1] = (int)trace->end_status;
+
+    ok = fwrite(TRACE_FILE_MAGIC, 8, 1, file) == 1
+        && fwrite(header, sizeof(header), 1, file) == 1
+        && fwrite(end, sizeof(end), 1, file) == 1;
+    for (i = 0; ok && i < trace->checkpoint_count; i++) {
+        ok = fwrite(trace->checkpoints[i], sizeof(TraceCheckpoint), 1, file) == 1;
+    }
+    for (i = 0; ok && i < trace->block_count; i++) {
+        unsigned long used = block_used(trace, i);
+        ok = fwrite(&used, sizeof(used), 1, file) == 1
+            && (used == 0 || fwrite(trace->blocks[i].data, used, 1, file) == 1);
+    }
+
+    if (fclose(file) != 0) ok = false;
+    if (!ok) fprintf(stderr, "Error: Could not write trace file %s\n", path);
+    return ok;
+}
+
+SimTrace *sim_trace_load(const char *path) {
+    FILE *file = fopen(path, "rb");
+    SimTrace *trace;
+    char magic[8];
+    unsigned long header[7];
+    unsigned long i;
+    int end[2];
+    bool ok;
+
+    if (!file) {
+        fprintf(stderr, "Error: Could not open trace file %s\n", path);
+        return NULL;
+    }
+
+    trace = sim_trace_create(0);
+    ok = trace != NULL
+        && fread(magic, 8, 1, file) == 1 && memcmp(magic, TRACE_FILE_MAGIC, 8) == 0
+        && fread(header, sizeof(header), 1, file) == 1
+        && fread(end, sizeof(end), 1, file) == 1
+        && header[5] == (unsigned long)sizeof(TraceCheckpoint)
+        && header[3] > 0 && header[2] > 0;
+
+    if (ok) {
+        trace->steps = header[0];
+        trace->block_base = header[1];
+        trace->dropped_blocks = header[4];
+        trace->max_bytes = header[6];
+        trace->end_pc = end[0];
+        trace->end_status = (SimStatus)end[1];
+        trace->checkpoints = (TraceCheckpoint **)ASM_CALLOC(header[3], sizeof(TraceCheckpoint *), MEM_OTHER);
+        trace->blocks = (TraceBlock *)ASM_CALLOC(header[2], sizeof(TraceBlock), MEM_OTHER);
+        ok = trace->checkpoints && trace->blocks;
+    }
+    for (i = 0; ok && i < header[3]; i++) {
+        trace->checkpoints[i] = (TraceCheckpoint *)ASM_MALLOC(sizeof(TraceCheckpoint), MEM_OTHER);
+        ok = trace->checkpoints[i] && fread(trace->checkpoints[i], sizeof(TraceCheckpoint), 1, file) == 1;
+        if (trace->checkpoints[i]) trace->checkpoint_count = trace->checkpoint_capacity = i + 1;
+    }
+    for (i = 0; ok && i < header[2]; i++) {
+        unsigned long used;
+        ok = fread(&used, sizeof(used), 1, file) == 1 && used <= TRACE_BLOCK_SIZE;
+        if (!ok) break;
+        trace->blocks[i].data = (unsigned char *)ASM_MALLOC(used ? used : 1, MEM_OTHER);
+        trace->blocks[i].used = used;
+        ok = trace->blocks[i].data && (used == 0 || fread(trace->blocks[i].data, used, 1, file) == 1);
+        if (trace->blocks[i].data) trace->block_count = trace->block_capacity = i + 1;
+    }
+    if (ok) {
+        ok = trace->checkpoints[0]->block == trace->block_base
+            && trace->checkpoints[trace->checkpoint_count - 1]->block < trace->block_base + trace->block_count;
+    }
+    if (ok) ok = check_events(trace);
+
+    fclose(file);
+    if (!ok) {
+        fprintf(stderr, "Error: %s is not a valid trace file\n", path);
+        sim_trace_destroy(trace);
+        return NULL;
+    }
+    return trace;
+}
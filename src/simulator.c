@@ -0,0 +1,558 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "simulator.h"
+#include "sim_jit.h"
+#include "sim_trace.h"
+#include "file_writer.h"
+#include "asm_alloc.h"
+
+#if defined(__GNUC__) && !defined(SIM_NO_THREADED)
+#define SIM_THREADED 1
+#endif
+
+/* 14-bit word to signed value */
+static int sign14(unsigned int word) {
+    word &= 0x3FFF;
+    return (word & 0x2000) ? (int)word - 0x4000 : (int)word;
+}
+
+/* Wraps a result to the 14-bit signed range */
+static int wrap14(int value) {
+    return sign14((unsigned int)value);
+}
+
+static int sign12(unsigned int word) {
+    word &= 0x0FFF;
+    return (word & 0x0800) ? (int)word - 0x1000 : (int)word;
+}
+
+void sim_init(Simulator *sim) {
+    memset(sim, 0, sizeof(*sim));
+    sim->code_start = START_ADDRESS;
+    sim->code_end = START_ADDRESS;
+    sim->image_end = START_ADDRESS;
+}
+
+void sim_free(Simulator *sim) {
+    ASM_FREE(sim->output);
+    sim->output = NULL;
+    sim->output_length = 0;
+    sim->output_capacity = 0;
+}
+
+void sim_reset(Simulator *sim) {
+    memset(sim->regs, 0, sizeof(sim->regs));
+    sim->pc = sim->code_start;
+    sim->zero = 0;
+    sim->negative = 0;
+    sim->sp = 0;
+    sim->input_pos = 0;
+    sim->output_length = 0;
+    sim->steps = 0;
+    sim->status = SIM_READY;
+    sim->error[0] = '\0';
+}
+
+void sim_set_input(Simulator *sim, const char *input, size_t length) {
+    sim->input = input;
+    sim->input_length = length;
+    sim->input_pos = 0;
+}
+
+const char *sim_status_name(SimStatus status) {
+    switch (status) {
+        case SIM_READY: return "ready";
+        case SIM_HALTED: return "halted";
+        case SIM_BUDGET: return "budget";
+        case SIM_FAULT: return "fault";
+    }
+    return "unknown";
+}
+
+/*
+ * decode_operand:
+ * Resolves the operand word at addr for an operand in the given mode.
+ * Returns 0 for operands that cannot be executed (external references).
+ */
+static int decode_operand(const Simulator *sim, int mode, int addr, int is_src, unsigned char *kind, short *value) {
+    unsigned int word = sim->memory[addr];
+    int target;
+
+    switch (mode) {
+        case 0:
+            *kind = SIM_OPND_IMM;
+            *value = (short)sign14(word);
+            return 1;
+        case 1:
+            if (((word >> 12) & 0x3) == 1) return 0;   /* unresolved extern */
+            *kind = SIM_OPND_MEM;
+            *value = (short)(word & 0x0FFF);
+            return 1;
+        case 2:
+            target = addr + sign12(word);
+            if (target < 0 || target >= SIM_MEMORY_SIZE) return 0;
+            *kind = SIM_OPND_MEM;
+            *value = (short)target;
+            return 1;
+        default:
+            *kind = SIM_OPND_REG;
+            *value = (short)(is_src ? (word >> 6) & 0x7 : (word >> 3) & 0x7);
+            return 1;
+    }
+}
+
+/* Instructions that store into their destination operand */
+static int writes_destination(int op) {
+    return op == INST_MOV || op == INST_ADD || op == INST_SUB || op == INST_LEA
+        || op == INST_CLR || op == INST_NOT || op == INST_INC || op == INST_DEC
+        || op == INST_RED;
+}
+
+/*
+ * decode_at:
+ * Predecodes the instruction starting at addr into its record. Only the
+ * code area is executable: an instruction outside it, or one whose operand
+ * words would run past its end, gets a SIM_OP_BAD record.
+ */
+static void decode_at(Simulator *sim, int addr) {
+    SimInsn *d = &sim->decoded[addr];
+    unsigned int word = sim->memory[addr];
+    int op = (int)((word >> 4) & 0xF);
+    int src_mode = (int)((word >> 8) & 0x3);
+    int dst_mode = (int)((word >> 10) & 0x3);
+    int operands = OP_PER_INST(op);
+    int next = addr + 1;
+
+    memset(d, 0, sizeof(*d));
+    d->op = SIM_OP_BAD;
+
+    if (addr < sim->code_start || addr >= sim->code_end) return;
+    if ((word & 0x300F) != 0) return;
+    if (operands < 2 && src_mode != 0) return;
+    if (operands < 1 && dst_mode != 0) return;
+
+    if (operands == 2 && src_mode == 3 && dst_mode == 3) {
+        if (next >= sim->code_end) return;
+        d->src_kind = d->dst_kind = SIM_OPND_REG;
+        d->src = (short)((sim->memory[next] >> 6) & 0x7);
+        d->dst = (short)((sim->memory[next] >> 3) & 0x7);
+        next++;
+    } else {
+        if (operands == 2) {
+            if (next >= sim->code_end) return;
+            if (!decode_operand(sim, src_mode, next, 1, &d->src_kind, &d->src)) return;
+            next++;
+        }
+        if (operands >= 1) {
+            if (next >= sim->code_end) return;
+            if (!decode_operand(sim, dst_mode, next, 0, &d->dst_kind, &d->dst)) return;
+            next++;
+        }
+    }
+
+    if (writes_destination(op) && d->dst_kind == SIM_OPND_IMM) return;
+    if (op == INST_LEA && d->src_kind != SIM_OPND_MEM) return;
+    if ((op == INST_JMP || op == INST_BNE || op == INST_JSR) && d->dst_kind == SIM_OPND_IMM) return;
+
+    d->op = (unsigned char)op;
+    d->length = (unsigned char)(next - addr);
+}
+
+/* Decodes every address; records of operand words are only used if jumped into */
+void sim_predecode(Simulator *sim) {
+    int addr;
+    for (addr = 0; addr < SIM_MEMORY_SIZE; addr++) {
+        decode_at(sim, addr);
+    }
+    for (; addr < SIM_MEMORY_SIZE + MAX_WORDS_PER_LINE; addr++) {
+        memset(&sim->decoded[addr], 0, sizeof(SimInsn));
+        sim->decoded[addr].op = SIM_OP_BAD;
+    }
+    if (sim->jit) sim_jit_reset(sim->jit);
+}
+
+/*
+ * store_word:
+ * Writes memory; a store into the code area re-decodes every instruction
+ * that could contain the word. Records outside the code area never become
+ * executable, so other stores leave them alone.
+ */
+static void store_word(Simulator *sim, int addr, int value) {
+    sim->memory[addr] = (unsigned short)(value & 0x3FFF);
+    if (addr >= sim->code_start && addr < sim->code_end) {
+        int start = addr - (MAX_WORDS_PER_LINE - 1);
+        if (start < 0) start = 0;
+        for (; start <= addr; start++) {
+            decode_at(sim, start);
+        }
+        if (sim->jit) sim_jit_invalidate(sim->jit, addr);
+    }
+}
+
+static int emit_char(Simulator *sim, int c) {
+    if (sim->output_length + 1 >= sim->output_capacity) {
+        size_t new_capacity = (sim->output_capacity == 0) ? 256 : sim->output_capacity * 2;
+        char *temp = (char *)ASM_REALLOC(sim->output, new_capacity, MEM_OTHER);
+        if (!temp) return 0;
+        sim->output = temp;
+        sim->output_capacity = new_capacity;
+    }
+    sim->output[sim->output_length++] = (char)c;
+    sim->output[sim->output_length] = '\0';
+    return 1;
+}
+
+static void clear_image(Simulator *sim) {
+    memset(sim->memory, 0, sizeof(sim->memory));
+    sim->code_start = START_ADDRESS;
+    sim->code_end = START_ADDRESS;
+    sim->image_end = START_ADDRESS;
+}
+
+static bool finish_load(Simulator *sim, int code_words, int data_words) {
+    sim->code_start = START_ADDRESS;
+    sim->code_end = START_ADDRESS + code_words;
+    sim->image_end = sim->code_end + data_words;
+    sim_predecode(sim);
+    sim_reset(sim);
+    return true;
+}
+
+/*
+ * sim_load_object:
+ * Loads the .ob text format: a "<code words> <data words>" header, then
+ * one "address value" line per word (decimal address, hex value).
+ */
+bool sim_load_object(Simulator *sim, const char *text, size_t length) {
+    const char *p = text;
+    const char *end = text + length;
+    long fields[2];
+    int f;
+
+    clear_image(sim);
+
+    for (f = 0; f < 2; f++) {
+        while (p < end && isspace((unsigned char)*p)) p++;
+        if (p == end || !isdigit((unsigned char)*p)) {
+            sprintf(sim->error, "malformed object header");
+            return false;
+        }
+        fields[f] = 0;
+        while (p < end && isdigit((unsigned char)*p)) fields[f] = fields[f] * 10 + (*p++ - '0');
+    }
+
+    if (START_ADDRESS + fields[0] + fields[1] > SIM_MEMORY_SIZE) {
+        sprintf(sim->error, "image of %ld words does not fit in memory", fields[0] + fields[1]);
+        return false;
+    }
+
+    for (;;) {
+        long address = 0;
+        unsigned int value = 0;
+        int digits = 0;
+
+        while (p < end && isspace((unsigned char)*p)) p++;
+        if (p == end) break;
+
+        while (p < end && isdigit((unsigned char)*p)) {
+            address = address * 10 + (*p++ - '0');
+            digits++;
+        }
+        while (p < end && (*p == ' ' || *p == '\t')) p++;
+        while (p < end && isxdigit((unsigned char)*p)) {
+            int c = *p++;
+            value = value * 16 + (unsigned int)(isdigit(c) ? c - '0' : tolower(c) - 'a' + 10);
+            digits++;
+        }
+
+        if (digits == 0 || (p < end && !isspace((unsigned char)*p)) || address >= SIM_MEMORY_SIZE) {
+            sprintf(sim->error, "malformed object line near offset %ld", (long)(p - text));
+            return false;
+        }
+        sim->memory[address] = (unsigned short)(value & 0x3FFF);
+    }
+
+    return finish_load(sim, (int)fields[0], (int)fields[1]);
+}
+
+/*
+ * sim_load_binary:
+ * Loads the binary object format written by write_binary_object_file().
+ */
+bool sim_load_binary(Simulator *sim, const unsigned char *data, size_t length) {
+    int load_address, code_words, data_words, i;
+
+    clear_image(sim);
+
+    if (length < OBJECT_BINARY_HEADER || memcmp(data, OBJECT_BINARY_MAGIC, 4) != 0) {
+        sprintf(sim->error, "not a binary object image");
+        return false;
+    }
+
+    load_address = data[4] | (data[5] << 8);
+    code_words = data[6] | (data[7] << 8);
+    data_words = data[8] | (data[9] << 8);
+
+    if (load_address != START_ADDRESS
+        || length != OBJECT_BINARY_HEADER + (size_t)(code_words + data_words) * 2
+        || load_address + code_words + data_words > SIM_MEMORY_SIZE) {
+        sprintf(sim->error, "corrupt binary object header");
+        return false;
+    }
+
+    data += OBJECT_BINARY_HEADER;
+    for (i = 0; i < code_words + data_words; i++) {
+        sim->memory[load_address + i] = (unsigned short)((data[i * 2] | (data[i * 2 + 1] << 8)) & 0x3FFF);
+    }
+
+    return finish_load(sim, code_words, data_words);
+}
+
+/*
+ * sim_load_result:
+ * Loads the code and data words of an assemble_buffer() result.
+ */
+bool sim_load_result(Simulator *sim, const AsmResult *result) {
+    int i;
+
+    clear_image(sim);
+
+    if (START_ADDRESS + result->code_count + result->data_count > SIM_MEMORY_SIZE) {
+        sprintf(sim->error, "image of %d words does not fit in memory", result->code_count + result->data_count);
+        return false;
+    }
+
+    for (i = 0; i < result->code_count; i++) {
+        sim->memory[result->code[i].address] = (unsigned short)(result->code[i].value & 0x3FFF);
+    }
+    for (i = 0; i < result->data_count; i++) {
+        sim->memory[result->data[i].address] = (unsigned short)(result->data[i].value & 0x3FFF);
+    }
+
+    return finish_load(sim, result->code_count, result->data_count);
+}
+
+bool sim_load_image(Simulator *sim, const char *data, size_t length) {
+    if (length >= 4 && memcmp(data, OBJECT_BINARY_MAGIC, 4) == 0) {
+        return sim_load_binary(sim, (const unsigned char *)data, length);
+    }
+    return sim_load_object(sim, data, length);
+}
+
+#define SRC_VALUE(d) ((d)->src_kind == SIM_OPND_REG ? regs[(d)->src] \
+                    : (d)->src_kind == SIM_OPND_MEM ? sign14(mem[(d)->src]) : (d)->src)
+#define DST_VALUE(d) ((d)->dst_kind == SIM_OPND_REG ? regs[(d)->dst] \
+                    : (d)->dst_kind == SIM_OPND_MEM ? sign14(mem[(d)->dst]) : (d)->dst)
+/* Jump target: the address of a memory operand, or the value of a register */
+#define DST_TARGET(d) ((d)->dst_kind == SIM_OPND_REG ? (regs[(d)->dst] & 0x0FFF) : (d)->dst)
+
+#define WRITE_DST(d, value) do { \
+        int v_ = wrap14(value); \
+        if ((d)->dst_kind == SIM_OPND_REG) { \
+            regs[(d)->dst] = v_; \
+            if (trace) sim_trace_reg(trace, (d)->dst, v_); \
+        } else { \
+            store_word(sim, (d)->dst, v_); \
+            if (trace) sim_trace_mem(trace, (d)->dst, v_ & 0x3FFF); \
+        } \
+    } while (0)
+
+/*
+ * The handlers are written once and dispatched either through a table of
+ * label addresses (GCC "labels as values", one indirect jump per handler)
+ * or, on other compilers, through a switch in a loop.
+ */
+/* Block entry: continue in translated code if there is any for pc */
+#define ENTER_BLOCK() do { \
+        if (sim->jit) pc = sim_jit_execute(sim, sim->jit, pc, budget - steps, &steps); \
+    } while (0)
+
+#ifdef SIM_THREADED
+#define CASE(op) L_##op:
+#define NEXT() do { \
+        if (steps >= budget) goto out_of_budget; \
+        d = &decoded[pc]; \
+        steps++; \
+        if (profile) profile[pc]++; \
+        if (trace) sim_trace_step(trace, sim, pc); \
+        goto *labels[d->op]; \
+    } while (0)
+#else
+#define CASE(op) case op:
+#define NEXT() continue
+#endif
+
+#ifdef SIM_THREADED
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+
+/*
+ * sim_run:
+ * Executes from the current pc until stop, a fault, or max_steps more
+ * instructions (0 = no limit).
+ */
+SimStatus sim_run(Simulator *sim, unsigned long max_steps) {
+#ifdef SIM_THREADED
+    static const void *const labels[SIM_OP_BAD + 1] = {
+        &&L_INST_MOV, &&L_INST_CMP, &&L_INST_ADD, &&L_INST_SUB, &&L_INST_LEA,
+        &&L_INST_CLR, &&L_INST_NOT, &&L_INST_INC, &&L_INST_DEC, &&L_INST_JMP,
+        &&L_INST_BNE, &&L_INST_JSR, &&L_INST_RED, &&L_INST_PRN, &&L_INST_RTS,
+        &&L_INST_STOP, &&L_SIM_OP_BAD
+    };
+#endif
+    const SimInsn *decoded = sim->decoded;
+    const SimInsn *d;
+    unsigned short *mem = sim->memory;
+    int *regs = sim->regs;
+    unsigned long *profile = sim->profile;
+    SimTrace *trace = sim->trace;
+    int pc = sim->pc;
+    unsigned long steps = 0;
+    unsigned long budget = max_steps ? max_steps : (unsigned long)-1;
+    int value;
+
+    if (sim->status == SIM_HALTED || sim->status == SIM_FAULT) return sim->status;
+
+#ifdef SIM_THREADED
+    NEXT();
+#else
+    for (;;) {
+        if (steps >= budget) goto out_of_budget;
+        d = &decoded[pc];
+        steps++;
+        if (profile) profile[pc]++;
+        if (trace) sim_trace_step(trace, sim, pc);
+        switch (d->op) {
+#endif
+
+    CASE(INST_MOV)
+        WRITE_DST(d, SRC_VALUE(d));
+        pc += d->length;
+        NEXT();
+
+    CASE(INST_CMP)
+        value = wrap14(SRC_VALUE(d) - DST_VALUE(d));
+        sim->zero = (value == 0);
+        sim->negative = (value < 0);
+        if (trace) sim_trace_flags(trace, sim->zero, sim->negative);
+        pc += d->length;
+        NEXT();
+
+    CASE(INST_ADD)
+        WRITE_DST(d, DST_VALUE(d) + SRC_VALUE(d));
+        pc += d->length;
+        NEXT();
+
+    CASE(INST_SUB)
+        WRITE_DST(d, DST_VALUE(d) - SRC_VALUE(d));
+        pc += d->length;
+        NEXT();
+
+    CASE(INST_LEA)
+        WRITE_DST(d, d->src);
+        pc += d->length;
+        NEXT();
+
+    CASE(INST_CLR)
+        WRITE_DST(d, 0);
+        pc += d->length;
+        NEXT();
+
+    CASE(INST_NOT)
+        WRITE_DST(d, ~DST_VALUE(d));
+        pc += d->length;
+        NEXT();
+
+    CASE(INST_INC)
+        WRITE_DST(d, DST_VALUE(d) + 1);
+        pc += d->length;
+        NEXT();
+
+    CASE(INST_DEC)
+        WRITE_DST(d, DST_VALUE(d) - 1);
+        pc += d->length;
+        NEXT();
+
+    CASE(INST_JMP)
+        pc = DST_TARGET(d);
+        ENTER_BLOCK();
+        NEXT();
+
+    CASE(INST_BNE)
+        pc = sim->zero ? pc + d->length : DST_TARGET(d);
+        ENTER_BLOCK();
+        NEXT();
+
+    CASE(INST_JSR)
+        if (sim->sp >= SIM_STACK_SIZE) {
+            sprintf(sim->error, "stack overflow at %d", pc);
+            goto fault;
+        }
+        sim->stack[sim->sp++] = pc + d->length;
+        if (trace) sim_trace_push(trace, pc + d->length);
+        pc = DST_TARGET(d);
+        ENTER_BLOCK();
+        NEXT();
+
+    CASE(INST_RED)
+        value = (sim->input_pos < sim->input_length) ? (unsigned char)sim->input[sim->input_pos++] : -1;
+        if (trace && value != -1) sim_trace_input(trace);
+        WRITE_DST(d, value);
+        pc += d->length;
+        NEXT();
+
+    CASE(INST_PRN)
+        if (!emit_char(sim, DST_VALUE(d) & 0xFF)) {
+            sprintf(sim->error, "out of memory for output at %d", pc);
+            goto fault;
+        }
+        if (trace) sim_trace_output(trace, DST_VALUE(d) & 0xFF);
+        pc += d->length;
+        NEXT();
+
+    CASE(INST_RTS)
+        if (sim->sp == 0) {
+            sprintf(sim->error, "stack underflow at %d", pc);
+            goto fault;
+        }
+        pc = sim->stack[--sim->sp];
+        if (trace) sim_trace_pop(trace);
+        ENTER_BLOCK();
+        NEXT();
+
+    CASE(INST_STOP)
+        sim->status = SIM_HALTED;
+        goto done;
+
+    CASE(SIM_OP_BAD)
+        if (pc < sim->code_start || pc >= sim->code_end) {
+            sprintf(sim->error, "execution outside the code area at %d", pc);
+        } else {
+            sprintf(sim->error, "invalid instruction at %d", pc);
+        }
+        goto fault;
+
+#ifndef SIM_THREADED
+        }
+    }
+#endif
+
+out_of_budget:
+    sim->status = SIM_BUDGET;
+    goto done;
+
+fault:
+    sim->status = SIM_FAULT;
+done:
+    sim->pc = pc;
+    sim->steps += steps;
+    if (trace) sim_trace_end(trace, pc, sim->status);
+    return sim->status;
+}
+
+#ifdef SIM_THREADED
+#pragma GCC diagnostic pop
+#endif
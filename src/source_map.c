@@ -0,0 +1,93 @@
+#include <string.h>
+#include "source_map.h"
+#include "asm_alloc.h"
+
+int source_map_add_origin(SourceMap *map, int line, int macro, int call_line) {
+    LineOrigin *temp;
+
+    if (map->origin_count >= map->origin_capacity) {
+        int new_capacity = (map->origin_capacity == 0) ? 256 : map->origin_capacity * 2;
+        temp = (LineOrigin *)ASM_REALLOC(map->origins, new_capacity * sizeof(LineOrigin), MEM_LINE);
+        if (!temp) return 0;
+        map->origins = temp;
+        map->origin_capacity = new_capacity;
+    }
+
+    map->origins[map->origin_count].line = line;
+    map->origins[map->origin_count].call_line = call_line;
+    map->origins[map->origin_count].macro = macro;
+    map->origin_count++;
+    return 1;
+}
+
+/*
+ * source_map_intern_macro:
+ * Few distinct macros are expanded per file, and calls of the same macro
+ * tend to repeat, so the names are kept in a short list searched from the
+ * most recently added.
+ */
+int source_map_intern_macro(SourceMap *map, const char *name) {
+    int i;
+    char **temp;
+
+    for (i = map->macro_count - 1; i >= 0; i--) {
+        if (strcmp(map->macros[i], name) == 0) return i;
+    }
+
+    if (map->macro_count >= map->macro_capacity) {
+        int new_capacity = (map->macro_capacity == 0) ? 16 : map->macro_capacity * 2;
+        temp = (char **)ASM_REALLOC(map->macros, new_capacity * sizeof(char *), MEM_MACRO);
+        if (!temp) return -1;
+        map->macros = temp;
+        map->macro_capacity = new_capacity;
+    }
+
+    map->macros[map->macro_count] = asm_strdup(name, MEM_MACRO);
+    if (!map->macros[map->macro_count]) return -1;
+    return map->macro_count++;
+}
+
+int source_map_add_instruction(SourceMap *map, int address, int length, int expanded_line) {
+    MapInstruction *temp;
+
+    if (map->instruction_count >= map->instruction_capacity) {
+        int new_capacity = (map->instruction_capacity == 0) ? 256 : map->instruction_capacity * 2;
+        temp = (MapInstruction *)ASM_REALLOC(map->instructions, new_capacity * sizeof(MapInstruction), MEM_CODE);
+        if (!temp) return 0;
+        map->instructions = temp;
+        map->instruction_capacity = new_capacity;
+    }
+
+    map->instructions[map->instruction_count].address = address;
+    map->instructions[map->instruction_count].length = length;
+    map->instructions[map->instruction_count].expanded_line = expanded_line;
+    map->instruction_count++;
+    return 1;
+}
+
+const LineOrigin *source_map_origin(const SourceMap *map, int expanded_line) {
+    if (expanded_line < 1 || expanded_line > map->origin_count) return NULL;
+    return &map->origins[expanded_line - 1];
+}
+
+/*
+ * source_map_reset:
+ * Empties the map for the next assembly while keeping its arrays.
+ */
+void source_map_reset(SourceMap *map) {
+    int i;
+    for (i = 0; i < map->macro_count; i++) {
+        ASM_FREE(map->macros[i]);
+    }
+    map->macro_count = 0;
+    map->origin_count = 0;
+    map->instruction_count = 0;
+}
+
+void source_map_free(SourceMap *map) {
+    source_map_reset(map);
+    ASM_FREE(map->origins);
+    ASM_FREE(map->macros);
+    ASM_FREE(map->instructions);
+    memset(map, 0, sizeof(*map));
+}
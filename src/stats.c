@@ -0,0 +1,260 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "stats.h"
+#include "asm_alloc.h"
+
+static StatsFormat stats_format = STATS_OFF;
+static FileStats *files = NULL;
+static int file_count = 0;
+static int file_capacity = 0;
+
+static const char *phase_names[PHASE_COUNT] = {
+    "pre_assemble", "first_pass", "second_pass", "write_output"
+};
+
+/* Counter names, in the order counter_values() lists them */
+static const char *counter_names[] = {
+    "source_lines", "expanded_lines", "macro_expansions", "macro_lookups", "macro_probes",
+    "symbols", "symbol_lookups", "symbol_probes", "words_emitted", "bytes_written",
+    "pooled_words", "pool_words_saved", "data_words_stripped",
+    "peephole_words_saved", "peephole_cycles_saved"
+};
+
+#define COUNTER_COUNT (sizeof(counter_names) / sizeof(counter_names[0]))
+
+void stats_enable(StatsFormat format) {
+    stats_format = format;
+}
+
+const char *stats_phase_name(AsmPhase phase) {
+    return phase_names[phase];
+}
+
+/*
+ * stats_now:
+ * Monotonic wall clock in seconds.
+ */
+double stats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/*
+ * stats_peak_rss_kb:
+ * Reads VmHWM from /proc, which follows stats_reset_peak_rss(); falls back
+ * to getrusage() elsewhere.
+ */
+long stats_peak_rss_kb(void) {
+    struct rusage usage;
+    FILE *status = fopen("/proc/self/status", "r");
+
+    if (status) {
+        char line[128];
+        long kb = -1;
+        while (fgets(line, sizeof(line), status)) {
+            if (sscanf(line, "VmHWM: %ld kB", &kb) == 1) break;
+        }
+        fclose(status);
+        if (kb >= 0) return kb;
+    }
+
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return -1;
+    return usage.ru_maxrss;
+}
+
+int stats_reset_peak_rss(void) {
+    FILE *refs = fopen("/proc/self/clear_refs", "w");
+    int ok;
+
+    if (!refs) return 0;
+    ok = fputs("5", refs) >= 0;
+    if (fclose(refs) != 0) ok = 0;
+    return ok;
+}
+
+FileStats *stats_add_file(const char *name) {
+    FileStats *fs;
+
+    if (stats_format == STATS_OFF) return NULL;
+
+    if (file_count >= file_capacity) {
+        int new_capacity = (file_capacity == 0) ? 8 : file_capacity * 2;
+        FileStats *temp = ASM_REALLOC(files, new_capacity * sizeof(FileStats), MEM_OTHER);
+        if (!temp) return NULL;
+        files = temp;
+        file_capacity = new_capacity;
+    }
+
+    fs = &files[file_count++];
+    memset(fs, 0, sizeof(*fs));
+    strncpy(fs->file, name, sizeof(fs->file) - 1);
+    return fs;
+}
+
+void stats_phase_begin(FileStats *fs, AsmPhase phase) {
+    (void)phase;
+    if (fs) fs->phase_start = stats_now();
+}
+
+void stats_phase_end(FileStats *fs, AsmPhase phase) {
+    if (fs) fs->phase_seconds[phase] += stats_now() - fs->phase_start;
+}
+
+void stats_add_counters(FileStats *fs, const AsmCounters *counters) {
+    AsmCounters *out;
+
+    if (!fs) return;
+    out = &fs->counters;
+    out->source_lines += counters->source_lines;
+    out->expanded_lines += counters->expanded_lines;
+    out->macro_expansions += counters->macro_expansions;
+    out->macro_lookups += counters->macro_lookups;
+    out->macro_probes += counters->macro_probes;
+    out->symbols += counters->symbols;
+    out->symbol_lookups += counters->symbol_lookups;
+    out->symbol_probes += counters->symbol_probes;
+    out->words_emitted += counters->words_emitted;
+    out->bytes_written += counters->bytes_written;
+    out->pooled_words += counters->pooled_words;
+    out->pool_words_saved += counters->pool_words_saved;
+    out->data_words_stripped += counters->data_words_stripped;
+    out->peephole_words_saved += counters->peephole_words_saved;
+    out->peephole_cycles_saved += counters->peephole_cycles_saved;
+}
+
+/* Lists the counters in counter_names order */
+static void counter_values(const AsmCounters *counters, unsigned long *values) {
+    values[0] = counters->source_lines;
+    values[1] = counters->expanded_lines;
+    values[2] = counters->macro_expansions;
+    values[3] = counters->macro_lookups;
+    values[4] = counters->macro_probes;
+    values[5] = counters->symbols;
+    values[6] = counters->symbol_lookups;
+    values[7] = counters->symbol_probes;
+    values[8] = counters->words_emitted;
+    values[9] = counters->bytes_written;
+    values[10] = counters->pooled_words;
+    values[11] = counters->pool_words_saved;
+    values[12] = counters->data_words_stripped;
+    values[13] = counters->peephole_words_saved;
+    values[14] = counters->peephole_cycles_saved;
+}
+
+static void accumulate(FileStats *total, const FileStats *fs) {
+    int p;
+    for (p = 0; p < PHASE_COUNT; p++) {
+        total->phase_seconds[p] += fs->phase_seconds[p];
+    }
+    stats_add_counters(total, &fs->counters);
+}
+
+/* Writes s as a JSON string literal */
+static void print_json_string(FILE *out, const char *s) {
+    fputc('"', out);
+    for (; *s != '\0'; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') {
+            fputc('\\', out);
+            fputc(c, out);
+        } else if (c < 0x20) {
+            fprintf(out, "\\u%04x", c);
+        } else {
+            fputc(c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+static void print_json_entry(FILE *out, const FileStats *fs, const char *indent) {
+    unsigned long counters[COUNTER_COUNT];
+    size_t i;
+    int p;
+
+    counter_values(&fs->counters, counters);
+    fprintf(out, "%s{\"file\": ", indent);
+    print_json_string(out, fs->file);
+    fprintf(out, ", \"phases\": {");
+    for (p = 0; p < PHASE_COUNT; p++) {
+        fprintf(out, "%s\"%s\": %.6f", p ? ", " : "", phase_names[p], fs->phase_seconds[p]);
+    }
+    fprintf(out, "}, \"counters\": {");
+    for (i = 0; i < COUNTER_COUNT; i++) {
+        fprintf(out, "%s\"%s\": %lu", i ? ", " : "", counter_names[i], counters[i]);
+    }
+    fprintf(out, "}}");
+}
+
+static void print_json(FILE *out, const FileStats *total) {
+    int i;
+
+    fprintf(out, "{\n  \"files\": [\n");
+    for (i = 0; i < file_count; i++) {
+        print_json_entry(out, &files[i], "    ");
+        fprintf(out, "%s\n", (i + 1 < file_count) ? "," : "");
+    }
+    fprintf(out, "  ],\n  \"total\":\n");
+    print_json_entry(out, total, "    ");
+    fprintf(out, "\n}\n");
+}
+
+static void print_table_row(FILE *out, const FileStats *fs) {
+    double sum = 0;
+    int p;
+
+    fprintf(out, "%-24s", fs->file);
+    for (p = 0; p < PHASE_COUNT; p++) {
+        fprintf(out, " %12.3f", fs->phase_seconds[p] * 1000.0);
+        sum += fs->phase_seconds[p];
+    }
+    fprintf(out, " %12.3f\n", sum * 1000.0);
+}
+
+static void print_table(FILE *out, const FileStats *total) {
+    unsigned long counters[COUNTER_COUNT];
+    size_t c;
+    int i, p;
+
+    fprintf(out, "%-24s", "time (ms)");
+    for (p = 0; p < PHASE_COUNT; p++) {
+        fprintf(out, " %12s", phase_names[p]);
+    }
+    fprintf(out, " %12s\n", "total");
+    for (i = 0; i < file_count; i++) {
+        print_table_row(out, &files[i]);
+    }
+    print_table_row(out, total);
+
+    fprintf(out, "\n%-24s %12s\n", "counter", "total");
+    counter_values(&total->counters, counters);
+    for (c = 0; c < COUNTER_COUNT; c++) {
+        fprintf(out, "%-24s %12lu\n", counter_names[c], counters[c]);
+    }
+}
+
+void stats_report(FILE *out) {
+    FileStats total;
+    int i;
+
+    if (stats_format == STATS_OFF) return;
+
+    memset(&total, 0, sizeof(total));
+    strcpy(total.file, "total");
+    for (i = 0; i < file_count; i++) {
+        accumulate(&total, &files[i]);
+    }
+
+    if (stats_format == STATS_JSON) {
+        print_json(out, &total);
+    } else {
+        print_table(out, &total);
+    }
+
+    ASM_FREE(files);
+    files = NULL;
+    file_count = 0;
+    file_capacity = 0;
+}
@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <string.h>
+#include "stream.h"
+#include "asm_context.h"
+#include "file_writer.h"
+#include "logger.h"
+#include "utils.h"
+#include "asm_alloc.h"
+
+/*
+ * assemble_lines:
+ * Runs the expanded lines of one source line through the one-pass
+ * assembler. Returns false if any of them had an error.
+ */
+static bool assemble_lines(AsmContext *ctx, const char *text, size_t length, int line_number) {
+    const char *pos = text;
+    const char *end = text + length;
+    char line[LINE_LENGTH + 2];
+    bool ok = true;
+
+    while (read_buffer_line(&pos, end, line, sizeof(line))) {
+        if (diag_limit_reached(&ctx->diagnostics)) return false;
+        if (!one_pass_line(ctx, line, line_number)) ok = false;
+    }
+    return ok;
+}
+
+bool assemble_stream(AsmContext *ctx, MacroTable *table, FILE *in, FILE *out, size_t *bytes_written) {
+    char line[LINE_LENGTH];
+    char *expanded = NULL;
+    size_t expanded_length = 0, expanded_capacity = 0;
+    bool has_error = false;
+    PreAsm pa;
+
+    ctx->one_pass = true;
+    ctx->IC = START_ADDRESS;
+    ctx->DC = 0;
+
+    pre_asm_begin(&pa, ctx, table);
+    pa.track_origins = 0;
+
+    while (fgets(line, sizeof(line), in)) {
+        if (diag_limit_reached(&ctx->diagnostics)) {
+            has_error = true;
+            break;
+        }
+
+        /* The expansion of one line is assembled and dropped right away */
+        expanded_length = 0;
+        if (!pre_asm_line(&pa, line, &expanded, &expanded_length, &expanded_capacity)) {
+            has_error = true;
+            break;
+        }
+        if (expanded_length > 0 && !assemble_lines(ctx, expanded, expanded_length, pa.line_num)) {
+            has_error = true;
+        }
+    }
+    if (ferror(in)) {
+        diag_report(&ctx->diagnostics, LOG_ERR, ctx->source_name, pa.line_num, 0, "Error reading the source");
+        has_error = true;
+    }
+
+    ASM_FREE(expanded);
+    if (!pre_asm_end(&pa)) has_error = true;
+    if (!one_pass_finish(ctx, has_error)) return false;
+
+    return print_object(ctx, out, bytes_written);
+}
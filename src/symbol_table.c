@@ -1,38 +1,108 @@
 #include "symbol_table.h"
+#include "asm_alloc.h"
 
-Symbol *symbol_table = NULL;
+#define SYMBOL_INITIAL_BUCKETS 64
 
-void free_symbol_table() {
-    Symbol *current = symbol_table;
+static unsigned long hash_name(const char *name) {
+    unsigned long hash = 5381;
+    while (*name) {
+        hash = hash * 33 + (unsigned char)*name++;
+    }
+    return hash;
+}
+
+/*
+ * grow_buckets:
+ * Doubles the bucket array and rehashes the symbols from the list.
+ */
+static int grow_buckets(SymbolTable *table) {
+    unsigned long new_count = (table->bucket_count == 0) ? SYMBOL_INITIAL_BUCKETS : table->bucket_count * 2;
+    Symbol **buckets = (Symbol **)ASM_CALLOC(new_count, sizeof(Symbol *), MEM_SYMBOL);
+    Symbol *sym;
+
+    if (!buckets) return 0;
+    for (sym = table->head; sym != NULL; sym = sym->next) {
+        unsigned long b = hash_name(sym->name) % new_count;
+        sym->chain = buckets[b];
+        buckets[b] = sym;
+    }
+    ASM_FREE(table->buckets);
+    table->buckets = buckets;
+    table->bucket_count = new_count;
+    return 1;
+}
+
+void free_symbol_table(SymbolTable *table) {
+    Symbol *current;
+
+    reset_symbol_table(table);
+    current = table->spare;
+    while (current != NULL) {
+        Symbol *next = current->next;
+        ASM_FREE(current);
+        current = next;
+    }
+    table->spare = NULL;
+    ASM_FREE(table->buckets);
+    table->buckets = NULL;
+    table->bucket_count = 0;
+}
+
+/*
+ * reset_symbol_table:
+ * Empties the table but keeps its nodes, so a long-running process can
+ * reassemble without going back to malloc for every symbol.
+ */
+void reset_symbol_table(SymbolTable *table) {
+    Symbol *current = table->head;
     while (current != NULL) {
         Symbol *next = current->next;
-        free(current);
+        current->next = table->spare;
+        table->spare = current;
         current = next;
     }
-    symbol_table = NULL;
+    table->head = NULL;
+    if (table->buckets) memset(table->buckets, 0, table->bucket_count * sizeof(Symbol *));
+    table->count = 0;
+    table->lookups = 0;
+    table->probes = 0;
 }
 
 /*
  * add_symbol:
  * Adds a new symbol to the symbol table if it does not already exist.
  */
-void add_symbol(const char *name, int address, SymbolType type) {
-    Symbol *existing = symbol_table;
-    while (existing) {
+void add_symbol(SymbolTable *table, const char *name, int address, SymbolType type) {
+    unsigned long b;
+    Symbol *existing;
+
+    if (table->count >= table->bucket_count && !grow_buckets(table)) return;
+
+    b = hash_name(name) % table->bucket_count;
+    for (existing = table->buckets[b]; existing; existing = existing->chain) {
+        table->probes++;
         if (strcmp(existing->name, name) == 0) {
             /* Duplicate symbol, do not add */
             return;
         }
-        existing = existing->next;
     }
     {
-        Symbol *new_sym = malloc(sizeof(Symbol));
+        Symbol *new_sym = table->spare;
+        if (new_sym) {
+            table->spare = new_sym->next;
+        } else {
+            new_sym = ASM_MALLOC(sizeof(Symbol), MEM_SYMBOL);
+        }
         if (new_sym) {
             strncpy(new_sym->name, name, MAX_SYMBOL_NAME);
+            new_sym->name[MAX_SYMBOL_NAME - 1] = '\0';
             new_sym->address = address;
             new_sym->type = type;
-            new_sym->next = symbol_table;
-            symbol_table = new_sym;
+            new_sym->next = table->head;
+            table->head = new_sym;
+            new_sym->chain = table->buckets[b];
+            table->buckets[b] = new_sym;
+            table->count++;
         }
     }
 }
@@ -41,13 +111,16 @@ void add_symbol(const char *name, int address, SymbolType type) {
  * find_symbol:
  * Searches the symbol table for a given name and returns the symbol if found.
  */
-Symbol* find_symbol(const char *name) {
-    Symbol *curr = symbol_table;
-    while (curr) {
+Symbol* find_symbol(SymbolTable *table, const char *name) {
+    Symbol *curr;
+
+    table->lookups++;
+    if (table->bucket_count == 0) return NULL;
+    for (curr = table->buckets[hash_name(name) % table->bucket_count]; curr; curr = curr->chain) {
+        table->probes++;
         if (strcmp(curr->name, name) == 0) {
             return curr;
         }
-        curr = curr->next;
     }
     return NULL;
 }
@@ -56,9 +129,9 @@ Symbol* find_symbol(const char *name) {
  * mark_entry:
  * Marks an existing symbol as an entry type.
  */
-void mark_entry(const char *name) {
-    Symbol *sym = find_symbol(name);
+void mark_entry(SymbolTable *table, const char *name) {
+    Symbol *sym = find_symbol(table, name);
     if (sym) {
         sym->type = SYMBOL_ENTRY;
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,164 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "trace.h"
+#include "asm_alloc.h"
+
+typedef struct {
+    char phase;                 /* 'B' or 'E' */
+    const char *category;       /* static string */
+    char name[TRACE_NAME_LEN];
+    double ts;                  /* microseconds since trace_open() */
+} TraceEvent;
+
+/* Events of one thread; only that thread appends to it */
+typedef struct TraceBuffer {
+    int tid;
+    TraceEvent *events;
+    int count;
+    int capacity;
+    struct TraceBuffer *next;
+} TraceBuffer;
+
+static volatile int trace_enabled = 0;
+static char *trace_path = NULL;
+static double trace_origin;
+static pthread_key_t buffer_key;
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static TraceBuffer *buffers = NULL;
+static int next_tid = 1;
+
+static double now_micros(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e6 + (double)ts.tv_nsec / 1e3;
+}
+
+int trace_open(const char *path) {
+    trace_path = (char *)ASM_MALLOC(strlen(path) + 1, MEM_OTHER);
+    if (!trace_path) return 0;
+    strcpy(trace_path, path);
+
+    if (pthread_key_create(&buffer_key, NULL) != 0) {
+        ASM_FREE(trace_path);
+        trace_path = NULL;
+        return 0;
+    }
+
+    trace_origin = now_micros();
+    trace_enabled = 1;
+    return 1;
+}
+
+/*
+ * thread_buffer:
+ * Returns the calling thread's buffer, registering a new one on first use.
+ * The registry lock is only taken once per thread.
+ */
+static TraceBuffer *thread_buffer(void) {
+    TraceBuffer *buffer = (TraceBuffer *)pthread_getspecific(buffer_key);
+    if (buffer) return buffer;
+
+    buffer = (TraceBuffer *)ASM_CALLOC(1, sizeof(TraceBuffer), MEM_OTHER);
+    if (!buffer) return NULL;
+
+    pthread_mutex_lock(&registry_lock);
+    buffer->tid = next_tid++;
+    buffer->next = buffers;
+    buffers = buffer;
+    pthread_mutex_unlock(&registry_lock);
+
+    pthread_setspecific(buffer_key, buffer);
+    return buffer;
+}
+
+static void trace_event(char phase, const char *category, const char *name) {
+    TraceBuffer *buffer = thread_buffer();
+    TraceEvent *event;
+
+    if (!buffer) return;
+
+    if (buffer->count >= buffer->capacity) {
+        int new_capacity = (buffer->capacity == 0) ? 256 : buffer->capacity * 2;
+        TraceEvent *temp = (TraceEvent *)ASM_REALLOC(buffer->events, new_capacity * sizeof(TraceEvent), MEM_OTHER);
+        if (!temp) return;
+        buffer->events = temp;
+        buffer->capacity = new_capacity;
+    }
+
+    event = &buffer->events[buffer->count++];
+    event->phase = phase;
+    event->category = category;
+    strncpy(event->name, name, TRACE_NAME_LEN - 1);
+    event->name[TRACE_NAME_LEN - 1] = '\0';
+    event->ts = now_micros() - trace_origin;
+}
+
+void trace_begin(const char *category, const char *name) {
+    if (trace_enabled) trace_event('B', category, name);
+}
+
+void trace_end(const char *category, const char *name) {
+    if (trace_enabled) trace_event('E', category, name);
+}
+
+static void write_json_string(FILE *out, const char *s) {
+    fputc('"', out);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            fputc('\\', out);
+            fputc(*s, out);
+        } else if ((unsigned char)*s < 0x20) {
+            fprintf(out, "\\u%04x", (unsigned char)*s);
+        } else {
+            fputc(*s, out);
+        }
+    }
+    fputc('"', out);
+}
+
+void trace_close(void) {
+    TraceBuffer *buffer;
+    FILE *out;
+    int first = 1;
+    long pid = (long)getpid();
+
+    if (!trace_enabled) return;
+    trace_enabled = 0;
+
+    out = fopen(trace_path, "w");
+    if (!out) {
+        fprintf(stderr, "Error: Cannot write trace file %s\n", trace_path);
+    } else {
+        fprintf(out, "{\"traceEvents\": [\n");
+        for (buffer = buffers; buffer; buffer = buffer->next) {
+            int i;
+            for (i = 0; i < buffer->count; i++) {
+                const TraceEvent *event = &buffer->events[i];
+                fprintf(out, "%s  {\"name\": ", first ? "" : ",\n");
+                write_json_string(out, event->name);
+                fprintf(out, ", \"cat\": \"%s\", \"ph\": \"%c\", \"ts\": %.3f, \"pid\": %ld, \"tid\": %d}",
+                        event->category, event->phase, event->ts, pid, buffer->tid);
+                first = 0;
+            }
+        }
+        fprintf(out, "\n], \"displayTimeUnit\": \"ms\"}\n");
+        fclose(out);
+    }
+
+    pthread_mutex_lock(&registry_lock);
+    while (buffers) {
+        buffer = buffers->next;
+        ASM_FREE(buffers->events);
+        ASM_FREE(buffers);
+        buffers = buffer;
+    }
+    pthread_mutex_unlock(&registry_lock);
+
+    pthread_key_delete(buffer_key);
+    ASM_FREE(trace_path);
+    trace_path = NULL;
+}
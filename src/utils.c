@@ -1,5 +1,6 @@
-
 #include "utils.h"
+#include "asm_alloc.h"
+#include <stdio.h>
 #include <ctype.h>
 #include <string.h>
 #include <stdlib.h>
@@ -30,9 +31,92 @@ bool is_register(const char *str) {
 char *strdup_c90(const char *src) {
     char *copy;
     size_t len = strlen(src) + 1;
-    copy = (char *)malloc(len);
+    copy = (char *)ASM_MALLOC(len, MEM_LINE);
     if (copy != NULL) {
         strcpy(copy, src);
     }
     return copy;
-}
\ No newline at end of file
+}
+/*
+ * next_token:
+ * Reentrant replacement for strtok(). The scan position is kept in *cursor
+ * instead of hidden static state, so independent assemblies can tokenize
+ * concurrently.
+ */
+char *next_token(char **cursor, const char *delims) {
+    char *start = *cursor;
+    char *end;
+
+    if (start == NULL) return NULL;
+
+    start += strspn(start, delims);
+    if (*start == '\0') {
+        *cursor = NULL;
+        return NULL;
+    }
+
+    end = start + strcspn(start, delims);
+    if (*end == '\0') {
+        *cursor = NULL;
+    } else {
+        *end = '\0';
+        *cursor = end + 1;
+    }
+    return start;
+}
+
+/*
+ * read_buffer_line:
+ * Copies the next line from [*pos, end) into line, with the same semantics
+ * as fgets(): at most size - 1 characters, the newline is kept and lines
+ * longer than the buffer are returned in pieces.
+ */
+bool read_buffer_line(const char **pos, const char *end, char *line, size_t size) {
+    const char *p = *pos;
+    size_t n = 0;
+
+    if (p >= end || size < 2) return false;
+
+    while (p < end && n < size - 1) {
+        char c = *p++;
+        line[n++] = c;
+        if (c == '\n') break;
+    }
+    line[n] = '\0';
+    *pos = p;
+    return true;
+}
+
+/*
+ * read_file:
+ * Loads a file into memory. The buffer is NUL-terminated so it can also be
+ * treated as a string; its length is stored in *out_len.
+ */
+char *read_file(const char *path, size_t *out_len) {
+    FILE *file = fopen(path, "rb");
+    char *buffer = NULL;
+    size_t length = 0, capacity = 0, n;
+
+    if (!file) return NULL;
+
+    do {
+        if (capacity - length < 4096) {
+            char *temp;
+            capacity = (capacity == 0) ? 8192 : capacity * 2;
+            temp = (char *)ASM_REALLOC(buffer, capacity + 1, MEM_TEXT);
+            if (!temp) {
+                ASM_FREE(buffer);
+                fclose(file);
+                return NULL;
+            }
+            buffer = temp;
+        }
+        n = fread(buffer + length, 1, capacity - length, file);
+        length += n;
+    } while (n > 0);
+
+    fclose(file);
+    buffer[length] = '\0';
+    if (out_len) *out_len = length;
+    return buffer;
+}
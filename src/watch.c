@@ -0,0 +1,572 @@
+#define _XOPEN_SOURCE 700   /* realpath() */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <poll.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include "watch.h"
+#include "libassembler.h"
+#include "file_writer.h"
+#include "utils.h"
+#include "logger.h"
+#include "asm_alloc.h"
+
+#define WATCH_PATH_LEN 4096
+
+/* Events closer together than this are handled as one batch (editors write in steps) */
+#define WATCH_SETTLE_MS 5
+
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE)
+
+typedef struct {
+    char name[WATCH_PATH_LEN];      /* <directory>/<file>.as, as used in diagnostics */
+    char path[WATCH_PATH_LEN];      /* canonical, to match events */
+    char *source;                   /* source of the last assembly, to detect real changes */
+    size_t source_length;
+    bool assembled;
+    bool dirty;                     /* reassemble if the source changed */
+    bool force;                     /* reassemble even if it did not (an input changed) */
+    AsmResult result;               /* last assembly */
+    AsmDocument *doc;               /* kept assembly, so edits are reassembled incrementally */
+    char **deps;                    /* canonical .incbin paths of the last assembly */
+    int dep_count;
+} WatchedFile;
+
+typedef struct {
+    int wd;
+    char path[WATCH_PATH_LEN];      /* canonical directory */
+} WatchedDir;
+
+typedef struct {
+    const WatchOptions *options;
+    AsmSession *session;
+    char library_path[WATCH_PATH_LEN];
+    int fd;                         /* inotify */
+    WatchedFile *files;
+    int file_count;
+    int file_capacity;
+    WatchedDir *dirs;
+    int dir_count;
+    int dir_capacity;
+} Watcher;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void request_stop(int signal_number) {
+    (void)signal_number;
+    stop_requested = 1;
+}
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1000.0 + (double)ts.tv_nsec / 1e6;
+}
+
+/*
+ * canonical_path:
+ * Resolves the directory part of path, so that a file can be matched with
+ * inotify events even after it was deleted. Returns false if the directory
+ * does not exist.
+ */
+static bool canonical_path(const char *path, char *out) {
+    char dir[WATCH_PATH_LEN];
+    char resolved[PATH_MAX];
+    const char *slash = strrchr(path, '/');
+    const char *base = slash ? slash + 1 : path;
+
+    if (!slash) {
+        strcpy(dir, ".");
+    } else if (slash == path) {
+        strcpy(dir, "/");
+    } else {
+        if ((size_t)(slash - path) >= sizeof(dir)) return false;
+        memcpy(dir, path, (size_t)(slash - path));
+        dir[slash - path] = '\0';
+    }
+    if (!realpath(dir, resolved)) return false;
+    return snprintf(out, WATCH_PATH_LEN, "%s%s%s", resolved, strcmp(resolved, "/") == 0 ? "" : "/", base) < WATCH_PATH_LEN;
+}
+
+/*
+ * watch_directory:
+ * Adds an inotify watch on the directory of a canonical file path, once.
+ */
+static void watch_directory(Watcher *w, const char *file_path) {
+    char dir[WATCH_PATH_LEN];
+    const char *slash = strrchr(file_path, '/');
+    int i, wd;
+
+    if (!slash) return;
+    memcpy(dir, file_path, (size_t)(slash - file_path));
+    dir[slash - file_path] = '\0';
+    if (dir[0] == '\0') strcpy(dir, "/");
+
+    for (i = 0; i < w->dir_count; i++) {
+        if (strcmp(w->dirs[i].path, dir) == 0) return;
+    }
+
+    wd = inotify_add_watch(w->fd, dir, WATCH_EVENTS);
+    if (wd < 0) {
+        fprintf(stderr, "Error: Cannot watch %s: %s\n", dir, strerror(errno));
+        return;
+    }
+    if (w->dir_count >= w->dir_capacity) {
+        int new_capacity = (w->dir_capacity == 0) ? 4 : w->dir_capacity * 2;
+        WatchedDir *temp = ASM_REALLOC(w->dirs, new_capacity * sizeof(WatchedDir), MEM_OTHER);
+        if (!temp) return;
+        w->dirs = temp;
+        w->dir_capacity = new_capacity;
+    }
+    w->dirs[w->dir_count].wd = wd;
+    strcpy(w->dirs[w->dir_count].path, dir);
+    w->dir_count++;
+}
+
+static void free_deps(WatchedFile *file) {
+    int i;
+    for (i = 0; i < file->dep_count; i++) {
+        ASM_FREE(file->deps[i]);
+    }
+    ASM_FREE(file->deps);
+    file->deps = NULL;
+    file->dep_count = 0;
+}
+
+/*
+ * collect_deps:
+ * Records the files the expanded source pulls in with .incbin. The names
+ * are resolved next to the source, as the assembler does.
+ */
+static void collect_deps(Watcher *w, WatchedFile *file) {
+    const char *text = file->result.expanded;
+    const char *end = text ? text + file->result.expanded_length : NULL;
+    const char *slash = strrchr(file->name, '/');
+    int capacity = 0;
+
+    free_deps(file);
+    while (text && text < end) {
+        const char *line_end = memchr(text, '\n', (size_t)(end - text));
+        const char *p = text, *open, *close;
+        char path[WATCH_PATH_LEN], canonical[WATCH_PATH_LEN];
+        size_t dir_length;
+
+        if (!line_end) line_end = end;
+        text = line_end + 1;
+
+        p = strstr(p, ".incbin");
+        if (!p || p >= line_end) continue;
+        open = memchr(p, '"', (size_t)(line_end - p));
+        close = open ? memchr(open + 1, '"', (size_t)(line_end - open - 1)) : NULL;
+        if (!close) continue;
+
+        dir_length = (open[1] != '/' && slash) ? (size_t)(slash - file->name) + 1 : 0;
+        if (dir_length + (size_t)(close - open) >= sizeof(path)) continue;
+        memcpy(path, file->name, dir_length);
+        memcpy(path + dir_length, open + 1, (size_t)(close - open - 1));
+        path[dir_length + (size_t)(close - open - 1)] = '\0';
+        if (!canonical_path(path, canonical)) continue;
+
+        if (file->dep_count >= capacity) {
+            int new_capacity = (capacity == 0) ? 4 : capacity * 2;
+            char **temp = ASM_REALLOC(file->deps, new_capacity * sizeof(char *), MEM_OTHER);
+            if (!temp) return;
+            file->deps = temp;
+            capacity = new_capacity;
+        }
+        file->deps[file->dep_count] = strdup_c90(canonical);
+        if (!file->deps[file->dep_count]) return;
+        file->dep_count++;
+        watch_directory(w, canonical);
+    }
+}
+
+/* Prints the diagnostics of a result, one "file:line:col: level: message" per line */
+static void print_diagnostics(const AsmResult *result) {
+    int i;
+    for (i = 0; i < result->diagnostic_count; i++) {
+        const AsmDiagnostic *d = &result->diagnostics[i];
+        fprintf(stderr, "%s:%d:%d: %s: %s\n", d->file, d->line, d->column,
+                d->level == ASM_DIAG_ERROR ? "error" : "warning", d->message);
+    }
+}
+
+/*
+ * write_if_changed:
+ * Writes an output unless the previous assembly produced the same bytes,
+ * so that tools watching the outputs only see real changes.
+ */
+static void write_if_changed(const char *path, const char *text, size_t length, const char *previous, size_t previous_length) {
+    if (!text) return;
+    if (previous && previous_length == length && memcmp(previous, text, length) == 0) return;
+    write_expanded_file(path, text, length);
+}
+
+/*
+ * assemble_watched:
+ * Reassembles one file if its source changed (or force is set), writes
+ * its .am and .ob and prints a status line. Returns false if the source
+ * could not be read.
+ */
+static bool assemble_watched(Watcher *w, WatchedFile *file, bool force) {
+    const WatchOptions *options = w->options;
+    char out_path[WATCH_PATH_LEN + 4];
+    AsmOptions asm_options;
+    AsmResult result;
+    size_t length, base_length;
+    double start = now_ms();
+    char *source = read_file(file->name, &length);
+
+    if (!source) return false;
+
+    if (!force && file->assembled && length == file->source_length && memcmp(source, file->source, length) == 0) {
+        ASM_FREE(source);
+        return true;
+    }
+
+    asm_options_init(&asm_options);
+    asm_options.name = file->name;
+    asm_options.format_object = true;
+    asm_options.max_errors = options->max_errors;
+    asm_options.pool = options->pool;
+    asm_options.strip_data = options->strip_data;
+    asm_options.optimize = options->optimize;
+    if (!file->doc) file->doc = asm_document_create(w->session);
+    if (file->doc) {
+        if (force) asm_document_reset(file->doc);
+        asm_document_assemble(file->doc, source, length, &asm_options, &result);
+    } else {
+        asm_session_assemble(w->session, source, length, &asm_options, &result);
+    }
+
+    base_length = strlen(file->name) - 3;
+    memcpy(out_path, file->name, base_length);
+    strcpy(out_path + base_length, ".am");
+    write_if_changed(out_path, result.expanded, result.expanded_length,
+                     file->assembled ? file->result.expanded : NULL, file->result.expanded_length);
+    strcpy(out_path + base_length, ".ob");
+    write_if_changed(out_path, result.object, result.object_length,
+                     file->assembled ? file->result.object : NULL, file->result.object_length);
+
+    if (result.success) {
+        printf("%s: ok, %d code + %d data words in %.2f ms%s\n", file->name,
+               result.code_count, result.data_count, now_ms() - start,
+               result.incremental ? " (incremental)" : "");
+    } else {
+        printf("%s: %d error%s in %.2f ms\n", file->name, result.error_count,
+               result.error_count == 1 ? "" : "s", now_ms() - start);
+    }
+    fflush(stdout);
+    print_diagnostics(&result);
+
+    if (file->assembled) asm_result_free(&file->result);
+    file->result = result;
+    file->assembled = true;
+    ASM_FREE(file->source);
+    file->source = source;
+    file->source_length = length;
+    collect_deps(w, file);
+    return true;
+}
+
+static WatchedFile *find_file(Watcher *w, const char *path) {
+    int i;
+    for (i = 0; i < w->file_count; i++) {
+        if (strcmp(w->files[i].path, path) == 0) return &w->files[i];
+    }
+    return NULL;
+}
+
+static WatchedFile *add_file(Watcher *w, const char *name, const char *path) {
+    WatchedFile *file;
+
+    if (w->file_count >= w->file_capacity) {
+        int new_capacity = (w->file_capacity == 0) ? 16 : w->file_capacity * 2;
+        WatchedFile *temp = ASM_REALLOC(w->files, new_capacity * sizeof(WatchedFile), MEM_OTHER);
+        if (!temp) return NULL;
+        w->files = temp;
+        w->file_capacity = new_capacity;
+    }
+    file = &w->files[w->file_count++];
+    memset(file, 0, sizeof(*file));
+    strcpy(file->name, name);
+    strcpy(file->path, path);
+    return file;
+}
+
+static void remove_file(Watcher *w, WatchedFile *file) {
+    if (file->assembled) asm_result_free(&file->result);
+    ASM_FREE(file->source);
+    asm_document_destroy(file->doc);
+    free_deps(file);
+    *file = w->files[--w->file_count];
+}
+
+static bool is_source_name(const char *name) {
+    size_t length = strlen(name);
+    return length > 3 && strcmp(name + length - 3, ".as") == 0 && name[0] != '.';
+}
+
+/*
+ * load_library:
+ * Starts a new session with the macro library loaded; a session cannot
+ * forget macros, so a changed library means a fresh one.
+ */
+static bool load_library(Watcher *w) {
+    AsmSession *session = asm_session_create();
+    const char *library_name = w->options->macro_library;
+    int i;
+
+    if (!session) {
+        fprintf(stderr, "Failed to allocate assembler session.\n");
+        return false;
+    }
+
+    if (library_name) {
+        AsmOptions lib_options;
+        size_t length;
+        char *library = read_file(library_name, &length);
+
+        if (!library) {
+            fprintf(stderr, "Error: Could not open macro library %s\n", library_name);
+            asm_session_destroy(session);
+            return false;
+        }
+        asm_options_init(&lib_options);
+        lib_options.name = library_name;
+        lib_options.echo_diagnostics = true;
+        if (!asm_session_load_macros(session, library, length, &lib_options)) {
+            fprintf(stderr, "Failed to load macro library %s\n", library_name);
+            ASM_FREE(library);
+            asm_session_destroy(session);
+            return false;
+        }
+        ASM_FREE(library);
+    }
+
+    /* Documents use the library of the session they were made with */
+    for (i = 0; i < w->file_count; i++) {
+        asm_document_destroy(w->files[i].doc);
+        w->files[i].doc = NULL;
+    }
+    if (w->session) asm_session_destroy(w->session);
+    w->session = session;
+    return true;
+}
+
+/*
+ * scan_directory:
+ * Assembles every .as file of the watched directory.
+ */
+static bool scan_directory(Watcher *w) {
+    const char *directory = w->options->directory;
+    DIR *dir = opendir(directory);
+    struct dirent *entry;
+    double start = now_ms();
+    int i;
+
+    if (!dir) {
+        fprintf(stderr, "Error: Cannot open directory %s\n", directory);
+        return false;
+    }
+    while ((entry = readdir(dir)) != NULL) {
+        char name[WATCH_PATH_LEN], path[WATCH_PATH_LEN];
+
+        if (!is_source_name(entry->d_name)) continue;
+        if (snprintf(name, sizeof(name), "%s/%s", directory, entry->d_name) >= (int)sizeof(name)) continue;
+        if (!canonical_path(name, path)) continue;
+        if (!add_file(w, name, path)) break;
+    }
+    closedir(dir);
+
+    for (i = 0; i < w->file_count; i++) {
+        assemble_watched(w, &w->files[i], true);
+    }
+    printf("watching %s: %d files assembled in %.2f ms\n", directory, w->file_count, now_ms() - start);
+    fflush(stdout);
+    return true;
+}
+
+/*
+ * note_change:
+ * Marks the files affected by a change to path (canonical).
+ */
+static void note_change(Watcher *w, const char *dir, const char *name, unsigned int mask) {
+    char path[WATCH_PATH_LEN];
+    WatchedFile *file;
+    int i, j;
+
+    if (snprintf(path, sizeof(path), "%s%s%s", dir, strcmp(dir, "/") == 0 ? "" : "/", name) >= (int)sizeof(path)) return;
+
+    if (w->library_path[0] != '\0' && strcmp(path, w->library_path) == 0 && !(mask & (IN_DELETE | IN_MOVED_FROM))) {
+        if (load_library(w)) {
+            printf("%s: macro library reloaded\n", w->options->macro_library);
+            for (i = 0; i < w->file_count; i++) w->files[i].force = true;
+        }
+    }
+
+    file = find_file(w, path);
+    if (file && (mask & (IN_DELETE | IN_MOVED_FROM))) {
+        printf("%s: removed\n", file->name);
+        remove_file(w, file);
+    } else if (file) {
+        file->dirty = true;
+    } else if (is_source_name(name) && strcmp(dir, w->dirs[0].path) == 0
+               && !(mask & (IN_DELETE | IN_MOVED_FROM))) {
+        char full_name[WATCH_PATH_LEN];
+
+        if (snprintf(full_name, sizeof(full_name), "%s/%s", w->options->directory, name) < (int)sizeof(full_name)) {
+            file = add_file(w, full_name, path);
+            if (file) file->dirty = true;
+        }
+    }
+
+    /* Files that .incbin the changed file are reassembled even if their source is unchanged */
+    for (i = 0; i < w->file_count; i++) {
+        for (j = 0; j < w->files[i].dep_count; j++) {
+            if (strcmp(w->files[i].deps[j], path) == 0) {
+                w->files[i].force = true;
+                break;
+            }
+        }
+    }
+}
+
+/*
+ * read_events:
+ * Reads the pending inotify events and marks the affected files.
+ * Returns false if the descriptor failed.
+ */
+static bool read_events(Watcher *w) {
+    char buffer[16384];
+    ssize_t n = read(w->fd, buffer, sizeof(buffer));
+    ssize_t offset = 0;
+
+    if (n < 0) return errno == EINTR || errno == EAGAIN;
+    while (offset < n) {
+        const struct inotify_event *event = (const struct inotify_event *)(buffer + offset);
+        int i;
+
+        for (i = 0; event->len > 0 && i < w->dir_count; i++) {
+            if (w->dirs[i].wd == event->wd) {
+                note_change(w, w->dirs[i].path, event->name, event->mask);
+                break;
+            }
+        }
+        offset += (ssize_t)sizeof(struct inotify_event) + (ssize_t)event->len;
+    }
+    return true;
+}
+
+static void free_watcher(Watcher *w) {
+    while (w->file_count > 0) {
+        remove_file(w, &w->files[w->file_count - 1]);
+    }
+    ASM_FREE(w->files);
+    ASM_FREE(w->dirs);
+    if (w->session) asm_session_destroy(w->session);
+    if (w->fd >= 0) close(w->fd);
+}
+
+/*
+ * watch:
+ * Entry point of watch mode.
+ */
+int watch(const WatchOptions *options) {
+    struct sigaction action;
+    char probe[WATCH_PATH_LEN];
+    char dir_path[WATCH_PATH_LEN];
+    Watcher w;
+    int status = 0;
+
+    /* Status lines go to stdout; per-line debug logging would bury them */
+    asm_log_set_level(LOG_WARN);
+
+    memset(&w, 0, sizeof(w));
+    w.options = options;
+    w.fd = inotify_init();
+    if (w.fd < 0) {
+        perror("inotify_init");
+        return 1;
+    }
+
+    /* The watched directory is always dirs[0]; canonical_path() resolves the directory of a file in it */
+    sprintf(probe, "%.*s/x", WATCH_PATH_LEN - 3, options->directory);
+    if (!canonical_path(probe, dir_path)) {
+        fprintf(stderr, "Error: Cannot open directory %s\n", options->directory);
+        free_watcher(&w);
+        return 1;
+    }
+    watch_directory(&w, dir_path);
+    if (w.dir_count == 0) {
+        free_watcher(&w);
+        return 1;
+    }
+
+    if (options->macro_library) {
+        if (!canonical_path(options->macro_library, w.library_path)) {
+            fprintf(stderr, "Error: Could not open macro library %s\n", options->macro_library);
+            free_watcher(&w);
+            return 1;
+        }
+        watch_directory(&w, w.library_path);
+    }
+
+    if (!load_library(&w) || !scan_directory(&w)) {
+        free_watcher(&w);
+        return 1;
+    }
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = request_stop;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    while (!stop_requested) {
+        struct pollfd pfd;
+        int i, ready;
+
+        pfd.fd = w.fd;
+        pfd.events = POLLIN;
+        ready = poll(&pfd, 1, -1);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            status = 1;
+            break;
+        }
+
+        /* Take the whole burst of a save before assembling */
+        do {
+            if (!read_events(&w)) {
+                perror("inotify");
+                stop_requested = 1;
+                status = 1;
+                break;
+            }
+            pfd.revents = 0;
+        } while (poll(&pfd, 1, WATCH_SETTLE_MS) > 0);
+
+        for (i = 0; i < w.file_count; i++) {
+            WatchedFile *file = &w.files[i];
+            bool force = file->force;
+
+            if (!file->dirty && !force) continue;
+            file->dirty = false;
+            file->force = false;
+            if (!assemble_watched(&w, file, force)) {
+                fprintf(stderr, "Error: Could not open source file %s\n", file->name);
+            }
+        }
+    }
+
+    free_watcher(&w);
+    return status;
+}
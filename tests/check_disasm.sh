@@ -0,0 +1,33 @@
+#!/bin/sh
+#
+# check_disasm.sh:
+# Round-trips object images through 'asmdis --verify': the examples that
+# assemble and a generated program, each as .ob and .bin. A corrupt image
+# must be rejected. Run from the repository root after 'make' and
+# 'make bench/asmgen'.
+#
+
+root=$(pwd)
+dir=$(mktemp -d) || exit 1
+status=0
+
+for src in examples/*.as; do
+    cp "$src" "$dir/"
+    ./assembler --binary "$dir/$(basename "$src" .as)" > /dev/null 2>&1
+done
+./bench/asmgen --lines 2000 --seed 7 -o "$dir/generated.as" > /dev/null || status=1
+./assembler --binary "$dir/generated" > /dev/null 2>&1
+
+cd "$dir" || exit 1
+"$root/asmdis" --verify *.ob *.bin || status=1
+
+printf '15 0\n000100 ffcd00\n' > corrupt.ob
+if "$root/asmdis" --verify corrupt.ob > /dev/null 2>&1; then
+    echo "corrupt.ob: FAILED, a word wider than 14 bits was accepted"
+    status=1
+else
+    echo "corrupt.ob: rejected"
+fi
+
+cd "$root" && rm -rf "$dir"
+exit $status
@@ -0,0 +1,25 @@
+#!/bin/sh
+#
+# check_examples.sh:
+# Assembles every example that has an expected object file in
+# tests/expected and compares the .ob output with it byte for byte.
+# Run from the repository root after 'make'.
+#
+
+dir=$(mktemp -d) || exit 1
+status=0
+
+for expected in tests/expected/*.ob; do
+    base=$(basename "$expected" .ob)
+    cp "examples/$base.as" "$dir/"
+    ./assembler "$dir/$base" > /dev/null 2>&1
+    if cmp -s "$expected" "$dir/$base.ob"; then
+        echo "$base: ok"
+    else
+        echo "$base: FAILED, output differs from $expected"
+        status=1
+    fi
+done
+
+rm -rf "$dir"
+exit $status
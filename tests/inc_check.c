@@ -0,0 +1,290 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libassembler.h"
+#include "logger.h"
+
+/*
+ * inc_check: differential test of incremental reassembly. A program is
+ * edited at random (lines deleted, numbers changed, lines inserted) and
+ * every version is assembled both by an AsmDocument, which reuses the
+ * previous assembly where it can, and by a plain asm_session_assemble().
+ * The two results must be the same: images, object text, expanded text,
+ * symbols and diagnostics. An edit that makes the program fail is undone
+ * afterwards, so the program stays mostly valid and most edits can be
+ * followed incrementally.
+ *
+ *   inc_check [edits per seed] [seeds]
+ *
+ * Prints the source and the difference on the first mismatch; exits 1 if
+ * there was one.
+ */
+
+#define DEFAULT_EDITS 500
+#define DEFAULT_SEEDS 4
+#define MAX_NEW_LABELS 64
+
+static const char *start_program =
+    "MAIN:\tadd\tr3, LIST\n"
+    "LOOP:\tprn\t#49\n"
+    "\tinc\tr2\n"
+    "\tmacro\tcheck_k\n"
+    "\tcmp\tK, #-6\n"
+    "\tbne\t&END\n"
+    "\tmacroend\n"
+    "\tlea\tSTR, r6\n"
+    "\tinc\tr6\n"
+    "\tmov\tr3, K\n"
+    "\tsub\tr1, r4\n"
+    "\tbne\tEND\n"
+    "\tcheck_k\n"
+    "\tdec\tK\n"
+    "\tjmp\t&LOOP\n"
+    "END:\tstop\n"
+    "STR:\t.string\t\"abcd\"\n"
+    "LIST:\t.data\t6, -9\n"
+    "\t.data\t-100\n"
+    "BUF:\t.space\t40\n"
+    "K:\t.data\t31\n";
+
+/* Lines inserted by edits; %s is a new label or an existing one */
+static const char *new_lines[] = {
+    "\tinc\tr1\n", "\tprn\t#5\n", "\tmov\tr1, r2\n", "\t.data\t1, 2, 3\n", "\t.string\t\"hey\"\n",
+    "\tstop\n", "\tlea\t%s, r3\n", "\tjmp\t&%s\n", "\tcmp\t%s, #-1\n", "; comment\n", "\n",
+    "%s:\tadd\t#1, r4\n", "%s:\t.data\t7\n", "\tbne\t&%s\n", "\t.space\t700\n", "%s:\t.fill\t300, 2\n"
+};
+
+typedef struct {
+    char **lines;
+    int count;
+    int capacity;
+} Program;
+
+static unsigned long random_state;
+
+/* A fixed generator, so a seed gives the same edits everywhere */
+static int next_random(int limit) {
+    random_state = (random_state * 1103515245UL + 12345UL) & 0xFFFFFFFFUL;
+    return (int)((random_state >> 16) % (unsigned long)limit);
+}
+
+static char *copy_text(const char *text, size_t length) {
+    char *copy = (char *)malloc(length + 1);
+    if (!copy) {
+        fprintf(stderr, "inc_check: out of memory\n");
+        exit(2);
+    }
+    memcpy(copy, text, length);
+    copy[length] = '\0';
+    return copy;
+}
+
+static void insert_line(Program *prog, int at, const char *text, size_t length) {
+    if (prog->count == prog->capacity) {
+        prog->capacity = prog->capacity ? prog->capacity * 2 : 64;
+        prog->lines = (char **)realloc(prog->lines, (size_t)prog->capacity * sizeof(char *));
+        if (!prog->lines) {
+            fprintf(stderr, "inc_check: out of memory\n");
+            exit(2);
+        }
+    }
+    memmove(prog->lines + at + 1, prog->lines + at, (size_t)(prog->count - at) * sizeof(char *));
+    prog->lines[at] = copy_text(text, length);
+    prog->count++;
+}
+
+static void delete_line(Program *prog, int at) {
+    free(prog->lines[at]);
+    memmove(prog->lines + at, prog->lines + at + 1, (size_t)(prog->count - at - 1) * sizeof(char *));
+    prog->count--;
+}
+
+/* Replaces the program with the lines of src */
+static void set_program(Program *prog, const char *src) {
+    while (prog->count > 0) delete_line(prog, prog->count - 1);
+    while (*src != '\0') {
+        const char *end = strchr(src, '\n');
+        size_t length = end ? (size_t)(end - src) + 1 : strlen(src);
+        insert_line(prog, prog->count, src, length);
+        src += length;
+    }
+}
+
+static char *join_program(const Program *prog, size_t *length) {
+    size_t total = 0;
+    char *text;
+    int i;
+
+    for (i = 0; i < prog->count; i++) total += strlen(prog->lines[i]);
+    text = (char *)malloc(total + 1);
+    if (!text) {
+        fprintf(stderr, "inc_check: out of memory\n");
+        exit(2);
+    }
+    *length = 0;
+    for (i = 0; i < prog->count; i++) {
+        size_t n = strlen(prog->lines[i]);
+        memcpy(text + *length, prog->lines[i], n);
+        *length += n;
+    }
+    text[*length] = '\0';
+    return text;
+}
+
+/*
+ * random_edit:
+ * Deletes a line, changes a digit of a number, or inserts a line from
+ * new_lines; labels gets the labels the edits have defined.
+ */
+static void random_edit(Program *prog, char labels[][16], int *label_count, int edit) {
+    int kind = next_random(10);
+    int at = prog->count > 0 ? next_random(prog->count) : 0;
+    char line[64];
+    const char *format, *label = "MAIN";
+
+    if (kind < 3 && prog->count > 1) {
+        delete_line(prog, at);
+    } else if (kind < 5 && prog->count > 0) {
+        char *digit = strpbrk(prog->lines[at], "0123456789");
+        /* Only digits that start a number; r3 and label digits stay */
+        if (digit && (digit == prog->lines[at] || strchr("#, \t-", digit[-1]))) {
+            *digit = (char)('0' + next_random(10));
+        }
+    } else {
+        format = new_lines[next_random((int)(sizeof(new_lines) / sizeof(new_lines[0])))];
+        if (strstr(format, "%s:")) {
+            sprintf(labels[*label_count % MAX_NEW_LABELS], "NL%d", edit);
+            label = labels[*label_count % MAX_NEW_LABELS];
+            (*label_count)++;
+        } else if (*label_count > 0 && next_random(2)) {
+            label = labels[next_random(*label_count < MAX_NEW_LABELS ? *label_count : MAX_NEW_LABELS)];
+        }
+        sprintf(line, format, label);
+        insert_line(prog, at, line, strlen(line));
+    }
+}
+
+static int compare_symbols(const void *a, const void *b) {
+    return strcmp(((const AsmSymbol *)a)->name, ((const AsmSymbol *)b)->name);
+}
+
+/* Returns what differs between two results, or NULL if they are the same */
+static const char *difference(AsmResult *a, AsmResult *b) {
+    int i;
+
+    if (a->success != b->success) return "success";
+    if (a->code_count != b->code_count || a->data_count != b->data_count) return "image size";
+    for (i = 0; i < a->code_count; i++) {
+        if (a->code[i].address != b->code[i].address || a->code[i].value != b->code[i].value) return "code image";
+    }
+    for (i = 0; i < a->data_count; i++) {
+        if (a->data[i].address != b->data[i].address || a->data[i].value != b->data[i].value) return "data image";
+    }
+    if (a->expanded_length != b->expanded_length
+        || (a->expanded_length > 0 && memcmp(a->expanded, b->expanded, a->expanded_length) != 0)) {
+        return "expanded text";
+    }
+    if (a->object_length != b->object_length
+        || (a->object_length > 0 && memcmp(a->object, b->object, a->object_length) != 0)) {
+        return "object text";
+    }
+    if (a->symbol_count != b->symbol_count) return "symbol count";
+    qsort(a->symbols, (size_t)a->symbol_count, sizeof(AsmSymbol), compare_symbols);
+    qsort(b->symbols, (size_t)b->symbol_count, sizeof(AsmSymbol), compare_symbols);
+    for (i = 0; i < a->symbol_count; i++) {
+        if (strcmp(a->symbols[i].name, b->symbols[i].name) != 0 || a->symbols[i].address != b->symbols[i].address
+            || a->symbols[i].kind != b->symbols[i].kind) {
+            return "symbols";
+        }
+    }
+    if (a->diagnostic_count != b->diagnostic_count || a->error_count != b->error_count) return "diagnostic count";
+    for (i = 0; i < a->diagnostic_count; i++) {
+        if (a->diagnostics[i].line != b->diagnostics[i].line
+            || strcmp(a->diagnostics[i].message, b->diagnostics[i].message) != 0
+            || strcmp(a->diagnostics[i].file, b->diagnostics[i].file) != 0) {
+            return "diagnostics";
+        }
+    }
+    return NULL;
+}
+
+/*
+ * run_seed:
+ * Applies edits to the start program with one seed. Returns false on the
+ * first mismatch; *incremental counts the edits followed incrementally.
+ */
+static bool run_seed(unsigned long seed, int edits, int *incremental) {
+    AsmSession *session = asm_session_create();
+    AsmDocument *doc = session ? asm_document_create(session) : NULL;
+    AsmOptions options;
+    Program prog = { NULL, 0, 0 };
+    char labels[MAX_NEW_LABELS][16];
+    int label_count = 0;
+    char *last_good = NULL;
+    bool ok = true;
+    int edit;
+
+    if (!doc) {
+        fprintf(stderr, "inc_check: out of memory\n");
+        exit(2);
+    }
+
+    asm_options_init(&options);
+    options.name = "inc_check.as";
+    options.format_object = true;
+    random_state = seed;
+    set_program(&prog, start_program);
+
+    for (edit = 0; edit < edits && ok; edit++) {
+        AsmResult by_doc, by_session;
+        const char *what;
+        size_t length;
+        char *src;
+
+        if (edit > 0) random_edit(&prog, labels, &label_count, edit);
+        src = join_program(&prog, &length);
+        asm_document_assemble(doc, src, length, &options, &by_doc);
+        asm_session_assemble(session, src, length, &options, &by_session);
+
+        if (by_doc.incremental) (*incremental)++;
+        what = difference(&by_doc, &by_session);
+        if (what) {
+            printf("FAIL seed %lu edit %d (%s): %s differs\n%s", seed, edit,
+                   by_doc.incremental ? "incremental" : "full", what, src);
+            ok = false;
+        }
+
+        if (!by_session.success && last_good) {
+            set_program(&prog, last_good);
+        } else {
+            free(last_good);
+            last_good = src;
+            src = NULL;
+        }
+        free(src);
+        asm_result_free(&by_doc);
+        asm_result_free(&by_session);
+    }
+
+    free(last_good);
+    set_program(&prog, "");
+    free(prog.lines);
+    asm_document_destroy(doc);
+    asm_session_destroy(session);
+    return ok;
+}
+
+int main(int argc, char *argv[]) {
+    int edits = argc > 1 ? atoi(argv[1]) : DEFAULT_EDITS;
+    int seeds = argc > 2 ? atoi(argv[2]) : DEFAULT_SEEDS;
+    int incremental = 0, failed = 0;
+    int seed;
+
+    asm_log_set_level(LOG_ERR);
+    for (seed = 1; seed <= seeds; seed++) {
+        if (!run_seed((unsigned long)seed, edits, &incremental)) failed++;
+    }
+
+    printf("inc_check: %d seeds x %d edits, %d incremental, %d failed\n", seeds, edits, incremental, failed);
+    return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,326 @@
+#include <stdio.h>
+#include <string.h>
+#include "libassembler.h"
+#include "simulator.h"
+#include "sim_jit.h"
+#include "sim_trace.h"
+#include "logger.h"
+
+/*
+ * sim_check: regression tests for the simulator. Each program is assembled
+ * in memory and run by the interpreter, then again with every block
+ * translated as soon as it is entered (where the platform has the JIT).
+ * Recorded traces are checked by seeking them against fresh runs, and a
+ * saved trace with a bad event must not load.
+ * Prints one line per failed check and a summary; exits 1 on any failure.
+ */
+
+#define MAX_STEPS 100000
+#define TRACE_FILE "sim_check.trace"
+
+static Simulator sim;
+static Simulator other;
+static int checks;
+static int failures;
+
+static void check(bool ok, const char *test, const char *mode, const char *what) {
+    checks++;
+    if (!ok) {
+        printf("FAIL %s (%s): %s\n", test, mode, what);
+        failures++;
+    }
+}
+
+/*
+ * load_program:
+ * Assembles source into a freshly initialized machine; false if it does
+ * not assemble or load.
+ */
+static bool load_program(Simulator *target, const char *source, SimJit *jit) {
+    AsmOptions options;
+    AsmResult result;
+    bool ok;
+
+    asm_options_init(&options);
+    options.name = "sim_check.as";
+    ok = assemble_buffer(source, strlen(source), &options, &result);
+
+    sim_free(target);
+    sim_init(target);
+    target->jit = jit;
+    if (ok) ok = sim_load_result(target, &result);
+    asm_result_free(&result);
+    return ok;
+}
+
+/* Loads source and runs it from the start */
+static bool run_program(const char *source, SimJit *jit) {
+    if (!load_program(&sim, source, jit)) return false;
+    sim_run(&sim, MAX_STEPS);
+    return true;
+}
+
+/* Register operands are encoded and decoded back */
+static void test_registers(SimJit *jit, const char *mode) {
+    const char *source =
+        "MAIN:\tmov\t#7, r2\n"
+        "\tmov\tr2, r5\n"
+        "\tadd\tr5, r2\n"
+        "\tlea\tX, r1\n"
+        "\tprn\tr2\n"
+        "\tstop\n"
+        "X:\t.data\t3\n";
+
+    check(run_program(source, jit), "registers", mode, "does not assemble");
+    check(sim.status == SIM_HALTED, "registers", mode, "does not halt");
+    check(sim.regs[2] == 14 && sim.regs[5] == 7, "registers", mode, "wrong register values");
+    check(sim.regs[1] == sim.code_end, "registers", mode, "lea gives the wrong address");
+    check(sim.output_length == 1 && sim.output[0] == 14, "registers", mode, "wrong output");
+}
+
+/* A store into the code area changes what runs next, also inside a hot loop */
+static void test_code_store(SimJit *jit, const char *mode) {
+    const char *source =
+        "MAIN:\tmov\t#20, r3\n"
+        "LOOP:\tmov\tr3, P+1\n"
+        "P:\tadd\t#1, r1\n"
+        "\tdec\tr3\n"
+        "\tcmp\tr3, #0\n"
+        "\tbne\tLOOP\n"
+        "\tstop\n";
+
+    check(run_program(source, jit), "code_store", mode, "does not assemble");
+    check(sim.status == SIM_HALTED, "code_store", mode, "does not halt");
+    check(sim.regs[1] == 210, "code_store", mode, "the rewritten immediate was not used");
+}
+
+/* Data written with an instruction word is not executed */
+static void test_data_exec(SimJit *jit, const char *mode) {
+    const char *source =
+        "MAIN:\tmov\t#30, r1\n"
+        "LOOP:\tmov\tr1, D\n"
+        "\tdec\tr1\n"
+        "\tcmp\tr1, #0\n"
+        "\tbne\tLOOP\n"
+        "\tmov\t#240, D\n"
+        "\tjmp\tD\n"
+        "\tstop\n"
+        "D:\t.data\t0\n";
+
+    check(run_program(source, jit), "data_exec", mode, "does not assemble");
+    check(sim.memory[sim.code_end] == 240, "data_exec", mode, "the data was not written");
+    check(sim.status == SIM_FAULT && sim.pc == sim.code_end, "data_exec", mode, "the data was executed");
+    check(strstr(sim.error, "outside the code area") != NULL, "data_exec", mode, "wrong fault");
+}
+
+/* Running off the end of the code faults instead of running into the data */
+static void test_fall_through(SimJit *jit, const char *mode) {
+    const char *source =
+        "MAIN:\tinc\tr1\n"
+        "\tinc\tr1\n"
+        "D:\t.data\t240\n";
+
+    check(run_program(source, jit), "fall_through", mode, "does not assemble");
+    check(sim.status == SIM_FAULT && sim.pc == sim.code_end, "fall_through", mode, "the data was executed");
+    check(sim.regs[1] == 2, "fall_through", mode, "wrong register value");
+}
+
+/* Either machine can go on with sim_run() */
+static bool resumable(SimStatus status) {
+    return status == SIM_READY || status == SIM_BUDGET;
+}
+
+/* The machine states two runs must share at a step */
+static bool same_state(const Simulator *a, const Simulator *b) {
+    return a->pc == b->pc && (a->status == b->status || (resumable(a->status) && resumable(b->status)))
+        && a->zero == b->zero && a->negative == b->negative
+        && a->sp == b->sp && a->input_pos == b->input_pos
+        && memcmp(a->regs, b->regs, sizeof(a->regs)) == 0
+        && memcmp(a->stack, b->stack, (size_t)a->sp * sizeof(a->stack[0])) == 0
+        && memcmp(a->memory, b->memory, sizeof(a->memory)) == 0;
+}
+
+/*
+ * test_trace_seek:
+ * Records a run long enough to hold several checkpoints, then seeks to
+ * steps before, on and between them and compares each state with a run
+ * stopped at that step. A trace with a small limit must refuse the steps
+ * it dropped and still seek to the rest.
+ */
+static void test_trace_seek(void) {
+    const char *source =
+        "MAIN:\tmov\t#100, r1\n"
+        "OUTER:\tmov\t#1000, r2\n"
+        "INNER:\tadd\tr2, SUM\n"
+        "\tjsr\tSTEP\n"
+        "\tdec\tr2\n"
+        "\tcmp\tr2, #0\n"
+        "\tbne\tINNER\n"
+        "\tred\tr5\n"
+        "\tdec\tr1\n"
+        "\tcmp\tr1, #0\n"
+        "\tbne\tOUTER\n"
+        "\tstop\n"
+        "STEP:\tinc\tCOUNT\n"
+        "\trts\n"
+        "SUM:\t.data\t0\n"
+        "COUNT:\t.data\t0\n";
+    const char *input = "the input is shorter than the outer loop";
+    unsigned long steps[] = { 0, 1, 2, 4097, 123457, 350000, 699999, 0 };
+    unsigned long limits[] = { 0, 256UL * 1024 };
+    int l, i;
+
+    for (l = 0; l < 2; l++) {
+        SimTrace *trace = sim_trace_create(limits[l]);
+        SimTraceStats ts;
+
+        if (!trace || !load_program(&sim, source, NULL)) {
+            check(false, "trace_seek", "interpreter", "cannot record");
+            sim_trace_destroy(trace);
+            return;
+        }
+        sim_set_input(&sim, input, strlen(input));
+        sim.trace = trace;
+        sim_run(&sim, 0);
+        sim.trace = NULL;
+        sim_trace_stats(trace, &ts);
+        check(sim.status == SIM_HALTED && ts.steps == sim.steps, "trace_seek", "interpreter", "the recorded run did not halt");
+        check(l == 0 ? ts.checkpoints > 2 : ts.dropped_blocks > 0, "trace_seek", "interpreter",
+              l == 0 ? "too few checkpoints" : "nothing was dropped");
+        steps[sizeof(steps) / sizeof(steps[0]) - 1] = ts.steps;
+
+        for (i = 0; i < (int)(sizeof(steps) / sizeof(steps[0])); i++) {
+            bool found;
+
+            sim_free(&other);
+            sim_init(&other);
+            sim_set_input(&other, input, strlen(input));
+            found = sim_trace_seek(trace, &other, steps[i]);
+            if (steps[i] < ts.first_step) {
+                check(!found, "trace_seek", "interpreter", "seek to a dropped step succeeded");
+                continue;
+            }
+            check(found, "trace_seek", "interpreter", "seek failed");
+
+            load_program(&sim, source, NULL);
+            sim_set_input(&sim, input, strlen(input));
+            if (steps[i] > 0) sim_run(&sim, steps[i]);
+            check(sim.steps == steps[i], "trace_seek", "interpreter", "the reference run stopped early");
+            check(!found || same_state(&sim, &other), "trace_seek", "interpreter", "seek gives a different state");
+        }
+        sim_trace_destroy(trace);
+    }
+    sim_free(&other);
+}
+
+/*
+ * rewrite_events:
+ * Overwrites the start of the last event block of a saved trace, which is
+ * the end of the file after its byte count. False if the block is not found
+ * or is shorter than the events.
+ */
+static bool rewrite_events(const unsigned char *events, size_t count) {
+    FILE *file = fopen(TRACE_FILE, "r+b");
+    unsigned long used = 0;
+    long size, length;
+    bool ok = false;
+
+    if (!file) return false;
+    if (fseek(file, 0L, SEEK_END) == 0 && (size = ftell(file)) > 0) {
+        /* The byte count is right before the block: try each short length */
+        for (length = (long)count; length < 256 && length + (long)sizeof(used) <= size; length++) {
+            if (fseek(file, size - length - (long)sizeof(used), SEEK_SET) != 0
+                || fread(&used, sizeof(used), 1, file) != 1) {
+                break;
+            }
+            if (used == (unsigned long)length) {
+                ok = fseek(file, size - length, SEEK_SET) == 0 && fwrite(events, 1, count, file) == count;
+                break;
+            }
+        }
+    }
+    if (fclose(file) != 0) ok = false;
+    return ok;
+}
+
+/*
+ * test_trace_events:
+ * Saves the trace of a short run, then replaces its first events with a
+ * stack underflow, an address past the end of memory and register 8;
+ * each file must be refused by sim_trace_load().
+ */
+static void test_trace_events(void) {
+    const char *source =
+        "MAIN:\tmov\t#5, X\n"
+        "\tjsr\tSUB\n"
+        "\tstop\n"
+        "SUB:\tinc\tr1\n"
+        "\trts\n"
+        "X:\t.data\t0\n";
+    static const unsigned char pop[] = { 0x00, 0x41 };
+    static const unsigned char memory[] = { 0x00, 0x20, 0x80, 0x40, 0x00 };
+    static const unsigned char reg[] = { 0x00, 0x18, 0x00 };
+    const unsigned char *bad[3];
+    size_t bad_length[3];
+    SimTrace *trace = sim_trace_create(0);
+    SimTrace *loaded;
+    int i;
+
+    bad[0] = pop;
+    bad_length[0] = sizeof(pop);
+    bad[1] = memory;
+    bad_length[1] = sizeof(memory);
+    bad[2] = reg;
+    bad_length[2] = sizeof(reg);
+
+    if (!trace || !load_program(&sim, source, NULL)) {
+        check(false, "trace_events", "interpreter", "cannot record");
+        sim_trace_destroy(trace);
+        return;
+    }
+    sim.trace = trace;
+    sim_run(&sim, 0);
+    sim.trace = NULL;
+    check(sim.status == SIM_HALTED && sim_trace_save(trace, TRACE_FILE), "trace_events", "interpreter", "cannot save");
+    sim_trace_destroy(trace);
+
+    loaded = sim_trace_load(TRACE_FILE);
+    check(loaded != NULL, "trace_events", "interpreter", "the saved trace does not load");
+    sim_trace_destroy(loaded);
+
+    for (i = 0; i < 3; i++) {
+        check(rewrite_events(bad[i], bad_length[i]), "trace_events", "interpreter", "cannot rewrite the events");
+        loaded = sim_trace_load(TRACE_FILE);
+        check(loaded == NULL, "trace_events", "interpreter", "a bad event was accepted");
+        sim_trace_destroy(loaded);
+    }
+    remove(TRACE_FILE);
+}
+
+static void run_tests(SimJit *jit, const char *mode) {
+    test_registers(jit, mode);
+    test_code_store(jit, mode);
+    test_data_exec(jit, mode);
+    test_fall_through(jit, mode);
+}
+
+int main(void) {
+    SimJit *jit;
+
+    asm_log_set_level(LOG_WARN);
+    sim_init(&sim);
+    sim_init(&other);
+
+    run_tests(NULL, "interpreter");
+    test_trace_seek();
+    test_trace_events();
+    jit = sim_jit_create(1, false);
+    if (jit) {
+        run_tests(jit, "jit");
+        sim_jit_destroy(jit);
+    }
+
+    sim_free(&sim);
+    printf("sim_check: %d checks, %d failed\n", checks, failures);
+    return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,199 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "disasm.h"
+#include "libassembler.h"
+#include "logger.h"
+#include "stats.h"
+#include "asm_alloc.h"
+
+/*
+ * asmdis: disassembles object images (.ob text or .bin binary) into source
+ * the assembler accepts (see disasm.h). Images are memory-mapped.
+ *
+ * --verify reassembles each disassembly in memory and checks that it gives
+ * back the same image word for word; one line per image:
+ *
+ *   <image>: ok, <words> words
+ *   <image>: FAILED, <reason>
+ */
+
+static void print_usage(const char *prog) {
+    printf("Usage: %s [options] <image.ob|image.bin>...\n", prog);
+    printf("  -o <file>    write the source to file (one image only; default stdout)\n");
+    printf("  --verify     reassemble each disassembly and compare it with the image\n");
+    printf("  --quiet      --verify: print only failures\n");
+    printf("  --stats      print the decoding speed to stderr\n");
+}
+
+/* Maps a file read-only; NULL if it cannot be read or is empty */
+static const char *map_file(const char *path, size_t *length) {
+    struct stat st;
+    void *address;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0) return NULL;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+    address = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (address == MAP_FAILED) return NULL;
+    *length = (size_t)st.st_size;
+    return (const char *)address;
+}
+
+/*
+ * verify:
+ * Assembles the disassembly and compares the result with the image.
+ * Prints the outcome; returns false on any difference.
+ */
+static bool verify(const char *path, const DisImage *image, const DisOutput *out, bool quiet) {
+    AsmOptions options;
+    AsmResult result;
+    int total = image->code_count + image->data_count;
+    int i;
+    bool ok;
+
+    if (out->invalid > 0) {
+        printf("%s: FAILED, %d word%s cannot be disassembled\n", path, out->invalid, out->invalid == 1 ? "" : "s");
+        return false;
+    }
+
+    asm_options_init(&options);
+    options.name = "disassembly.as";
+    ok = assemble_buffer(out->text, out->length, &options, &result);
+
+    if (!ok) {
+        printf("%s: FAILED, the disassembly does not assemble", path);
+        if (result.diagnostic_count > 0) {
+            printf(" (line %d: %s)", result.diagnostics[0].line, result.diagnostics[0].message);
+        }
+        printf("\n");
+    } else if (result.code_count != image->code_count || result.data_count != image->data_count) {
+        printf("%s: FAILED, %d code + %d data words instead of %d + %d\n", path,
+               result.code_count, result.data_count, image->code_count, image->data_count);
+        ok = false;
+    } else {
+        for (i = 0; i < total && ok; i++) {
+            const AsmWord *word = i < image->code_count ? &result.code[i] : &result.data[i - image->code_count];
+            /* The writers keep the low 14 bits; the image words are compared as loaded */
+            if ((word->value & 0x3FFF) != image->words[i]) {
+                printf("%s: FAILED, word %d is %04x instead of %04x\n", path, word->address,
+                       word->value & 0x3FFF, image->words[i]);
+                ok = false;
+            }
+        }
+    }
+
+    if (ok && !quiet) printf("%s: ok, %d words\n", path, total);
+    asm_result_free(&result);
+    return ok;
+}
+
+int main(int argc, char *argv[]) {
+    const char *output_path = NULL;
+    bool do_verify = false, quiet = false, show_stats = false;
+    int first_image = 0, image_count = 0;
+    unsigned long decoded_words = 0;
+    double decode_seconds = 0;
+    int status = 0;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            output_path = argv[++i];
+        } else if (strcmp(argv[i], "--verify") == 0) {
+            do_verify = true;
+        } else if (strcmp(argv[i], "--quiet") == 0) {
+            quiet = true;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            show_stats = true;
+        } else if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
+            print_usage(argv[0]);
+            return 0;
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "Unknown option '%s'\n", argv[i]);
+            print_usage(argv[0]);
+            return 1;
+        } else {
+            if (image_count == 0) first_image = i;
+            image_count++;
+        }
+    }
+
+    if (image_count == 0 || (output_path && image_count > 1)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    /* The assembler logs debug lines on stdout; keep only real problems */
+    asm_log_set_level(LOG_WARN);
+
+    for (i = first_image; i < argc; i++) {
+        const char *path = argv[i];
+        const char *data;
+        size_t length;
+        char error[128];
+        DisImage image;
+        DisOutput out;
+        double start;
+        bool loaded, done;
+
+        if (argv[i][0] == '-' || (i > 1 && strcmp(argv[i - 1], "-o") == 0)) continue;
+
+        data = map_file(path, &length);
+        if (!data) {
+            fprintf(stderr, "Error: Could not open image %s\n", path);
+            status = 1;
+            continue;
+        }
+
+        start = stats_now();
+        loaded = dis_load_image(data, length, &image, error, sizeof(error));
+        munmap((void *)data, length);
+        if (!loaded) {
+            fprintf(stderr, "%s: %s\n", path, error);
+            status = 1;
+            continue;
+        }
+        done = disassemble(&image, &out);
+        decode_seconds += stats_now() - start;
+        decoded_words += (unsigned long)(image.code_count + image.data_count);
+
+        if (!done) {
+            fprintf(stderr, "%s: out of memory\n", path);
+            status = 1;
+        } else if (do_verify) {
+            if (!verify(path, &image, &out, quiet)) status = 1;
+        } else if (output_path) {
+            FILE *file = fopen(output_path, "w");
+            if (!file || fwrite(out.text, 1, out.length, file) != out.length) {
+                fprintf(stderr, "Error: Cannot write to output file %s\n", output_path);
+                status = 1;
+            }
+            if (file && fclose(file) != 0) status = 1;
+        } else {
+            if (image_count > 1) printf("; %s\n", path);
+            fwrite(out.text, 1, out.length, stdout);
+        }
+        if (done && out.invalid > 0 && !do_verify) {
+            fprintf(stderr, "%s: %d word%s could not be disassembled\n", path, out.invalid, out.invalid == 1 ? "" : "s");
+            status = 1;
+        }
+
+        dis_output_free(&out);
+        dis_image_free(&image);
+    }
+
+    if (show_stats) {
+        fprintf(stderr, "%lu words decoded in %.3f s (%.0f words/s)\n", decoded_words, decode_seconds,
+                decode_seconds > 0 ? (double)decoded_words / decode_seconds : 0.0);
+    }
+    return status;
+}
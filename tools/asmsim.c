@@ -0,0 +1,306 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "simulator.h"
+#include "sim_jit.h"
+#include "sim_trace.h"
+#include "batch.h"
+#include "profile.h"
+#include "utils.h"
+#include "stats.h"
+#include "asm_alloc.h"
+
+/*
+ * asmsim: runs an object image (.ob or .bin) on the simulator. Program
+ * output (prn) goes to stdout; the run summary goes to stderr:
+ *
+ *   <status> <instructions> instructions in <seconds> s (<n> instr/s)
+ *
+ * With --jit, hot blocks run as native code and a translation summary follows.
+ * --batch runs a manifest of test programs instead (see batch.h).
+ * --profile prints the hot source lines and macros of the run (see profile.h).
+ * --record runs the program once more with a trace (see sim_trace.h) and
+ * saves it; --replay inspects a saved trace without the image.
+ */
+
+static Simulator sim;
+static unsigned long profile_counts[SIM_MEMORY_SIZE];
+
+static void print_usage(const char *prog) {
+    printf("Usage: %s [options] <image.ob|image.bin>\n", prog);
+    printf("       %s --batch <manifest> [--jobs <n>] [--max-steps <n>] [--optimize] [--jit] [--quiet]\n", prog);
+    printf("  --input <file>       characters read by red ('-' for stdin; default none)\n");
+    printf("  --max-steps <n>      stop after n instructions (default no limit)\n");
+    printf("  --repeat <n>         run the program n times and report the best time\n");
+    printf("  --quiet              do not print the program output (batch: only failures)\n");
+    printf("  --batch <manifest>   assemble, run and check every program in the manifest\n");
+    printf("  --jobs <n>           batch worker threads (default one per CPU)\n");
+    printf("  --optimize           batch: assemble with the peephole optimizer\n");
+    printf("  --jit                translate hot blocks to native code (x86-64 Linux)\n");
+    printf("  --jit-threshold <n>  block entries before translation (default 50)\n");
+    printf("  --profile <file.map> report hot source lines and macros (map from 'assembler --map')\n");
+    printf("  --profile-top <n>    rows per profile report (default 20)\n");
+    printf("  --record <file>      record an execution trace of one more run into file\n");
+    printf("  --trace-limit <MiB>  memory kept for the trace; older steps are dropped (default 64)\n");
+    printf("  --replay <file>      load a recorded trace instead of running an image\n");
+    printf("  --seek <n>           replay: print the machine state after n instructions\n");
+    printf("  --events <a>:<b>     replay: print the events of instructions a..b\n");
+}
+
+static void print_trace_stats(const SimTrace *trace) {
+    SimTraceStats ts;
+    sim_trace_stats(trace, &ts);
+    fprintf(stderr, "trace: steps %lu..%lu, %lu event bytes (%.2f bytes/instr), %lu blocks, %lu checkpoints, %lu blocks dropped, %lu bytes held\n",
+            ts.first_step, ts.steps, ts.event_bytes,
+            ts.steps > ts.first_step ? (double)ts.event_bytes / (double)(ts.steps - ts.first_step) : 0.0,
+            ts.blocks, ts.checkpoints, ts.dropped_blocks, ts.memory_bytes);
+}
+
+/*
+ * replay:
+ * Prints the summary of a saved trace, then the requested state and events.
+ */
+static int replay(const char *path, const char *seek, const char *events) {
+    SimTrace *trace = sim_trace_load(path);
+    int ok = 1;
+    int r;
+
+    if (!trace) return 1;
+    print_trace_stats(trace);
+
+    if (events) {
+        unsigned long first = 0, last = 0;
+        if (sscanf(events, "%lu:%lu", &first, &last) != 2 || last < first) {
+            fprintf(stderr, "Malformed --events range '%s'\n", events);
+            ok = 0;
+        } else {
+            sim_trace_dump(trace, stdout, first, last);
+        }
+    }
+
+    if (ok && seek) {
+        sim_init(&sim);
+        if (!sim_trace_seek(trace, &sim, strtoul(seek, NULL, 10))) {
+            fprintf(stderr, "%s: %s\n", path, sim.error);
+            ok = 0;
+        } else {
+            printf("step %lu pc %d (%s) z=%d n=%d sp=%d input %lu\n", sim.steps, sim.pc,
+                   sim_status_name(sim.status), sim.zero, sim.negative, sim.sp, (unsigned long)sim.input_pos);
+            for (r = 0; r < SIM_REGISTERS; r++) printf("%sr%d=%d", r ? " " : "", r, sim.regs[r]);
+            printf("\n");
+        }
+        sim_free(&sim);
+    }
+
+    sim_trace_destroy(trace);
+    return ok ? 0 : 1;
+}
+
+int main(int argc, char *argv[]) {
+    const char *image_path = NULL;
+    const char *input_path = NULL;
+    const char *batch_path = NULL;
+    const char *map_path = NULL;
+    const char *record_path = NULL;
+    const char *replay_path = NULL;
+    const char *seek = NULL;
+    const char *events = NULL;
+    unsigned long trace_limit = 0;
+    int profile_top = 20;
+    ProfileMap map;
+    int jobs = 0;
+    unsigned long max_steps = 0;
+    int repeat = 1;
+    int quiet = 0;
+    int use_jit = 0;
+    int optimize = 0;
+    int jit_threshold = 50;
+    char *image;
+    char *input = NULL;
+    size_t image_length, input_length = 0;
+    double best = -1.0;
+    SimStatus status = SIM_READY;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--input") == 0 && i + 1 < argc) {
+            input_path = argv[++i];
+        } else if (strcmp(argv[i], "--max-steps") == 0 && i + 1 < argc) {
+            max_steps = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+            repeat = atoi(argv[++i]);
+            if (repeat < 1) repeat = 1;
+        } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            batch_path = argv[++i];
+        } else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+            jobs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+            map_path = argv[++i];
+        } else if (strcmp(argv[i], "--profile-top") == 0 && i + 1 < argc) {
+            profile_top = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            record_path = argv[++i];
+        } else if (strcmp(argv[i], "--trace-limit") == 0 && i + 1 < argc) {
+            trace_limit = strtoul(argv[++i], NULL, 10) * 1024 * 1024;
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replay_path = argv[++i];
+        } else if (strcmp(argv[i], "--seek") == 0 && i + 1 < argc) {
+            seek = argv[++i];
+        } else if (strcmp(argv[i], "--events") == 0 && i + 1 < argc) {
+            events = argv[++i];
+        } else if (strcmp(argv[i], "--jit") == 0) {
+            use_jit = 1;
+        } else if (strcmp(argv[i], "--jit-threshold") == 0 && i + 1 < argc) {
+            jit_threshold = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--optimize") == 0) {
+            optimize = 1;
+        } else if (strcmp(argv[i], "--quiet") == 0) {
+            quiet = 1;
+        } else if (strcmp(argv[i], "--help") == 0) {
+            print_usage(argv[0]);
+            return 0;
+        } else if (strncmp(argv[i], "--", 2) == 0 || image_path) {
+            fprintf(stderr, "Unknown option '%s'\n", argv[i]);
+            print_usage(argv[0]);
+            return 1;
+        } else {
+            image_path = argv[i];
+        }
+    }
+
+    if (batch_path) {
+        BatchOptions batch;
+
+        batch.manifest = batch_path;
+        batch.jobs = jobs;
+        batch.max_steps = max_steps;
+        batch.use_jit = use_jit != 0;
+        batch.jit_threshold = jit_threshold;
+        batch.failures_only = quiet != 0;
+        batch.optimize = optimize != 0;
+        return run_batch(&batch);
+    }
+
+    if (replay_path) {
+        return replay(replay_path, seek, events);
+    }
+
+    if (!image_path) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    if (map_path && !profile_map_load(&map, map_path)) {
+        return 1;
+    }
+
+    image = read_file(image_path, &image_length);
+    if (!image) {
+        fprintf(stderr, "Error: Could not open image %s\n", image_path);
+        return 1;
+    }
+
+    if (input_path) {
+        input = read_file(strcmp(input_path, "-") == 0 ? "/dev/stdin" : input_path, &input_length);
+        if (!input) {
+            fprintf(stderr, "Error: Could not open input %s\n", input_path);
+            ASM_FREE(image);
+            return 1;
+        }
+    }
+
+    sim_init(&sim);
+    if (map_path) {
+        sim.profile = profile_counts;
+        if (use_jit) fprintf(stderr, "Profiling runs interpreted only\n");
+    }
+
+    if (use_jit) {
+        sim.jit = sim_jit_create(jit_threshold, true);
+        if (!sim.jit) {
+            fprintf(stderr, "Native translation is not available here; interpreting\n");
+        }
+    }
+
+    for (i = 0; i < repeat; i++) {
+        double start, elapsed;
+
+        if (!sim_load_image(&sim, image, image_length)) {
+            fprintf(stderr, "%s: %s\n", image_path, sim.error);
+            sim_jit_destroy(sim.jit);
+            sim_free(&sim);
+            ASM_FREE(image);
+            ASM_FREE(input);
+            return 1;
+        }
+        sim_set_input(&sim, input, input_length);
+        memset(profile_counts, 0, sizeof(profile_counts));
+
+        start = stats_now();
+        status = sim_run(&sim, max_steps);
+        elapsed = stats_now() - start;
+        if (best < 0 || elapsed < best) best = elapsed;
+    }
+
+    if (!quiet && sim.output_length > 0) {
+        fwrite(sim.output, 1, sim.output_length, stdout);
+        fflush(stdout);
+    }
+
+    if (status == SIM_FAULT) {
+        fprintf(stderr, "%s: %s\n", image_path, sim.error);
+    }
+    fprintf(stderr, "%s %lu instructions in %.6f s (%.0f instr/s)\n",
+            sim_status_name(status), sim.steps, best,
+            best > 0 ? (double)sim.steps / best : 0.0);
+
+    if (sim.jit) {
+        SimJitStats js;
+        sim_jit_stats(sim.jit, &js);
+        fprintf(stderr, "jit: %lu translations, %lu invalidations, %lu code bytes, %.6f s translating\n",
+                js.translations, js.invalidations, js.code_bytes, js.translate_seconds);
+        fprintf(stderr, "jit: %lu block runs, %lu native instructions (%.1f%%), %.6f s in native code\n",
+                js.block_runs, js.native_steps,
+                sim.steps ? 100.0 * (double)js.native_steps / ((double)sim.steps * repeat) : 0.0,
+                js.native_seconds);
+        sim_jit_destroy(sim.jit);
+    }
+
+    if (record_path) {
+        SimTrace *trace = sim_trace_create(trace_limit);
+        double start, elapsed;
+        bool saved;
+
+        if (!trace) {
+            fprintf(stderr, "Error: Could not allocate the trace\n");
+            status = SIM_FAULT;
+        } else {
+            /* One more run with the trace attached; its time against the best untraced run is the overhead */
+            sim_load_image(&sim, image, image_length);
+            sim_set_input(&sim, input, input_length);
+            sim.profile = NULL;
+            sim.trace = trace;
+            start = stats_now();
+            sim_run(&sim, max_steps);
+            elapsed = stats_now() - start;
+            sim.trace = NULL;
+
+            fprintf(stderr, "trace: recorded in %.6f s, %.2fx the untraced run\n",
+                    elapsed, best > 0 ? elapsed / best : 0.0);
+            print_trace_stats(trace);
+            saved = sim_trace_save(trace, record_path);
+            sim_trace_destroy(trace);
+            if (!saved) status = SIM_FAULT;
+        }
+    }
+
+    if (map_path) {
+        profile_report(stderr, &map, profile_counts, profile_top);
+        profile_map_free(&map);
+    }
+
+    sim_free(&sim);
+    ASM_FREE(image);
+    ASM_FREE(input);
+    return status == SIM_HALTED ? 0 : 2;
+}
@@ -0,0 +1,306 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "batch.h"
+#include "simulator.h"
+#include "sim_jit.h"
+#include "libassembler.h"
+#include "logger.h"
+#include "utils.h"
+#include "stats.h"
+#include "asm_alloc.h"
+
+#define BATCH_PATH_LEN 512
+#define BATCH_REASON_LEN 200
+
+typedef enum {
+    TEST_PENDING,
+    TEST_PASS,
+    TEST_FAIL
+} TestStatus;
+
+typedef struct {
+    char source[BATCH_PATH_LEN];
+    char input[BATCH_PATH_LEN];         /* empty = no input */
+    char expected[BATCH_PATH_LEN];      /* empty = no output expected */
+    TestStatus status;
+    unsigned long steps;
+    char reason[BATCH_REASON_LEN];
+} BatchTest;
+
+typedef struct {
+    BatchTest *tests;
+    int count;
+    int capacity;
+    int next;                           /* next test to hand out */
+    pthread_mutex_t lock;
+    const BatchOptions *options;
+    unsigned long max_steps;
+} BatchQueue;
+
+/*
+ * resolve_path:
+ * Makes a manifest entry relative to the manifest's directory; "-" stays empty.
+ */
+static void resolve_path(const char *manifest, const char *entry, char *out, size_t size) {
+    const char *slash = strrchr(manifest, '/');
+
+    if (strcmp(entry, "-") == 0) {
+        out[0] = '\0';
+    } else if (entry[0] == '/' || !slash) {
+        snprintf(out, size, "%s", entry);
+    } else {
+        snprintf(out, size, "%.*s/%s", (int)(slash - manifest), manifest, entry);
+    }
+}
+
+static int add_test(BatchQueue *queue) {
+    if (queue->count >= queue->capacity) {
+        int new_capacity = (queue->capacity == 0) ? 64 : queue->capacity * 2;
+        BatchTest *temp = (BatchTest *)ASM_REALLOC(queue->tests, new_capacity * sizeof(BatchTest), MEM_OTHER);
+        if (!temp) return 0;
+        queue->tests = temp;
+        queue->capacity = new_capacity;
+    }
+    memset(&queue->tests[queue->count++], 0, sizeof(BatchTest));
+    return 1;
+}
+
+/*
+ * load_manifest:
+ * Reads the manifest into the queue. Returns false on I/O or syntax errors.
+ */
+static bool load_manifest(BatchQueue *queue, const char *manifest) {
+    size_t length;
+    char *text = read_file(manifest, &length);
+    char *cursor = text;
+    char *line;
+    int line_number = 0;
+
+    if (!text) {
+        fprintf(stderr, "Error: Could not open manifest %s\n", manifest);
+        return false;
+    }
+
+    while ((line = next_token(&cursor, "\n")) != NULL) {
+        char *fields[3];
+        char *field_cursor;
+        BatchTest *test;
+        int f;
+
+        line_number++;
+        line = trim_whitespace(line);
+        if (*line == '\0' || *line == '#') continue;
+
+        field_cursor = line;
+        for (f = 0; f < 3; f++) {
+            fields[f] = next_token(&field_cursor, " \t\r");
+        }
+        if (!fields[2] || next_token(&field_cursor, " \t\r")) {
+            fprintf(stderr, "%s:%d: expected '<program.as> <input> <expected output>'\n", manifest, line_number);
+            ASM_FREE(text);
+            return false;
+        }
+
+        if (!add_test(queue)) {
+            fprintf(stderr, "Error: Memory allocation failed reading %s\n", manifest);
+            ASM_FREE(text);
+            return false;
+        }
+        test = &queue->tests[queue->count - 1];
+        resolve_path(manifest, fields[0], test->source, sizeof(test->source));
+        resolve_path(manifest, fields[1], test->input, sizeof(test->input));
+        resolve_path(manifest, fields[2], test->expected, sizeof(test->expected));
+    }
+
+    ASM_FREE(text);
+    return true;
+}
+
+/* Reads an optional file; an empty path gives an empty buffer */
+static char *read_optional(const char *path, size_t *length) {
+    if (path[0] == '\0') {
+        *length = 0;
+        return asm_strdup("", MEM_TEXT);
+    }
+    return read_file(path, length);
+}
+
+static void fail(BatchTest *test, const char *reason) {
+    test->status = TEST_FAIL;
+    strncpy(test->reason, reason, BATCH_REASON_LEN - 1);
+    test->reason[BATCH_REASON_LEN - 1] = '\0';
+}
+
+/*
+ * run_test:
+ * Assembles, simulates and checks one program with the worker's simulator.
+ */
+static void run_test(BatchTest *test, Simulator *sim, unsigned long max_steps, bool optimize) {
+    AsmOptions options;
+    AsmResult result;
+    char *source = NULL, *input = NULL, *expected = NULL;
+    size_t source_length, input_length, expected_length;
+    char reason[BATCH_REASON_LEN];
+    SimStatus status;
+
+    source = read_file(test->source, &source_length);
+    input = read_optional(test->input, &input_length);
+    expected = read_optional(test->expected, &expected_length);
+    if (!source || !input || !expected) {
+        sprintf(reason, "cannot read %.180s", !source ? test->source : !input ? test->input : test->expected);
+        fail(test, reason);
+        ASM_FREE(source);
+        ASM_FREE(input);
+        ASM_FREE(expected);
+        return;
+    }
+
+    asm_options_init(&options);
+    options.name = test->source;
+    options.max_errors = 1;
+    options.optimize = optimize;
+
+    if (!assemble_buffer(source, source_length, &options, &result)) {
+        if (result.diagnostic_count > 0) {
+            sprintf(reason, "assembly failed: line %d: %.140s", result.diagnostics[0].line, result.diagnostics[0].message);
+        } else {
+            sprintf(reason, "assembly failed");
+        }
+        fail(test, reason);
+    } else if (!sim_load_result(sim, &result)) {
+        sprintf(reason, "load failed: %.150s", sim->error);
+        fail(test, reason);
+    } else {
+        sim_set_input(sim, input, input_length);
+        status = sim_run(sim, max_steps);
+        test->steps = sim->steps;
+
+        if (status == SIM_BUDGET) {
+            sprintf(reason, "no stop within %lu instructions", max_steps);
+            fail(test, reason);
+        } else if (status == SIM_FAULT) {
+            sprintf(reason, "fault: %.150s", sim->error);
+            fail(test, reason);
+        } else if (sim->output_length != expected_length
+                   || (expected_length > 0 && memcmp(sim->output, expected, expected_length) != 0)) {
+            size_t i = 0;
+            while (i < sim->output_length && i < expected_length && sim->output[i] == expected[i]) i++;
+            sprintf(reason, "output differs at byte %lu (%lu bytes, expected %lu)",
+                    (unsigned long)i, (unsigned long)sim->output_length, (unsigned long)expected_length);
+            fail(test, reason);
+        } else {
+            test->status = TEST_PASS;
+        }
+    }
+
+    asm_result_free(&result);
+    ASM_FREE(source);
+    ASM_FREE(input);
+    ASM_FREE(expected);
+}
+
+static void *batch_worker(void *arg) {
+    BatchQueue *queue = (BatchQueue *)arg;
+    Simulator *sim = (Simulator *)ASM_MALLOC(sizeof(Simulator), MEM_OTHER);
+
+    if (!sim) return NULL;
+    sim_init(sim);
+    if (queue->options->use_jit) {
+        sim->jit = sim_jit_create(queue->options->jit_threshold, false);
+    }
+
+    for (;;) {
+        int index;
+
+        pthread_mutex_lock(&queue->lock);
+        index = queue->next < queue->count ? queue->next++ : -1;
+        pthread_mutex_unlock(&queue->lock);
+        if (index < 0) break;
+
+        run_test(&queue->tests[index], sim, queue->max_steps, queue->options->optimize);
+    }
+
+    sim_jit_destroy(sim->jit);
+    sim_free(sim);
+    ASM_FREE(sim);
+    return NULL;
+}
+
+/*
+ * run_batch:
+ * Runs every program in the manifest and prints one line per program in
+ * manifest order - PASS|FAIL, source, instructions executed, reason -
+ * followed by a summary.
+ */
+int run_batch(const BatchOptions *options) {
+    BatchQueue queue;
+    pthread_t *threads;
+    unsigned long total_steps = 0;
+    int jobs = options->jobs;
+    int started = 0;
+    int passed = 0;
+    double start;
+    int i;
+
+    memset(&queue, 0, sizeof(queue));
+    queue.options = options;
+    queue.max_steps = options->max_steps ? options->max_steps : BATCH_DEFAULT_MAX_STEPS;
+
+    if (!load_manifest(&queue, options->manifest)) {
+        ASM_FREE(queue.tests);
+        return 2;
+    }
+
+    if (jobs <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        jobs = cpus > 0 ? (int)cpus : 1;
+    }
+    if (jobs > queue.count) jobs = queue.count > 0 ? queue.count : 1;
+
+    /* Diagnostics are reported per program below, not logged */
+    asm_log_set_level(LOG_WARN);
+
+    threads = (pthread_t *)ASM_MALLOC(jobs * sizeof(pthread_t), MEM_OTHER);
+    if (!threads) {
+        ASM_FREE(queue.tests);
+        return 2;
+    }
+    pthread_mutex_init(&queue.lock, NULL);
+
+    start = stats_now();
+    for (i = 0; i < jobs; i++) {
+        if (pthread_create(&threads[i], NULL, batch_worker, &queue) != 0) break;
+        started++;
+    }
+    if (started == 0) {
+        batch_worker(&queue);
+    }
+    for (i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    for (i = 0; i < queue.count; i++) {
+        const BatchTest *test = &queue.tests[i];
+
+        total_steps += test->steps;
+        if (test->status == TEST_PASS) {
+            passed++;
+            if (!options->failures_only) printf("PASS %s %lu\n", test->source, test->steps);
+        } else {
+            printf("FAIL %s %lu %s\n", test->source, test->steps,
+                   test->status == TEST_PENDING ? "not run" : test->reason);
+        }
+    }
+
+    printf("%d programs: %d passed, %d failed; %lu instructions in %.3f s on %d threads\n",
+           queue.count, passed, queue.count - passed, total_steps, stats_now() - start,
+           started > 0 ? started : 1);
+
+    pthread_mutex_destroy(&queue.lock);
+    ASM_FREE(threads);
+    ASM_FREE(queue.tests);
+    return passed == queue.count ? 0 : 1;
+}
@@ -0,0 +1,32 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdbool.h>
+
+/*
+ * Batch runner: assembles and simulates every program listed in a manifest
+ * on a pool of threads, in memory, and compares each program's prn output
+ * with the expected output. Manifest lines are
+ *
+ *   <program.as> <input file or -> <expected output file or ->
+ *
+ * with paths relative to the manifest; blank lines and lines starting
+ * with '#' are skipped.
+ */
+
+#define BATCH_DEFAULT_MAX_STEPS 10000000UL
+
+typedef struct {
+    const char *manifest;
+    int jobs;                   /* worker threads; 0 = one per online CPU */
+    unsigned long max_steps;    /* instruction budget per program; 0 = default */
+    bool use_jit;
+    int jit_threshold;
+    bool failures_only;         /* list only the programs that fail */
+    bool optimize;              /* assemble with the peephole optimizer */
+} BatchOptions;
+
+/* Returns 0 if every program passed, 1 if any failed, 2 if the manifest could not be run */
+int run_batch(const BatchOptions *options);
+
+#endif
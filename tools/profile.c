@@ -0,0 +1,202 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "profile.h"
+#include "simulator.h"
+#include "utils.h"
+#include "asm_alloc.h"
+
+/* One row of a report: a source line, or a macro call site */
+typedef struct {
+    int line;
+    const char *macro;
+    unsigned long count;
+} ProfileRow;
+
+static int add_entry(ProfileMap *map, const ProfileMapEntry *entry) {
+    if (map->count >= map->capacity) {
+        int new_capacity = (map->capacity == 0) ? 256 : map->capacity * 2;
+        ProfileMapEntry *temp = (ProfileMapEntry *)ASM_REALLOC(map->entries, new_capacity * sizeof(ProfileMapEntry), MEM_OTHER);
+        if (!temp) return 0;
+        map->entries = temp;
+        map->capacity = new_capacity;
+    }
+    map->entries[map->count++] = *entry;
+    return 1;
+}
+
+/*
+ * profile_map_load:
+ * Reads a .map file (see format_source_map()).
+ */
+bool profile_map_load(ProfileMap *map, const char *path) {
+    size_t length;
+    char *text = read_file(path, &length);
+    char *cursor = text;
+    char *line;
+
+    memset(map, 0, sizeof(*map));
+    if (!text) {
+        fprintf(stderr, "Error: Could not open source map %s\n", path);
+        return false;
+    }
+
+    while ((line = next_token(&cursor, "\n")) != NULL) {
+        ProfileMapEntry entry;
+        char macro[LINE_LENGTH];
+        int fields;
+
+        if (strncmp(line, "source ", 7) == 0) {
+            strncpy(map->source, line + 7, sizeof(map->source) - 1);
+            continue;
+        }
+
+        memset(&entry, 0, sizeof(entry));
+        fields = sscanf(line, "%d %d %d %79s %d", &entry.address, &entry.length, &entry.line, macro, &entry.call_line);
+        if (fields != 3 && fields != 5) {
+            fprintf(stderr, "%s: malformed line '%s'\n", path, line);
+            ASM_FREE(text);
+            profile_map_free(map);
+            return false;
+        }
+        if (fields == 5) {
+            size_t length = strlen(macro);
+            if (length > LABEL_LENGTH) length = LABEL_LENGTH;
+            memcpy(entry.macro, macro, length);
+            entry.macro[length] = '\0';
+        }
+        if (!add_entry(map, &entry)) {
+            ASM_FREE(text);
+            profile_map_free(map);
+            return false;
+        }
+    }
+
+    ASM_FREE(text);
+    return true;
+}
+
+void profile_map_free(ProfileMap *map) {
+    ASM_FREE(map->entries);
+    map->entries = NULL;
+    map->count = 0;
+    map->capacity = 0;
+}
+
+static int compare_line(const void *a, const void *b) {
+    const ProfileRow *x = (const ProfileRow *)a;
+    const ProfileRow *y = (const ProfileRow *)b;
+    return x->line - y->line;
+}
+
+static int compare_call_site(const void *a, const void *b) {
+    const ProfileRow *x = (const ProfileRow *)a;
+    const ProfileRow *y = (const ProfileRow *)b;
+    int c = strcmp(x->macro, y->macro);
+    return c != 0 ? c : x->line - y->line;
+}
+
+static int compare_count(const void *a, const void *b) {
+    const ProfileRow *x = (const ProfileRow *)a;
+    const ProfileRow *y = (const ProfileRow *)b;
+    if (x->count != y->count) return x->count < y->count ? 1 : -1;
+    return x->line - y->line;
+}
+
+/* Sorts rows by the given key and sums the counts of equal keys; returns the new row count */
+static int merge_rows(ProfileRow *rows, int n, int (*key)(const void *, const void *)) {
+    int i, out = 0;
+
+    qsort(rows, (size_t)n, sizeof(ProfileRow), key);
+    for (i = 0; i < n; i++) {
+        if (out > 0 && key(&rows[out - 1], &rows[i]) == 0) {
+            rows[out - 1].count += rows[i].count;
+        } else {
+            rows[out++] = rows[i];
+        }
+    }
+    return out;
+}
+
+static double percent(unsigned long count, unsigned long total) {
+    return total ? 100.0 * (double)count / (double)total : 0.0;
+}
+
+/*
+ * profile_report:
+ * Prints the hottest source lines (macro body lines count every call) and
+ * the hottest macros with their call sites.
+ */
+void profile_report(FILE *out, const ProfileMap *map, const unsigned long *counts, int top) {
+    ProfileRow *rows;
+    ProfileRow *macros;
+    unsigned long total = 0;
+    int n, m, i, j, shown;
+
+    for (i = 0; i < SIM_MEMORY_SIZE; i++) total += counts[i];
+
+    rows = (ProfileRow *)ASM_MALLOC((size_t)(map->count + 1) * sizeof(ProfileRow), MEM_OTHER);
+    macros = (ProfileRow *)ASM_MALLOC((size_t)(map->count + 1) * sizeof(ProfileRow), MEM_OTHER);
+    if (!rows || !macros) {
+        ASM_FREE(rows);
+        ASM_FREE(macros);
+        return;
+    }
+
+    n = m = 0;
+    for (i = 0; i < map->count; i++) {
+        const ProfileMapEntry *e = &map->entries[i];
+        unsigned long count = (e->address >= 0 && e->address < SIM_MEMORY_SIZE) ? counts[e->address] : 0;
+
+        if (count == 0) continue;
+        rows[n].line = e->line;
+        rows[n].macro = e->macro;
+        rows[n].count = count;
+        n++;
+        if (e->macro[0] != '\0') {
+            macros[m].line = e->call_line;
+            macros[m].macro = e->macro;
+            macros[m].count = count;
+            m++;
+        }
+    }
+
+    n = merge_rows(rows, n, compare_line);
+    qsort(rows, (size_t)n, sizeof(ProfileRow), compare_count);
+
+    fprintf(out, "hot lines in %s (%lu instructions executed)\n", map->source, total);
+    fprintf(out, "%12s %7s %6s  %s\n", "count", "%", "line", "macro");
+    for (i = 0; i < n && i < top; i++) {
+        fprintf(out, "%12lu %6.2f%% %6d  %s\n", rows[i].count, percent(rows[i].count, total), rows[i].line, rows[i].macro);
+    }
+
+    /* Call sites grouped per macro, then macros ordered by their total */
+    m = merge_rows(macros, m, compare_call_site);
+    fprintf(out, "\nhot macros\n");
+    fprintf(out, "%12s %7s  %s\n", "count", "%", "macro / call line");
+    for (shown = 0; shown < top; shown++) {
+        int best = -1, best_end = 0;
+        unsigned long best_total = 0;
+
+        for (i = 0; i < m; i = j) {
+            unsigned long sum = 0;
+            for (j = i; j < m && strcmp(macros[j].macro, macros[i].macro) == 0; j++) sum += macros[j].count;
+            if (macros[i].count != 0 && sum > best_total) {
+                best = i;
+                best_end = j;
+                best_total = sum;
+            }
+        }
+        if (best < 0) break;
+
+        fprintf(out, "%12lu %6.2f%%  %s\n", best_total, percent(best_total, total), macros[best].macro);
+        qsort(macros + best, (size_t)(best_end - best), sizeof(ProfileRow), compare_count);
+        for (j = best; j < best_end; j++) {
+            fprintf(out, "%12lu %6.2f%%    line %d\n", macros[j].count, percent(macros[j].count, total), macros[j].line);
+            macros[j].count = 0;    /* marks the macro as printed */
+        }
+    }
+
+    ASM_FREE(rows);
+    ASM_FREE(macros);
+}
@@ -0,0 +1,35 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "assembler.h"
+
+/*
+ * Source-level profile of a simulated program: per-address execution
+ * counts folded through the .map file written by 'assembler --map' into
+ * hot source lines and hot macros.
+ */
+
+typedef struct {
+    int address;
+    int length;
+    int line;
+    int call_line;                  /* 0 outside macros */
+    char macro[LABEL_LENGTH + 1];   /* empty outside macros */
+} ProfileMapEntry;
+
+typedef struct {
+    char source[256];
+    ProfileMapEntry *entries;
+    int count;
+    int capacity;
+} ProfileMap;
+
+bool profile_map_load(ProfileMap *map, const char *path);
+void profile_map_free(ProfileMap *map);
+
+/* Prints the top hot lines and macros for the given per-address counts */
+void profile_report(FILE *out, const ProfileMap *map, const unsigned long *counts, int top);
+
+#endif